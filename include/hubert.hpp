@@ -34,9 +34,83 @@ SOFTWARE.
 
 // system dependencies
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(HUBERT_PARALLEL_STL)
+#include <execution>
+#endif
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define HUBERT_HAS_PMR 1
+#endif
+#endif
+
+// SIMD kernels are selected at run time from the instruction sets that the
+// compiler can generate code for. Define HUBERT_NO_SIMD to use only the
+// scalar code.
+#if !defined(HUBERT_NO_SIMD)
+#if defined(__x86_64__) || defined(_M_X64)
+#define HUBERT_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HUBERT_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+// GCC and Clang need the instruction set enabled on each function that
+// uses it, MSVC allows the intrinsics everywhere. AVX-512 implies FMA, and
+// GCC would otherwise fuse the kernels' multiplies and adds, which changes
+// the rounding compared to the scalar code.
+#if defined(HUBERT_SIMD_X86) && defined(__clang__)
+#define HUBERT_TARGET_AVX2 __attribute__((target("avx2")))
+#define HUBERT_TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(HUBERT_SIMD_X86) && defined(__GNUC__)
+#define HUBERT_TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define HUBERT_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#else
+#define HUBERT_TARGET_AVX2
+#define HUBERT_TARGET_AVX512
+#endif
+
+// Marks the routines that also compile for a GPU under nvcc or hipcc: the
+// scalar comparisons, Point3, Vector3, UnitVector3, Plane, Ray3 and
+// Triangle3 with the arithmetic and queries between them, the raw
+// coordinate kernels and the device view queries (see "Device views").
+// Elsewhere it is empty.
+#if defined(__CUDACC__) || defined(__HIPCC__)
+#define HUBERT_HOST_DEVICE __host__ __device__
+#else
+#define HUBERT_HOST_DEVICE
+#endif
+
+// Defined while the device side of a translation unit is compiled. The
+// instrumentation counts nothing there.
+#if defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+#define HUBERT_DEVICE_COMPILE
+#endif
 
 // The Hubert library uses one single namespace for everything
 namespace hubert
@@ -62,2431 +136,10538 @@ enum class ResultCode : uint32_t
 // Epsilon, to be used for managing floating point precision, is defined
 // correctly by the system for each type.
 template <typename T> 
-inline T epsilon() { return std::numeric_limits<T>::epsilon();} 
+HUBERT_HOST_DEVICE inline T epsilon() { return std::numeric_limits<T>::epsilon();} 
 
 // Infinity is often used by Hubert to mark invalid values
 template <typename T> 
-inline T infinity() { return std::numeric_limits<T>::infinity();}
+HUBERT_HOST_DEVICE inline T infinity() { return std::numeric_limits<T>::infinity();}
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Epsilon comparisons
+// Instrumentation
+//
+// Define HUBERT_INSTRUMENT before including hubert.hpp to count, per
+// thread, the entities validated or built trusted (and how many of those
+// came out invalid, degenerate or subnormal), the hypot calls and the
+// result codes of each intersection query. instrumentationSnapshot() sums
+// the counts over all threads, including those that have exited, and
+// instrumentationReset() clears them; both are meant to be called while
+// no other thread is counting. Nested queries count too: a Bvh ray query
+// counts its own result and those of the triangle tests it runs.
+//
+// Without HUBERT_INSTRUMENT the hooks are empty inline functions, the
+// snapshot is all zeros and nothing is added to the hot paths. Device code
+// is never counted: there the hooks are empty either way.
 /////////////////////////////////////////////////////////////////////////////
 
-template <typename T>
-inline bool isEqualScaled(T v1, T v2, T scale)
+// The entities whose validations are counted
+enum class InstrumentedEntity : uint32_t
+{
+    ePoint3 = 0,
+    eVector3,
+    eUnitVector3,
+    eMatrix3,
+    eMatrixRotation3,
+    eTransform3,
+    eLine3,
+    ePlane,
+    eRay3,
+    eSegment3,
+    eTriangle3,
+    eAabb3,
+    eCount
+};
+
+// The intersection queries whose results are counted. The PreparedRay3
+// and PreparedTriangle3 overloads count as the query they stand in for,
+// the policy overloads as the plain ones and the Bvh any hit queries as
+// the closest hit ones.
+enum class InstrumentedQuery : uint32_t
 {
-    T eps = scale * epsilon<T>();
+    ePlaneLine = 0,
+    ePlaneRay,
+    ePlaneSegment,
+    eTriangleRay,
+    eTriangleLine,
+    eTriangleSegment,
+    eTrianglePlane,
+    eTriangleTriangle,
+    eTriangleTriangleSegment,
+    eTriangleTriangleExact,
+    eAabbRay,
+    eAabbAabb,
+    eAabbPlane,
+    eAabbTriangle,
+    eSoupRay,
+    eBvhRay,
+    eBvhSegment,
+    eBvhLine,
+    eCount
+};
 
-    if (v1 != 0.0 && v2 != 0.0)
+constexpr size_t cEntityCount = size_t(InstrumentedEntity::eCount);
+constexpr size_t cQueryCount = size_t(InstrumentedQuery::eCount);
+constexpr size_t cResultCodeCount = size_t(ResultCode::eOverflow) + 1;
+
+// The counts, summed over threads
+struct InstrumentationCounts
+{
+    uint64_t validated[cEntityCount] = {};      // built through the validating constructors
+    uint64_t trusted[cEntityCount] = {};        // built through the trusted constructors
+    uint64_t invalid[cEntityCount] = {};        // validated and found invalid
+    uint64_t degenerate[cEntityCount] = {};     // validated and found degenerate (valid or not)
+    uint64_t subnormal[cEntityCount] = {};      // validated and found to have subnormal data
+    uint64_t hypot = 0;
+    uint64_t results[cQueryCount][cResultCodeCount] = {};
+
+    uint64_t constructed(InstrumentedEntity e) const { return validated[size_t(e)] + trusted[size_t(e)]; }
+    uint64_t result(InstrumentedQuery q, ResultCode r) const { return results[size_t(q)][size_t(r)]; }
+    uint64_t calls(InstrumentedQuery q) const
     {
-        return std::abs(v1 - v2) / std::abs(v1) <= eps && std::abs(v1 - v2) / std::abs(v2) <= eps;
+        uint64_t n = 0;
+        for (uint64_t c : results[size_t(q)])
+        {
+            n += c;
+        }
+        return n;
     }
-    else
+};
+
+#if defined(HUBERT_INSTRUMENT)
+
+inline constexpr bool cInstrumented = true;
+
+// One thread's counters, in the order of the members of
+// InstrumentationCounts. Each is only written by its own thread, so a
+// relaxed load and store is enough, and the snapshot can read it at any
+// time.
+struct InstrumentationSlots
+{
+    static constexpr size_t cValidated = 0;
+    static constexpr size_t cTrusted = cEntityCount;
+    static constexpr size_t cInvalid = 2 * cEntityCount;
+    static constexpr size_t cDegenerate = 3 * cEntityCount;
+    static constexpr size_t cSubnormal = 4 * cEntityCount;
+    static constexpr size_t cHypot = 5 * cEntityCount;
+    static constexpr size_t cResults = 5 * cEntityCount + 1;
+    static constexpr size_t cSize = cResults + cQueryCount * cResultCodeCount;
+
+    InstrumentationSlots();
+    ~InstrumentationSlots();
+
+    void add(size_t slot)
     {
-        return std::abs(v1 - v2) <= eps;
+        slots[slot].store(slots[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
+
+    std::atomic<uint64_t> slots[cSize] = {};
+};
+
+struct InstrumentationRegistry
+{
+    std::mutex lock;
+    std::vector<InstrumentationSlots *> live;
+    uint64_t retired[InstrumentationSlots::cSize] = {};
+};
+
+inline InstrumentationRegistry & instrumentationRegistry()
+{
+    static InstrumentationRegistry registry;
+    return registry;
 }
-template <typename T>
-inline bool isEqual(T v1, T v2)
+
+inline InstrumentationSlots::InstrumentationSlots()
 {
-    T eps = epsilon<T>();
+    InstrumentationRegistry & r = instrumentationRegistry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.live.push_back(this);
+}
 
-    if (v1 != 0.0 && v2 != 0.0)
+// an exiting thread leaves its counts behind in the registry
+inline InstrumentationSlots::~InstrumentationSlots()
+{
+    InstrumentationRegistry & r = instrumentationRegistry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (size_t i = 0; i < cSize; i++)
     {
-         return std::abs(v1 - v2) / std::abs(v1) <= eps &&  std::abs(v1 - v2) / std::abs(v2) <= eps;
+        r.retired[i] += slots[i].load(std::memory_order_relaxed);
     }
-    else
-    {
-        return std::abs(v1 - v2) <= eps;
-   }
+    r.live.erase(std::find(r.live.begin(), r.live.end(), this));
 }
 
-template <typename T>
-inline bool isGreaterOrEqual(T v1, T v2)
+inline InstrumentationSlots & threadInstrumentation()
 {
-    return (v1 > v2) || isEqual(v1, v2);
+    thread_local InstrumentationSlots slots;
+    return slots;
 }
 
-template <typename T>
-inline bool isLessOrEqual(T v1, T v2)
+HUBERT_HOST_DEVICE inline void countValidation(InstrumentedEntity e, bool isInvalid, bool isDegenerate, bool isSubnormal)
 {
-    return (v1 < v2) || isEqual(v1, v2);
+#if !defined(HUBERT_DEVICE_COMPILE)
+    InstrumentationSlots & s = threadInstrumentation();
+    size_t i = size_t(e);
+    s.add(InstrumentationSlots::cValidated + i);
+    if (isInvalid)
+    {
+        s.add(InstrumentationSlots::cInvalid + i);
+    }
+    if (isDegenerate)
+    {
+        s.add(InstrumentationSlots::cDegenerate + i);
+    }
+    if (isSubnormal)
+    {
+        s.add(InstrumentationSlots::cSubnormal + i);
+    }
+#endif
 }
 
-template <typename T>
-inline T difference(T v1, T v2)
+HUBERT_HOST_DEVICE inline void countTrusted(InstrumentedEntity e)
 {
-    return std::abs(v1 - v2);
+#if !defined(HUBERT_DEVICE_COMPILE)
+    threadInstrumentation().add(InstrumentationSlots::cTrusted + size_t(e));
+#endif
 }
 
-
-
-/////////////////////////////////////////////////////////////////////////////
-// Validation checks on primitive types
-/////////////////////////////////////////////////////////////////////////////
-
-template <typename T>
-inline bool isValid(const T & v)
+HUBERT_HOST_DEVICE inline void countHypot()
 {
-    return std::isfinite(v);
+#if !defined(HUBERT_DEVICE_COMPILE)
+    threadInstrumentation().add(InstrumentationSlots::cHypot);
+#endif
 }
 
-template <typename T>
-inline bool isSubnormal(const T & v)
+HUBERT_HOST_DEVICE inline ResultCode countResult(InstrumentedQuery q, ResultCode r)
 {
-    return std::isfinite(v) && !std::isnormal(v) && v != T(0.0);
+#if !defined(HUBERT_DEVICE_COMPILE)
+    threadInstrumentation().add(InstrumentationSlots::cResults + size_t(q) * cResultCodeCount + size_t(r));
+#endif
+    return r;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// Core type definitions
-/////////////////////////////////////////////////////////////////////////////
-
-// This class is the base class for all entities.
-class HubertBase
+inline InstrumentationCounts instrumentationSnapshot()
 {
-    public:
-        HubertBase() = default;
-        ~HubertBase() = default;
+    InstrumentationRegistry & r = instrumentationRegistry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    uint64_t sum[InstrumentationSlots::cSize];
+    std::copy(r.retired, r.retired + InstrumentationSlots::cSize, sum);
+    for (InstrumentationSlots * s : r.live)
+    {
+        for (size_t i = 0; i < InstrumentationSlots::cSize; i++)
+        {
+            sum[i] += s->slots[i].load(std::memory_order_relaxed);
+        }
+    }
 
-        bool amValid() const { return !(flags & cInvalid); }
-        bool amDegenerate() const { return (flags & (cDegenerate | cInvalid)); }
-        bool amSubnormal() const { return (flags & cSubnormalData); }
+    InstrumentationCounts counts;
+    for (size_t e = 0; e < cEntityCount; e++)
+    {
+        counts.validated[e] = sum[InstrumentationSlots::cValidated + e];
+        counts.trusted[e] = sum[InstrumentationSlots::cTrusted + e];
+        counts.invalid[e] = sum[InstrumentationSlots::cInvalid + e];
+        counts.degenerate[e] = sum[InstrumentationSlots::cDegenerate + e];
+        counts.subnormal[e] = sum[InstrumentationSlots::cSubnormal + e];
+    }
+    counts.hypot = sum[InstrumentationSlots::cHypot];
+    for (size_t q = 0; q < cQueryCount; q++)
+    {
+        for (size_t c = 0; c < cResultCodeCount; c++)
+        {
+            counts.results[q][c] = sum[InstrumentationSlots::cResults + q * cResultCodeCount + c];
+        }
+    }
+    return counts;
+}
 
-    protected:
-        static constexpr uint64_t cInvalid =          0x00001;        // entity is invalid (and data has been set to infinity)
-        static constexpr uint64_t cDegenerate =       0x00002;        // entity is degenerate (may or may not be invalid)
-        static constexpr uint64_t cSubnormalData =    0x00004;        // entity is valid but one of the defining data is non-zero subnormal
-        static constexpr uint64_t cValidityMask =     0x0000F;        // entity is valid but one of the defining data is non-zero subnormal
+inline void instrumentationReset()
+{
+    InstrumentationRegistry & r = instrumentationRegistry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    std::fill(r.retired, r.retired + InstrumentationSlots::cSize, uint64_t(0));
+    for (InstrumentationSlots * s : r.live)
+    {
+        for (auto & slot : s->slots)
+        {
+            slot.store(0, std::memory_order_relaxed);
+        }
+    }
+}
 
-        uint64_t getValidityFlags() const { return flags & cValidityMask; }
-        void setValidityFlags(uint64_t f) { flags = (flags & ~cValidityMask) | (f & cValidityMask); }
+#else
 
-    private:
-        uint64_t    flags = 0;
+inline constexpr bool cInstrumented = false;
 
-};
+HUBERT_HOST_DEVICE inline void countValidation(InstrumentedEntity, bool, bool, bool) {}
+HUBERT_HOST_DEVICE inline void countTrusted(InstrumentedEntity) {}
+HUBERT_HOST_DEVICE inline void countHypot() {}
+HUBERT_HOST_DEVICE inline ResultCode countResult(InstrumentedQuery, ResultCode r) { return r; }
+inline InstrumentationCounts instrumentationSnapshot() { return InstrumentationCounts(); }
+inline void instrumentationReset() {}
 
-//
-// Point3.
-//
-// Is considered valid as long as the 3 components (x, y, z) are valid. 
-// 
-// There are no non-validity related degenerate cases for Point3.
-// 
+#endif
+
+// std::hypot of three values, counted. Device code has no three argument
+// std::hypot and uses norm3d, which is as careful about overflow.
 template <typename T>
-class Point3 : public HubertBase
+HUBERT_HOST_DEVICE inline T hypot3(T x, T y, T z)
 {
-    public:
-        // constructors
-        Point3() : Point3(T(0.0), T(0.0), T(0.0)) {}
-        Point3(T inX, T inY, T inZ) { _validate(inX, inY, inZ); }
-        Point3(const Point3 &) = default;
-        ~Point3() = default;
+    countHypot();
+#if defined(HUBERT_DEVICE_COMPILE)
+    if constexpr (std::is_same<T, float>::value)
+    {
+        return norm3df(x, y, z);
+    }
+    else
+    {
+        return norm3d(x, y, z);
+    }
+#else
+    return std::hypot(x, y, z);
+#endif
+}
 
-        // public operators 
-        inline Point3<T>& operator=(const Point3<T>&) = default;
 
-        // public methods
-        inline T x() const {return _x;}
-        inline T y() const {return _y;}
-        inline T z() const {return _z;}
+/////////////////////////////////////////////////////////////////////////////
+// Epsilon comparisons
+//
+// The comparisons, and the intersection routines built on them, take an
+// optional leading epsilon policy that decides what "equal" means, e.g.
+// isEqual(AbsoluteTolerance<1, 1000000>(), a, b) or
+// intersect(AbsoluteEpsilon<>(), tri, ray, p). A policy is an empty type
+// derived from EpsilonPolicy with static equal() and equalScaled()
+// members; its tolerance is a compile time constant, so the absolute
+// policies come down to a subtraction and a compare. Without a policy
+// the comparisons are those of DefaultEpsilon.
+/////////////////////////////////////////////////////////////////////////////
 
-    private:
-        // private methods
-        void _validate(T inX, T inY, T inZ)
-        {
-            _x = inX;
-            _y = inY;
-            _z = inZ;
+struct EpsilonPolicy
+{
+};
 
-            uint64_t newFlags = 0;
+template <typename Policy>
+using IfEpsilonPolicy = typename std::enable_if<std::is_base_of<EpsilonPolicy, Policy>::value, int>::type;
 
-            if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
-            {
-                newFlags |= cSubnormalData;
-            }
-             if (!(isValid(_x) && isValid(_y) && isValid(_z)))
-            {
-                newFlags |= cInvalid;
-            }
+// Machine epsilon, relative to both values when neither is zero and
+// absolute otherwise.
+struct DefaultEpsilon : EpsilonPolicy
+{
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equalScaled(T v1, T v2, T scale)
+    {
+        T eps = scale * epsilon<T>();
 
-            setValidityFlags(newFlags);
+        if (v1 != 0.0 && v2 != 0.0)
+        {
+            return std::abs(v1 - v2) / std::abs(v1) <= eps && std::abs(v1 - v2) / std::abs(v2) <= eps;
         }
+        else
+        {
+            return std::abs(v1 - v2) <= eps;
+        }
+    }
 
-        // private data
-        T   _x;
-        T   _y;
-        T   _z;
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equal(T v1, T v2)
+    {
+        T eps = epsilon<T>();
 
+        if (v1 != 0.0 && v2 != 0.0)
+        {
+             return std::abs(v1 - v2) / std::abs(v1) <= eps &&  std::abs(v1 - v2) / std::abs(v2) <= eps;
+        }
+        else
+        {
+            return std::abs(v1 - v2) <= eps;
+       }
+    }
 };
 
-//
-// Vector3.
-//
-// Is considered valid as long as the 3 components (x, y, z) are valid. 
-// 
-// There are no non-validity related degenerate cases for Vector3. Note
-// that while it may be possible to construct a valid Vector3 where the
-// magnitude overflows and is invalid, that is not considered a degenerate
-// vector.
-// 
-template <typename T>
-class Vector3 : public HubertBase
+// As DefaultEpsilon with a tolerance of Multiple epsilons.
+template <int Multiple>
+struct ScaledEpsilon : EpsilonPolicy
 {
-    public:
-        // constructors
-        Vector3() : Vector3(T(0.0), T(0.0), T(0.0)) {}
-        Vector3(T inX, T inY, T inZ) { _validate(inX, inY, inZ); }
-        Vector3(const Vector3 &) = default;
-        ~Vector3() = default;
+    template <typename T>
+    HUBERT_HOST_DEVICE static constexpr T tolerance() { return T(Multiple) * std::numeric_limits<T>::epsilon(); }
 
-        // public operators
-        inline Vector3<T> & operator=(const Vector3<T> &) = default;
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equalScaled(T v1, T v2, T scale)
+    {
+        return DefaultEpsilon::equalScaled(v1, v2, scale * T(Multiple));
+    }
 
-        // public methods
-        inline T x() const {return _x;}
-        inline T y() const {return _y;}
-        inline T z() const {return _z;}
-        inline T magnitude() const {return _mag; }
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equal(T v1, T v2)
+    {
+        return DefaultEpsilon::equalScaled(v1, v2, T(Multiple));
+    }
+};
 
-    private:
-        // private methods
-        void _validate(T inX, T inY, T inZ)
-        {
-            _x = inX;
-            _y = inY;
-            _z = inZ;
+// |v1 - v2| within Multiple epsilons, whatever the magnitudes.
+template <int Multiple = 1>
+struct AbsoluteEpsilon : EpsilonPolicy
+{
+    template <typename T>
+    HUBERT_HOST_DEVICE static constexpr T tolerance() { return T(Multiple) * std::numeric_limits<T>::epsilon(); }
 
-            uint64_t newFlags = 0;
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equalScaled(T v1, T v2, T scale) { return std::abs(v1 - v2) <= scale * tolerance<T>(); }
 
-            if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
-            {
-                newFlags |= cSubnormalData;
-            }
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equal(T v1, T v2) { return std::abs(v1 - v2) <= tolerance<T>(); }
+};
 
-            if (!(isValid(_x) && isValid(_y) && isValid(_z)))
-            {
-                newFlags |= cInvalid;
-            }
+// |v1 - v2| within Numerator / Denominator, for data of a known, fixed
+// scale.
+template <int64_t Numerator, int64_t Denominator = 1>
+struct AbsoluteTolerance : EpsilonPolicy
+{
+    static_assert(Numerator >= 0 && Denominator > 0, "the tolerance must be a non-negative fraction");
 
-            // only do degeneracy checks if valid
-            if (!(newFlags & cInvalid))
-            {
-                _mag = std::hypot(_x, _y, _z);
-            }
-            else
-            {
-                _mag = infinity<T>();
-            }
+    template <typename T>
+    HUBERT_HOST_DEVICE static constexpr T tolerance() { return T(Numerator) / T(Denominator); }
 
-            setValidityFlags(newFlags);
-        }
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equalScaled(T v1, T v2, T scale) { return std::abs(v1 - v2) <= scale * tolerance<T>(); }
 
-        // private data
-        T   _x;
-        T   _y;
-        T   _z;
-        T   _mag;
+    template <typename T>
+    HUBERT_HOST_DEVICE static bool equal(T v1, T v2) { return std::abs(v1 - v2) <= tolerance<T>(); }
 };
 
-//
-// UnitVector3.
-//
-// Is considered valid as long as the 3 components (x, y, z) are valid. 
-// 
-// A valid UnitVector3 is considered degenerate if a valid unit vector could
-// not be computed from the input vector from which the UnitVector3 
-// was constructed. This condition will happen if the input vector is
-// zero length, or if calculation of the unit vector overflows the 
-// available range of the specified floating point type.
-// 
-template <typename T>
-class UnitVector3 : public HubertBase
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline bool isEqualScaled(Policy, T v1, T v2, T scale)
 {
-    public:
-        // constructors
-        UnitVector3() : UnitVector3(T(0.0), T(1.0), T(0.0)) {}
-        UnitVector3(T inX, T inY, T inZ){ _normalizeAndValidate(inX, inY, inZ); }
-        UnitVector3(const UnitVector3 &) = default;
-        ~UnitVector3() = default;
-
-        // public operators
-        inline UnitVector3<T> & operator=(const UnitVector3<T> &) = default;
+    return Policy::equalScaled(v1, v2, scale);
+}
 
-        // public methods
-        inline T x() const {return _x;}
-        inline T y() const {return _y;}
-        inline T z() const {return _z;}
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline bool isEqual(Policy, T v1, T v2)
+{
+    return Policy::equal(v1, v2);
+}
 
-    private:
-        // private methods
-        void _normalizeAndValidate(T inX, T inY, T inZ)
-        {
-            _x = inX;
-            _y = inY;
-            _z = inZ;
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline bool isGreaterOrEqual(Policy, T v1, T v2)
+{
+    return (v1 > v2) || Policy::equal(v1, v2);
+}
 
-            uint64_t newFlags = 0;
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline bool isLessOrEqual(Policy, T v1, T v2)
+{
+    return (v1 < v2) || Policy::equal(v1, v2);
+}
 
-           if (!(isValid(_x) && isValid(_y) && isValid(_z)))
-            {
-                newFlags |= cInvalid;
-                _mag = infinity<T>();
-            }
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isEqualScaled(T v1, T v2, T scale)
+{
+    return DefaultEpsilon::equalScaled(v1, v2, scale);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isEqual(T v1, T v2)
+{
+    return DefaultEpsilon::equal(v1, v2);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isGreaterOrEqual(T v1, T v2)
+{
+    return (v1 > v2) || isEqual(v1, v2);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isLessOrEqual(T v1, T v2)
+{
+    return (v1 < v2) || isEqual(v1, v2);
+}
+
+template <typename T>
+inline T difference(T v1, T v2)
+{
+    return std::abs(v1 - v2);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Validation checks on primitive types
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const T & v)
+{
+    return std::isfinite(v);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const T & v)
+{
+    // finite, not normal and not zero, without std::isnormal, which device
+    // code lacks
+    T a = std::abs(v);
+    return a != T(0.0) && a < std::numeric_limits<T>::min();
+}
+
+// True if all three values are valid and none is subnormal, which is what
+// the entity constructors would find. Written without short circuits so
+// that it compiles to a handful of compares.
+template <typename T>
+HUBERT_HOST_DEVICE inline bool areNormalOrZero(T x, T y, T z)
+{
+    const T lo = std::numeric_limits<T>::min();
+    const T hi = std::numeric_limits<T>::max();
+    T ax = std::abs(x);
+    T ay = std::abs(y);
+    T az = std::abs(z);
+    return ((ax == T(0.0)) | ((ax >= lo) & (ax <= hi))) &
+           ((ay == T(0.0)) | ((ay >= lo) & (ay <= hi))) &
+           ((az == T(0.0)) | ((az >= lo) & (az <= hi)));
+}
+
+// True if the length of (x, y, z) is within epsilon of 0, exactly as
+// isEqual(std::hypot(x, y, z), T(0.0)) decides it. The sum of squares
+// settles it except within rounding of epsilon squared, and only there is
+// the hypot taken.
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isZeroLength(T x, T y, T z)
+{
+    const T e2 = epsilon<T>() * epsilon<T>();
+    T s = x * x + y * y + z * z;
+    if (s < e2 * T(0.99))
+    {
+        return true;
+    }
+    if (!(s > e2 * T(1.01)))
+    {
+        // on the boundary, or not a number
+        return isEqual(hypot3(x, y, z), T(0.0));
+    }
+    return false;
+}
+
+// True if the length of (x, y, z) is finite, as isValid(std::hypot(x, y,
+// z)) decides it. The hypot is only taken if the sum of squares overflows.
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isFiniteLength(T x, T y, T z)
+{
+    T s = x * x + y * y + z * z;
+    return (s <= std::numeric_limits<T>::max()) || isValid(hypot3(x, y, z));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Exact orientation predicates
+//
+// orient2d() and orient3d() after Shewchuk, "Adaptive Precision
+// Floating-Point Arithmetic and Fast Robust Geometric Predicates" (1997).
+// The determinant is evaluated in plain floating point first, together
+// with a bound on its rounding error. Only if the bound does not settle
+// the sign is the determinant evaluated again exactly, as an expansion (a
+// sum of non-overlapping floating point components). The sign returned is
+// always exact, provided no intermediate overflows or underflows; the
+// magnitude is only approximate.
+/////////////////////////////////////////////////////////////////////////////
+
+// Tag for the routines that decide with the exact predicates instead of
+// epsilon comparisons, e.g. intersect(exact, tri1, tri2).
+struct Exact
+{
+    explicit Exact() = default;
+};
+inline constexpr Exact exact{};
+
+// Selects the predicates the batch intersection routines decide with.
+enum class Predicates : uint32_t
+{
+    eEpsilon = 0,       // epsilon comparisons, as intersect(Triangle3, Triangle3)
+    eExact              // the exact predicates, as intersect(exact, Triangle3, Triangle3)
+};
+
+template <typename T>
+struct ExpansionConstants
+{
+    // half an ulp of one, the unit roundoff
+    static constexpr T cEpsilon = std::numeric_limits<T>::epsilon() / 2;
+    // 2^ceil(p / 2) + 1, splits a p bit value into two halves
+    static constexpr T cSplitter = T((uint64_t(1) << ((std::numeric_limits<T>::digits + 1) / 2)) + 1);
+    // error bounds of the floating point filters
+    static constexpr T cOrient2dBound = (T(3) + T(16) * cEpsilon) * cEpsilon;
+    static constexpr T cOrient3dBound = (T(7) + T(56) * cEpsilon) * cEpsilon;
+};
+
+// x + y == a + b exactly, x being the rounded sum
+template <typename T>
+inline void twoSum(T a, T b, T & x, T & y)
+{
+    x = a + b;
+    T bv = x - a;
+    T av = x - bv;
+    y = (a - av) + (b - bv);
+}
+
+// x + y == a - b exactly, x being the rounded difference
+template <typename T>
+inline void twoDiff(T a, T b, T & x, T & y)
+{
+    x = a - b;
+    T bv = a - x;
+    T av = x + bv;
+    y = (a - av) + (bv - b);
+}
+
+// hi + lo == a, each with at most half the significand bits
+template <typename T>
+inline void splitHalves(T a, T & hi, T & lo)
+{
+    T c = ExpansionConstants<T>::cSplitter * a;
+    hi = c - (c - a);
+    lo = a - hi;
+}
+
+// x + y == a * b exactly, x being the rounded product
+template <typename T>
+inline void twoProduct(T a, T b, T & x, T & y)
+{
+    x = a * b;
+    T ahi, alo, bhi, blo;
+    splitHalves(a, ahi, alo);
+    splitHalves(b, bhi, blo);
+    T err = x - ahi * bhi;
+    err -= alo * bhi;
+    err -= ahi * blo;
+    y = alo * blo - err;
+}
+
+// h = e + f. The expansions have at least one component each, in order of
+// increasing magnitude; h needs room for elen + flen. Zero components are
+// dropped. Returns the length of h.
+template <typename T>
+inline int expansionSum(int elen, const T * e, int flen, const T * f, T * h)
+{
+    int ei = 0, fi = 0, hi = 0;
+    auto next = [&]() {
+        if (fi == flen || (ei < elen && std::abs(e[ei]) < std::abs(f[fi])))
+        {
+            return e[ei++];
+        }
+        return f[fi++];
+    };
+
+    T q = next();
+    while (ei < elen || fi < flen)
+    {
+        T y;
+        twoSum(q, next(), q, y);
+        if (y != T(0))
+        {
+            h[hi++] = y;
+        }
+    }
+    if (q != T(0) || hi == 0)
+    {
+        h[hi++] = q;
+    }
+    return hi;
+}
+
+// h = e * b. h needs room for 2 * elen. Returns the length of h.
+template <typename T>
+inline int scaleExpansion(int elen, const T * e, T b, T * h)
+{
+    int hi = 0;
+    T q, y;
+    twoProduct(e[0], b, q, y);
+    if (y != T(0))
+    {
+        h[hi++] = y;
+    }
+    for (int i = 1; i < elen; i++)
+    {
+        T p1, p0, s;
+        twoProduct(e[i], b, p1, p0);
+        twoSum(q, p0, s, y);
+        if (y != T(0))
+        {
+            h[hi++] = y;
+        }
+        twoSum(p1, s, q, y);
+        if (y != T(0))
+        {
+            h[hi++] = y;
+        }
+    }
+    if (q != T(0) || hi == 0)
+    {
+        h[hi++] = q;
+    }
+    return hi;
+}
+
+// h = e * f, for short expansions: flen is at most 2 and h needs room for
+// 4 * elen.
+template <typename T>
+inline int multiplyExpansion(int elen, const T * e, int flen, const T * f, T * h)
+{
+    if (flen == 1)
+    {
+        return scaleExpansion(elen, e, f[0], h);
+    }
+    T * p0 = h + 2 * elen;
+    T p1[64];
+    int n0 = scaleExpansion(elen, e, f[0], p0);
+    int n1 = scaleExpansion(elen, e, f[1], p1);
+    return expansionSum(n0, p0, n1, p1, h);
+}
+
+// -e, in place
+template <typename T>
+inline void negateExpansion(int elen, T * e)
+{
+    for (int i = 0; i < elen; i++)
+    {
+        e[i] = -e[i];
+    }
+}
+
+// a - b exactly, dropping a zero low component. Returns the length.
+template <typename T>
+inline int exactDiff(T a, T b, T * h)
+{
+    twoDiff(a, b, h[1], h[0]);
+    if (h[0] == T(0))
+    {
+        h[0] = h[1];
+        return 1;
+    }
+    return 2;
+}
+
+// (a - c)(b - d) - (e - g)(f - k) exactly into h (room for 16). Returns
+// the length.
+template <typename T>
+inline int exactMinor2(T a, T c, T b, T d, T e, T g, T f, T k, T * h)
+{
+    T d1[2], d2[2], d3[2], d4[2], p1[8], p2[8];
+    int n1 = exactDiff(a, c, d1);
+    int n2 = exactDiff(b, d, d2);
+    int n3 = exactDiff(e, g, d3);
+    int n4 = exactDiff(f, k, d4);
+    int m1 = multiplyExpansion(n1, d1, n2, d2, p1);
+    int m2 = multiplyExpansion(n3, d3, n4, d4, p2);
+    negateExpansion(m2, p2);
+    return expansionSum(m1, p1, m2, p2, h);
+}
+
+template <typename T>
+inline T orient2dExact(const T a[2], const T b[2], const T c[2])
+{
+    T det[16];
+    int n = exactMinor2(a[0], c[0], b[1], c[1], a[1], c[1], b[0], c[0], det);
+    return det[n - 1];
+}
+
+template <typename T>
+inline T orient3dExact(const T a[3], const T b[3], const T c[3], const T d[3])
+{
+    // expanded along the z column:
+    //   adz (bdx cdy - cdx bdy) + bdz (cdx ady - adx cdy) + cdz (adx bdy - bdx ady)
+    T minor[16], dz[2], term[64], sum1[128], sum2[192];
+    int n, m;
+
+    n = exactMinor2(b[0], d[0], c[1], d[1], c[0], d[0], b[1], d[1], minor);
+    m = exactDiff(a[2], d[2], dz);
+    int t1 = multiplyExpansion(n, minor, m, dz, term);
+    std::copy(term, term + t1, sum2);
+
+    n = exactMinor2(c[0], d[0], a[1], d[1], a[0], d[0], c[1], d[1], minor);
+    m = exactDiff(b[2], d[2], dz);
+    int t2 = multiplyExpansion(n, minor, m, dz, term);
+    int s1 = expansionSum(t1, sum2, t2, term, sum1);
+
+    n = exactMinor2(a[0], d[0], b[1], d[1], b[0], d[0], a[1], d[1], minor);
+    m = exactDiff(c[2], d[2], dz);
+    int t3 = multiplyExpansion(n, minor, m, dz, term);
+    int s2 = expansionSum(s1, sum1, t3, term, sum2);
+    return sum2[s2 - 1];
+}
+
+// Positive if a, b, c are in counterclockwise order, negative if they are
+// in clockwise order, zero if they are collinear. Equals twice the signed
+// area of the triangle abc.
+template <typename T>
+inline T orient2d(const T a[2], const T b[2], const T c[2])
+{
+    T left = (a[0] - c[0]) * (b[1] - c[1]);
+    T right = (a[1] - c[1]) * (b[0] - c[0]);
+    T det = left - right;
+
+    T sum;
+    if (left > T(0))
+    {
+        if (right <= T(0))
+        {
+            return det;
+        }
+        sum = left + right;
+    }
+    else if (left < T(0))
+    {
+        if (right >= T(0))
+        {
+            return det;
+        }
+        sum = -left - right;
+    }
+    else
+    {
+        return det;
+    }
+
+    if (std::abs(det) >= ExpansionConstants<T>::cOrient2dBound * sum)
+    {
+        return det;
+    }
+    return orient2dExact(a, b, c);
+}
+
+// Positive if d lies below the plane through a, b, c, below being the side
+// from which a, b, c appear in clockwise order; negative if above, zero if
+// the four points are coplanar. Equals six times the signed volume of the
+// tetrahedron abcd.
+template <typename T>
+inline T orient3d(const T a[3], const T b[3], const T c[3], const T d[3])
+{
+    T adx = a[0] - d[0], ady = a[1] - d[1], adz = a[2] - d[2];
+    T bdx = b[0] - d[0], bdy = b[1] - d[1], bdz = b[2] - d[2];
+    T cdx = c[0] - d[0], cdy = c[1] - d[1], cdz = c[2] - d[2];
+
+    T bdxcdy = bdx * cdy, cdxbdy = cdx * bdy;
+    T cdxady = cdx * ady, adxcdy = adx * cdy;
+    T adxbdy = adx * bdy, bdxady = bdx * ady;
+
+    T det = adz * (bdxcdy - cdxbdy) + bdz * (cdxady - adxcdy) + cdz * (adxbdy - bdxady);
+    T permanent = (std::abs(bdxcdy) + std::abs(cdxbdy)) * std::abs(adz)
+                + (std::abs(cdxady) + std::abs(adxcdy)) * std::abs(bdz)
+                + (std::abs(adxbdy) + std::abs(bdxady)) * std::abs(cdz);
+
+    if (std::abs(det) > ExpansionConstants<T>::cOrient3dBound * permanent)
+    {
+        return det;
+    }
+    return orient3dExact(a, b, c, d);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Core type definitions
+/////////////////////////////////////////////////////////////////////////////
+
+// Tag for the trusted constructors, which take data that is already known
+// to be valid and free of subnormals and skip validation entirely, e.g.
+// Point3<T>(trusted, x, y, z). Handing them anything else produces an
+// entity whose flags are wrong.
+struct Trusted
+{
+    explicit Trusted() = default;
+};
+inline constexpr Trusted trusted{};
+
+// This class is the base class for all entities.
+class HubertBase
+{
+    public:
+        HubertBase() = default;
+        ~HubertBase() = default;
+
+        HUBERT_HOST_DEVICE bool amValid() const { return !(flags & cInvalid); }
+        HUBERT_HOST_DEVICE bool amDegenerate() const { return (flags & (cDegenerate | cInvalid)); }
+        HUBERT_HOST_DEVICE bool amSubnormal() const { return (flags & cSubnormalData); }
+
+    protected:
+        static constexpr uint32_t cInvalid =          0x00001;        // entity is invalid (and data has been set to infinity)
+        static constexpr uint32_t cDegenerate =       0x00002;        // entity is degenerate (may or may not be invalid)
+        static constexpr uint32_t cSubnormalData =    0x00004;        // entity is valid but one of the defining data is non-zero subnormal
+        static constexpr uint32_t cValidityMask =     0x0000F;        // entity is valid but one of the defining data is non-zero subnormal
+
+        HUBERT_HOST_DEVICE uint32_t getValidityFlags() const { return flags & cValidityMask; }
+        HUBERT_HOST_DEVICE void setValidityFlags(uint32_t f) { flags = (flags & ~cValidityMask) | (f & cValidityMask); }
+        HUBERT_HOST_DEVICE static void countValidityFlags(InstrumentedEntity e, uint32_t f) { countValidation(e, f & cInvalid, f & cDegenerate, f & cSubnormalData); }
+
+    private:
+        // 32 bits, so that the float entities pack into 16 byte multiples
+        uint32_t    flags = 0;
+
+};
+
+//
+// Point3.
+//
+// Is considered valid as long as the 3 components (x, y, z) are valid. 
+// 
+// There are no non-validity related degenerate cases for Point3.
+// 
+template <typename T>
+class Point3 : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE Point3() : Point3(T(0.0), T(0.0), T(0.0)) {}
+        HUBERT_HOST_DEVICE Point3(T inX, T inY, T inZ) { _validate(inX, inY, inZ); }
+        HUBERT_HOST_DEVICE Point3(Trusted, T inX, T inY, T inZ) : _x(inX), _y(inY), _z(inZ) { countTrusted(InstrumentedEntity::ePoint3); }
+        Point3(const Point3 &) = default;
+        ~Point3() = default;
+
+        // public operators 
+        inline Point3<T>& operator=(const Point3<T>&) = default;
+
+        // public methods
+        HUBERT_HOST_DEVICE inline T x() const {return _x;}
+        HUBERT_HOST_DEVICE inline T y() const {return _y;}
+        HUBERT_HOST_DEVICE inline T z() const {return _z;}
+
+    private:
+        // private methods
+        HUBERT_HOST_DEVICE void _validate(T inX, T inY, T inZ)
+        {
+            _x = inX;
+            _y = inY;
+            _z = inZ;
+
+            uint32_t newFlags = 0;
+
+            if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
+            {
+                newFlags |= cSubnormalData;
+            }
+             if (!(isValid(_x) && isValid(_y) && isValid(_z)))
+            {
+                newFlags |= cInvalid;
+            }
+
+            countValidityFlags(InstrumentedEntity::ePoint3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        // private data
+        T   _x;
+        T   _y;
+        T   _z;
+
+};
+
+//
+// Vector3.
+//
+// Is considered valid as long as the 3 components (x, y, z) are valid. 
+// 
+// There are no non-validity related degenerate cases for Vector3. Note
+// that while it may be possible to construct a valid Vector3 where the
+// magnitude overflows and is invalid, that is not considered a degenerate
+// vector.
+// 
+template <typename T>
+class Vector3 : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE Vector3() : Vector3(T(0.0), T(0.0), T(0.0)) {}
+        HUBERT_HOST_DEVICE Vector3(T inX, T inY, T inZ) { _validate(inX, inY, inZ); }
+        HUBERT_HOST_DEVICE Vector3(Trusted, T inX, T inY, T inZ) : _x(inX), _y(inY), _z(inZ) { countTrusted(InstrumentedEntity::eVector3); }
+        Vector3(const Vector3 &) = default;
+        ~Vector3() = default;
+
+        // public operators
+        inline Vector3<T> & operator=(const Vector3<T> &) = default;
+
+        // public methods
+        HUBERT_HOST_DEVICE inline T x() const {return _x;}
+        HUBERT_HOST_DEVICE inline T y() const {return _y;}
+        HUBERT_HOST_DEVICE inline T z() const {return _z;}
+        // computed on every call rather than cached, since most vectors
+        // (edges and other temporaries) never need it
+        HUBERT_HOST_DEVICE inline T magnitude() const { return amValid() ? hypot3(_x, _y, _z) : infinity<T>(); }
+        // for comparisons; may overflow where magnitude() does not
+        HUBERT_HOST_DEVICE inline T magnitudeSquared() const { return amValid() ? _x * _x + _y * _y + _z * _z : infinity<T>(); }
+
+    private:
+        // private methods
+        HUBERT_HOST_DEVICE void _validate(T inX, T inY, T inZ)
+        {
+            _x = inX;
+            _y = inY;
+            _z = inZ;
+
+            uint32_t newFlags = 0;
+
+            if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
+            {
+                newFlags |= cSubnormalData;
+            }
+
+            if (!(isValid(_x) && isValid(_y) && isValid(_z)))
+            {
+                newFlags |= cInvalid;
+            }
+
+            countValidityFlags(InstrumentedEntity::eVector3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        // private data
+        T   _x;
+        T   _y;
+        T   _z;
+};
+
+//
+// UnitVector3.
+//
+// Is considered valid as long as the 3 components (x, y, z) are valid. 
+// 
+// A valid UnitVector3 is considered degenerate if a valid unit vector could
+// not be computed from the input vector from which the UnitVector3 
+// was constructed. This condition will happen if the input vector is
+// zero length, or if calculation of the unit vector overflows the 
+// available range of the specified floating point type.
+// 
+template <typename T>
+class UnitVector3 : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE UnitVector3() : UnitVector3(T(0.0), T(1.0), T(0.0)) {}
+        HUBERT_HOST_DEVICE UnitVector3(T inX, T inY, T inZ){ _normalizeAndValidate(inX, inY, inZ); }
+        // the components must already be of unit length
+        HUBERT_HOST_DEVICE UnitVector3(Trusted, T inX, T inY, T inZ) : _x(inX), _y(inY), _z(inZ) { countTrusted(InstrumentedEntity::eUnitVector3); }
+        UnitVector3(const UnitVector3 &) = default;
+        ~UnitVector3() = default;
+
+        // public operators
+        inline UnitVector3<T> & operator=(const UnitVector3<T> &) = default;
+
+        // public methods
+        HUBERT_HOST_DEVICE inline T x() const {return _x;}
+        HUBERT_HOST_DEVICE inline T y() const {return _y;}
+        HUBERT_HOST_DEVICE inline T z() const {return _z;}
+
+    private:
+        // private methods
+        HUBERT_HOST_DEVICE void _normalizeAndValidate(T inX, T inY, T inZ)
+        {
+            _x = inX;
+            _y = inY;
+            _z = inZ;
+
+            uint32_t newFlags = 0;
+
+           if (!(isValid(_x) && isValid(_y) && isValid(_z)))
+            {
+                newFlags |= cInvalid;
+            }
+
+            // only do normalization and degeneracy checks if valid
+            if (!(newFlags & cInvalid))
+            {
+                if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                T mag = hypot3(_x, _y, _z);
+           
+                if (!isValid(mag) || isEqual(mag, T(0.0)))
+                {
+                    newFlags |= cDegenerate;
+                }
+                else
+                {
+                    _x /= mag;
+                    _y /= mag;
+                    _z /= mag;
+
+                    // becasue we have modified the numbers, check them for subnormality again
+                    if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
+                    {
+                        newFlags |= cSubnormalData;
+                    }
+                }
+             }
+
+             countValidityFlags(InstrumentedEntity::eUnitVector3, newFlags);
+             setValidityFlags(newFlags);
+        }
+
+        // private data
+        T   _x;
+        T   _y;
+        T   _z;
+};
+
+template <typename T>
+class Matrix3 : public HubertBase
+{
+    public:
+        // constructors
+        Matrix3() : _m{} {}
+        Matrix3(T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2) { _validate(r0c0, r0c1, r0c2, r1c0, r1c1, r1c2, r2c0, r2c1, r2c2); }
+        Matrix3(Trusted, T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2) : _m{ { r0c0, r0c1, r0c2 }, { r1c0, r1c1, r1c2 }, { r2c0, r2c1, r2c2 } } { countTrusted(InstrumentedEntity::eMatrix3); _setMaxVal(); }
+        Matrix3(const Matrix3&) = default;
+        ~Matrix3() = default;
+
+        // public operators
+        inline Matrix3<T>& operator=(const Matrix3<T>&) = default;
+
+        // public methods
+        inline T get(uint32_t r, uint32_t c) const { return _m[r][c]; }
+        inline T getDeterminantEpsilonScale() const { return T(12.0) * _maxVal; }
+
+        inline Matrix3<T> transpose(void) const
+        {
+            Matrix3<T> mt(
+                _m[0][0], _m[1][0], _m[2][0],
+                _m[0][1], _m[1][1], _m[2][1],
+                _m[0][2], _m[1][2], _m[2][2]
+            );
+
+            return mt;
+        }
+
+        inline Matrix3<T> multiply(const Matrix3<T> & m2) const
+        {
+           T mt[3][3];
+
+            for (int i = 0; i < 3; i++){
+                for (int j = 0; j < 3; j++) {
+                    mt[i][j] = T(0.0);
+                    for (int u = 0; u < 3; u++) {
+                        mt[i][j] += _m[i][u] * m2._m[u][j];
+                    }
+                }
+            }
+
+            return Matrix3(mt[0][0], mt[0][1], mt[0][2], mt[1][0], mt[1][1], mt[1][2], mt[2][0], mt[2][1], mt[2][2]);
+        }
+
+        inline bool isIdentity(T scale = T(1.0)) const 
+        {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    if (!isEqualScaled(_m[i][j], (i == j) ? T(1.0) : T(0.0), scale)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        inline bool isIdentityTolerance(T tolerance) const
+        {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    if (difference(_m[i][j], (i == j) ? T(1.0) : T(0.0)) > tolerance) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        inline T determinant() const
+        {
+            return (
+                _m[0][0] * (_m[1][1] * _m[2][2] - _m[2][1] * _m[1][2]) -
+                _m[0][1] * (_m[1][0] * _m[2][2] - _m[2][0] * _m[1][2]) +
+                _m[0][2] * (_m[1][0] * _m[2][1] - _m[2][0] * _m[1][1])
+            );
+        }
+
+
+    protected:
+        T   _m[3][3];
+
+
+    private:
+        // private methods
+        void _validate(T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2)
+        {
+            _m[0][0] = r0c0;
+            _m[1][0] = r1c0;
+            _m[2][0] = r2c0;
+            _m[0][1] = r0c1;
+            _m[1][1] = r1c1;
+            _m[2][1] = r2c1;
+            _m[0][2] = r0c2;
+            _m[1][2] = r1c2;
+            _m[2][2] = r2c2;
+
+            _setMaxVal();
+
+            uint32_t newFlags = 0;
+
+            // only reason for invalidity is the source data
+            T* v = &_m[0][0];
+            for (int i = 0; i < 9; i++, v++)
+            {
+                if (!isValid(*v))
+                {
+                    newFlags |= cInvalid;
+                    break;
+                }
+            }
+
+            // only do normalization checks if we are valid. There is no
+            // degeneracy case unrelated to validity.
+            if (!(newFlags & cInvalid))
+            {
+                v = &_m[0][0];
+                for (int i = 0; i < 9; i++, v++)
+                {
+                    if (isSubnormal(T(*v)))
+                    {
+                        newFlags |= cSubnormalData;
+                        break;
+                    }
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::eMatrix3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        // we use the maximum value to scale epsilon
+        void _setMaxVal()
+        {
+            T* v = &_m[0][0];
+            for (int i = 0; i < 9; i++, v++)
+            {
+                if (std::abs(*v) > _maxVal)
+                {
+                    _maxVal = std::abs(*v);
+                }
+            }
+        }
+
+        // Don't allow direct access to the data
+        T   _maxVal = T(0.0);
+};
+
+
+template <typename T>
+class MatrixRotation3 : public Matrix3<T>
+{
+    public:
+        // constructors
+        MatrixRotation3() : MatrixRotation3(UnitVector3<T>(T(1.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(1.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0)) ) {}
+        MatrixRotation3(const UnitVector3<T> & inX, const UnitVector3<T>& inY, const UnitVector3<T>& inZ) : Matrix3<T>(inX.x(), inX.y(), inX.z(), inY.x(), inY.y(), inY.z(), inZ.x(), inZ.y(), inZ.z()) { _validate(inX, inY, inZ); }
+        MatrixRotation3(Trusted, T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2) : Matrix3<T>(trusted, r0c0, r0c1, r0c2, r1c0, r1c1, r1c2, r2c0, r2c1, r2c2) { countTrusted(InstrumentedEntity::eMatrixRotation3); }
+        MatrixRotation3(const MatrixRotation3&) = default;
+        ~MatrixRotation3() = default;
+
+        // public operators
+        inline MatrixRotation3<T>& operator=(const MatrixRotation3<T>&) = default;
+
+        // public methods
+        inline MatrixRotation3<T> transpose(void) const 
+        {
+            MatrixRotation3<T> mt(
+                UnitVector3<T>(this->_m[0][0], this->_m[1][0], this->_m[2][0]),
+                UnitVector3<T>(this->_m[0][1], this->_m[1][1], this->_m[2][1]),
+                UnitVector3<T>(this->_m[0][2], this->_m[1][2], this->_m[2][2])
+                );
+
+            return mt;
+        }
+
+        inline MatrixRotation3<T> multiply(const MatrixRotation3<T> & m2) const
+        {
+            T mt[3][3];
+
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    mt[i][j] = T(0.0);
+                    for (int u = 0; u < 3; u++) {
+                        mt[i][j] += this->_m[i][u] * m2._m[u][j];
+                    }
+                }
+            }
+
+            return MatrixRotation3(
+                UnitVector3<T>(mt[0][0], mt[0][1], mt[0][2]),
+                UnitVector3<T>(mt[1][0], mt[1][1], mt[1][2]),
+                UnitVector3<T>(mt[2][0], mt[2][1], mt[2][2])
+            );
+        }
+
+    private:
+        // Rotation matrix specific validation
+        void _validate(const UnitVector3<T>& inX, const UnitVector3<T>& inY, const UnitVector3<T>& inZ)
+        {
+            uint32_t newFlags = 0;
+
+            // the validity & subnormality flags will already have been set by the parent class. 
+            // All we have to worry about is degeneracy checks specific to the Rotation matrix
+            if (!(newFlags & HubertBase::cInvalid))
+            {
+                // the incoming vectors must be legitimate unit vectors, otherwise the matrix
+                // does not stand a chance of being a rotation matrix.
+                if (isDegenerate(inX) || isDegenerate(inY) || isDegenerate(inZ))
+                {
+                    newFlags |= HubertBase::cDegenerate;
+                }
+
+                // Multiplied by its transpose must be an identity. Because we did
+                // a matrix multiply we have to scale the epsilon that will be used.
+                // Since we know all the columns are unit vectors, we don't worry
+                // about the magnitude of the values, but rather just on the number of
+                // operations performed
+                if (!(newFlags & HubertBase::cDegenerate))
+                {
+                    // Force using the parent class so that we don't do this validation
+                    // routine recursively
+                    if (!(Matrix3<T>::multiply(Matrix3<T>::transpose()).isIdentityTolerance(T(.00001))))
+                    {
+                        newFlags |= HubertBase::cDegenerate;
+                    }
+                }
+
+                // determinant must be 1
+                if (!(newFlags & HubertBase::cDegenerate))
+                {
+                    if (!isEqualScaled(this->determinant(), T(1.0), this->getDeterminantEpsilonScale()))
+                    {
+                        newFlags |= HubertBase::cDegenerate;
+                    }
+                }
+            }
+
+            this->countValidityFlags(InstrumentedEntity::eMatrixRotation3, newFlags);
+            this->setValidityFlags(newFlags);
+        }
+};
+
+
+
+
+//
+// Transform3.
+//
+// A rigid transform: a rotation followed by a translation, applied to row
+// vectors as p * rotation + translation, the convention of
+// multiply(Vector3, Matrix3).
+//
+// Is considered valid as long as the rotation and the translation are
+// valid. A valid Transform3 is considered degenerate if the rotation is.
+//
+// compose() multiplies the rotations without revalidating the product
+// (see composeRotations()), so a long chain of compositions slowly drifts
+// away from orthonormal. Each transform counts the compositions since its
+// rotation was last validated, and compose() re-orthonormalizes and
+// revalidates the rotation when the count reaches its interval argument.
+//
+template <typename T>
+class Transform3 : public HubertBase
+{
+    public:
+        // constructors
+        Transform3() : Transform3(MatrixRotation3<T>(), Vector3<T>(T(0.0), T(0.0), T(0.0))) {}
+        Transform3(const MatrixRotation3<T> & inRotation, const Vector3<T> & inTranslation, uint32_t inComposed = 0) : _rotation(inRotation), _translation(inTranslation), _composed(inComposed) { _validate(); }
+        Transform3(const Transform3 &) = default;
+        ~Transform3() = default;
+
+        // public operators
+        inline Transform3<T> & operator=(const Transform3<T> &) = default;
+
+        // public methods
+        inline const MatrixRotation3<T> & rotation() const { return _rotation; }
+        inline const Vector3<T> & translation() const { return _translation; }
+
+        // compositions since the rotation was last validated
+        inline uint32_t composed() const { return _composed; }
+
+    private:
+        // private methods
+        void _validate()
+        {
+            uint32_t newFlags = 0;
+
+            if (!isValid(_rotation) || !isValid(_translation))
+            {
+                newFlags |= cInvalid;
+            }
+            else if (isDegenerate(_rotation))
+            {
+                newFlags |= cDegenerate;
+            }
+            if (isSubnormal(_rotation) || isSubnormal(_translation))
+            {
+                newFlags |= cSubnormalData;
+            }
+
+            countValidityFlags(InstrumentedEntity::eTransform3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        // private data
+        MatrixRotation3<T>  _rotation;
+        Vector3<T>          _translation;
+        uint32_t            _composed = 0;
+};
+
+
+//
+// Line3.
+//
+// Is considered valid as long as both Point3 input values used to 
+// define it are valid. 
+// 
+// A valid Line3 is considered degenerate if a valid unit vector could
+// not be computed from the input Vector3 from which the UnitVector3 
+// was constructed. This condition would happen if the input vcctor is
+// zero length, or if calculation of the unit vector overflowed the 
+// available range of the specified floating point type.
+// 
+template <typename T>
+class Line3 : public HubertBase
+{
+    public:
+        // constructors
+        Line3() : Line3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(1.0), T(1.0))) {}
+        Line3(const Point3<T> & inP1, const Point3<T> & inP2) { _normalizeAndValidate(inP1, inP2); }
+        Line3(const Line3 &) = default;
+        ~Line3() = default;
+
+        // public operators
+        inline Line3<T> & operator=(const Line3<T> &) = default;
+
+        // public methods
+        inline const Point3<T> & base() const { return _base; }
+        inline const Point3<T> & target() const { return _target; }
+        inline const UnitVector3<T>& unitDirection() const { return _unitDirection; }
+        inline const Vector3<T>& fullDirection() const { return _fullDirection; }
+
+
+    private:
+        // private methods
+        void _normalizeAndValidate(const Point3<T> & p1, const Point3<T> & p2)
+        {
+            uint32_t newFlags = 0;
+
+            // non calculated data is preserved as is
+            _base = p1;
+            _target = p2;
+
+            // only do normalization and degeneracy checks if valid
+            if (!(isValid(p1) && isValid(p2)))
+            {
+                newFlags |= cInvalid;
+                _fullDirection = Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+                _unitDirection = UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+            }
+            else {
+                // if subnormal, we will do the calculations, but set the subnormal flag
+                // so that everyone knows that the calculations are reduced precision
+                if (isSubnormal(p1) || isSubnormal(p2))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                // if the two poits are too close, we are degenerate
+                if (isZeroLength(p2.x() - p1.x(), p2.y() - p1.y(), p2.z() - p1.z()))
+                {
+                    newFlags |= cDegenerate;
+                    _fullDirection = Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+                    _unitDirection = UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+                }
+                else
+                {
+                    _base = p1;
+                    _target = p2;
+                    _fullDirection = Vector3<T>(p2.x() - p1.x(), p2.y() - p1.y(), p2.z() - p1.z());
+                    _unitDirection = makeUnitVector3(_fullDirection);
+
+                    if (isDegenerate(_fullDirection) || isDegenerate(_unitDirection))
+                    {
+                        // if the vector calculation overflows, call the line degenerate because
+                        // there is not much we can do with it since the points are too far apart
+                        // to use in any calculation
+                        newFlags |= cDegenerate;
+                    }
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::eLine3, newFlags);
+            setValidityFlags(newFlags);
+        }
+        
+        Point3<T>       _base;
+        Point3<T>       _target;
+        Vector3<T>  _fullDirection;
+        UnitVector3<T>  _unitDirection;
+};
+
+//
+// Plane.
+//
+// Is considered valid as long as the base Point3 input values and the
+// up UnitVector3 used to define it are valid
+// 
+// A valid Plane is considered degenerate if a non-degenerate up UnitVector3
+// is not provided.
+// 
+template <typename T>
+class Plane : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE Plane() : Plane(Point3<T>(T(0.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0))) {}
+        HUBERT_HOST_DEVICE Plane(const Point3<T> & p, const UnitVector3<T>& v) { _validate(p, v);  }
+        Plane(const Plane &) = default;
+        ~Plane() = default;
+
+        // public methods
+        inline Plane<T> & operator=(const Plane<T> &) = default;
+
+        // public medthods
+        HUBERT_HOST_DEVICE inline const Point3<T>& base() const { return _base; }
+        HUBERT_HOST_DEVICE inline const UnitVector3<T>& up() const { return _up; }
+
+    private:
+        HUBERT_HOST_DEVICE void _validate(const Point3<T>& p, const UnitVector3<T>& v)
+        {
+            _base = p;
+            _up = v;
+
+            uint32_t newFlags = 0;
 
             // only do normalization and degeneracy checks if valid
-            if (!(newFlags & cInvalid))
+            if (!(isValid(_base) && isValid(_up)))
+            {
+                newFlags |= cInvalid;
+            }
+            else {
+                // if subnormal, we will do the calculations, but set the subnormal flag
+                // so that everyone knows that the calculations are reduced precision
+                if (isSubnormal(_base) || isSubnormal(_up))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                if (isDegenerate(_up))
+                {
+                    newFlags |= cDegenerate;
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::ePlane, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+
+        // public data
+        Point3<T>       _base;
+        UnitVector3<T>  _up;
+};
+
+//
+// Ray3.
+//
+// Is considered valid as long as the base Point3 input values and the
+// direction UnitVector3 used to define it are valid
+// 
+// A valid Ray3 is considered degenerate if a non-degenerate direction UnitVector3
+// is not provided.
+// 
+template <typename T>
+class Ray3 : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE Ray3() : Ray3(Point3<T>(T(0.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0))) {}
+        HUBERT_HOST_DEVICE Ray3(const Point3<T>& p, const UnitVector3<T>& v) { _validate(p, v); }
+        Ray3(const Ray3 &) = default;
+        ~Ray3() = default;
+
+        // public operators
+        inline Ray3<T> & operator=(const Ray3<T> &) = default;
+
+        // public medthods
+        HUBERT_HOST_DEVICE inline const Point3<T>& base() const { return _base; }
+        HUBERT_HOST_DEVICE inline const UnitVector3<T> & unitDirection() const { return _direction; }
+
+    private:
+        HUBERT_HOST_DEVICE void _validate(const Point3<T>& p, const UnitVector3<T>& v)
+        {
+            _base = p;
+            _direction = v;
+
+            uint32_t newFlags = 0;
+
+            // only do normalization and degeneracy checks if valid
+            if (!(isValid(_base) && isValid(_direction)))
+            {
+                newFlags |= cInvalid;
+            }
+            else {
+                // if subnormal, we will do the calculations, but set the subnormal flag
+                // so that everyone knows that the calculations are reduced precision
+                if (isSubnormal(_base) || isSubnormal(_direction))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                if (isDegenerate(_direction))
+                {
+                    newFlags |= cDegenerate;
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::eRay3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        Point3<T>       _base;
+        UnitVector3<T>  _direction;
+};
+
+//
+// Segment3.
+//
+// Is considered valid as long as both Point3 input values used to 
+// define it are valid. 
+// 
+// A valid Segment3 is considered degenerate if a valid unit vector could
+// not be computed from the input Vector3 from which the UnitVector3 
+// was constructed. This condition would happen if the input vector is
+// zero length, or if calculation of the unit vector overflowed the 
+// available range of the specified floating point type.
+// 
+template <typename T>
+class Segment3 : public HubertBase
+{
+    public:
+        // constructors
+        Segment3() : Segment3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(1.0), T(1.0))) {}
+        Segment3(const Point3<T>& inP1, const Point3<T>& inP2) { _validate(inP1, inP2); }
+        Segment3(const Segment3 &) = default;
+        ~Segment3() = default;
+
+        // public operators
+        inline Segment3<T> & operator=(const Segment3<T> &) = default;
+
+        // public methods
+        inline const Point3<T> & base() const { return _base; }
+        inline const Point3<T> & target() const { return _target; }
+
+    private:
+        void _validate(const Point3<T>& p1, const Point3<T>& p2)
+        {
+            _base = p1;
+            _target = p2;
+
+            uint32_t newFlags = 0;
+
+            // only do subnormal and degeneracy checks if valid
+            if (!(isValid(_base) && isValid(_target)))
+            {
+                newFlags |= cInvalid;
+            }
+            else {
+                // if subnormal, we will do the calculations, but set the subnormal flag
+                // so that everyone knows that the calculations are reduced precision
+                if (isSubnormal(_base) || isSubnormal(_target))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                T dx = p2.x() - p1.x();
+                T dy = p2.y() - p1.y();
+                T dz = p2.z() - p1.z();
+                if (isZeroLength(dx, dy, dz) || !isFiniteLength(dx, dy, dz))
+                {
+                    newFlags |= cDegenerate;
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::eSegment3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        //private data
+        Point3<T>   _base;
+        Point3<T>   _target;
+};
+
+//
+// Triangle degeneracy classification.
+//
+// A triangle with valid vertices is degenerate if any of these hold:
+//    * an edge length (hypot) is within epsilon of 0, or overflows
+//    * the area (half the hypot of (p2 - p1) x (p3 - p1)) is within
+//      epsilon of 0
+//    * every component of (p2 - p1) x (p3 - p1), (p2 - p1) x (p3 - p2) or
+//      (p3 - p1) x (p3 - p2) is within epsilon of 0
+//
+// The hypot of (x, y, z) lies between m = max(|x|, |y|, |z|) and sqrt(3) m,
+// so m alone settles the length and area checks except in a narrow band,
+// and only there does classifyTriangle() report the triangle ambiguous.
+// The first cross product check is implied by the area check and is not
+// repeated. Vertices that are not finite make a triangle degenerate.
+//
+
+// the exact checks
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerateTriangleExact(const T p1[3], const T p2[3], const T p3[3])
+{
+    const T e1[3] = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+    const T e2[3] = { p3[0] - p1[0], p3[1] - p1[1], p3[2] - p1[2] };
+    const T e3[3] = { p3[0] - p2[0], p3[1] - p2[1], p3[2] - p2[2] };
+
+    for (const T * e : { e1, e2, e3 })
+    {
+        if (isZeroLength(e[0], e[1], e[2]) || !isFiniteLength(e[0], e[1], e[2]))
+        {
+            return true;
+        }
+    }
+
+    auto crossIsZero = [](const T a[3], const T b[3], T c[3]) {
+        c[0] = a[1] * b[2] - a[2] * b[1];
+        c[1] = a[2] * b[0] - a[0] * b[2];
+        c[2] = a[0] * b[1] - a[1] * b[0];
+        return isEqual(c[0], T(0.0)) && isEqual(c[1], T(0.0)) && isEqual(c[2], T(0.0));
+    };
+
+    T c[3];
+    if (crossIsZero(e1, e2, c))
+    {
+        return true;
+    }
+    if (isValid(c[0]) && isValid(c[1]) && isValid(c[2]) && isZeroLength(c[0] * T(0.5), c[1] * T(0.5), c[2] * T(0.5)))
+    {
+        return true;
+    }
+    return crossIsZero(e1, e3, c) || crossIsZero(e2, e3, c);
+}
+
+// Branch free first pass: returns the degeneracy of the triangle, unless
+// ambiguous is set, in which case isDegenerateTriangleExact() decides.
+template <typename T>
+HUBERT_HOST_DEVICE inline bool classifyTriangle(const T p1[3], const T p2[3], const T p3[3], bool & ambiguous)
+{
+    const T eps = epsilon<T>();
+    const T hi = std::numeric_limits<T>::max();
+
+    const T e1[3] = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+    const T e2[3] = { p3[0] - p1[0], p3[1] - p1[1], p3[2] - p1[2] };
+    const T e3[3] = { p3[0] - p2[0], p3[1] - p2[1], p3[2] - p2[2] };
+
+    bool degenerate = false;
+    bool unsure = false;
+
+    // edge lengths: 0 if m <= eps / 2, fine if eps < m <= hi / 2, and
+    // overflowed (or not finite) if any component is beyond hi
+    for (const T * e : { e1, e2, e3 })
+    {
+        T ax = std::abs(e[0]);
+        T ay = std::abs(e[1]);
+        T az = std::abs(e[2]);
+        bool finite = (ax <= hi) & (ay <= hi) & (az <= hi);
+        bool zero = (ax * T(2.0) <= eps) & (ay * T(2.0) <= eps) & (az * T(2.0) <= eps);
+        bool fine = ((ax > eps) | (ay > eps) | (az > eps)) & (ax <= hi * T(0.5)) & (ay <= hi * T(0.5)) & (az <= hi * T(0.5));
+        degenerate |= !finite | zero;
+        unsure |= !(!finite | zero | fine);
+    }
+
+    auto cross = [](const T a[3], const T b[3], T c[3]) {
+        c[0] = std::abs(a[1] * b[2] - a[2] * b[1]);
+        c[1] = std::abs(a[2] * b[0] - a[0] * b[2]);
+        c[2] = std::abs(a[0] * b[1] - a[1] * b[0]);
+    };
+
+    // area: 0 if m <= eps, fine if m > 2 eps (or not finite)
+    T c[3];
+    cross(e1, e2, c);
+    degenerate |= (c[0] <= eps) & (c[1] <= eps) & (c[2] <= eps);
+    unsure |= (c[0] <= T(2.0) * eps) & (c[1] <= T(2.0) * eps) & (c[2] <= T(2.0) * eps);
+
+    cross(e1, e3, c);
+    degenerate |= (c[0] <= eps) & (c[1] <= eps) & (c[2] <= eps);
+    cross(e2, e3, c);
+    degenerate |= (c[0] <= eps) & (c[1] <= eps) & (c[2] <= eps);
+
+    ambiguous = unsure & !degenerate;
+    return degenerate;
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerateTriangle(const T p1[3], const T p2[3], const T p3[3])
+{
+    bool ambiguous;
+    bool degenerate = classifyTriangle(p1, p2, p3, ambiguous);
+    return ambiguous ? isDegenerateTriangleExact(p1, p2, p3) : degenerate;
+}
+
+//
+// Triangle3.
+//
+// Is considered valid as long as all 3 Point3 input values used to 
+// define it are valid. 
+// 
+// A valid Triangle3 is considered degenerate For a number of reasons:
+//    * Any of the 3 edges is collapsed to 0 length
+//    * Any of the 3 edges overflows when its length is computed
+//    * Are of the triangle is computed to be 0
+//    * Cross product of edge1 & edge2 creates a vector of 0 length
+//    * Cross product of edge1 & edge3 creates a vector of 0 length
+//    * Cross product of edge2 & edge3 creates a vector of 0 length
+// 
+// 
+template <typename T>
+class Triangle3 : public HubertBase
+{
+    public:
+        // constructors
+        HUBERT_HOST_DEVICE Triangle3() : Triangle3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(0.0), T(0.0)), Point3<T>(T(0.0), T(1.0), T(0.0))) {}
+        HUBERT_HOST_DEVICE Triangle3(const Point3<T>& inP1, const Point3<T>& inP2, const Point3<T>& inP3) { _validate(inP1, inP2, inP3); }
+        Triangle3(const Triangle3 &) = default;
+        ~Triangle3() = default;
+
+        // public operators
+        inline Triangle3<T> & operator=(const Triangle3<T> &) = default;
+
+        // public methods
+        HUBERT_HOST_DEVICE inline const Point3<T>& p1() const { return _p1; }
+        HUBERT_HOST_DEVICE inline const Point3<T>& p2() const { return _p2; }
+        HUBERT_HOST_DEVICE inline const Point3<T>& p3() const { return _p3; }
+
+    private:
+        HUBERT_HOST_DEVICE void _validate(const Point3<T>& p1, const Point3<T>& p2, const Point3<T>& p3)
+        {
+            _p1 = p1;
+            _p2 = p2;
+            _p3 = p3;
+
+            uint32_t newFlags = 0;
+
+            // only do subnormal and degeneracy checks if valid
+            if (!(isValid(_p1) && isValid(_p2) && isValid(_p3)))
+            {
+                newFlags |= cInvalid;
+            }
+            else {
+                // if subnormal, we will do the calculations, but set the subnormal flag
+                // so that everyone knows that the calculations are reduced precision
+                if (isSubnormal(_p1) || isSubnormal(_p2) || isSubnormal(_p3))
+                {
+                    newFlags |= cSubnormalData;
+                }
+
+                // we do multiple degeneracy tests because we need to fail if any of them fail. If we did not
+                // other calculations down stream might fail because we reported a non-degenerate triangle. 
+                // Because of numerical  instability depending on the scale of the numbers, it is possible for 
+                // some approaches to differ in their response. Overflowing edges count as degenerate too:
+                // even though the points are valid, allowing such a triangle makes many downstream
+                // calculations fail. The checks are listed, and fused into one pass, above.
+                const T a[3] = { _p1.x(), _p1.y(), _p1.z() };
+                const T b[3] = { _p2.x(), _p2.y(), _p2.z() };
+                const T c[3] = { _p3.x(), _p3.y(), _p3.z() };
+                if (isDegenerateTriangle(a, b, c))
+                {
+                    newFlags |= cDegenerate;
+                }
+            }
+
+            countValidityFlags(InstrumentedEntity::eTriangle3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        //private data
+        Point3<T>   _p1;
+        Point3<T>   _p2;
+        Point3<T>   _p3;
+};
+
+// so that they can be copied to and from the GPU as they are
+static_assert(std::is_trivially_copyable<Point3<float>>::value && std::is_trivially_copyable<UnitVector3<float>>::value &&
+              std::is_trivially_copyable<Plane<float>>::value && std::is_trivially_copyable<Ray3<float>>::value &&
+              std::is_trivially_copyable<Triangle3<float>>::value, "the device entities must be memcpy-able");
+
+//
+// Aabb3.
+//
+// An axis aligned bounding box, held as its lowest and highest corners.
+// Is considered valid as long as both corners are valid. The corners may
+// be given in any order.
+//
+// The default constructed box holds nothing, and is considered degenerate
+// until something is added to it. A box around a single point (or a flat
+// box around a segment along an axis) is not degenerate: it has no volume
+// but can still be hit.
+//
+template <typename T>
+class Aabb3 : public HubertBase
+{
+    public:
+        // constructors
+        Aabb3() { _setEmpty(); }
+        Aabb3(const Point3<T>& inP) { _validate(inP, inP); }
+        Aabb3(const Point3<T>& inP1, const Point3<T>& inP2) { _validate(inP1, inP2); }
+        Aabb3(const Segment3<T>& inSegment) { _validate(inSegment.base(), inSegment.target()); }
+        Aabb3(const Triangle3<T>& inTri) { _validate(inTri.p1(), inTri.p2()); expand(inTri.p3()); }
+        Aabb3(const Aabb3 &) = default;
+        ~Aabb3() = default;
+
+        // public operators
+        inline Aabb3<T> & operator=(const Aabb3<T> &) = default;
+
+        // public methods
+        inline const Point3<T> & lo() const { return _lo; }
+        inline const Point3<T> & hi() const { return _hi; }
+        inline bool amEmpty() const { return _empty; }
+
+        // grow the box to hold the point or box as well
+        inline void expand(const Point3<T> & p)
+        {
+            if (_empty || !isValid(p))
+            {
+                _validate(p, p);
+            }
+            else if (amValid())
+            {
+                _validate(
+                    Point3<T>(std::min(_lo.x(), p.x()), std::min(_lo.y(), p.y()), std::min(_lo.z(), p.z())),
+                    Point3<T>(std::max(_hi.x(), p.x()), std::max(_hi.y(), p.y()), std::max(_hi.z(), p.z())));
+            }
+        }
+
+        inline void expand(const Aabb3<T> & box)
+        {
+            if (box._empty)
+            {
+                return;
+            }
+            if (_empty || !isValid(box))
+            {
+                *this = box;
+                return;
+            }
+            expand(box._lo);
+            expand(box._hi);
+        }
+
+    private:
+        void _setEmpty()
+        {
+            _lo = Point3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+            _hi = Point3<T>(-infinity<T>(), -infinity<T>(), -infinity<T>());
+            _empty = true;
+            setValidityFlags(cDegenerate);
+        }
+
+        void _validate(const Point3<T>& p1, const Point3<T>& p2)
+        {
+            _empty = false;
+
+            uint32_t newFlags = 0;
+
+            if (!(isValid(p1) && isValid(p2)))
+            {
+                newFlags |= cInvalid;
+                _lo = p1;
+                _hi = p2;
+            }
+            else
+            {
+                if (isSubnormal(p1) || isSubnormal(p2))
+                {
+                    newFlags |= cSubnormalData;
+                }
+                _lo = Point3<T>(std::min(p1.x(), p2.x()), std::min(p1.y(), p2.y()), std::min(p1.z(), p2.z()));
+                _hi = Point3<T>(std::max(p1.x(), p2.x()), std::max(p1.y(), p2.y()), std::max(p1.z(), p2.z()));
+            }
+
+            countValidityFlags(InstrumentedEntity::eAabb3, newFlags);
+            setValidityFlags(newFlags);
+        }
+
+        //private data
+        Point3<T>   _lo;
+        Point3<T>   _hi;
+        bool        _empty;
+};
+
+//
+// PreparedRay3.
+//
+// A Ray3 together with the per ray constants of the fast intersection
+// routines, for testing one ray against many primitives:
+//    * the reciprocal of the direction and its sign bits, for slab tests
+//    * the dominant axis kz of the direction and the other two axes kx, ky,
+//      ordered to keep the winding, plus the shear constants Sx, Sy, Sz of
+//      the watertight ray / triangle test of Woop, Benthin & Wald
+//
+// Its validity and degeneracy are those of the ray it was built from.
+//
+template <typename T>
+class PreparedRay3 : public HubertBase
+{
+    public:
+        // constructors
+        PreparedRay3() : PreparedRay3(Ray3<T>()) {}
+        PreparedRay3(const Ray3<T>& inRay) { _prepare(inRay); }
+        PreparedRay3(const PreparedRay3 &) = default;
+        ~PreparedRay3() = default;
+
+        // public operators
+        inline PreparedRay3<T> & operator=(const PreparedRay3<T> &) = default;
+
+        // public methods
+        inline const Ray3<T> & ray() const { return _ray; }
+        inline const T * origin() const { return _orig; }
+        inline const T * direction() const { return _dir; }
+        inline const T * invDirection() const { return _invDir; }
+        inline uint32_t sign(int axis) const { return _sign[axis]; }
+        inline int kx() const { return _kx; }
+        inline int ky() const { return _ky; }
+        inline int kz() const { return _kz; }
+        inline T sx() const { return _sx; }
+        inline T sy() const { return _sy; }
+        inline T sz() const { return _sz; }
+
+    private:
+        void _prepare(const Ray3<T>& inRay)
+        {
+            _ray = inRay;
+
+            const Point3<T> & b = inRay.base();
+            const UnitVector3<T> & d = inRay.unitDirection();
+            _orig[0] = b.x();
+            _orig[1] = b.y();
+            _orig[2] = b.z();
+            _dir[0] = d.x();
+            _dir[1] = d.y();
+            _dir[2] = d.z();
+
+            for (int a = 0; a < 3; a++)
+            {
+                _invDir[a] = T(1.0) / _dir[a];
+                _sign[a] = std::signbit(_invDir[a]) ? 1 : 0;
+            }
+
+            _kz = 0;
+            if (std::abs(_dir[1]) > std::abs(_dir[_kz])) _kz = 1;
+            if (std::abs(_dir[2]) > std::abs(_dir[_kz])) _kz = 2;
+            _kx = (_kz + 1) % 3;
+            _ky = (_kx + 1) % 3;
+            if (_dir[_kz] < T(0.0))
+            {
+                std::swap(_kx, _ky);
+            }
+
+            _sx = _dir[_kx] / _dir[_kz];
+            _sy = _dir[_ky] / _dir[_kz];
+            _sz = T(1.0) / _dir[_kz];
+
+            setValidityFlags((inRay.amValid() ? 0 : cInvalid) | (inRay.amDegenerate() ? cDegenerate : 0) | (inRay.amSubnormal() ? cSubnormalData : 0));
+        }
+
+        //private data
+        Ray3<T>     _ray;
+        T           _orig[3];
+        T           _dir[3];
+        T           _invDir[3];
+        uint32_t    _sign[3];
+        int         _kx;
+        int         _ky;
+        int         _kz;
+        T           _sx;
+        T           _sy;
+        T           _sz;
+};
+
+//
+// PreparedTriangle3.
+//
+// A Triangle3 reduced to what the ray, line, segment and triangle
+// intersection routines need: the vertices, the two edges from the first
+// one, the unit normal and the plane equation N.X + d = 0 with N the
+// unnormalised edge1 x edge2, which are computed once when it is built.
+// The edges and plane are exactly those the Triangle3 routines compute on
+// every call (p2 - p1, p3 - p1), so the results of the intersection
+// routines are identical.
+//
+// Its validity and degeneracy are those of the triangle it was built from.
+//
+template <typename T>
+class PreparedTriangle3 : public HubertBase
+{
+    public:
+        // constructors
+        PreparedTriangle3() : PreparedTriangle3(Triangle3<T>()) {}
+        PreparedTriangle3(const Triangle3<T>& inTri) { _prepare(inTri); }
+        PreparedTriangle3(const Point3<T>& inP1, const Point3<T>& inP2, const Point3<T>& inP3) { _prepare(Triangle3<T>(inP1, inP2, inP3)); }
+        PreparedTriangle3(const PreparedTriangle3 &) = default;
+        ~PreparedTriangle3() = default;
+
+        // public operators
+        inline PreparedTriangle3<T> & operator=(const PreparedTriangle3<T> &) = default;
+
+        // public methods
+        inline const Point3<T> & p1() const { return _p1; }
+        inline const T * vertex() const { return _vert0; }
+        inline const T * vertex2() const { return _vert1; }
+        inline const T * vertex3() const { return _vert2; }
+        inline const T * edge1() const { return _edge1; }
+        inline const T * edge2() const { return _edge2; }
+        inline const UnitVector3<T> & normal() const { return _normal; }
+        inline const T * planeNormal() const { return _planeNormal; }
+        inline T planeOffset() const { return _planeOffset; }
+
+    private:
+        void _prepare(const Triangle3<T>& inTri)
+        {
+            _p1 = inTri.p1();
+            _vert0[0] = _p1.x();
+            _vert0[1] = _p1.y();
+            _vert0[2] = _p1.z();
+            _vert1[0] = inTri.p2().x();
+            _vert1[1] = inTri.p2().y();
+            _vert1[2] = inTri.p2().z();
+            _vert2[0] = inTri.p3().x();
+            _vert2[1] = inTri.p3().y();
+            _vert2[2] = inTri.p3().z();
+
+            Vector3<T> e1 = inTri.p2() - inTri.p1();
+            Vector3<T> e2 = inTri.p3() - inTri.p1();
+            _edge1[0] = e1.x();
+            _edge1[1] = e1.y();
+            _edge1[2] = e1.z();
+            _edge2[0] = e2.x();
+            _edge2[1] = e2.y();
+            _edge2[2] = e2.z();
+
+            _planeNormal[0] = _edge1[1] * _edge2[2] - _edge1[2] * _edge2[1];
+            _planeNormal[1] = _edge1[2] * _edge2[0] - _edge1[0] * _edge2[2];
+            _planeNormal[2] = _edge1[0] * _edge2[1] - _edge1[1] * _edge2[0];
+            _planeOffset = -(_planeNormal[0] * _vert0[0] + _planeNormal[1] * _vert0[1] + _planeNormal[2] * _vert0[2]);
+
+            if (inTri.amDegenerate())
+            {
+                _normal = UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+            }
+            else
+            {
+                _normal = UnitVector3<T>(
+                    e1.y() * e2.z() - e1.z() * e2.y(),
+                    e1.z() * e2.x() - e1.x() * e2.z(),
+                    e1.x() * e2.y() - e1.y() * e2.x());
+            }
+
+            setValidityFlags((inTri.amValid() ? 0 : cInvalid) | (inTri.amDegenerate() ? cDegenerate : 0) | (inTri.amSubnormal() ? cSubnormalData : 0));
+        }
+
+        //private data
+        Point3<T>       _p1;
+        T               _vert0[3];
+        T               _vert1[3];
+        T               _vert2[3];
+        T               _edge1[3];
+        T               _edge2[3];
+        UnitVector3<T>  _normal;
+        T               _planeNormal[3];
+        T               _planeOffset;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Packed storage types
+//
+// Plain coordinates without the flags word, for holding large data sets
+// and for reading and writing them directly (memcpy, mmap). They know
+// nothing about validity: convert to Point3 / Triangle3 to find out.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct PackedPoint3
+{
+    T   x;
+    T   y;
+    T   z;
+};
+
+// Same as PackedPoint3, padded out to a 16 byte boundary so that each point
+// can be loaded with one aligned vector load (float) or two (double).
+template <typename T>
+struct alignas(16) AlignedPoint3
+{
+    T   x;
+    T   y;
+    T   z;
+};
+
+template <typename T>
+struct PackedTriangle3
+{
+    PackedPoint3<T>     p1;
+    PackedPoint3<T>     p2;
+    PackedPoint3<T>     p3;
+};
+
+static_assert(std::is_trivially_copyable<PackedPoint3<float>>::value && std::is_standard_layout<PackedPoint3<float>>::value, "PackedPoint3 must be memcpy-able");
+static_assert(std::is_trivially_copyable<AlignedPoint3<float>>::value && std::is_standard_layout<AlignedPoint3<float>>::value, "AlignedPoint3 must be memcpy-able");
+static_assert(std::is_trivially_copyable<PackedTriangle3<float>>::value && std::is_standard_layout<PackedTriangle3<float>>::value, "PackedTriangle3 must be memcpy-able");
+static_assert(sizeof(PackedPoint3<float>) == 12 && sizeof(PackedPoint3<double>) == 24, "PackedPoint3 must not be padded");
+static_assert(sizeof(AlignedPoint3<float>) == 16 && sizeof(AlignedPoint3<double>) == 32, "AlignedPoint3 must be padded to 16 bytes");
+static_assert(sizeof(PackedTriangle3<float>) == 36 && sizeof(PackedTriangle3<double>) == 72, "PackedTriangle3 must not be padded");
+
+/////////////////////////////////////////////////////////////////////////////
+// Special invalid entity instances
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T invalidValue()
+{
+    return infinity<T>();
+}
+
+HUBERT_HOST_DEVICE inline size_t invalidIndex()
+{
+    return std::numeric_limits<size_t>::max();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> invalidPoint3()
+{
+    return Point3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> invalidVector3()
+{
+    return Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline UnitVector3<T> invalidUnitVector3()
+{
+    return UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+}
+
+template <typename T>
+inline Aabb3<T> invalidAabb3()
+{
+    return Aabb3<T>(invalidPoint3<T>());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Creation functions - (alternates to provided constructor)
+/////////////////////////////////////////////////////////////////////////////
+
+// Used by the arithmetic that produces most of the temporaries in the
+// library. The flags of the result depend only on its components, so when
+// those are plainly valid and not subnormal the validation is skipped.
+// They build their own Trusted tag, since device code cannot read the
+// host variable trusted.
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> makeVector3Fast(T x, T y, T z)
+{
+    return areNormalOrZero(x, y, z) ? Vector3<T>(Trusted(), x, y, z) : Vector3<T>(x, y, z);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> makePoint3Fast(T x, T y, T z)
+{
+    return areNormalOrZero(x, y, z) ? Point3<T>(Trusted(), x, y, z) : Point3<T>(x, y, z);
+}
+
+template <typename T>
+inline Vector3<T> makeVector3(const Point3<T> & from, const Point3<T> to)
+{
+    return makeVector3Fast(to.x() - from.x(), to.y() - from.y(), to.z() - from.z());
+}
+
+template <typename T>
+inline Vector3<T> makeVector3(const UnitVector3<T> & u)
+{
+    return Vector3<T>(u.x(), u.y(), u.z());
+}
+
+template <typename T>
+inline UnitVector3<T> makeUnitVector3(const Vector3<T> & v)
+{
+    return UnitVector3<T>(v.x(), v.y(), v.z());
+}
+
+template <typename T>
+inline UnitVector3<T> makeUnitVector3(const Point3<T> & from, const Point3<T> to)
+{
+    return UnitVector3<T>(to.x() - from.x(), to.y() - from.y(), to.z() - from.z());
+}
+
+
+template <typename T>
+inline Line3<T> makeLine3(const Point3<T> & p, const Vector3<T> v)
+{
+    return Line3<T>(p, p + v);
+}
+
+template <typename T>
+inline Line3<T> makeLine3(const Point3<T> & p, const UnitVector3<T> v)
+{
+    return Line3<T>(p, p + makeVector3(v));
+}
+
+
+template <typename T>
+inline Plane<T> makePlane( const Point3<T> & p1, const Point3<T> & p2, const Point3<T> & p3)
+{
+    return Plane<T>(p1, makeUnitVector3(crossProduct(p2 - p1, p3 - p1)));
+}
+
+template <typename T>
+inline Ray3<T> makeRay3(const Point3<T> & p1, const Point3<T> & p2)
+{
+    return Ray3<T>(p1, makeUnitVector3(p2 - p1));
+}
+
+// conversions between the packed storage types and the validated entities
+
+template <typename T>
+inline Point3<T> makePoint3(const PackedPoint3<T> & p)
+{
+    return Point3<T>(p.x, p.y, p.z);
+}
+
+template <typename T>
+inline Point3<T> makePoint3(const AlignedPoint3<T> & p)
+{
+    return Point3<T>(p.x, p.y, p.z);
+}
+
+template <typename T>
+inline Triangle3<T> makeTriangle3(const PackedTriangle3<T> & tri)
+{
+    return Triangle3<T>(makePoint3(tri.p1), makePoint3(tri.p2), makePoint3(tri.p3));
+}
+
+template <typename T>
+inline PackedPoint3<T> makePackedPoint3(const Point3<T> & p)
+{
+    return PackedPoint3<T>{ p.x(), p.y(), p.z() };
+}
+
+template <typename T>
+inline AlignedPoint3<T> makeAlignedPoint3(const Point3<T> & p)
+{
+    return AlignedPoint3<T>{ p.x(), p.y(), p.z() };
+}
+
+template <typename T>
+inline PackedTriangle3<T> makePackedTriangle3(const Triangle3<T> & tri)
+{
+    return PackedTriangle3<T>{ makePackedPoint3(tri.p1()), makePackedPoint3(tri.p2()), makePackedPoint3(tri.p3()) };
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Validity checks
+//
+// These are checks for numerical validity, rather than any sort of
+// contextual checks. They simly care whether the floating point 
+// numbers are valid.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const Point3<T> & v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const Vector3<T> & v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const UnitVector3<T> & v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const Matrix3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const MatrixRotation3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const Transform3<T> & v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const Line3<T> & v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const Plane<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const Ray3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const Segment3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isValid(const Triangle3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const Aabb3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const PreparedRay3<T>& v)
+{
+    return v.amValid();
+}
+
+template <typename T>
+inline bool isValid(const PreparedTriangle3<T>& v)
+{
+    return v.amValid();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Degeneracy checks
+//
+// These are checks for degenerate forms of the entities we support. This
+// is a superset of the validity checks in that if one of the components
+// of an entity is invalid. Degeneracy, however, by no means implies that
+// andy of the individual components are invalid.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const Point3<T> & v)
+{
+     return v.amDegenerate();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const Vector3<T> & v)
+{
+   return v.amDegenerate();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const UnitVector3<T> & v)
+{
+   return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const Matrix3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const MatrixRotation3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const Transform3<T> & v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const Line3<T> & v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const Plane<T> & v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const Triangle3<T> & v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const Segment3<T> & v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isDegenerate(const Ray3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const Aabb3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const PreparedRay3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+template <typename T>
+inline bool isDegenerate(const PreparedTriangle3<T>& v)
+{
+    return v.amDegenerate();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Subnormal checks
+//
+// 
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const Point3<T> & v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const Vector3<T> & v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const UnitVector3<T> & v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const Matrix3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const MatrixRotation3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const Transform3<T> & v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const Line3<T> & v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const Plane<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const Ray3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const Segment3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline bool isSubnormal(const Triangle3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const Aabb3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const PreparedRay3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+template <typename T>
+inline bool isSubnormal(const PreparedTriangle3<T>& v)
+{
+    return v.amSubnormal();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Vector Math
+/////////////////////////////////////////////////////////////////////////////
+
+// dot product
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T dotProduct(const Vector3<T> & v1, const Vector3<T> & v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return infinity<T>();
+    }
+    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T dotProduct(const UnitVector3<T> & v1, const Vector3<T> & v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return infinity<T>();
+    }
+    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T dotProduct(const Vector3<T> & v1, const UnitVector3<T> & v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return infinity<T>();
+    }
+    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T dotProduct(const UnitVector3<T> & v1, const UnitVector3<T> & v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return infinity<T>();
+    }
+    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+}
+
+// scalar multiply
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> multiply(const Vector3<T>  &v , T m)
+{
+    return makeVector3Fast(v.x() * m, v.y() * m, v.z() * m);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> operator*(const Vector3<T>& v, T m)
+{
+    return multiply(v, m);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> multiply(const UnitVector3<T> & v, T m)
+{
+    return makeVector3Fast(v.x() * m, v.y() * m, v.z() * m);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> operator*(const UnitVector3<T>& v, T m)
+{
+    return multiply(v, m);
+}
+
+// cross product
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> crossProduct(const Vector3<T>& v1, const Vector3<T>& v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return invalidVector3<T>();
+    }
+
+    return makeVector3Fast(
+        v1.y() * v2.z() - v1.z() * v2.y(),
+        v1.z() * v2.x() - v1.x() * v2.z(),
+        v1.x() * v2.y() - v1.y() * v2.x()
+    );
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> crossProduct(const Vector3<T>& v1, const UnitVector3<T>& v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return invalidVector3<T>();
+    }
+
+    return makeVector3Fast(
+        v1.y() * v2.z() - v1.z() * v2.y(),
+        v1.z() * v2.x() - v1.x() * v2.z(),
+        v1.x() * v2.y() - v1.y() * v2.x()
+        );
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> crossProduct(const UnitVector3<T>& v1, const Vector3<T>& v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return invalidVector3<T>();
+    }
+
+    return makeVector3Fast(
+        v1.y() * v2.z() - v1.z() * v2.y(),
+        v1.z() * v2.x() - v1.x() * v2.z(),
+        v1.x() * v2.y() - v1.y() * v2.x()
+        );
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> crossProduct(const UnitVector3<T>& v1, const UnitVector3<T>& v2)
+{
+    if (v1.amDegenerate() || v2.amDegenerate())
+    {
+        return invalidVector3<T>();
+    }
+
+    return makeVector3Fast(
+        v1.y() * v2.z() - v1.z() * v2.y(),
+        v1.z() * v2.x() - v1.x() * v2.z(),
+        v1.x() * v2.y() - v1.y() * v2.x()
+        );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Distance functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline T distance(const Point3<T> & p1, const Point3<T> & p2)
+{
+    T dx = p1.x() - p2.x();
+    T dy = p1.y() - p2.y();
+    T dz = p1.z() - p2.z();
+
+    T tot = hypot3(dx, dy, dz);
+
+    return tot;
+ }
+
+// For comparing distances without taking the hypot. Note that it overflows
+// for points more than about the square root of the largest T apart.
+template <typename T>
+inline T distanceSquared(const Point3<T> & p1, const Point3<T> & p2)
+{
+    T dx = p1.x() - p2.x();
+    T dy = p1.y() - p2.y();
+    T dz = p1.z() - p2.z();
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// isEqual(distance(p1, p2), T(0.0)), without the hypot
+template <typename T>
+inline bool isCoincident(const Point3<T> & p1, const Point3<T> & p2)
+{
+    return isZeroLength(p1.x() - p2.x(), p1.y() - p2.y(), p1.z() - p2.z());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T distance(const Point3<T> & thePoint, const Plane<T> & thePlane)
+{
+    return dotProduct(thePlane.up(), thePoint - thePlane.base());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline T distance(const Plane<T> & thePlane, const Point3<T> & thePoint)
+{
+    return distance(thePoint, thePlane);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// vector magnitude functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline T magnitude(const Vector3<T>& v)
+{
+    if (!isValid(v))
+    {
+        return infinity<T>();
+    }
+
+    return hypot3(v.x(), v.y(), v.z());
+}
+
+template <typename T>
+inline T magnitudeSquared(const Vector3<T>& v)
+{
+    return v.magnitudeSquared();
+}
+
+// isEqual(magnitude(v), T(0.0)), without the hypot
+template <typename T>
+inline bool isZeroLength(const Vector3<T>& v)
+{
+    return v.amValid() && isZeroLength(v.x(), v.y(), v.z());
+}
+
+template <typename T>
+inline T magnitude(const UnitVector3<T>& v)
+{
+    if (v.amDegenerate())
+    {
+        if (v.amValid())
+        {
+            return T(0.0);
+        }
+        else
+        {
+            return infinity<T>();
+        }
+    }
+    return T(1.0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Transforms
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline Matrix3<T> transpose(const Matrix3<T>& v)
+{
+    return v.transpose();
+}
+
+template <typename T>
+inline MatrixRotation3<T> transpose(const MatrixRotation3<T>& v)
+{
+    return v.transpose();
+}
+
+template <typename T>
+inline Matrix3<T> multiply(const Matrix3<T>& v1, const Matrix3<T>& v2)
+{
+    return v1.multiply(v2);
+}
+
+// two valid rotation matrices are guaranteed to result in a rotation matrix
+template <typename T>
+inline MatrixRotation3<T> multiply(const MatrixRotation3<T> & v1, const MatrixRotation3<T> & v2)
+{
+    return v1.multiply(v2);
+}
+
+template <typename T>
+inline Vector3<T> multiply(const Vector3<T>& v, const Matrix3<T>& m)
+{
+    return makeVector3Fast(
+        v.x() * m.get(0, 0) + v.y() * m.get(1, 0) + v.z() * m.get(2, 0),
+        v.x() * m.get(0, 1) + v.y() * m.get(1, 1) + v.z() * m.get(2, 1),
+        v.x() * m.get(0, 2) + v.y() * m.get(1, 2) + v.z() * m.get(2, 2)
+    );
+}
+
+// The product of two rotations. The product of two valid rotation
+// matrices is a rotation matrix up to rounding, so unless either is
+// degenerate, or the product has an entry that is not plainly valid and
+// normal, the orthonormality check of the MatrixRotation3 constructor is
+// skipped. Rounding accumulates over long chains of products; see
+// orthonormalize().
+template <typename T>
+inline MatrixRotation3<T> composeRotations(const MatrixRotation3<T> & v1, const MatrixRotation3<T> & v2)
+{
+    if (isDegenerate(v1) || isDegenerate(v2))
+    {
+        return v1.multiply(v2);
+    }
+
+    T mt[3][3];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        for (uint32_t j = 0; j < 3; j++)
+        {
+            mt[i][j] = v1.get(i, 0) * v2.get(0, j) + v1.get(i, 1) * v2.get(1, j) + v1.get(i, 2) * v2.get(2, j);
+        }
+    }
+    if (!areNormalOrZero(mt[0][0], mt[0][1], mt[0][2]) || !areNormalOrZero(mt[1][0], mt[1][1], mt[1][2]) || !areNormalOrZero(mt[2][0], mt[2][1], mt[2][2]))
+    {
+        return v1.multiply(v2);
+    }
+    return MatrixRotation3<T>(trusted, mt[0][0], mt[0][1], mt[0][2], mt[1][0], mt[1][1], mt[1][2], mt[2][0], mt[2][1], mt[2][2]);
+}
+
+// The nearest rotation to a matrix that has drifted from orthonormal, by
+// Gram-Schmidt on its rows (the third row is rebuilt as the cross product
+// of the first two, which keeps the determinant at 1). The result is fully
+// validated.
+template <typename T>
+inline MatrixRotation3<T> orthonormalize(const MatrixRotation3<T> & v)
+{
+    if (!isValid(v))
+    {
+        return v;
+    }
+    UnitVector3<T> r0(v.get(0, 0), v.get(0, 1), v.get(0, 2));
+    T d = v.get(1, 0) * r0.x() + v.get(1, 1) * r0.y() + v.get(1, 2) * r0.z();
+    UnitVector3<T> r1(v.get(1, 0) - d * r0.x(), v.get(1, 1) - d * r0.y(), v.get(1, 2) - d * r0.z());
+    UnitVector3<T> r2(r0.y() * r1.z() - r0.z() * r1.y(), r0.z() * r1.x() - r0.x() * r1.z(), r0.x() * r1.y() - r0.y() * r1.x());
+    return MatrixRotation3<T>(r0, r1, r2);
+}
+
+template <typename T>
+inline Transform3<T> invalidTransform3()
+{
+    return Transform3<T>(MatrixRotation3<T>(invalidUnitVector3<T>(), invalidUnitVector3<T>(), invalidUnitVector3<T>()), invalidVector3<T>());
+}
+
+// compositions after which compose() re-orthonormalizes by default
+constexpr uint32_t cReorthonormalizeInterval = 64;
+
+// The transform that applies first and then second. If first and second
+// are valid, the result's rotation is revalidated (after being
+// re-orthonormalized) only once interval compositions have accumulated
+// since that was last done; an interval of 0 never does it. Degenerate
+// input gives an invalid transform.
+template <typename T>
+inline Transform3<T> compose(const Transform3<T> & first, const Transform3<T> & second, uint32_t interval = cReorthonormalizeInterval)
+{
+    if (isDegenerate(first) || isDegenerate(second))
+    {
+        return invalidTransform3<T>();
+    }
+
+    MatrixRotation3<T> rotation = composeRotations(first.rotation(), second.rotation());
+    Vector3<T> translation = multiply(first.translation(), second.rotation()) + second.translation();
+    uint32_t composed = first.composed() + second.composed() + 1;
+    if (interval != 0 && composed >= interval)
+    {
+        rotation = orthonormalize(rotation);
+        composed = 0;
+    }
+    return Transform3<T>(rotation, translation, composed);
+}
+
+// The transform that undoes v. The transpose of the rotation is taken as
+// is, since it is exactly as orthonormal as the rotation.
+template <typename T>
+inline Transform3<T> inverse(const Transform3<T> & v)
+{
+    if (isDegenerate(v))
+    {
+        return invalidTransform3<T>();
+    }
+
+    const MatrixRotation3<T> & r = v.rotation();
+    MatrixRotation3<T> rt(trusted,
+        r.get(0, 0), r.get(1, 0), r.get(2, 0),
+        r.get(0, 1), r.get(1, 1), r.get(2, 1),
+        r.get(0, 2), r.get(1, 2), r.get(2, 2));
+    Vector3<T> t = multiply(v.translation(), rt);
+    return Transform3<T>(rt, makeVector3Fast(-t.x(), -t.y(), -t.z()), v.composed());
+}
+
+// Applies a transform to an entity. Points are rotated and translated,
+// directions only rotated. A degenerate transform or an invalid entity
+// gives an invalid result; otherwise the result is validated as the
+// entity's constructor would.
+template <typename T>
+inline Point3<T> transform(const Transform3<T> & xf, const Point3<T> & p)
+{
+    if (isDegenerate(xf) || !isValid(p))
+    {
+        return invalidPoint3<T>();
+    }
+    const MatrixRotation3<T> & m = xf.rotation();
+    const Vector3<T> & t = xf.translation();
+    return makePoint3Fast(
+        p.x() * m.get(0, 0) + p.y() * m.get(1, 0) + p.z() * m.get(2, 0) + t.x(),
+        p.x() * m.get(0, 1) + p.y() * m.get(1, 1) + p.z() * m.get(2, 1) + t.y(),
+        p.x() * m.get(0, 2) + p.y() * m.get(1, 2) + p.z() * m.get(2, 2) + t.z()
+    );
+}
+
+template <typename T>
+inline Vector3<T> transform(const Transform3<T> & xf, const Vector3<T> & v)
+{
+    if (isDegenerate(xf) || !isValid(v))
+    {
+        return invalidVector3<T>();
+    }
+    return multiply(v, xf.rotation());
+}
+
+template <typename T>
+inline UnitVector3<T> transform(const Transform3<T> & xf, const UnitVector3<T> & v)
+{
+    if (isDegenerate(xf) || isDegenerate(v))
+    {
+        return invalidUnitVector3<T>();
+    }
+    const MatrixRotation3<T> & m = xf.rotation();
+    return UnitVector3<T>(
+        v.x() * m.get(0, 0) + v.y() * m.get(1, 0) + v.z() * m.get(2, 0),
+        v.x() * m.get(0, 1) + v.y() * m.get(1, 1) + v.z() * m.get(2, 1),
+        v.x() * m.get(0, 2) + v.y() * m.get(1, 2) + v.z() * m.get(2, 2)
+    );
+}
+
+template <typename T>
+inline Line3<T> transform(const Transform3<T> & xf, const Line3<T> & v)
+{
+    return Line3<T>(transform(xf, v.base()), transform(xf, v.target()));
+}
+
+template <typename T>
+inline Ray3<T> transform(const Transform3<T> & xf, const Ray3<T> & v)
+{
+    return Ray3<T>(transform(xf, v.base()), transform(xf, v.unitDirection()));
+}
+
+template <typename T>
+inline Segment3<T> transform(const Transform3<T> & xf, const Segment3<T> & v)
+{
+    return Segment3<T>(transform(xf, v.base()), transform(xf, v.target()));
+}
+
+template <typename T>
+inline Plane<T> transform(const Transform3<T> & xf, const Plane<T> & v)
+{
+    return Plane<T>(transform(xf, v.base()), transform(xf, v.up()));
+}
+
+template <typename T>
+inline Triangle3<T> transform(const Transform3<T> & xf, const Triangle3<T> & v)
+{
+    return Triangle3<T>(transform(xf, v.p1()), transform(xf, v.p2()), transform(xf, v.p3()));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// normal functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline UnitVector3<T> unitNormal(const Triangle3<T> & tri)
+{
+    // degenerate triangles do not have normals
+    if (isDegenerate(tri))
+    {
+        return invalidUnitVector3<T>();
+    }
+
+    // Ordering of points is not arbitrary. This follows from the hubert
+    // convention for a triangle
+    Vector3<T> v1 = tri.p2() - tri.p1();
+    Vector3<T> v2 = tri.p3() - tri.p1();
+
+    Vector3<T> norm = crossProduct(v1, v2);
+    if (!isValid(norm))
+    {
+        return invalidUnitVector3<T>();
+    }
+
+    // the unit normal could be degenerate (e.g. zero length or overflow)
+    // but it is up to the caller to detect that and deal with it.
+    UnitVector3<T> unorm = makeUnitVector3(norm);
+
+    return unorm;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Closest point functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline Point3<T> closestPoint(const Line3<T> & theLine, const Point3<T> & thePoint)
+{
+    Vector3<T> v2 = makeVector3(theLine.base(), thePoint);
+
+    T f = dotProduct(theLine.unitDirection(), v2) ;
+
+    return theLine.base() + multiply(theLine.unitDirection(), f);
+}
+
+template <typename T>
+inline Point3<T> closestPoint(const Plane<T>& thePlane, const Point3<T>& thePoint)
+{
+    Vector3<T> v = makeVector3(thePlane.base(), thePoint);
+    T distance = dotProduct(v, thePlane.up());
+    return (thePoint - multiply(thePlane.up(), distance));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Closest feature queries
+//
+// Closest points and distances between points, segments, rays and
+// triangles, after Ericson, "Real-Time Collision Detection", 5.1. The
+// cores work on raw coordinates; the wrappers check their inputs, so that
+// degenerate or invalid entities give invalidPoint3<T>(), eDegenerate or
+// an infinite distance. Segments and rays are handled as p + t d, with t in
+// [0, 1] for a segment (d = target - base) and [0, infinity) for a ray.
+// The distanceSquared() variants skip the final square root, for when
+// distances are only compared.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline T dot3(const T a[3], const T b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+template <typename T>
+inline void sub3(const T a[3], const T b[3], T out[3])
+{
+    out[0] = a[0] - b[0];
+    out[1] = a[1] - b[1];
+    out[2] = a[2] - b[2];
+}
+
+template <typename T>
+inline void cross3(const T a[3], const T b[3], T out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+template <typename T>
+inline void copy3(const T a[3], T out[3])
+{
+    out[0] = a[0];
+    out[1] = a[1];
+    out[2] = a[2];
+}
+
+// out = p + d * t
+template <typename T>
+inline void along3(const T p[3], const T d[3], T t, T out[3])
+{
+    out[0] = p[0] + d[0] * t;
+    out[1] = p[1] + d[1] * t;
+    out[2] = p[2] + d[2] * t;
+}
+
+template <typename T>
+inline T distanceSquared3(const T a[3], const T b[3])
+{
+    T d[3];
+    sub3(a, b, d);
+    return dot3(d, d);
+}
+
+// The point of triangle a b c closest to p, by finding which of the
+// vertex, edge and face Voronoi regions p lies in (Ericson 5.1.5).
+template <typename T>
+inline void closestPointTriangle(const T p[3], const T a[3], const T b[3], const T c[3], T out[3])
+{
+    T ab[3];
+    T ac[3];
+    T ap[3];
+    sub3(b, a, ab);
+    sub3(c, a, ac);
+    sub3(p, a, ap);
+    T d1 = dot3(ab, ap);
+    T d2 = dot3(ac, ap);
+    if (d1 <= T(0.0) && d2 <= T(0.0))
+    {
+        copy3(a, out);
+        return;
+    }
+
+    T bp[3];
+    sub3(p, b, bp);
+    T d3 = dot3(ab, bp);
+    T d4 = dot3(ac, bp);
+    if (d3 >= T(0.0) && d4 <= d3)
+    {
+        copy3(b, out);
+        return;
+    }
+
+    T vc = d1 * d4 - d3 * d2;
+    if (vc <= T(0.0) && d1 >= T(0.0) && d3 <= T(0.0))
+    {
+        along3(a, ab, d1 / (d1 - d3), out);
+        return;
+    }
+
+    T cp[3];
+    sub3(p, c, cp);
+    T d5 = dot3(ab, cp);
+    T d6 = dot3(ac, cp);
+    if (d6 >= T(0.0) && d5 <= d6)
+    {
+        copy3(c, out);
+        return;
+    }
+
+    T vb = d5 * d2 - d1 * d6;
+    if (vb <= T(0.0) && d2 >= T(0.0) && d6 <= T(0.0))
+    {
+        along3(a, ac, d2 / (d2 - d6), out);
+        return;
+    }
+
+    T va = d3 * d6 - d5 * d4;
+    if (va <= T(0.0) && (d4 - d3) >= T(0.0) && (d5 - d6) >= T(0.0))
+    {
+        T bc[3];
+        sub3(c, b, bc);
+        along3(b, bc, (d4 - d3) / ((d4 - d3) + (d5 - d6)), out);
+        return;
+    }
+
+    // inside the face
+    T denom = T(1.0) / (va + vb + vc);
+    T v = vb * denom;
+    T w = vc * denom;
+    out[0] = a[0] + ab[0] * v + ac[0] * w;
+    out[1] = a[1] + ab[1] * v + ac[1] * w;
+    out[2] = a[2] + ab[2] * v + ac[2] * w;
+}
+
+// Closest points c1 on p1 + s d1, s in [0, sMax], and c2 on p2 + t d2, t
+// in [0, tMax], neither d being zero (Ericson 5.1.9). sMax and tMax may be
+// infinite. Returns the squared distance between c1 and c2.
+template <typename T>
+inline T closestPointsParametric(const T p1[3], const T d1[3], T sMax, const T p2[3], const T d2[3], T tMax, T c1[3], T c2[3])
+{
+    T r[3];
+    sub3(p1, p2, r);
+    T a = dot3(d1, d1);
+    T e = dot3(d2, d2);
+    T f = dot3(d2, r);
+    T c = dot3(d1, r);
+    T b = dot3(d1, d2);
+    auto clampS = [&](T v) { return std::min(std::max(v, T(0.0)), sMax); };
+
+    // for (nearly) parallel lines any s will do, so start at 0
+    T denom = a * e - b * b;
+    T s = (denom > epsilon<T>() * a * e) ? clampS((b * f - c * e) / denom) : T(0.0);
+    T t = (b * s + f) / e;
+    if (t < T(0.0))
+    {
+        t = T(0.0);
+        s = clampS(-c / a);
+    }
+    else if (t > tMax)
+    {
+        t = tMax;
+        s = clampS((b * tMax - c) / a);
+    }
+
+    along3(p1, d1, s, c1);
+    along3(p2, d2, t, c2);
+    return distanceSquared3(c1, c2);
+}
+
+// If p + t d, t in [0, tMax], passes through triangle a b c, sets x to
+// where it does and returns true. Paths lying in the plane of the
+// triangle are not reported: their closest points come from the edges.
+template <typename T>
+inline bool crossesTriangle(const T p[3], const T d[3], T tMax, const T a[3], const T b[3], const T c[3], T x[3])
+{
+    T ab[3];
+    T ac[3];
+    T ap[3];
+    T n[3];
+    sub3(b, a, ab);
+    sub3(c, a, ac);
+    sub3(p, a, ap);
+    cross3(ab, ac, n);
+
+    T dn = dot3(d, n);
+    if (dn == T(0.0))
+    {
+        return false;
+    }
+    T t = -dot3(ap, n) / dn;
+    if (!(t >= T(0.0) && t <= tMax))
+    {
+        return false;
+    }
+    along3(p, d, t, x);
+
+    // inside if on the inner side of all three edges
+    const T * v[3] = { a, b, c };
+    for (int i = 0; i < 3; i++)
+    {
+        T edge[3];
+        T vx[3];
+        T side[3];
+        sub3(v[(i + 1) % 3], v[i], edge);
+        sub3(x, v[i], vx);
+        cross3(edge, vx, side);
+        if (dot3(side, n) < T(0.0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Closest points c1 on p + t d, t in [0, tMax], and c2 on triangle a b c.
+// Returns the squared distance, 0 if the path passes through the triangle.
+template <typename T>
+inline T closestPointsPathTriangle(const T p[3], const T d[3], T tMax, const T a[3], const T b[3], const T c[3], T c1[3], T c2[3])
+{
+    if (crossesTriangle(p, d, tMax, a, b, c, c1))
+    {
+        copy3(c1, c2);
+        return T(0.0);
+    }
+
+    // the start, the end if there is one, and the edges
+    T best = infinity<T>();
+    T q1[3];
+    T q2[3];
+    auto consider = [&](T dd) {
+        if (dd < best)
+        {
+            best = dd;
+            copy3(q1, c1);
+            copy3(q2, c2);
+        }
+    };
+
+    copy3(p, q1);
+    closestPointTriangle(q1, a, b, c, q2);
+    consider(distanceSquared3(q1, q2));
+    if (tMax < infinity<T>())
+    {
+        along3(p, d, tMax, q1);
+        closestPointTriangle(q1, a, b, c, q2);
+        consider(distanceSquared3(q1, q2));
+    }
+
+    const T * v[3] = { a, b, c };
+    for (int i = 0; i < 3; i++)
+    {
+        T edge[3];
+        sub3(v[(i + 1) % 3], v[i], edge);
+        consider(closestPointsParametric(p, d, tMax, v[i], edge, T(1.0), q1, q2));
+    }
+    return best;
+}
+
+// Closest points c1 on triangle a1 b1 c1 and c2 on triangle a2 b2 c2.
+// Triangles that intersect have an edge of one passing through the other,
+// or, if coplanar, a vertex or an edge crossing in the other; otherwise
+// the closest points are on an edge pair or a vertex and a face.
+template <typename T>
+inline T closestPointsTriangleTriangle(const T * tri1[3], const T * tri2[3], T c1[3], T c2[3])
+{
+    const T ** tris[2] = { tri1, tri2 };
+    T edges[2][3][3];
+    for (int k = 0; k < 2; k++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            sub3(tris[k][(i + 1) % 3], tris[k][i], edges[k][i]);
+        }
+    }
+
+    T x[3];
+    for (int k = 0; k < 2; k++)
+    {
+        const T ** other = tris[1 - k];
+        for (int i = 0; i < 3; i++)
+        {
+            if (crossesTriangle(tris[k][i], edges[k][i], T(1.0), other[0], other[1], other[2], x))
+            {
+                copy3(x, c1);
+                copy3(x, c2);
+                return T(0.0);
+            }
+        }
+    }
+
+    T best = infinity<T>();
+    T q1[3];
+    T q2[3];
+    auto consider = [&](T dd, bool swapped) {
+        if (dd < best)
+        {
+            best = dd;
+            copy3(swapped ? q2 : q1, c1);
+            copy3(swapped ? q1 : q2, c2);
+        }
+    };
+
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            consider(closestPointsParametric(tri1[i], edges[0][i], T(1.0), tri2[j], edges[1][j], T(1.0), q1, q2), false);
+        }
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        copy3(tri1[i], q1);
+        closestPointTriangle(q1, tri2[0], tri2[1], tri2[2], q2);
+        consider(distanceSquared3(q1, q2), false);
+
+        copy3(tri2[i], q1);
+        closestPointTriangle(q1, tri1[0], tri1[1], tri1[2], q2);
+        consider(distanceSquared3(q1, q2), true);
+    }
+    return best;
+}
+
+// Point queries, which follow closestPoint(Line3, Point3) in returning the
+// point
+
+template <typename T>
+inline Point3<T> closestPoint(const Segment3<T> & theSegment, const Point3<T> & thePoint)
+{
+    if (isDegenerate(theSegment) || !isValid(thePoint))
+    {
+        return invalidPoint3<T>();
+    }
+    const T p[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+    const T a[3] = { theSegment.base().x(), theSegment.base().y(), theSegment.base().z() };
+    const T d[3] = { theSegment.target().x() - a[0], theSegment.target().y() - a[1], theSegment.target().z() - a[2] };
+    T ap[3];
+    sub3(p, a, ap);
+    T t = std::min(std::max(dot3(d, ap), T(0.0)) / dot3(d, d), T(1.0));
+    T c[3];
+    along3(a, d, t, c);
+    return Point3<T>(c[0], c[1], c[2]);
+}
+
+template <typename T>
+inline Point3<T> closestPoint(const Ray3<T> & theRay, const Point3<T> & thePoint)
+{
+    if (isDegenerate(theRay) || !isValid(thePoint))
+    {
+        return invalidPoint3<T>();
+    }
+    T t = std::max(dotProduct(theRay.unitDirection(), makeVector3(theRay.base(), thePoint)), T(0.0));
+    return theRay.base() + multiply(theRay.unitDirection(), t);
+}
+
+template <typename T>
+inline Point3<T> closestPoint(const Triangle3<T> & theTri, const Point3<T> & thePoint)
+{
+    if (isDegenerate(theTri) || !isValid(thePoint))
+    {
+        return invalidPoint3<T>();
+    }
+    const T p[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+    const T a[3] = { theTri.p1().x(), theTri.p1().y(), theTri.p1().z() };
+    const T b[3] = { theTri.p2().x(), theTri.p2().y(), theTri.p2().z() };
+    const T c[3] = { theTri.p3().x(), theTri.p3().y(), theTri.p3().z() };
+    T out[3];
+    closestPointTriangle(p, a, b, c, out);
+    return Point3<T>(out[0], out[1], out[2]);
+}
+
+// Pair queries: closest points p1 on the first entity and p2 on the second.
+// For entities that touch, p1 and p2 are the same point, one of those they
+// share.
+
+// The path p + t d, t in [0, tMax], that the cores use for a segment or ray
+template <typename T>
+inline T pathOf(const Segment3<T> & theSegment, T p[3], T d[3])
+{
+    p[0] = theSegment.base().x();
+    p[1] = theSegment.base().y();
+    p[2] = theSegment.base().z();
+    d[0] = theSegment.target().x() - p[0];
+    d[1] = theSegment.target().y() - p[1];
+    d[2] = theSegment.target().z() - p[2];
+    return T(1.0);
+}
+
+template <typename T>
+inline T pathOf(const Ray3<T> & theRay, T p[3], T d[3])
+{
+    p[0] = theRay.base().x();
+    p[1] = theRay.base().y();
+    p[2] = theRay.base().z();
+    d[0] = theRay.unitDirection().x();
+    d[1] = theRay.unitDirection().y();
+    d[2] = theRay.unitDirection().z();
+    return infinity<T>();
+}
+
+template <typename T>
+inline ResultCode closestPointsResult(const T c1[3], const T c2[3], Point3<T> & p1, Point3<T> & p2)
+{
+    p1 = Point3<T>(c1[0], c1[1], c1[2]);
+    p2 = Point3<T>(c2[0], c2[1], c2[2]);
+    if (!(isValid(p1) && isValid(p2)))
+    {
+        return ResultCode::eOverflow;
+    }
+    return ResultCode::eOk;
+}
+
+// segments and rays, in any combination
+template <typename T, typename A, typename B>
+inline ResultCode closestPointsPaths(const A & first, const B & second, Point3<T> & p1, Point3<T> & p2)
+{
+    p1 = invalidPoint3<T>();
+    p2 = invalidPoint3<T>();
+    if (isDegenerate(first) || isDegenerate(second))
+    {
+        return ResultCode::eDegenerate;
+    }
+    T a[3];
+    T da[3];
+    T b[3];
+    T db[3];
+    T aMax = pathOf(first, a, da);
+    T bMax = pathOf(second, b, db);
+    T c1[3];
+    T c2[3];
+    closestPointsParametric(a, da, aMax, b, db, bMax, c1, c2);
+    return closestPointsResult(c1, c2, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Segment3<T> & s1, const Segment3<T> & s2, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsPaths(s1, s2, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Ray3<T> & theRay, const Segment3<T> & theSegment, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsPaths(theRay, theSegment, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Segment3<T> & theSegment, const Ray3<T> & theRay, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsPaths(theSegment, theRay, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Ray3<T> & r1, const Ray3<T> & r2, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsPaths(r1, r2, p1, p2);
+}
+
+// a segment or ray and a triangle
+template <typename T, typename A>
+inline ResultCode closestPointsToTriangle(const A & thePath, const Triangle3<T> & theTri, Point3<T> & p1, Point3<T> & p2)
+{
+    p1 = invalidPoint3<T>();
+    p2 = invalidPoint3<T>();
+    if (isDegenerate(thePath) || isDegenerate(theTri))
+    {
+        return ResultCode::eDegenerate;
+    }
+    T p[3];
+    T d[3];
+    T tMax = pathOf(thePath, p, d);
+    const T a[3] = { theTri.p1().x(), theTri.p1().y(), theTri.p1().z() };
+    const T b[3] = { theTri.p2().x(), theTri.p2().y(), theTri.p2().z() };
+    const T c[3] = { theTri.p3().x(), theTri.p3().y(), theTri.p3().z() };
+    T c1[3];
+    T c2[3];
+    closestPointsPathTriangle(p, d, tMax, a, b, c, c1, c2);
+    return closestPointsResult(c1, c2, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Segment3<T> & theSegment, const Triangle3<T> & theTri, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsToTriangle(theSegment, theTri, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Triangle3<T> & theTri, const Segment3<T> & theSegment, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsToTriangle(theSegment, theTri, p2, p1);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Ray3<T> & theRay, const Triangle3<T> & theTri, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsToTriangle(theRay, theTri, p1, p2);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Triangle3<T> & theTri, const Ray3<T> & theRay, Point3<T> & p1, Point3<T> & p2)
+{
+    return closestPointsToTriangle(theRay, theTri, p2, p1);
+}
+
+template <typename T>
+inline ResultCode closestPoints(const Triangle3<T> & t1, const Triangle3<T> & t2, Point3<T> & p1, Point3<T> & p2)
+{
+    p1 = invalidPoint3<T>();
+    p2 = invalidPoint3<T>();
+    if (isDegenerate(t1) || isDegenerate(t2))
+    {
+        return ResultCode::eDegenerate;
+    }
+    const T v1[3][3] = { { t1.p1().x(), t1.p1().y(), t1.p1().z() }, { t1.p2().x(), t1.p2().y(), t1.p2().z() }, { t1.p3().x(), t1.p3().y(), t1.p3().z() } };
+    const T v2[3][3] = { { t2.p1().x(), t2.p1().y(), t2.p1().z() }, { t2.p2().x(), t2.p2().y(), t2.p2().z() }, { t2.p3().x(), t2.p3().y(), t2.p3().z() } };
+    const T * tri1[3] = { v1[0], v1[1], v1[2] };
+    const T * tri2[3] = { v2[0], v2[1], v2[2] };
+    T c1[3];
+    T c2[3];
+    closestPointsTriangleTriangle(tri1, tri2, c1, c2);
+    return closestPointsResult(c1, c2, p1, p2);
+}
+
+// Distances. Degenerate or invalid inputs are infinitely far from
+// everything.
+
+template <typename T, typename A>
+inline T distanceSquaredToPoint(const A & theEntity, const Point3<T> & thePoint)
+{
+    Point3<T> c = closestPoint(theEntity, thePoint);
+    if (!isValid(c))
+    {
+        return infinity<T>();
+    }
+    T d[3] = { c.x() - thePoint.x(), c.y() - thePoint.y(), c.z() - thePoint.z() };
+    return dot3(d, d);
+}
+
+template <typename T, typename A>
+inline T distanceToPoint(const A & theEntity, const Point3<T> & thePoint)
+{
+    Point3<T> c = closestPoint(theEntity, thePoint);
+    return isValid(c) ? hypot3(c.x() - thePoint.x(), c.y() - thePoint.y(), c.z() - thePoint.z()) : infinity<T>();
+}
+
+template <typename T, typename A, typename B>
+inline T distanceSquaredBetween(const A & first, const B & second)
+{
+    Point3<T> p1;
+    Point3<T> p2;
+    if (closestPoints(first, second, p1, p2) != ResultCode::eOk)
+    {
+        return infinity<T>();
+    }
+    T d[3] = { p2.x() - p1.x(), p2.y() - p1.y(), p2.z() - p1.z() };
+    return dot3(d, d);
+}
+
+template <typename T, typename A, typename B>
+inline T distanceBetween(const A & first, const B & second)
+{
+    Point3<T> p1;
+    Point3<T> p2;
+    if (closestPoints(first, second, p1, p2) != ResultCode::eOk)
+    {
+        return infinity<T>();
+    }
+    return hypot3(p2.x() - p1.x(), p2.y() - p1.y(), p2.z() - p1.z());
+}
+
+template <typename T>
+inline T distance(const Point3<T> & thePoint, const Segment3<T> & theSegment)
+{
+    return distanceToPoint(theSegment, thePoint);
+}
+
+template <typename T>
+inline T distance(const Segment3<T> & theSegment, const Point3<T> & thePoint)
+{
+    return distanceToPoint(theSegment, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Point3<T> & thePoint, const Segment3<T> & theSegment)
+{
+    return distanceSquaredToPoint(theSegment, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Segment3<T> & theSegment, const Point3<T> & thePoint)
+{
+    return distanceSquaredToPoint(theSegment, thePoint);
+}
+
+template <typename T>
+inline T distance(const Point3<T> & thePoint, const Ray3<T> & theRay)
+{
+    return distanceToPoint(theRay, thePoint);
+}
+
+template <typename T>
+inline T distance(const Ray3<T> & theRay, const Point3<T> & thePoint)
+{
+    return distanceToPoint(theRay, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Point3<T> & thePoint, const Ray3<T> & theRay)
+{
+    return distanceSquaredToPoint(theRay, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Ray3<T> & theRay, const Point3<T> & thePoint)
+{
+    return distanceSquaredToPoint(theRay, thePoint);
+}
+
+template <typename T>
+inline T distance(const Point3<T> & thePoint, const Triangle3<T> & theTri)
+{
+    return distanceToPoint(theTri, thePoint);
+}
+
+template <typename T>
+inline T distance(const Triangle3<T> & theTri, const Point3<T> & thePoint)
+{
+    return distanceToPoint(theTri, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Point3<T> & thePoint, const Triangle3<T> & theTri)
+{
+    return distanceSquaredToPoint(theTri, thePoint);
+}
+
+template <typename T>
+inline T distanceSquared(const Triangle3<T> & theTri, const Point3<T> & thePoint)
+{
+    return distanceSquaredToPoint(theTri, thePoint);
+}
+
+template <typename T>
+inline T distance(const Segment3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Segment3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Segment3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Segment3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Ray3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Ray3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Ray3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Ray3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Segment3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Segment3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Triangle3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Triangle3<T> & e1, const Segment3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Ray3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Ray3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Triangle3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Triangle3<T> & e1, const Ray3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distance(const Triangle3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceBetween<T>(e1, e2);
+}
+
+template <typename T>
+inline T distanceSquared(const Triangle3<T> & e1, const Triangle3<T> & e2)
+{
+    return distanceSquaredBetween<T>(e1, e2);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Addition functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Vector3 + Vector3 -> Vector3
+
+template <typename T>
+inline Vector3<T> add(const Vector3<T> & v1, const Vector3<T> & v2)
+{
+    return makeVector3Fast(v1.x() + v2.x(), v1.y() + v2.y(), v1.z() + v2.z());
+}
+
+template <typename T>
+inline Vector3<T> operator+(const Vector3<T> & v1, const Vector3<T> & v2)
+{
+    return add(v1, v2);
+}
+
+// Point3 + Vector3 -> Point3
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> add(const Point3<T> & p1, const Vector3<T> & v1)
+{
+    return makePoint3Fast(v1.x() + p1.x(), v1.y() + p1.y(), v1.z() + p1.z());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> operator+(const Point3<T> & p1, const Vector3<T> & v1)
+{
+    return add(p1, v1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Subtraction functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Vector3 - Vector3 -> Vector3
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> subtract(const Vector3<T> & v1, const Vector3<T> & v2)
+{
+    return makeVector3Fast(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> operator-(const Vector3<T> & v1, const Vector3<T> & v2)
+{
+    return subtract(v1, v2);
+}
+
+// Point3 - Vector3 -> Point3
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> subtract(const Point3<T> & v1, const Vector3<T> & v2)
+{
+    return makePoint3Fast(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Point3<T> operator-(const Point3<T> & v1, const Vector3<T> & v2)
+{
+    return subtract(v1, v2);
+}
+
+// Point3 - Point3 -> Vector3
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> subtract(const Point3<T> & v1, const Point3<T> & v2)
+{
+    return makeVector3Fast(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline Vector3<T> operator-(const Point3<T> & v1, const Point3<T> & v2)
+{
+    return subtract(v1, v2);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// area functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline T area(const Triangle3<T>& tri)
+{
+    // if we are invalid due to an invalid nubmer, there is nothing we can do.
+    // However the same is not true if we are degenerate. A degenerate triangle
+    // that is valid has an area of 0.
+    if (!isValid(tri))
+    {
+        return infinity<T>();
+    }
+    if (isDegenerate(tri))
+    {
+        return T(0.0);
+    }
+
+    T dx1 = tri.p2().x() - tri.p1().x();
+    T dy1 = tri.p2().y() - tri.p1().y();
+    T dz1 = tri.p2().z() - tri.p1().z();
+
+    T dx2 = tri.p3().x() - tri.p1().x();
+    T dy2 = tri.p3().y() - tri.p1().y();
+    T dz2 = tri.p3().z() - tri.p1().z();
+
+    T cx = dy1 * dz2 - dy2 * dz1;
+    T cy = dx2 * dz1 - dx1 * dz2;
+    T cz = dx1 * dy2 - dx2 * dy1;
+
+    // the above calculations can overflow
+    if (!(isValid(cx) && isValid(cy) && isValid(cz)))
+    {
+        return infinity<T>();
+    }
+
+    // hypot() will return inifinity if it overflows
+    return hypot3(cx, cy, cz) * T(0.5);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// centroid functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline Point3<T> centroid(const Triangle3<T>& tri)
+{
+    // if we are invalid due to an invalid nubmer, there is nothing we can do.
+    // However the same is not true if we are degenerate. A degenerate triangle
+    // will  have a valid centroid which we just calculate.
+    if (!isValid(tri))
+    {
+        return invalidPoint3<T>();
+    }
+
+    return Point3<T>((tri.p1().x() + tri.p2().x() + tri.p3().x()) / 3.0, (tri.p1().y() + tri.p2().y() + tri.p3().y()) / 3.0, (tri.p1().z() + tri.p2().z() + tri.p3().z()) / 3.0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// intersection functions
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Plane<T> & thePlane, const Line3<T> & theLine, Point3<T> & intersection)
+{
+    // Check for degnerate inputs
+    if (isDegenerate(thePlane) || isDegenerate(theLine))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::ePlaneLine, ResultCode::eDegenerate);
+    }
+
+    // check for parallel or coplanar
+    T dp = dotProduct(theLine.unitDirection(), thePlane.up());
+    if (isEqual(policy, dp, T(0.0)))
+    {
+        if (isEqual(policy, distance(theLine.base(), thePlane), T(0.0)))
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneLine, ResultCode::eCoplanar);
+        }
+        else
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneLine, ResultCode::eParallel);
+        }
+    }
+
+    // inputs are valid and we are not parallel
+    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
+    T d = dotProduct(thePlane.base() - theLine.base(), thePlane.up()) / dotProduct(theLine.unitDirection(), thePlane.up());
+    intersection = theLine.base() + multiply(theLine.unitDirection(), d);
+
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::ePlaneLine, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::ePlaneLine, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Plane<T> & thePlane, const Line3<T> & theLine, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), thePlane, theLine, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Line3<T> & theLine, const Plane<T> & thePlane, Point3<T> & intersection)
+{
+    return intersect(thePlane, theLine, intersection);
+}
+
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Plane<T>& thePlane, const Ray3<T>& theRay, Point3<T>& intersection)
+{
+    // Check for degnerate inputs
+    if (isDegenerate(thePlane) || isDegenerate(theRay))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eDegenerate);
+    }
+
+    // check for parallel or coplanar
+    T dp = dotProduct(theRay.unitDirection(), thePlane.up());
+    if (isEqual(policy, dp, T(0.0)))
+    {
+        if (isEqual(policy, distance(theRay.base(), thePlane), T(0.0)))
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eCoplanar);
+        }
+        else
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eParallel);
+        }
+    }
+
+    // inputs are valid and we are not parallel
+    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
+    T d = dotProduct(thePlane.base() - theRay.base(), thePlane.up()) / dotProduct(theRay.unitDirection(), thePlane.up());
+
+    // 0.0 would be touching, which is an interseciton, so we don't need to do a epsilon compare
+    if (d < 0.0)
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eNoIntersection);
+    }
+
+    intersection = theRay.base() + multiply(theRay.unitDirection(), d);
+
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::ePlaneRay, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Plane<T>& thePlane, const Ray3<T>& theRay, Point3<T>& intersection)
+{
+    return intersect(DefaultEpsilon(), thePlane, theRay, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Ray3<T>& theRay, const Plane<T>& thePlane, Point3<T>& intersection)
+{
+    return intersect(thePlane, theRay, intersection);
+}
+
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Plane<T>& thePlane, const Segment3<T>& theSegment, Point3<T>& intersection)
+{
+    // Check for degnerate inputs
+    if (isDegenerate(thePlane) || isDegenerate(theSegment))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eDegenerate);
+    }
+
+    UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+
+    // check for parallel or coplanar
+    T dp = dotProduct(segDir, thePlane.up());
+    if (isEqual(policy, dp, T(0.0)))
+    {
+        if (isEqual(policy, distance(theSegment.base(), thePlane), T(0.0)))
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eCoplanar);
+        }
+        else
+        {
+            intersection = invalidPoint3<T>();
+            return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eParallel);
+        }
+    }
+
+    // inputs are valid and we are not parallel
+    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
+    T d = dotProduct(thePlane.base() - theSegment.base(), thePlane.up()) / dotProduct(segDir, thePlane.up());
+
+    // 0.0 would be touching, which is an interseciton, so we don't need to do a epsilon compare
+    if (d < 0.0 || d > distance(theSegment.base(), theSegment.target()))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eNoIntersection);
+    }
+
+    intersection = theSegment.base() + multiply(segDir, d);
+
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::ePlaneSegment, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Plane<T>& thePlane, const Segment3<T>& theSegment, Point3<T>& intersection)
+{
+    return intersect(DefaultEpsilon(), thePlane, theSegment, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Segment3<T>& theSegment, const Plane<T>& thePlane, Point3<T>& intersection)
+{
+    return intersect(thePlane, theSegment, intersection);
+}
+
+
+// Core of the Moller-Trumbore ray/triangle test, operating on raw
+// coordinates so that it can be shared by the routines that do not keep
+// their data in Triangle3/Ray3 form (e.g. TriangleSoup). It performs exactly
+// the same arithmetic and epsilon comparisons as the Triangle3 overloads
+// below, up to and including the barycentric checks. The caller is
+// responsible for the checks on t, which differ between rays, lines and
+// segments. Returns eCoplanar, eNoIntersection or eOk.
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline ResultCode mollerTrumbore(Policy policy, const T orig[3], const T dir[3], const T vert0[3], const T edge1[3], const T edge2[3], T & t)
+{
+    T pvec[3];
+    pvec[0] = dir[1] * edge2[2] - dir[2] * edge2[1];
+    pvec[1] = dir[2] * edge2[0] - dir[0] * edge2[2];
+    pvec[2] = dir[0] * edge2[1] - dir[1] * edge2[0];
+
+    // an overflowed pvec is an invalid Vector3, for which dotProduct()
+    // reports infinity, so det is not coplanar and u ends up as NaN
+    bool pvecValid = isValid(pvec[0]) && isValid(pvec[1]) && isValid(pvec[2]);
+    T det = pvecValid ? edge1[0] * pvec[0] + edge1[1] * pvec[1] + edge1[2] * pvec[2] : infinity<T>();
+    if (isEqual(policy, det, T(0.0)))
+    {
+        return ResultCode::eCoplanar;
+    }
+    if (!pvecValid)
+    {
+        return ResultCode::eNoIntersection;
+    }
+
+    T tvec[3];
+    tvec[0] = orig[0] - vert0[0];
+    tvec[1] = orig[1] - vert0[1];
+    tvec[2] = orig[2] - vert0[2];
+
+    T u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) / det;
+    if (!(isGreaterOrEqual(policy, u, T(0.0)) && isLessOrEqual(policy, u, T(1.0))))
+    {
+        return ResultCode::eNoIntersection;
+    }
+
+    T qvec[3];
+    qvec[0] = tvec[1] * edge1[2] - tvec[2] * edge1[1];
+    qvec[1] = tvec[2] * edge1[0] - tvec[0] * edge1[2];
+    qvec[2] = tvec[0] * edge1[1] - tvec[1] * edge1[0];
+
+    T v = (dir[0] * qvec[0] + dir[1] * qvec[1] + dir[2] * qvec[2]) / det;
+    if (!(isGreaterOrEqual(policy, v, T(0.0)) && isLessOrEqual(policy, u + v, T(1.0))))
+    {
+        return ResultCode::eNoIntersection;
+    }
+
+    t = (edge2[0] * qvec[0] + edge2[1] * qvec[1] + edge2[2] * qvec[2]) / det;
+
+    return ResultCode::eOk;
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline ResultCode mollerTrumbore(const T orig[3], const T dir[3], const T vert0[3], const T edge1[3], const T edge2[3], T & t)
+{
+    return mollerTrumbore(DefaultEpsilon(), orig, dir, vert0, edge1, edge2, t);
+}
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+HUBERT_HOST_DEVICE inline ResultCode intersect(Policy policy, const Triangle3<T> & theTri,  const Ray3<T> & theRay, Point3<T> & intersection)
+{
+    // Check for degnerate inputs
+    if (isDegenerate(theTri) || isDegenerate(theRay))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eDegenerate);
+    }
+
+
+    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
+
+    Vector3<T> edge1 = theTri.p2() - theTri.p1();
+    Vector3<T> edge2 = theTri.p3() - theTri.p1();
+
+    Vector3<T> pvec = crossProduct(theRay.unitDirection(), edge2);
+
+    T det = dotProduct(edge1, pvec);
+    if (isEqual(policy, det, T(0.0)))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eCoplanar);
+    }
+
+    Vector3<T> tvec = theRay.base() - theTri.p1();
+
+    T u = dotProduct(tvec, pvec) / det;
+    if (!(isGreaterOrEqual(policy, u, T(0.0)) && isLessOrEqual(policy, u, T(1.0))))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    Vector3<T> qvec = crossProduct(tvec, edge1);
+
+    T v =  dotProduct(theRay.unitDirection(), qvec) / det;
+    if (!(isGreaterOrEqual(policy, v, T(0.0)) && isLessOrEqual(policy, u + v, T(1.0))))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    T t = dotProduct(edge2, qvec) / det;
+    if (!isGreaterOrEqual(policy, t, T(0.0)))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    intersection = theRay.base() + multiply(theRay.unitDirection(), t);
+
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOk);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline ResultCode intersect(const Triangle3<T> & theTri,  const Ray3<T> & theRay, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theRay, intersection);
+}
+
+template <typename T>
+HUBERT_HOST_DEVICE inline ResultCode intersect(const Ray3<T> & theRay, const Triangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theRay, intersection);
+}
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Triangle3<T> & theTri,  const Line3<T> & theLine, Point3<T> & intersection)
+{
+    // Check for degnerate inputs
+    if (isDegenerate(theTri) || isDegenerate(theLine))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eDegenerate);
+    }
+
+
+    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
+
+    Vector3<T> edge1 = theTri.p2() - theTri.p1();
+    Vector3<T> edge2 = theTri.p3() - theTri.p1();
+
+    Vector3<T> pvec = crossProduct(theLine.unitDirection(), edge2);
+
+    T det = dotProduct(edge1, pvec);
+    if (isEqual(policy, det, T(0.0)))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eCoplanar);
+    }
+
+    Vector3<T> tvec = theLine.base() - theTri.p1();
+
+    T u = dotProduct(tvec, pvec) / det;
+    if (!(isGreaterOrEqual(policy, u, T(0.0)) && isLessOrEqual(policy, u, T(1.0))))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eNoIntersection);
+    }
+
+    Vector3<T> qvec = crossProduct(tvec, edge1);
+
+    T v =  dotProduct(theLine.unitDirection(), qvec) / det;
+    if (!(isGreaterOrEqual(policy, v, T(0.0)) && isLessOrEqual(policy, u + v, T(1.0))))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eNoIntersection);
+    }
+
+    T t = dotProduct(edge2, qvec) / det;
+    intersection = theLine.base() + multiply(theLine.unitDirection(), t);
+
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T> & theTri,  const Line3<T> & theLine, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theLine, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Line3<T> & theLine, const Triangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theLine, intersection);
+}
+
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Triangle3<T>& theTri, const Segment3<T>& theSegment, Point3<T>& intersection)
+{
+    // initialize the output point to an invalid point
+    intersection = invalidPoint3<T>();
+
+    // Check for degenerate inputs
+    if (isDegenerate(theTri) || isDegenerate(theSegment))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eDegenerate);
+    }
+
+    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
+
+    Vector3<T> edge1 = theTri.p2() - theTri.p1();
+    Vector3<T> edge2 = theTri.p3() - theTri.p1();
+
+    Vector3<T> pvec = crossProduct(makeUnitVector3(theSegment.target() - theSegment.base()), edge2);
+
+    T det = dotProduct(edge1, pvec);
+    if (isEqual(policy, det, T(0.0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eCoplanar);
+    }
+
+    Vector3<T> tvec = theSegment.base() - theTri.p1();
+
+    UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+
+
+    T u = dotProduct(tvec, pvec) / det;
+    if (!(isGreaterOrEqual(policy, u, T(0.0)) && isLessOrEqual(policy, u, T(1.0))))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    Vector3<T> qvec = crossProduct(tvec, edge1);
+
+    T v = dotProduct(segDir, qvec) / det;
+    if (!(isGreaterOrEqual(policy, v, T(0.0)) && isLessOrEqual(policy, u + v, T(1.0))))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    T t = dotProduct(edge2, qvec) / det;
+
+    if (!isValid(t))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOverflow);
+    }
+
+    if (t < 0.0)
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    intersection = theSegment.base() + multiply(segDir, t);
+
+    if (!isValid(intersection))
+    {
+        // generally, if the result is invalid, we return the constant invalidPoint3<T>()
+        // but in this case we simply return the result of the calculation because it is
+        // possibly useful to the caller to figure out what is overflowing.
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOverflow);
+    }
+
+    if (hubert::distance(intersection, theSegment.base()) > hubert::distance(theSegment.base(), theSegment.target()))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    // we intersected
+    return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T>& theTri, const Segment3<T>& theSegment, Point3<T>& intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theSegment, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Segment3<T>& theSegment, const Triangle3<T>& theTri, Point3<T>& intersection)
+{
+    return intersect(theTri, theSegment, intersection);
+}
+
+// Signed distance classification of a triangle against a plane, on raw
+// coordinates and without allocating, so that it can be used in bulk. Sets
+// dist[i] to the distance of vertex i above the plane (along up) and
+// returns eOk if the triangle touches or crosses the plane (a vertex
+// within epsilon of it, or vertices on both sides), eCoplanar if all
+// three vertices are within epsilon of it, eParallel if they are all at
+// the same distance off it, eNoIntersection if the triangle is otherwise
+// to one side, and eOverflow if a distance could not be computed.
+template <typename T>
+inline ResultCode classifyTrianglePlane(const T p1[3], const T p2[3], const T p3[3], const T base[3], const T up[3], T dist[3])
+{
+    const T * p[3] = { p1, p2, p3 };
+    int above = 0;
+    int below = 0;
+    int on = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        dist[i] = up[0] * (p[i][0] - base[0]) + up[1] * (p[i][1] - base[1]) + up[2] * (p[i][2] - base[2]);
+        if (!isValid(dist[i]))
+        {
+            return ResultCode::eOverflow;
+        }
+        on += isEqual(dist[i], T(0.0)) ? 1 : 0;
+        above += (dist[i] > epsilon<T>()) ? 1 : 0;
+        below += (dist[i] < -epsilon<T>()) ? 1 : 0;
+    }
+
+    if (on == 3)
+    {
+        return ResultCode::eCoplanar;
+    }
+    if (on > 0 || (above > 0 && below > 0))
+    {
+        return ResultCode::eOk;
+    }
+    if (isEqual(dist[0], dist[1]) && isEqual(dist[1], dist[2]) && isEqual(dist[2], dist[0]))
+    {
+        return ResultCode::eParallel;
+    }
+    return ResultCode::eNoIntersection;
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T>& theTri, const Plane<T>& thePlane)
+{
+    // Degenerate triangles and planes are out of scope
+    if (isDegenerate(theTri) || isDegenerate(thePlane))
+    {
+        return countResult(InstrumentedQuery::eTrianglePlane, ResultCode::eDegenerate);
+    }
+
+    const T p1[3] = { theTri.p1().x(), theTri.p1().y(), theTri.p1().z() };
+    const T p2[3] = { theTri.p2().x(), theTri.p2().y(), theTri.p2().z() };
+    const T p3[3] = { theTri.p3().x(), theTri.p3().y(), theTri.p3().z() };
+    const T base[3] = { thePlane.base().x(), thePlane.base().y(), thePlane.base().z() };
+    const T up[3] = { thePlane.up().x(), thePlane.up().y(), thePlane.up().z() };
+    T dist[3];
+    return countResult(InstrumentedQuery::eTrianglePlane, classifyTrianglePlane(p1, p2, p3, base, up, dist));
+}
+
+template <typename T>
+inline ResultCode intersect(const Plane<T>& thePlane, const Triangle3<T>& theTri)
+{
+    return intersect(theTri, thePlane);
+}
+
+
+/* Triangle/triangle intersection test routine,
+* by Tomas Moller, 1997.
+* See article "A Fast Triangle-Triangle Intersection Test",
+* Journal of Graphics Tools, 2(2), 1997
+*
+* Updated June 1999: removed the divisions -- a little faster now!
+* Updated October 1999: added {} to CROSS and SUB macros
+*
+* int NoDivTriTriIsect(float V0[3],float V1[3],float V2[3],
+*                      float U0[3],float U1[3],float U2[3])
+*
+* parameters: vertices of triangle 1: V0,V1,V2
+*             vertices of triangle 2: U0,U1,U2
+* result    : returns 1 if the triangles intersect, otherwise 0
+*
+*/
+
+/*
+Copyright 2020 Tomas Akenine-M�ller
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
+to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial
+portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+
+/* some macros */
+#define CROSS(dest,v1,v2){                     \
+              dest[0]=v1[1]*v2[2]-v1[2]*v2[1]; \
+              dest[1]=v1[2]*v2[0]-v1[0]*v2[2]; \
+              dest[2]=v1[0]*v2[1]-v1[1]*v2[0];}
+
+#define DOT(v1,v2) (v1[0]*v2[0]+v1[1]*v2[1]+v1[2]*v2[2])
+
+#define SUB(dest,v1,v2){         \
+            dest[0]=v1[0]-v2[0]; \
+            dest[1]=v1[1]-v2[1]; \
+            dest[2]=v1[2]-v2[2];}
+
+/* sort so that a<=b */
+#define SORT(a,b)       \
+             if(a>b)    \
+             {          \
+               T ct; \
+               ct=a;     \
+               a=b;     \
+               b=ct;     \
+             }
+
+
+/* this edge to edge test is based on Franlin Antonio's gem:
+   "Faster Line Segment Intersection", in Graphics Gems III,
+   pp. 199-202 */
+#define EDGE_EDGE_TEST(V0,U0,U1)                      \
+  Bx=U0[i0]-U1[i0];                                   \
+  By=U0[i1]-U1[i1];                                   \
+  Cx=V0[i0]-U0[i0];                                   \
+  Cy=V0[i1]-U0[i1];                                   \
+  f=Ay*Bx-Ax*By;                                      \
+  d=By*Cx-Bx*Cy;                                      \
+  if((f>0 && d>=0 && d<=f) || (f<0 && d<=0 && d>=f))  \
+  {                                                   \
+    e=Ax*Cy-Ay*Cx;                                    \
+    if(f>0)                                           \
+    {                                                 \
+      if(e>=0 && e<=f) return ResultCode::eOk;                      \
+    }                                                 \
+    else                                              \
+    {                                                 \
+      if(e<=0 && e>=f) return ResultCode::eOk;                      \
+    }                                                 \
+  }
+
+#define EDGE_AGAINST_TRI_EDGES(V0,V1,U0,U1,U2) \
+{                                              \
+  T Ax,Ay,Bx,By,Cx,Cy,e,d,f;               \
+  Ax=V1[i0]-V0[i0];                            \
+  Ay=V1[i1]-V0[i1];                            \
+  /* test edge U0,U1 against V0,V1 */          \
+  EDGE_EDGE_TEST(V0,U0,U1);                    \
+  /* test edge U1,U2 against V0,V1 */          \
+  EDGE_EDGE_TEST(V0,U1,U2);                    \
+  /* test edge U2,U1 against V0,V1 */          \
+  EDGE_EDGE_TEST(V0,U2,U0);                    \
+}
+
+#define POINT_IN_TRI(V0,U0,U1,U2)           \
+{                                           \
+  T a,b,c,d0,d1,d2;                     \
+  /* is T1 completly inside T2? */          \
+  /* check if V0 is inside tri(U0,U1,U2) */ \
+  a=U1[i1]-U0[i1];                          \
+  b=-(U1[i0]-U0[i0]);                       \
+  c=-a*U0[i0]-b*U0[i1];                     \
+  d0=a*V0[i0]+b*V0[i1]+c;                   \
+                                            \
+  a=U2[i1]-U1[i1];                          \
+  b=-(U2[i0]-U1[i0]);                       \
+  c=-a*U1[i0]-b*U1[i1];                     \
+  d1=a*V0[i0]+b*V0[i1]+c;                   \
+                                            \
+  a=U0[i1]-U2[i1];                          \
+  b=-(U0[i0]-U2[i0]);                       \
+  c=-a*U2[i0]-b*U2[i1];                     \
+  d2=a*V0[i0]+b*V0[i1]+c;                   \
+  if(d0*d1>0.0)                             \
+  {                                         \
+    if(d0*d2>0.0) return ResultCode::eOk;                 \
+  }                                         \
+}
+
+/* the vertex of a triangle alone on its side of the other plane, from */
+/* which the interval is measured; -1 if all three lie in that plane */
+template <typename T>
+inline int triTriApex(const T D[3], T D0D1, T D0D2)
+{
+    if (D0D1 > 0.0f)
+        return 2;       /* D0, D1 are on the same side, D2 on the other or on the plane */
+    if (D0D2 > 0.0f)
+        return 1;
+    if (D[1] * D[2] > 0.0f || D[0] != 0.0f)
+        return 0;
+    if (D[1] != 0.0f)
+        return 1;
+    if (D[2] != 0.0f)
+        return 2;
+    return -1;          /* triangles are coplanar */
+}
+
+/* the interval of a triangle on the line of the two planes, in the */
+/* division free form A + B / X0 .. A + C / X1 of Moller's */
+/* NEWCOMPUTE_INTERVALS; k is the apex from triTriApex() */
+template <typename T>
+inline void triTriInterval(int k, const T VV[3], const T D[3], T & A, T & B, T & C, T & X0, T & X1)
+{
+    int k1 = (k == 0) ? 1 : 0;
+    int k2 = (k == 2) ? 1 : 2;
+    A = VV[k];
+    B = (VV[k1] - VV[k]) * D[k];
+    C = (VV[k2] - VV[k]) * D[k];
+    X0 = D[k] - D[k1];
+    X1 = D[k] - D[k2];
+}
+
+/* the points where the edges from the apex k cross the other plane */
+template <typename T>
+inline void triTriCrossings(int k, const T * V[3], const T D[3], T X0, T X1, T P[2][3])
+{
+    int k1 = (k == 0) ? 1 : 0;
+    int k2 = (k == 2) ? 1 : 2;
+    T s0 = D[k] / X0;
+    T s1 = D[k] / X1;
+    for (int i = 0; i < 3; i++)
+    {
+        P[0][i] = V[k][i] + (V[k1][i] - V[k][i]) * s0;
+        P[1][i] = V[k][i] + (V[k2][i] - V[k][i]) * s1;
+    }
+}
+
+
+template <typename T>
+inline ResultCode coplanar_tri_tri(const T N[3], const T V0[3], const T V1[3], const T V2[3],
+    const T U0[3], const T U1[3], const T U2[3])
+{
+    T A[3];
+    short i0, i1;
+    /* first project onto an axis-aligned plane, that maximizes the area */
+    /* of the triangles, compute indices: i0,i1. */
+    A[0] = std::abs(N[0]);
+    A[1] = std::abs(N[1]);
+    A[2] = std::abs(N[2]);
+    if (A[0] > A[1])
+    {
+        if (A[0] > A[2])
+        {
+            i0 = 1;      /* A[0] is greatest */
+            i1 = 2;
+        }
+        else
+        {
+            i0 = 0;      /* A[2] is greatest */
+            i1 = 1;
+        }
+    }
+    else   /* A[0]<=A[1] */
+    {
+        if (A[2] > A[1])
+        {
+            i0 = 0;      /* A[2] is greatest */
+            i1 = 1;
+        }
+        else
+        {
+            i0 = 0;      /* A[1] is greatest */
+            i1 = 2;
+        }
+    }
+
+    /* test all edges of triangle 1 against the edges of triangle 2 */
+    EDGE_AGAINST_TRI_EDGES(V0, V1, U0, U1, U2);
+    EDGE_AGAINST_TRI_EDGES(V1, V2, U0, U1, U2);
+    EDGE_AGAINST_TRI_EDGES(V2, V0, U0, U1, U2);
+
+    /* finally, test if tri1 is totally contained in tri2 or vice versa */
+    POINT_IN_TRI(V0, U0, U1, U2);
+    POINT_IN_TRI(U0, V0, V1, V2);
+
+    return ResultCode::eNoIntersection;
+}
+
+
+/* the plane N.X + d = 0 of triangle (V0,V1,V2) */
+template <typename T>
+inline void triTriPlane(const T V0[3], const T V1[3], const T V2[3], T N[3], T & d)
+{
+    T E1[3], E2[3];
+    SUB(E1, V1, V0);
+    SUB(E2, V2, V0);
+    CROSS(N, E1, E2);
+    d = -DOT(N, V0);
+}
+
+/* Moller's interval test with the plane of triangle 1 given. With */
+/* cSegment set, coplanar triangles that overlap give eCoplanar and an */
+/* intersection gives the end points of the overlap of the two intervals */
+/* in isect. */
+template <typename Policy, bool cSegment, typename T>
+inline ResultCode triTriIntersect(Policy policy, const T V0[3], const T V1[3], const T V2[3], const T N1[3], T d1,
+    const T U0[3], const T U1[3], const T U2[3], T isect[2][3])
+{
+    T E1[3], E2[3];
+    T N2[3], d2;
+    T du[3], dv[3];
+    T D[3];
+    T isect1[2], isect2[2];
+    T du0du1, du0du2, dv0dv1, dv0dv2;
+    short index;
+    T vp[3], up[3];
+    T bb, cc, max;
+
+    /* put U0,U1,U2 into plane equation 1 to compute signed distances to the plane*/
+    du[0] = DOT(N1, U0) + d1;
+    du[1] = DOT(N1, U1) + d1;
+    du[2] = DOT(N1, U2) + d1;
+
+    /* coplanarity robustness check */
+
+    if (isEqual(policy, du[0], T(0.0))) du[0] = 0.0;
+    if (isEqual(policy, du[1], T(0.0))) du[1] = 0.0;
+    if (isEqual(policy, du[2], T(0.0))) du[2] = 0.0;
+
+    du0du1 = du[0] * du[1];
+    du0du2 = du[0] * du[2];
+
+    if (du0du1 > 0.0f && du0du2 > 0.0f) /* same sign on all of them + not equal 0 ? */
+        return ResultCode::eNoIntersection;                    /* no intersection occurs */
+
+     /* compute plane of triangle (U0,U1,U2) */
+    SUB(E1, U1, U0);
+    SUB(E2, U2, U0);
+    CROSS(N2, E1, E2);
+    d2 = -DOT(N2, U0);
+    /* plane equation 2: N2.X+d2=0 */
+
+    /* put V0,V1,V2 into plane equation 2 */
+    dv[0] = DOT(N2, V0) + d2;
+    dv[1] = DOT(N2, V1) + d2;
+    dv[2] = DOT(N2, V2) + d2;
+
+    if (isEqual(policy, dv[0], T(0.0))) dv[0] = 0.0;
+    if (isEqual(policy, dv[1], T(0.0))) dv[1] = 0.0;
+    if (isEqual(policy, dv[2], T(0.0))) dv[2] = 0.0;
+
+    dv0dv1 = dv[0] * dv[1];
+    dv0dv2 = dv[0] * dv[2];
+
+    if (dv0dv1 > 0.0f && dv0dv2 > 0.0f) /* same sign on all of them + not equal 0 ? */
+        return ResultCode::eNoIntersection;                    /* no intersection occurs */
+
+    int kv = triTriApex(dv, dv0dv1, dv0dv2);
+    int ku = triTriApex(du, du0du1, du0du2);
+    if (kv < 0 || ku < 0)
+    {
+        ResultCode result = coplanar_tri_tri(N1, V0, V1, V2, U0, U1, U2);
+        if (cSegment && result == ResultCode::eOk)
+        {
+            return ResultCode::eCoplanar;
+        }
+        return result;
+    }
+
+     /* compute direction of intersection line */
+    CROSS(D, N1, N2);
+
+    /* compute and index to the largest component of D */
+    max = std::abs(D[0]);
+    index = 0;
+    bb = std::abs(D[1]);
+    cc = std::abs(D[2]);
+    if (bb > max) max = bb, index = 1;
+    if (cc > max) max = cc, index = 2;
+
+    /* this is the simplified projection onto L*/
+    vp[0] = V0[index];
+    vp[1] = V1[index];
+    vp[2] = V2[index];
+
+    up[0] = U0[index];
+    up[1] = U1[index];
+    up[2] = U2[index];
+
+    /* compute interval for triangle 1 */
+    T a, b, c, x0, x1;
+    triTriInterval(kv, vp, dv, a, b, c, x0, x1);
+
+    /* compute interval for triangle 2 */
+    T d, e, f, y0, y1;
+    triTriInterval(ku, up, du, d, e, f, y0, y1);
+
+    T xx, yy, xxyy, tmp;
+    xx = x0 * x1;
+    yy = y0 * y1;
+    xxyy = xx * yy;
+
+    tmp = a * xxyy;
+    isect1[0] = tmp + b * x1 * yy;
+    isect1[1] = tmp + c * x0 * yy;
+
+    tmp = d * xxyy;
+    isect2[0] = tmp + e * xx * y1;
+    isect2[1] = tmp + f * xx * y0;
+
+    bool swap1 = isect1[0] > isect1[1];
+    bool swap2 = isect2[0] > isect2[1];
+    SORT(isect1[0], isect1[1]);
+    SORT(isect2[0], isect2[1]);
+
+    if (isect1[1] < isect2[0] || isect2[1] < isect1[0]) 
+        return ResultCode::eNoIntersection;
+
+    if (cSegment)
+    {
+        /* the end points of the overlap, each from whichever interval bounds it */
+        const T * v[3] = { V0, V1, V2 };
+        const T * u[3] = { U0, U1, U2 };
+        T pv[2][3], pu[2][3];
+        triTriCrossings(kv, v, dv, x0, x1, pv);
+        triTriCrossings(ku, u, du, y0, y1, pu);
+        const T * lo = (isect1[0] >= isect2[0]) ? pv[swap1 ? 1 : 0] : pu[swap2 ? 1 : 0];
+        const T * hi = (isect1[1] <= isect2[1]) ? pv[swap1 ? 0 : 1] : pu[swap2 ? 0 : 1];
+        std::copy(lo, lo + 3, isect[0]);
+        std::copy(hi, hi + 3, isect[1]);
+    }
+
+    return ResultCode::eOk;
+}
+
+/* the segment overloads, past their degeneracy checks */
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode triTriSegment(Policy policy, const T V0[3], const T V1[3], const T V2[3], const T N1[3], T d1, const Triangle3<T>& tri2, Segment3<T>& segment)
+{
+    const T U0[3] = { tri2.p1().x(), tri2.p1().y(), tri2.p1().z() };
+    const T U1[3] = { tri2.p2().x(), tri2.p2().y(), tri2.p2().z() };
+    const T U2[3] = { tri2.p3().x(), tri2.p3().y(), tri2.p3().z() };
+    T isect[2][3];
+    ResultCode result = triTriIntersect<Policy, true, T>(policy, V0, V1, V2, N1, d1, U0, U1, U2, isect);
+    if (result == ResultCode::eOk)
+    {
+        segment = Segment3<T>(Point3<T>(isect[0][0], isect[0][1], isect[0][2]), Point3<T>(isect[1][0], isect[1][1], isect[1][2]));
+        if (!isValid(segment))
+        {
+            return ResultCode::eOverflow;
+        }
+    }
+    return result;
+}
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Triangle3<T>& tri1, const Triangle3<T>& tri2)
+{
+    const T V0[3] = { tri1.p1().x(), tri1.p1().y(), tri1.p1().z() };
+    const T V1[3] = { tri1.p2().x(), tri1.p2().y(), tri1.p2().z() };
+    const T V2[3] = { tri1.p3().x(), tri1.p3().y(), tri1.p3().z() };
+    const T U0[3] = { tri2.p1().x(), tri2.p1().y(), tri2.p1().z() };
+    const T U1[3] = { tri2.p2().x(), tri2.p2().y(), tri2.p2().z() };
+    const T U2[3] = { tri2.p3().x(), tri2.p3().y(), tri2.p3().z() };
+
+    /* compute plane equation of triangle(V0,V1,V2) */
+    T N1[3], d1;
+    triTriPlane(V0, V1, V2, N1, d1);
+    /* plane equation 1: N1.X+d1=0 */
+
+    return countResult(InstrumentedQuery::eTriangleTriangle, triTriIntersect<Policy, false, T>(policy, V0, V1, V2, N1, d1, U0, U1, U2, nullptr));
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T>& tri1, const Triangle3<T>& tri2)
+{
+    return intersect(DefaultEpsilon(), tri1, tri2);
+}
+
+// Intersection of two triangles as intersect(Triangle3, Triangle3) decides
+// it, together with the segment in which they cross: the overlap of the
+// intervals in which each crosses the line where the two planes meet,
+// found from the same intervals as the test itself. Triangles touching at
+// a single point give a zero length (degenerate) segment. Returns eOk,
+// eNoIntersection, eCoplanar if the triangles are coplanar and overlap
+// (the intersection is then an area, not a segment) or eDegenerate. The
+// segment is invalid unless the result is eOk.
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const Triangle3<T>& tri1, const Triangle3<T>& tri2, Segment3<T>& segment)
+{
+    segment = Segment3<T>(invalidPoint3<T>(), invalidPoint3<T>());
+    if (isDegenerate(tri1) || isDegenerate(tri2))
+    {
+        return countResult(InstrumentedQuery::eTriangleTriangleSegment, ResultCode::eDegenerate);
+    }
+
+    const T V0[3] = { tri1.p1().x(), tri1.p1().y(), tri1.p1().z() };
+    const T V1[3] = { tri1.p2().x(), tri1.p2().y(), tri1.p2().z() };
+    const T V2[3] = { tri1.p3().x(), tri1.p3().y(), tri1.p3().z() };
+    T N1[3], d1;
+    triTriPlane(V0, V1, V2, N1, d1);
+    return countResult(InstrumentedQuery::eTriangleTriangleSegment, triTriSegment(policy, V0, V1, V2, N1, d1, tri2, segment));
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T>& tri1, const Triangle3<T>& tri2, Segment3<T>& segment)
+{
+    return intersect(DefaultEpsilon(), tri1, tri2, segment);
+}
+
+// As intersect(Triangle3, Triangle3), with the plane of the first triangle
+// taken from the PreparedTriangle3, for testing one triangle against many.
+// The results are identical.
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const PreparedTriangle3<T>& tri1, const Triangle3<T>& tri2)
+{
+    const T U0[3] = { tri2.p1().x(), tri2.p1().y(), tri2.p1().z() };
+    const T U1[3] = { tri2.p2().x(), tri2.p2().y(), tri2.p2().z() };
+    const T U2[3] = { tri2.p3().x(), tri2.p3().y(), tri2.p3().z() };
+    return countResult(InstrumentedQuery::eTriangleTriangle, triTriIntersect<Policy, false, T>(policy, tri1.vertex(), tri1.vertex2(), tri1.vertex3(), tri1.planeNormal(), tri1.planeOffset(), U0, U1, U2, nullptr));
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedTriangle3<T>& tri1, const Triangle3<T>& tri2)
+{
+    return intersect(DefaultEpsilon(), tri1, tri2);
+}
+
+// As intersect(Triangle3, Triangle3, Segment3), with the plane of the first
+// triangle taken from the PreparedTriangle3.
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const PreparedTriangle3<T>& tri1, const Triangle3<T>& tri2, Segment3<T>& segment)
+{
+    segment = Segment3<T>(invalidPoint3<T>(), invalidPoint3<T>());
+    if (isDegenerate(tri1) || isDegenerate(tri2))
+    {
+        return countResult(InstrumentedQuery::eTriangleTriangleSegment, ResultCode::eDegenerate);
+    }
+    return countResult(InstrumentedQuery::eTriangleTriangleSegment, triTriSegment(policy, tri1.vertex(), tri1.vertex2(), tri1.vertex3(), tri1.planeNormal(), tri1.planeOffset(), tri2, segment));
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedTriangle3<T>& tri1, const Triangle3<T>& tri2, Segment3<T>& segment)
+{
+    return intersect(DefaultEpsilon(), tri1, tri2, segment);
+}
+
+// orient2d() and orient3d() on points, the former in the xy plane
+template <typename T>
+inline T orient2d(const Point3<T>& a, const Point3<T>& b, const Point3<T>& c)
+{
+    const T pa[2] = { a.x(), a.y() }, pb[2] = { b.x(), b.y() }, pc[2] = { c.x(), c.y() };
+    return orient2d(pa, pb, pc);
+}
+
+template <typename T>
+inline T orient3d(const Point3<T>& a, const Point3<T>& b, const Point3<T>& c, const Point3<T>& d)
+{
+    const T pa[3] = { a.x(), a.y(), a.z() }, pb[3] = { b.x(), b.y(), b.z() };
+    const T pc[3] = { c.x(), c.y(), c.z() }, pd[3] = { d.x(), d.y(), d.z() };
+    return orient3d(pa, pb, pc, pd);
+}
+
+// The exact triangle intersection after Guigue and Devillers, "Fast and
+// Robust Triangle-Triangle Overlap Test Using Orientation Predicates"
+// (2003). Every decision is the sign of orient3d() or orient2d(), so the
+// answer is exact for the triangles as given.
+
+// Overlap of two counterclockwise triangles in the plane, vertex p1 of the
+// first lying outside the second; after the vertex and edge cases of the
+// paper.
+template <typename T>
+inline bool exactOverlapVertex2d(const T p1[2], const T q1[2], const T r1[2], const T p2[2], const T q2[2], const T r2[2])
+{
+    if (orient2d(r2, p2, q1) >= T(0))
+    {
+        if (orient2d(r2, q2, q1) <= T(0))
+        {
+            if (orient2d(p1, p2, q1) > T(0))
+            {
+                return orient2d(p1, q2, q1) <= T(0);
+            }
+            return orient2d(p1, p2, r1) >= T(0) && orient2d(q1, r1, p2) >= T(0);
+        }
+        return orient2d(p1, q2, q1) <= T(0) && orient2d(r2, q2, r1) <= T(0) && orient2d(q1, r1, q2) >= T(0);
+    }
+    if (orient2d(r2, p2, r1) >= T(0))
+    {
+        if (orient2d(q1, r1, r2) >= T(0))
+        {
+            return orient2d(p1, p2, r1) >= T(0);
+        }
+        return orient2d(q1, r1, q2) >= T(0) && orient2d(r2, r1, q2) >= T(0);
+    }
+    return false;
+}
+
+template <typename T>
+inline bool exactOverlapEdge2d(const T p1[2], const T q1[2], const T r1[2], const T p2[2], const T q2[2], const T r2[2])
+{
+    (void)q2;
+    if (orient2d(r2, p2, q1) >= T(0))
+    {
+        if (orient2d(p1, p2, q1) >= T(0))
+        {
+            return orient2d(p1, q1, r2) >= T(0);
+        }
+        return orient2d(q1, r1, p2) >= T(0) && orient2d(r1, p1, p2) >= T(0);
+    }
+    if (orient2d(r2, p2, r1) >= T(0) && orient2d(p1, p2, r1) >= T(0))
+    {
+        return orient2d(p1, r1, r2) >= T(0) || orient2d(q1, r1, r2) >= T(0);
+    }
+    return false;
+}
+
+template <typename T>
+inline bool exactOverlapCcw2d(const T p1[2], const T q1[2], const T r1[2], const T p2[2], const T q2[2], const T r2[2])
+{
+    if (orient2d(p2, q2, p1) >= T(0))
+    {
+        if (orient2d(q2, r2, p1) >= T(0))
+        {
+            if (orient2d(r2, p2, p1) >= T(0))
+            {
+                return true;
+            }
+            return exactOverlapEdge2d(p1, q1, r1, p2, q2, r2);
+        }
+        if (orient2d(r2, p2, p1) >= T(0))
+        {
+            return exactOverlapEdge2d(p1, q1, r1, r2, p2, q2);
+        }
+        return exactOverlapVertex2d(p1, q1, r1, p2, q2, r2);
+    }
+    if (orient2d(q2, r2, p1) >= T(0))
+    {
+        if (orient2d(r2, p2, p1) >= T(0))
+        {
+            return exactOverlapEdge2d(p1, q1, r1, q2, r2, p2);
+        }
+        return exactOverlapVertex2d(p1, q1, r1, q2, r2, p2);
+    }
+    return exactOverlapVertex2d(p1, q1, r1, r2, p2, q2);
+}
+
+// Two coplanar triangles, projected onto the axis plane in which the
+// first has the largest area.
+template <typename T>
+inline bool exactOverlapCoplanar(const T p1[3], const T q1[3], const T r1[3], const T p2[3], const T q2[3], const T r2[3])
+{
+    T e1[3], e2[3], n[3];
+    SUB(e1, q1, p1);
+    SUB(e2, r1, p1);
+    CROSS(n, e1, e2);
+    T nx = std::abs(n[0]), ny = std::abs(n[1]), nz = std::abs(n[2]);
+    int i = 0, j = 1;
+    if (nx > nz && nx >= ny)
+    {
+        i = 1, j = 2;
+    }
+    else if (ny > nz && ny >= nx)
+    {
+        i = 0, j = 2;
+    }
+
+    T P1[2] = { p1[i], p1[j] }, Q1[2] = { q1[i], q1[j] }, R1[2] = { r1[i], r1[j] };
+    T P2[2] = { p2[i], p2[j] }, Q2[2] = { q2[i], q2[j] }, R2[2] = { r2[i], r2[j] };
+    bool ccw1 = orient2d(P1, Q1, R1) >= T(0);
+    bool ccw2 = orient2d(P2, Q2, R2) >= T(0);
+    return exactOverlapCcw2d(P1, ccw1 ? Q1 : R1, ccw1 ? R1 : Q1, P2, ccw2 ? Q2 : R2, ccw2 ? R2 : Q2);
+}
+
+// The intervals in which the two triangles cross the line of their
+// planes overlap. Vertex p1 lies alone on its side of the plane of the
+// second triangle, p2 on its side of the plane of the first.
+template <typename T>
+inline bool exactCheckMinMax(const T p1[3], const T q1[3], const T r1[3], const T p2[3], const T q2[3], const T r2[3])
+{
+    return orient3d(p2, p1, q2, q1) <= T(0) && orient3d(p2, r1, r2, p1) <= T(0);
+}
+
+// Brings p2 alone on its side of the plane of the first triangle, which
+// is oriented so that p1 lies above it, and runs exactCheckMinMax().
+template <typename T>
+inline bool exactTriTri3d(const T p1[3], const T q1[3], const T r1[3], const T p2[3], const T q2[3], const T r2[3], T dp2, T dq2, T dr2)
+{
+    if (dp2 > T(0))
+    {
+        if (dq2 > T(0)) return exactCheckMinMax(p1, r1, q1, r2, p2, q2);
+        if (dr2 > T(0)) return exactCheckMinMax(p1, r1, q1, q2, r2, p2);
+        return exactCheckMinMax(p1, q1, r1, p2, q2, r2);
+    }
+    if (dp2 < T(0))
+    {
+        if (dq2 < T(0)) return exactCheckMinMax(p1, q1, r1, r2, p2, q2);
+        if (dr2 < T(0)) return exactCheckMinMax(p1, q1, r1, q2, r2, p2);
+        return exactCheckMinMax(p1, r1, q1, p2, q2, r2);
+    }
+    if (dq2 < T(0))
+    {
+        if (dr2 >= T(0)) return exactCheckMinMax(p1, r1, q1, q2, r2, p2);
+        return exactCheckMinMax(p1, q1, r1, p2, q2, r2);
+    }
+    if (dq2 > T(0))
+    {
+        if (dr2 > T(0)) return exactCheckMinMax(p1, r1, q1, p2, q2, r2);
+        return exactCheckMinMax(p1, q1, r1, q2, r2, p2);
+    }
+    if (dr2 > T(0)) return exactCheckMinMax(p1, q1, r1, r2, p2, q2);
+    if (dr2 < T(0)) return exactCheckMinMax(p1, r1, q1, r2, p2, q2);
+    return exactOverlapCoplanar(p1, q1, r1, p2, q2, r2);
+}
+
+// Intersection of two closed triangles decided with the exact predicates:
+// triangles that only touch, at a vertex or along an edge, intersect.
+// Unlike intersect(Triangle3, Triangle3) nothing is decided within an
+// epsilon, so the answer is the same whatever the scale of the
+// coordinates. The floating point filters settle almost every pair in
+// general position, so it costs only somewhat more than the epsilon test.
+// Returns eDegenerate if either triangle is degenerate.
+template <typename T>
+inline ResultCode intersect(Exact, const Triangle3<T>& tri1, const Triangle3<T>& tri2)
+{
+    if (isDegenerate(tri1) || isDegenerate(tri2))
+    {
+        return countResult(InstrumentedQuery::eTriangleTriangleExact, ResultCode::eDegenerate);
+    }
+
+    const T p1[3] = { tri1.p1().x(), tri1.p1().y(), tri1.p1().z() };
+    const T q1[3] = { tri1.p2().x(), tri1.p2().y(), tri1.p2().z() };
+    const T r1[3] = { tri1.p3().x(), tri1.p3().y(), tri1.p3().z() };
+    const T p2[3] = { tri2.p1().x(), tri2.p1().y(), tri2.p1().z() };
+    const T q2[3] = { tri2.p2().x(), tri2.p2().y(), tri2.p2().z() };
+    const T r2[3] = { tri2.p3().x(), tri2.p3().y(), tri2.p3().z() };
+
+    // sides of the vertices of each triangle with respect to the plane of the other
+    T dp1 = orient3d(p2, q2, p1, r2);
+    T dq1 = orient3d(p2, q2, q1, r2);
+    T dr1 = orient3d(p2, q2, r1, r2);
+    if ((dp1 > T(0) && dq1 > T(0) && dr1 > T(0)) || (dp1 < T(0) && dq1 < T(0) && dr1 < T(0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleTriangleExact, ResultCode::eNoIntersection);
+    }
+
+    T dp2 = orient3d(q1, r1, p2, p1);
+    T dq2 = orient3d(q1, r1, q2, p1);
+    T dr2 = orient3d(q1, r1, r2, p1);
+    if ((dp2 > T(0) && dq2 > T(0) && dr2 > T(0)) || (dp2 < T(0) && dq2 < T(0) && dr2 < T(0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleTriangleExact, ResultCode::eNoIntersection);
+    }
+
+    bool hit;
+    if (dp1 > T(0))
+    {
+        if (dq1 > T(0)) hit = exactTriTri3d(r1, p1, q1, p2, r2, q2, dp2, dr2, dq2);
+        else if (dr1 > T(0)) hit = exactTriTri3d(q1, r1, p1, p2, r2, q2, dp2, dr2, dq2);
+        else hit = exactTriTri3d(p1, q1, r1, p2, q2, r2, dp2, dq2, dr2);
+    }
+    else if (dp1 < T(0))
+    {
+        if (dq1 < T(0)) hit = exactTriTri3d(r1, p1, q1, p2, q2, r2, dp2, dq2, dr2);
+        else if (dr1 < T(0)) hit = exactTriTri3d(q1, r1, p1, p2, q2, r2, dp2, dq2, dr2);
+        else hit = exactTriTri3d(p1, q1, r1, p2, r2, q2, dp2, dr2, dq2);
+    }
+    else if (dq1 < T(0))
+    {
+        if (dr1 >= T(0)) hit = exactTriTri3d(q1, r1, p1, p2, r2, q2, dp2, dr2, dq2);
+        else hit = exactTriTri3d(p1, q1, r1, p2, q2, r2, dp2, dq2, dr2);
+    }
+    else if (dq1 > T(0))
+    {
+        if (dr1 > T(0)) hit = exactTriTri3d(p1, q1, r1, p2, r2, q2, dp2, dr2, dq2);
+        else hit = exactTriTri3d(q1, r1, p1, p2, q2, r2, dp2, dq2, dr2);
+    }
+    else if (dr1 > T(0)) hit = exactTriTri3d(r1, p1, q1, p2, q2, r2, dp2, dq2, dr2);
+    else if (dr1 < T(0)) hit = exactTriTri3d(r1, p1, q1, p2, r2, q2, dp2, dr2, dq2);
+    else hit = exactOverlapCoplanar(p1, q1, r1, p2, q2, r2);
+
+    return countResult(InstrumentedQuery::eTriangleTriangleExact, hit ? ResultCode::eOk : ResultCode::eNoIntersection);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Axis aligned box intersection
+/////////////////////////////////////////////////////////////////////////////
+
+// the union of two boxes
+template <typename T>
+inline Aabb3<T> merge(const Aabb3<T> & box1, const Aabb3<T> & box2)
+{
+    Aabb3<T> box(box1);
+    box.expand(box2);
+    return box;
+}
+
+// Slab test of the box [lo, hi] against orig + t * dir, with invDir the
+// component wise reciprocal of dir, narrowing [tNear, tFar] down to the
+// part of the range inside the box. The near and far slab are picked by
+// the sign of invDir (a select, not a branch), and the std::max / std::min
+// argument order drops the NaN that a zero direction component with the
+// origin exactly on a slab produces, instead of letting it poison the
+// range. Touching within epsilon counts as a hit.
+template <typename T>
+HUBERT_HOST_DEVICE inline bool slabTest(const T lo[3], const T hi[3], const T orig[3], const T invDir[3], T & tNear, T & tFar)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        T t0 = (lo[a] - orig[a]) * invDir[a];
+        T t1 = (hi[a] - orig[a]) * invDir[a];
+        bool negative = invDir[a] < T(0.0);
+        tNear = std::max(tNear, negative ? t1 : t0);
+        tFar = std::min(tFar, negative ? t0 : t1);
+    }
+    return tNear <= tFar || isEqual(tNear, tFar);
+}
+
+// The range of distances along the ray [tNear, tFar] that is inside the
+// box. The reciprocal of the direction is computed once per call: use
+// slabTest() directly to share it across many boxes.
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const Ray3<T> & theRay, T & tNear, T & tFar)
+{
+    tNear = infinity<T>();
+    tFar = infinity<T>();
+    if (isDegenerate(theBox) || isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eAabbRay, ResultCode::eDegenerate);
+    }
+
+    const T lo[3] = { theBox.lo().x(), theBox.lo().y(), theBox.lo().z() };
+    const T hi[3] = { theBox.hi().x(), theBox.hi().y(), theBox.hi().z() };
+    const T orig[3] = { theRay.base().x(), theRay.base().y(), theRay.base().z() };
+    const UnitVector3<T> & dir = theRay.unitDirection();
+    const T invDir[3] = { T(1.0) / dir.x(), T(1.0) / dir.y(), T(1.0) / dir.z() };
+
+    T t0 = T(0.0);
+    T t1 = infinity<T>();
+    if (!slabTest(lo, hi, orig, invDir, t0, t1))
+    {
+        return countResult(InstrumentedQuery::eAabbRay, ResultCode::eNoIntersection);
+    }
+    tNear = t0;
+    tFar = std::max(t0, t1);
+    return countResult(InstrumentedQuery::eAabbRay, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const Ray3<T> & theRay)
+{
+    T tNear, tFar;
+    return intersect(theBox, theRay, tNear, tFar);
+}
+
+template <typename T>
+inline ResultCode intersect(const Ray3<T> & theRay, const Aabb3<T> & theBox)
+{
+    return intersect(theBox, theRay);
+}
+
+// boxes that touch overlap
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & box1, const Aabb3<T> & box2)
+{
+    if (isDegenerate(box1) || isDegenerate(box2))
+    {
+        return countResult(InstrumentedQuery::eAabbAabb, ResultCode::eDegenerate);
+    }
+
+    if (isLessOrEqual(box1.lo().x(), box2.hi().x()) && isLessOrEqual(box2.lo().x(), box1.hi().x()) &&
+        isLessOrEqual(box1.lo().y(), box2.hi().y()) && isLessOrEqual(box2.lo().y(), box1.hi().y()) &&
+        isLessOrEqual(box1.lo().z(), box2.hi().z()) && isLessOrEqual(box2.lo().z(), box1.hi().z()))
+    {
+        return countResult(InstrumentedQuery::eAabbAabb, ResultCode::eOk);
+    }
+    return countResult(InstrumentedQuery::eAabbAabb, ResultCode::eNoIntersection);
+}
+
+// the box overlaps the plane if the distance from its center to the plane
+// is no more than the projection of its half extents onto the normal
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const Plane<T> & thePlane)
+{
+    if (isDegenerate(theBox) || isDegenerate(thePlane))
+    {
+        return countResult(InstrumentedQuery::eAabbPlane, ResultCode::eDegenerate);
+    }
+
+    const UnitVector3<T> & n = thePlane.up();
+    T ex = (theBox.hi().x() - theBox.lo().x()) * T(0.5);
+    T ey = (theBox.hi().y() - theBox.lo().y()) * T(0.5);
+    T ez = (theBox.hi().z() - theBox.lo().z()) * T(0.5);
+    T cx = theBox.lo().x() + ex - thePlane.base().x();
+    T cy = theBox.lo().y() + ey - thePlane.base().y();
+    T cz = theBox.lo().z() + ez - thePlane.base().z();
+
+    T r = ex * std::abs(n.x()) + ey * std::abs(n.y()) + ez * std::abs(n.z());
+    T d = cx * n.x() + cy * n.y() + cz * n.z();
+    return countResult(InstrumentedQuery::eAabbPlane, isLessOrEqual(std::abs(d), r) ? ResultCode::eOk : ResultCode::eNoIntersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Plane<T> & thePlane, const Aabb3<T> & theBox)
+{
+    return intersect(theBox, thePlane);
+}
+
+// Separating axis test of Akenine-Moller, "Fast 3D Triangle-Box Overlap
+// Testing": the box axes, the triangle normal and the nine cross products
+// of box axes and triangle edges. Everything is relative to the center of
+// the box.
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const Triangle3<T> & theTri)
+{
+    if (isDegenerate(theBox) || isDegenerate(theTri))
+    {
+        return countResult(InstrumentedQuery::eAabbTriangle, ResultCode::eDegenerate);
+    }
+
+    const T e[3] = {
+        (theBox.hi().x() - theBox.lo().x()) * T(0.5),
+        (theBox.hi().y() - theBox.lo().y()) * T(0.5),
+        (theBox.hi().z() - theBox.lo().z()) * T(0.5) };
+    const T c[3] = { theBox.lo().x() + e[0], theBox.lo().y() + e[1], theBox.lo().z() + e[2] };
+
+    const T v[3][3] = {
+        { theTri.p1().x() - c[0], theTri.p1().y() - c[1], theTri.p1().z() - c[2] },
+        { theTri.p2().x() - c[0], theTri.p2().y() - c[1], theTri.p2().z() - c[2] },
+        { theTri.p3().x() - c[0], theTri.p3().y() - c[1], theTri.p3().z() - c[2] } };
+
+    // the projections [pMin, pMax] of the triangle and [-r, r] of the box
+    // are disjoint (touching within epsilon counts as overlapping)
+    auto separated = [](T pMin, T pMax, T r) {
+        return !isLessOrEqual(pMin, r) || !isLessOrEqual(-r, pMax);
+    };
+
+    // box face normals
+    for (int a = 0; a < 3; a++)
+    {
+        T pMin = std::min(v[0][a], std::min(v[1][a], v[2][a]));
+        T pMax = std::max(v[0][a], std::max(v[1][a], v[2][a]));
+        if (separated(pMin, pMax, e[a]))
+        {
+            return countResult(InstrumentedQuery::eAabbTriangle, ResultCode::eNoIntersection);
+        }
+    }
+
+    // box axes crossed with the triangle edges
+    const T f[3][3] = {
+        { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] },
+        { v[2][0] - v[1][0], v[2][1] - v[1][1], v[2][2] - v[1][2] },
+        { v[0][0] - v[2][0], v[0][1] - v[2][1], v[0][2] - v[2][2] } };
+
+    for (int a = 0; a < 3; a++)
+    {
+        int a1 = (a + 1) % 3;
+        int a2 = (a + 2) % 3;
+        for (int k = 0; k < 3; k++)
+        {
+            // axis = unit(a) x f[k], which has components a1 and a2 only
+            T ax1 = -f[k][a2];
+            T ax2 = f[k][a1];
+            T p0 = v[0][a1] * ax1 + v[0][a2] * ax2;
+            T p1 = v[1][a1] * ax1 + v[1][a2] * ax2;
+            T p2 = v[2][a1] * ax1 + v[2][a2] * ax2;
+            T r = e[a1] * std::abs(ax1) + e[a2] * std::abs(ax2);
+            if (separated(std::min(p0, std::min(p1, p2)), std::max(p0, std::max(p1, p2)), r))
+            {
+                return countResult(InstrumentedQuery::eAabbTriangle, ResultCode::eNoIntersection);
+            }
+        }
+    }
+
+    // triangle normal
+    const T n[3] = {
+        f[0][1] * f[1][2] - f[0][2] * f[1][1],
+        f[0][2] * f[1][0] - f[0][0] * f[1][2],
+        f[0][0] * f[1][1] - f[0][1] * f[1][0] };
+    T d = n[0] * v[0][0] + n[1] * v[0][1] + n[2] * v[0][2];
+    T r = e[0] * std::abs(n[0]) + e[1] * std::abs(n[1]) + e[2] * std::abs(n[2]);
+    if (separated(d, d, r))
+    {
+        return countResult(InstrumentedQuery::eAabbTriangle, ResultCode::eNoIntersection);
+    }
+
+    return countResult(InstrumentedQuery::eAabbTriangle, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Triangle3<T> & theTri, const Aabb3<T> & theBox)
+{
+    return intersect(theBox, theTri);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Prepared ray intersection
+/////////////////////////////////////////////////////////////////////////////
+
+// Slab test using the cached reciprocal direction and sign bits, which
+// pick the near and far corner of the box directly.
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const PreparedRay3<T> & theRay, T & tNear, T & tFar)
+{
+    tNear = infinity<T>();
+    tFar = infinity<T>();
+    if (isDegenerate(theBox) || isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eAabbRay, ResultCode::eDegenerate);
+    }
+
+    const T bounds[2][3] = {
+        { theBox.lo().x(), theBox.lo().y(), theBox.lo().z() },
+        { theBox.hi().x(), theBox.hi().y(), theBox.hi().z() } };
+    const T * orig = theRay.origin();
+    const T * invDir = theRay.invDirection();
+
+    T t0 = T(0.0);
+    T t1 = infinity<T>();
+    for (int a = 0; a < 3; a++)
+    {
+        t0 = std::max(t0, (bounds[theRay.sign(a)][a] - orig[a]) * invDir[a]);
+        t1 = std::min(t1, (bounds[1 - theRay.sign(a)][a] - orig[a]) * invDir[a]);
+    }
+    if (!(t0 <= t1 || isEqual(t0, t1)))
+    {
+        return countResult(InstrumentedQuery::eAabbRay, ResultCode::eNoIntersection);
+    }
+    tNear = t0;
+    tFar = std::max(t0, t1);
+    return countResult(InstrumentedQuery::eAabbRay, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const Aabb3<T> & theBox, const PreparedRay3<T> & theRay)
+{
+    T tNear, tFar;
+    return intersect(theBox, theRay, tNear, tFar);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedRay3<T> & theRay, const Aabb3<T> & theBox)
+{
+    return intersect(theBox, theRay);
+}
+
+// The 2D edge functions of the watertight test, for the vertices already
+// translated to the ray origin and sheared. Values that come out exactly
+// zero are recomputed in double precision for float, so that hits on
+// edges and vertices are decided consistently.
+template <typename T>
+inline void woopEdgeFunctions(T ax, T ay, T bx, T by, T cx, T cy, T & u, T & v, T & w)
+{
+    u = cx * by - cy * bx;
+    v = ax * cy - ay * cx;
+    w = bx * ay - by * ax;
+
+    if (std::is_same<T, float>::value && (u == T(0.0) || v == T(0.0) || w == T(0.0)))
+    {
+        u = T(double(cx) * double(by) - double(cy) * double(bx));
+        v = T(double(ax) * double(cy) - double(ay) * double(cx));
+        w = T(double(bx) * double(ay) - double(by) * double(ax));
+    }
+}
+
+// Watertight ray / triangle intersection (Woop, Benthin & Wald, "Watertight
+// Ray/Triangle Intersection", JCGT 2013). Unlike the Moller-Trumbore based
+// overload for Ray3, there are no epsilon tolerances: a ray through an edge
+// or vertex shared by several triangles hits at least one of them, and a
+// ray that misses never hits. Both sides of the triangle are hit. Returns
+// eCoplanar if the ray lies in (or is parallel to) the plane of the
+// triangle.
+template <typename T>
+inline ResultCode intersect(const Triangle3<T> & theTri, const PreparedRay3<T> & theRay, Point3<T> & intersection)
+{
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theTri) || isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eDegenerate);
+    }
+
+    const T * orig = theRay.origin();
+    const int kx = theRay.kx();
+    const int ky = theRay.ky();
+    const int kz = theRay.kz();
+
+    // vertices relative to the ray origin
+    const T a[3] = { theTri.p1().x() - orig[0], theTri.p1().y() - orig[1], theTri.p1().z() - orig[2] };
+    const T b[3] = { theTri.p2().x() - orig[0], theTri.p2().y() - orig[1], theTri.p2().z() - orig[2] };
+    const T c[3] = { theTri.p3().x() - orig[0], theTri.p3().y() - orig[1], theTri.p3().z() - orig[2] };
+
+    // shear and scale, so that the ray runs along +z
+    const T ax = a[kx] - theRay.sx() * a[kz];
+    const T ay = a[ky] - theRay.sy() * a[kz];
+    const T bx = b[kx] - theRay.sx() * b[kz];
+    const T by = b[ky] - theRay.sy() * b[kz];
+    const T cx = c[kx] - theRay.sx() * c[kz];
+    const T cy = c[ky] - theRay.sy() * c[kz];
+
+    T u, v, w;
+    woopEdgeFunctions(ax, ay, bx, by, cx, cy, u, v, w);
+
+    if ((u < T(0.0) || v < T(0.0) || w < T(0.0)) && (u > T(0.0) || v > T(0.0) || w > T(0.0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    T det = u + v + w;
+    if (det == T(0.0))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eCoplanar);
+    }
+
+    const T az = theRay.sz() * a[kz];
+    const T bz = theRay.sz() * b[kz];
+    const T cz = theRay.sz() * c[kz];
+    T scaledT = u * az + v * bz + w * cz;
+
+    // behind the origin, whichever side of the triangle faces the ray
+    if ((det < T(0.0)) ? (scaledT > T(0.0)) : (scaledT < T(0.0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    T t = scaledT / det;
+    intersection = theRay.ray().base() + multiply(theRay.ray().unitDirection(), t);
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedRay3<T> & theRay, const Triangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theRay, intersection);
+}
+
+// a plane test has no per ray setup worth caching, so this is the same as
+// the Ray3 overload
+template <typename T>
+inline ResultCode intersect(const Plane<T> & thePlane, const PreparedRay3<T> & theRay, Point3<T> & intersection)
+{
+    return intersect(thePlane, theRay.ray(), intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedRay3<T> & theRay, const Plane<T> & thePlane, Point3<T> & intersection)
+{
+    return intersect(thePlane, theRay.ray(), intersection);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Prepared triangle intersection
+//
+// These give exactly the results of the Triangle3 overloads, without
+// recomputing the edges on every call.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const PreparedTriangle3<T> & theTri, const Ray3<T> & theRay, Point3<T> & intersection)
+{
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theTri) || isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eDegenerate);
+    }
+
+    const T orig[3] = { theRay.base().x(), theRay.base().y(), theRay.base().z() };
+    const T dir[3] = { theRay.unitDirection().x(), theRay.unitDirection().y(), theRay.unitDirection().z() };
+
+    T t;
+    ResultCode rc = mollerTrumbore(policy, orig, dir, theTri.vertex(), theTri.edge1(), theTri.edge2(), t);
+    if (rc != ResultCode::eOk)
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, rc);
+    }
+    if (!isGreaterOrEqual(policy, t, T(0.0)))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eNoIntersection);
+    }
+
+    intersection = theRay.base() + multiply(theRay.unitDirection(), t);
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleRay, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedTriangle3<T> & theTri, const Ray3<T> & theRay, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theRay, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Ray3<T> & theRay, const PreparedTriangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theRay, intersection);
+}
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const PreparedTriangle3<T> & theTri, const Line3<T> & theLine, Point3<T> & intersection)
+{
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theTri) || isDegenerate(theLine))
+    {
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eDegenerate);
+    }
+
+    const T orig[3] = { theLine.base().x(), theLine.base().y(), theLine.base().z() };
+    const T dir[3] = { theLine.unitDirection().x(), theLine.unitDirection().y(), theLine.unitDirection().z() };
+
+    T t;
+    ResultCode rc = mollerTrumbore(policy, orig, dir, theTri.vertex(), theTri.edge1(), theTri.edge2(), t);
+    if (rc != ResultCode::eOk)
+    {
+        return countResult(InstrumentedQuery::eTriangleLine, rc);
+    }
+
+    intersection = theLine.base() + multiply(theLine.unitDirection(), t);
+    if (!isValid(intersection))
+    {
+        return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eOverflow);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleLine, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedTriangle3<T> & theTri, const Line3<T> & theLine, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theLine, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Line3<T> & theLine, const PreparedTriangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theLine, intersection);
+}
+
+template <typename Policy, typename T, IfEpsilonPolicy<Policy> = 0>
+inline ResultCode intersect(Policy policy, const PreparedTriangle3<T> & theTri, const Segment3<T> & theSegment, Point3<T> & intersection)
+{
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theTri) || isDegenerate(theSegment))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eDegenerate);
+    }
+
+    UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+    const T orig[3] = { theSegment.base().x(), theSegment.base().y(), theSegment.base().z() };
+    const T dir[3] = { segDir.x(), segDir.y(), segDir.z() };
+
+    T t;
+    ResultCode rc = mollerTrumbore(policy, orig, dir, theTri.vertex(), theTri.edge1(), theTri.edge2(), t);
+    if (rc != ResultCode::eOk)
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, rc);
+    }
+    if (!isValid(t))
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOverflow);
+    }
+    if (t < 0.0)
+    {
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    intersection = theSegment.base() + multiply(segDir, t);
+    if (!isValid(intersection))
+    {
+        // as for Triangle3, the overflowed result is handed back
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOverflow);
+    }
+
+    if (hubert::distance(intersection, theSegment.base()) > hubert::distance(theSegment.base(), theSegment.target()))
+    {
+        intersection = invalidPoint3<T>();
+        return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eNoIntersection);
+    }
+
+    return countResult(InstrumentedQuery::eTriangleSegment, ResultCode::eOk);
+}
+
+template <typename T>
+inline ResultCode intersect(const PreparedTriangle3<T> & theTri, const Segment3<T> & theSegment, Point3<T> & intersection)
+{
+    return intersect(DefaultEpsilon(), theTri, theSegment, intersection);
+}
+
+template <typename T>
+inline ResultCode intersect(const Segment3<T> & theSegment, const PreparedTriangle3<T> & theTri, Point3<T> & intersection)
+{
+    return intersect(theTri, theSegment, intersection);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Arenas
+//
+// Batch routines that produce many results of unknown number (the pairs
+// of intersectSelf(), the segments of slice()) can write them into memory
+// taken from a MonotonicArena instead of the heap: allocation is a
+// pointer bump, nothing is freed one by one, and reset() gives all of it
+// back at once. An arena is not thread safe; the batch routines give each
+// of their threads its own.
+//
+// ArenaAllocator makes an arena usable by the standard containers
+// (ArenaVector), and when the standard library has <memory_resource>
+// (HUBERT_HAS_PMR is then defined), ArenaResource does the same for the
+// std::pmr ones. The routines that fill a vector take any allocator, so
+// std::pmr::vector and std::pmr::monotonic_buffer_resource work as well.
+/////////////////////////////////////////////////////////////////////////////
+
+// The default size of the blocks an arena takes from the heap
+constexpr size_t cArenaBlockSize = 64 * 1024;
+
+//
+// MonotonicArena.
+//
+// Hands out memory from a chain of blocks, moving on to a new block when
+// the current one is full. reset() starts again at the first block, and
+// keeps all of them to be reused. A request larger than the block size
+// gets a block of its own.
+//
+class MonotonicArena
+{
+    public:
+        // constructors
+        explicit MonotonicArena(size_t blockSize = cArenaBlockSize) : _blockSize(std::max(blockSize, size_t(256))) {}
+        MonotonicArena(const MonotonicArena &) = delete;
+        ~MonotonicArena() { release(); }
+
+        // public operators
+        MonotonicArena & operator=(const MonotonicArena &) = delete;
+
+        // public methods
+
+        // alignment must be a power of two
+        void * allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+        {
+            for (;;)
             {
-                if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
+                if (_current != nullptr)
                 {
-                    newFlags |= cSubnormalData;
+                    uintptr_t base = reinterpret_cast<uintptr_t>(_data(_current));
+                    uintptr_t at = (base + _offset + (alignment - 1)) & ~uintptr_t(alignment - 1);
+                    if (at - base <= _current->size && bytes <= _current->size - (at - base))
+                    {
+                        _offset = size_t(at - base) + bytes;
+                        _used += bytes;
+                        return reinterpret_cast<void *>(at);
+                    }
+                    if (_current->next != nullptr)
+                    {
+                        _current = _current->next;
+                        _offset = 0;
+                        continue;
+                    }
                 }
 
-                _mag = std::hypot(_x, _y, _z);
-           
-                if (!isValid(_mag) || isEqual(_mag, T(0.0)))
+                if (bytes > std::numeric_limits<size_t>::max() - alignment - sizeof(Block))
                 {
-                    newFlags |= cDegenerate;
+                    throw std::bad_alloc();
+                }
+                size_t size = std::max(_blockSize, bytes + alignment);
+                Block * block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+                block->next = nullptr;
+                block->size = size;
+                if (_last != nullptr)
+                {
+                    _last->next = block;
                 }
                 else
                 {
-                    _x /= _mag;
-                    _y /= _mag;
-                    _z /= _mag;
-
-                    // becasue we have modified the numbers, check them for subnormality again
-                    if (isSubnormal(_x) || isSubnormal(_y) || isSubnormal(_z))
-                    {
-                        newFlags |= cSubnormalData;
-                    }
+                    _first = block;
                 }
-             }
+                _last = block;
+                _current = block;
+                _offset = 0;
+                _capacity += size;
+            }
+        }
 
-             setValidityFlags(newFlags);
+        // everything allocated so far is given back, in O(1); the blocks
+        // are kept
+        inline void reset()
+        {
+            _current = _first;
+            _offset = 0;
+            _used = 0;
+        }
+
+        // everything allocated so far is given back, and so are the blocks
+        void release()
+        {
+            while (_first != nullptr)
+            {
+                Block * next = _first->next;
+                ::operator delete(_first);
+                _first = next;
+            }
+            _last = nullptr;
+            _current = nullptr;
+            _offset = 0;
+            _used = 0;
+            _capacity = 0;
         }
 
+        // the bytes handed out since the last reset(), and the bytes held
+        // in blocks
+        inline size_t used() const { return _used; }
+        inline size_t capacity() const { return _capacity; }
+
+    private:
+        struct alignas(std::max_align_t) Block
+        {
+            Block *     next;
+            size_t      size;
+        };
+
+        static inline uint8_t * _data(Block * block) { return reinterpret_cast<uint8_t *>(block) + sizeof(Block); }
+
         // private data
-        T   _x;
-        T   _y;
-        T   _z;
-        T   _mag;
+        size_t      _blockSize;
+        Block *     _first = nullptr;
+        Block *     _last = nullptr;
+        Block *     _current = nullptr;
+        size_t      _offset = 0;
+        size_t      _used = 0;
+        size_t      _capacity = 0;
 };
 
-template <typename T>
-class Matrix3 : public HubertBase
+// A standard allocator drawing from an arena. Deallocation does nothing;
+// the memory comes back when the arena is reset.
+template <typename V>
+struct ArenaAllocator
+{
+    using value_type = V;
+
+    explicit ArenaAllocator(MonotonicArena & inArena) noexcept : arena(&inArena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & other) noexcept : arena(other.arena) {}
+
+    inline V * allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(V))
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<V *>(arena->allocate(n * sizeof(V), alignof(V)));
+    }
+
+    inline void deallocate(V *, size_t) noexcept {}
+
+    MonotonicArena * arena;
+};
+
+template <typename V, typename U>
+inline bool operator==(const ArenaAllocator<V> & a, const ArenaAllocator<U> & b) { return a.arena == b.arena; }
+
+template <typename V, typename U>
+inline bool operator!=(const ArenaAllocator<V> & a, const ArenaAllocator<U> & b) { return a.arena != b.arena; }
+
+template <typename V>
+using ArenaVector = std::vector<V, ArenaAllocator<V>>;
+
+#if defined(HUBERT_HAS_PMR)
+// An arena as a std::pmr::memory_resource
+class ArenaResource : public std::pmr::memory_resource
 {
     public:
         // constructors
-        Matrix3() : _m{} {}
-        Matrix3(T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2) { _validate(r0c0, r0c1, r0c2, r1c0, r1c1, r1c2, r2c0, r2c1, r2c2); }
-        Matrix3(const Matrix3&) = default;
-        ~Matrix3() = default;
-
-        // public operators
-        inline Matrix3<T>& operator=(const Matrix3<T>&) = default;
+        explicit ArenaResource(MonotonicArena & arena) : _arena(arena) {}
 
         // public methods
-        inline T get(uint32_t r, uint32_t c) const { return _m[r][c]; }
-        inline T getDeterminantEpsilonScale() const { return T(12.0) * _maxVal; }
+        inline MonotonicArena & arena() const { return _arena; }
 
-        inline Matrix3<T> transpose(void) const
-        {
-            Matrix3<T> mt(
-                _m[0][0], _m[1][0], _m[2][0],
-                _m[0][1], _m[1][1], _m[2][1],
-                _m[0][2], _m[1][2], _m[2][2]
-            );
+    private:
+        void * do_allocate(size_t bytes, size_t alignment) override { return _arena.allocate(bytes, alignment); }
+        void do_deallocate(void *, size_t, size_t) override {}
+        bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
 
-            return mt;
-        }
+        // private data
+        MonotonicArena &    _arena;
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Parallel execution
+/////////////////////////////////////////////////////////////////////////////
+
+// Calls body(begin, end, thread) for consecutive chunks of grain items
+// covering [0, count). Chunks are handed out to the threads as they become
+// free, and thread is the index (0 .. threads - 1) of the one running the
+// chunk, for use with per thread results. threads == 0 means one per
+// hardware thread. The calling thread takes part, so a single thread (or
+// a single chunk) runs everything inline.
+template <typename Body>
+inline void parallelFor(size_t count, size_t grain, unsigned threads, Body body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t chunks = (count + grain - 1) / grain;
+    if (threads > chunks)
+    {
+        threads = unsigned(chunks);
+    }
+    if (threads <= 1)
+    {
+        body(size_t(0), count, 0u);
+        return;
+    }
 
-        inline Matrix3<T> multiply(const Matrix3<T> m2) const
+    std::atomic<size_t> next(0);
+    auto worker = [&](unsigned thread) {
+        for (size_t chunk = next++; chunk < chunks; chunk = next++)
         {
-           T mt[3][3];
+            body(chunk * grain, std::min(count, (chunk + 1) * grain), thread);
+        }
+    };
 
-            for (int i = 0; i < 3; i++){
-                for (int j = 0; j < 3; j++) {
-                    mt[i][j] = T(0.0);
-                    for (int u = 0; u < 3; u++) {
-                        mt[i][j] += _m[i][u] * m2._m[u][j];
-                    }
-                }
-            }
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned thread = 1; thread < threads; thread++)
+    {
+        pool.emplace_back(worker, thread);
+    }
+    worker(0);
+    for (auto & t : pool)
+    {
+        t.join();
+    }
+}
 
-            return Matrix3(mt[0][0], mt[0][1], mt[0][2], mt[1][0], mt[1][1], mt[1][2], mt[2][0], mt[2][1], mt[2][2]);
+// The number of threads parallelFor() will use for a given request.
+inline unsigned threadCount(unsigned threads)
+{
+    return (threads == 0) ? std::max(1u, std::thread::hardware_concurrency()) : threads;
+}
+
+// Executors run a loop body over [0, count) in chunks of grain items, as
+// body(begin, end). They are what the batch functions are parameterized
+// on; anything with the same forChunks() member can be plugged in.
+
+// Runs everything on the calling thread, in one call.
+struct SerialExecutor
+{
+    template <typename Body>
+    inline void forChunks(size_t count, size_t /*grain*/, Body body) const
+    {
+        if (count > 0)
+        {
+            body(size_t(0), count);
         }
+    }
+};
 
-        inline bool isIdentity(T scale = T(1.0)) const 
+// Starts threads for the duration of each call (see parallelFor()).
+struct ThreadExecutor
+{
+    unsigned threads = 0;
+
+    template <typename Body>
+    inline void forChunks(size_t count, size_t grain, Body body) const
+    {
+        parallelFor(count, grain, threads, [&](size_t begin, size_t end, unsigned) { body(begin, end); });
+    }
+};
+
+#if defined(HUBERT_PARALLEL_STL)
+// Hands the chunks to the standard library's parallel algorithms, which
+// use whatever backend the implementation provides (with libstdc++ that
+// is TBB, which must then be linked).
+struct ParallelStlExecutor
+{
+    template <typename Body>
+    inline void forChunks(size_t count, size_t grain, Body body) const
+    {
+        grain = std::max(grain, size_t(1));
+        std::vector<size_t> chunks((count + grain - 1) / grain);
+        for (size_t c = 0; c < chunks.size(); c++)
         {
-            for (int i = 0; i < 3; i++) {
-                for (int j = 0; j < 3; j++) {
-                    if (!isEqualScaled(_m[i][j], (i == j) ? T(1.0) : T(0.0), scale)) {
-                        return false;
-                    }
-                }
-            }
-            return true;
+            chunks[c] = c;
         }
+        std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](size_t c) {
+            body(c * grain, std::min(count, (c + 1) * grain));
+        });
+    }
+};
+#endif
 
-        inline bool isIdentityTolerance(T tolerance) const
+//
+// ThreadPool.
+//
+// Executor with a set of worker threads that live as long as the pool, so
+// that many short batches do not pay for starting threads. The calling
+// thread works on its own batch as well, and threads that run out of
+// chunks take the next one from the batch, so uneven chunks balance out.
+// One batch runs at a time; a batch started from inside a chunk (a nested
+// batch) runs inline on that thread.
+//
+class ThreadPool
+{
+    public:
+        // constructors
+        explicit ThreadPool(unsigned threads = 0)
         {
-            for (int i = 0; i < 3; i++) {
-                for (int j = 0; j < 3; j++) {
-                    if (difference(_m[i][j], (i == j) ? T(1.0) : T(0.0)) > tolerance) {
-                        return false;
-                    }
-                }
+            unsigned workers = threadCount(threads) - 1;
+            _threads.reserve(workers);
+            for (unsigned i = 0; i < workers; i++)
+            {
+                _threads.emplace_back([this] { _work(); });
             }
-            return true;
         }
-
-        inline T determinant() const
+        ThreadPool(const ThreadPool &) = delete;
+        ~ThreadPool()
         {
-            return (
-                _m[0][0] * (_m[1][1] * _m[2][2] - _m[2][1] * _m[1][2]) -
-                _m[0][1] * (_m[1][0] * _m[2][2] - _m[2][0] * _m[1][2]) +
-                _m[0][2] * (_m[1][0] * _m[2][1] - _m[2][0] * _m[1][1])
-            );
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto & t : _threads)
+            {
+                t.join();
+            }
         }
 
+        // public operators
+        ThreadPool & operator=(const ThreadPool &) = delete;
 
-    protected:
-        T   _m[3][3];
-
+        // public methods
+        inline unsigned threads() const { return unsigned(_threads.size()) + 1; }
 
-    private:
-        // private methods
-        void _validate(T r0c0, T r0c1, T r0c2, T r1c0, T r1c1, T r1c2, T r2c0, T r2c1, T r2c2)
+        template <typename Body>
+        void forChunks(size_t count, size_t grain, Body body)
         {
-            _m[0][0] = r0c0;
-            _m[1][0] = r1c0;
-            _m[2][0] = r2c0;
-            _m[0][1] = r0c1;
-            _m[1][1] = r1c1;
-            _m[2][1] = r2c1;
-            _m[0][2] = r0c2;
-            _m[1][2] = r1c2;
-            _m[2][2] = r2c2;
-
-            // we use the maximum value to scale epsilon
-            T* v = &_m[0][0];
-            for (int i = 0; i < 9; i++, v++)
+            grain = std::max(grain, size_t(1));
+            size_t chunks = (count + grain - 1) / grain;
+            if (chunks <= 1 || _threads.empty() || _inside())
             {
-                if (std::abs(*v) > _maxVal)
+                if (count > 0)
                 {
-                    _maxVal = std::abs(*v);
+                    body(size_t(0), count);
                 }
+                return;
+            }
+
+            std::lock_guard<std::mutex> batchLock(_batchMutex);
+            std::function<void(size_t, size_t)> run = [&](size_t begin, size_t end) { body(begin, end); };
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _body = &run;
+                _count = count;
+                _grain = grain;
+                _chunks = chunks;
+                _next = 0;
+                _active = unsigned(_threads.size());
+                _batch++;
             }
+            _wake.notify_all();
 
-            uint64_t newFlags = 0;
+            _inside() = true;
+            _runChunks();
+            _inside() = false;
 
-            // only reason for invalidity is the source data
-            v = &_m[0][0];
-            for (int i = 0; i < 9; i++, v++)
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this] { return _active == 0; });
+            _body = nullptr;
+        }
+
+    private:
+        // set while a thread is running chunks, to catch nested batches
+        static bool & _inside()
+        {
+            static thread_local bool inside = false;
+            return inside;
+        }
+
+        void _runChunks()
+        {
+            for (size_t chunk = _next++; chunk < _chunks; chunk = _next++)
             {
-                if (!isValid(*v))
-                {
-                    newFlags |= cInvalid;
-                    break;
-                }
+                (*_body)(chunk * _grain, std::min(_count, (chunk + 1) * _grain));
             }
+        }
 
-            // only do normalization checks if we are valid. There is no
-            // degeneracy case unrelated to validity.
-            if (!(newFlags & cInvalid))
+        void _work()
+        {
+            uint64_t seen = 0;
+            for (;;)
             {
-                v = &_m[0][0];
-                for (int i = 0; i < 9; i++, v++)
                 {
-                    if (isSubnormal(T(*v)))
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [&] { return _stop || _batch != seen; });
+                    if (_stop)
                     {
-                        newFlags |= cSubnormalData;
-                        break;
+                        return;
                     }
+                    seen = _batch;
                 }
-            }
 
-            setValidityFlags(newFlags);
+                _inside() = true;
+                _runChunks();
+                _inside() = false;
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_active == 0)
+                {
+                    _done.notify_one();
+                }
+            }
         }
 
-        // Don't allow direct access to the data
-        T   _maxVal = T(0.0);
+        std::vector<std::thread>                _threads;
+        std::mutex                              _batchMutex;
+        std::mutex                              _mutex;
+        std::condition_variable                 _wake;
+        std::condition_variable                 _done;
+        const std::function<void(size_t, size_t)> * _body = nullptr;
+        size_t                                  _count = 0;
+        size_t                                  _grain = 1;
+        size_t                                  _chunks = 0;
+        std::atomic<size_t>                     _next{ 0 };
+        unsigned                                _active = 0;
+        uint64_t                                _batch = 0;
+        bool                                    _stop = false;
 };
 
-
-template <typename T>
-class MatrixRotation3 : public Matrix3<T>
+// A pool with one thread per hardware thread, started on first use and
+// shared by everyone who does not want to manage their own.
+inline ThreadPool & sharedThreadPool()
 {
-    public:
-        // constructors
-        MatrixRotation3() : MatrixRotation3(UnitVector3<T>(T(1.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(1.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0)) ) {}
-        MatrixRotation3(const UnitVector3<T> & inX, const UnitVector3<T>& inY, const UnitVector3<T>& inZ) : Matrix3<T>(inX.x(), inX.y(), inX.z(), inY.x(), inY.y(), inY.z(), inZ.x(), inZ.y(), inZ.z()) { _validate(inX, inY, inZ); }
-        MatrixRotation3(const MatrixRotation3&) = default;
-        ~MatrixRotation3() = default;
-
-        // public operators
-        inline MatrixRotation3<T>& operator=(const MatrixRotation3<T>&) = default;
+    static ThreadPool pool;
+    return pool;
+}
 
-        // public methods
-        inline MatrixRotation3<T> transpose(void) const 
-        {
-            MatrixRotation3<T> mt(
-                UnitVector3<T>(this->_m[0][0], this->_m[1][0], this->_m[2][0]),
-                UnitVector3<T>(this->_m[0][1], this->_m[1][1], this->_m[2][1]),
-                UnitVector3<T>(this->_m[0][2], this->_m[1][2], this->_m[2][2])
-                );
+// The chunk size the batch functions use: as many items as fit,
+// with their results, in cBatchChunkBytes, which is sized to stay in the
+// L1 / L2 cache of one core while a chunk is processed.
+constexpr size_t cBatchChunkBytes = 16 * 1024;
 
-            return mt;
-        }
+inline size_t batchGrain(size_t bytesPerItem)
+{
+    return std::max(size_t(1), cBatchChunkBytes / std::max(bytesPerItem, size_t(1)));
+}
 
-        inline MatrixRotation3<T> multiply(const MatrixRotation3<T> m2) const
-        {
-            T mt[3][3];
+/////////////////////////////////////////////////////////////////////////////
+// Bulk triangle validation
+/////////////////////////////////////////////////////////////////////////////
 
-            for (int i = 0; i < 3; i++) {
-                for (int j = 0; j < 3; j++) {
-                    mt[i][j] = T(0.0);
-                    for (int u = 0; u < 3; u++) {
-                        mt[i][j] += this->_m[i][u] * m2._m[u][j];
-                    }
-                }
-            }
+// Classifies count packed triangles, setting bit i of degenerateBits
+// (resized to hold count bits) if triangle i is degenerate or invalid, as
+// Triangle3 would flag it. Blocks of 64 triangles go through the branch
+// free first pass of the classifier, which the compiler can vectorize, and
+// only the few ambiguous triangles of a block take the exact path. Blocks
+// are spread over threads (see parallelFor(), 1 by default). Returns the
+// number of flagged triangles.
+//
+// get(i) returns triangle i as a PackedTriangle3, for triangles that are
+// not held in an array of them (a mapped file, say).
+template <typename Get>
+inline size_t validateTriangles(size_t count, Get get, std::vector<uint64_t> & degenerateBits, unsigned threads = 1)
+{
+    using T = decltype(get(size_t(0)).p1.x);
 
-            return MatrixRotation3(
-                UnitVector3<T>(mt[0][0], mt[0][1], mt[0][2]),
-                UnitVector3<T>(mt[1][0], mt[1][1], mt[1][2]),
-                UnitVector3<T>(mt[2][0], mt[2][1], mt[2][2])
-            );
-        }
+    size_t words = (count + 63) / 64;
+    degenerateBits.assign(words, 0);
+    std::vector<size_t> flagged(threadCount(threads), 0);
 
-    private:
-        // Rotation matrix specific validation
-        void _validate(const UnitVector3<T>& inX, const UnitVector3<T>& inY, const UnitVector3<T>& inZ)
+    parallelFor(words, 64, threads, [&](size_t begin, size_t end, unsigned thread) {
+        size_t n = 0;
+        for (size_t w = begin; w < end; w++)
         {
-            uint64_t newFlags = 0;
+            size_t first = w * 64;
+            size_t last = std::min(count, first + 64);
 
-            // the validity & subnormality flags will already have been set by the parent class. 
-            // All we have to worry about is degeneracy checks specific to the Rotation matrix
-            if (!(newFlags & HubertBase::cInvalid))
+            uint64_t degenerate = 0;
+            uint64_t ambiguous = 0;
+            for (size_t i = first; i < last; i++)
             {
-                // the incoming vectors must be legitimate unit vectors, otherwise the matrix
-                // does not stand a chance of being a rotation matrix.
-                if (isDegenerate(inX) || isDegenerate(inY) || isDegenerate(inZ))
-                {
-                    newFlags |= HubertBase::cDegenerate;
-                }
+                const PackedTriangle3<T> tri = get(i);
+                const T p1[3] = { tri.p1.x, tri.p1.y, tri.p1.z };
+                const T p2[3] = { tri.p2.x, tri.p2.y, tri.p2.z };
+                const T p3[3] = { tri.p3.x, tri.p3.y, tri.p3.z };
+                bool amb;
+                bool deg = classifyTriangle(p1, p2, p3, amb);
+                degenerate |= uint64_t(deg) << (i - first);
+                ambiguous |= uint64_t(amb) << (i - first);
+            }
 
-                // Multiplied by its transpose must be an identity. Because we did
-                // a matrix multiply we have to scale the epsilon that will be used.
-                // Since we know all the columns are unit vectors, we don't worry
-                // about the magnitude of the values, but rather just on the number of
-                // operations performed
-                if (!(newFlags & HubertBase::cDegenerate))
+            for (uint64_t rest = ambiguous; rest != 0; rest &= rest - 1)
+            {
+                size_t bit = 0;
+                while (!((rest >> bit) & 1))
                 {
-                    // Force using the parent class so that we don't do this validation
-                    // routine recursively
-                    if (!(Matrix3<T>::multiply(Matrix3<T>::transpose()).isIdentityTolerance(T(.00001))))
-                    {
-                        newFlags |= HubertBase::cDegenerate;
-                    }
+                    bit++;
                 }
-
-                // determinant must be 1
-                if (!(newFlags & HubertBase::cDegenerate))
+                const PackedTriangle3<T> tri = get(first + bit);
+                const T p1[3] = { tri.p1.x, tri.p1.y, tri.p1.z };
+                const T p2[3] = { tri.p2.x, tri.p2.y, tri.p2.z };
+                const T p3[3] = { tri.p3.x, tri.p3.y, tri.p3.z };
+                if (isDegenerateTriangleExact(p1, p2, p3))
                 {
-                    if (!isEqualScaled(this->determinant(), T(1.0), this->getDeterminantEpsilonScale()))
-                    {
-                        newFlags |= HubertBase::cDegenerate;
-                    }
+                    degenerate |= uint64_t(1) << bit;
                 }
             }
 
-            this->setValidityFlags(newFlags);
+            degenerateBits[w] = degenerate;
+            for (uint64_t rest = degenerate; rest != 0; rest &= rest - 1)
+            {
+                n++;
+            }
         }
-};
+        flagged[thread] += n;
+    });
 
+    size_t total = 0;
+    for (size_t n : flagged)
+    {
+        total += n;
+    }
+    return total;
+}
 
+template <typename T>
+inline size_t validateTriangles(const PackedTriangle3<T> * tris, size_t count, std::vector<uint64_t> & degenerateBits, unsigned threads = 1)
+{
+    return validateTriangles(count, [tris](size_t i) { return tris[i]; }, degenerateBits, threads);
+}
 
+/////////////////////////////////////////////////////////////////////////////
+// Indexed mesh
+/////////////////////////////////////////////////////////////////////////////
 
 //
-// Line3.
+// IndexedMesh.
+//
+// Triangles as triples of uint32_t indices into a shared vertex buffer,
+// the way most modellers and file formats deliver meshes. Each vertex is
+// stored and checked once; a vertex that is plainly valid and not
+// subnormal becomes a Point3 without being revalidated.
+//
+// The per-face data (Triangle3 degeneracy, unit normal, area, centroid and
+// bounds) is computed the first time it is asked for and cached. Moving a
+// vertex with setVertex() only makes the faces that use it out of date.
+// The lazy computation happens inside the const accessors, so a mesh that
+// is read from several threads at once needs update() called on it after
+// its last change.
+//
+// A face with an index out of range is an invalid triangle.
 //
-// Is considered valid as long as both Point3 input values used to 
-// define it are valid. 
-// 
-// A valid Line3 is considered degenerate if a valid unit vector could
-// not be computed from the input Vector3 from which the UnitVector3 
-// was constructed. This condition would happen if the input vcctor is
-// zero length, or if calculation of the unit vector overflowed the 
-// available range of the specified floating point type.
-// 
 template <typename T>
-class Line3 : public HubertBase
+class IndexedMesh
 {
     public:
         // constructors
-        Line3() : Line3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(1.0), T(1.0))) {}
-        Line3(const Point3<T> & inP1, const Point3<T> & inP2) { _normalizeAndValidate(inP1, inP2); }
-        Line3(const Line3 &) = default;
-        ~Line3() = default;
+        IndexedMesh() = default;
+
+        // indices holds 3 * faceCount vertex indices
+        IndexedMesh(const PackedPoint3<T> * vertices, size_t vertexCount, const uint32_t * indices, size_t faceCount)
+            : _vertices(vertices, vertices + vertexCount), _indices(indices, indices + 3 * faceCount) { _build(); }
+
+        // a trailing partial face in indices is ignored
+        IndexedMesh(std::vector<PackedPoint3<T>> vertices, std::vector<uint32_t> indices)
+            : _vertices(std::move(vertices)), _indices(std::move(indices)) { _indices.resize(_indices.size() - _indices.size() % 3); _build(); }
+        IndexedMesh(const IndexedMesh &) = default;
+        ~IndexedMesh() = default;
 
         // public operators
-        inline Line3<T> & operator=(const Line3<T> &) = default;
+        inline IndexedMesh<T> & operator=(const IndexedMesh<T> &) = default;
 
         // public methods
-        inline const Point3<T> & base() const { return _base; }
-        inline const Point3<T> & target() const { return _target; }
-        inline const UnitVector3<T>& unitDirection() const { return _unitDirection; }
-        inline const Vector3<T>& fullDirection() const { return _fullDirection; }
+        inline size_t vertexCount() const { return _vertices.size(); }
+        inline size_t faceCount() const { return _indices.size() / 3; }
+        inline const std::vector<PackedPoint3<T>> & vertices() const { return _vertices; }
+        inline const std::vector<uint32_t> & indices() const { return _indices; }
+        inline uint32_t index(size_t face, uint32_t corner) const { return _indices[3 * face + corner]; }
+
+        inline Point3<T> vertex(size_t v) const
+        {
+            if (v >= _vertices.size())
+            {
+                return invalidPoint3<T>();
+            }
+            const PackedPoint3<T> & p = _vertices[v];
+            return _normal[v] ? Point3<T>(trusted, p.x, p.y, p.z) : Point3<T>(p.x, p.y, p.z);
+        }
 
+        // a face with an out of range index has infinite coordinates
+        inline PackedTriangle3<T> packedTriangle(size_t face) const
+        {
+            PackedTriangle3<T> tri;
+            PackedPoint3<T> * corners[3] = { &tri.p1, &tri.p2, &tri.p3 };
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t v = index(face, c);
+                *corners[c] = (v < _vertices.size()) ? _vertices[v] : PackedPoint3<T>{ infinity<T>(), infinity<T>(), infinity<T>() };
+            }
+            return tri;
+        }
 
-    private:
-        // private methods
-        void _normalizeAndValidate(const Point3<T> & p1, const Point3<T> & p2)
+        // the faces as packed triangles, in face order
+        inline void packedTriangles(std::vector<PackedTriangle3<T>> & tris) const
         {
-            uint64_t newFlags = 0;
+            tris.resize(faceCount());
+            for (size_t f = 0; f < tris.size(); f++)
+            {
+                tris[f] = packedTriangle(f);
+            }
+        }
+
+        inline Triangle3<T> triangle(size_t face) const
+        {
+            return Triangle3<T>(vertex(index(face, 0)), vertex(index(face, 1)), vertex(index(face, 2)));
+        }
+
+        // cached per-face data, as unitNormal(), area(), centroid() and
+        // Aabb3(Triangle3) give it for triangle(face)
+        inline bool amDegenerate(size_t face) const { return _face(face).degenerate; }
+        inline const UnitVector3<T> & unitNormal(size_t face) const { return _face(face).normal; }
+        inline T area(size_t face) const { return _face(face).area; }
+        inline const Point3<T> & centroid(size_t face) const { return _face(face).centroid; }
+        inline const Aabb3<T> & bounds(size_t face) const { return _face(face).bounds; }
+
+        // the number of faces whose cached data is out of date
+        inline size_t staleFaces() const { return _staleCount; }
+
+        // moves a vertex, making the faces around it out of date. An index
+        // out of range changes nothing and returns false.
+        bool setVertex(size_t v, const PackedPoint3<T> & p)
+        {
+            if (v >= _vertices.size())
+            {
+                return false;
+            }
+            _vertices[v] = p;
+            _normal[v] = areNormalOrZero(p.x, p.y, p.z);
+            if (_faceOffsets.empty())
+            {
+                _buildAdjacency();
+            }
+            for (size_t i = _faceOffsets[v]; i < _faceOffsets[v + 1]; i++)
+            {
+                _markStale(_vertexFaces[i]);
+            }
+            return true;
+        }
 
-            // non calculated data is preserved as is
-            _base = p1;
-            _target = p2;
+        inline bool setVertex(size_t v, const Point3<T> & p) { return setVertex(v, PackedPoint3<T>{ p.x(), p.y(), p.z() }); }
 
-            // only do normalization and degeneracy checks if valid
-            if (!(isValid(p1) && isValid(p2)))
+        // brings the cached data of every face up to date, spread over
+        // threads (see parallelFor(), 1 by default)
+        void update(unsigned threads = 1) const
+        {
+            if (_staleCount == 0)
             {
-                newFlags |= cInvalid;
-                _fullDirection = Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
-                _unitDirection = UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+                return;
             }
-            else {
-                // if subnormal, we will do the calculations, but set the subnormal flag
-                // so that everyone knows that the calculations are reduced precision
-                if (isSubnormal(p1) || isSubnormal(p2))
+            parallelFor(faceCount(), 1024, threads, [&](size_t begin, size_t end, unsigned) {
+                for (size_t f = begin; f < end; f++)
                 {
-                    newFlags |= cSubnormalData;
+                    if (_stale[f])
+                    {
+                        _compute(f);
+                    }
                 }
+            });
+            std::fill(_stale.begin(), _stale.end(), uint8_t(0));
+            _staleCount = 0;
+        }
 
-                // if the two poits are too close, we are degenerate
-                if (isEqual(distance(p1, p2), T(0.0)))
+    private:
+        struct FaceData
+        {
+            UnitVector3<T>  normal;
+            Point3<T>       centroid;
+            Aabb3<T>        bounds;
+            T               area = T(0.0);
+            bool            degenerate = true;
+        };
+
+        void _build()
+        {
+            _normal.resize(_vertices.size());
+            for (size_t v = 0; v < _vertices.size(); v++)
+            {
+                _normal[v] = areNormalOrZero(_vertices[v].x, _vertices[v].y, _vertices[v].z);
+            }
+            _faces.assign(faceCount(), FaceData());
+            _stale.assign(faceCount(), uint8_t(1));
+            _staleCount = faceCount();
+        }
+
+        // the faces around each vertex, built the first time a vertex moves
+        void _buildAdjacency()
+        {
+            _faceOffsets.assign(_vertices.size() + 1, 0);
+            for (uint32_t v : _indices)
+            {
+                if (v < _vertices.size())
                 {
-                    newFlags |= cDegenerate;
-                    _fullDirection = Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
-                    _unitDirection = UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+                    _faceOffsets[v + 1]++;
                 }
-                else
+            }
+            for (size_t v = 0; v < _vertices.size(); v++)
+            {
+                _faceOffsets[v + 1] += _faceOffsets[v];
+            }
+            _vertexFaces.resize(_faceOffsets.back());
+            std::vector<size_t> fill(_faceOffsets.begin(), _faceOffsets.end() - 1);
+            for (size_t i = 0; i < _indices.size(); i++)
+            {
+                uint32_t v = _indices[i];
+                if (v < _vertices.size())
                 {
-                    _base = p1;
-                    _target = p2;
-                    _fullDirection = Vector3<T>(p2.x() - p1.x(), p2.y() - p1.y(), p2.z() - p1.z());
-                    _unitDirection = makeUnitVector3(_fullDirection);
-
-                    if (isDegenerate(_fullDirection) || isDegenerate(_unitDirection))
-                    {
-                        // if the vector calculation overflows, call the line degenerate because
-                        // there is not much we can do with it since the points are too far apart
-                        // to use in any calculation
-                        newFlags |= cDegenerate;
-                    }
+                    _vertexFaces[fill[v]++] = i / 3;
                 }
             }
+        }
 
-            setValidityFlags(newFlags);
+        inline void _markStale(size_t face)
+        {
+            if (!_stale[face])
+            {
+                _stale[face] = 1;
+                _staleCount++;
+            }
         }
-        
-        Point3<T>       _base;
-        Point3<T>       _target;
-        Vector3<T>  _fullDirection;
-        UnitVector3<T>  _unitDirection;
+
+        void _compute(size_t face) const
+        {
+            Triangle3<T> tri = triangle(face);
+            FaceData & d = _faces[face];
+            d.degenerate = isDegenerate(tri);
+            d.normal = hubert::unitNormal(tri);
+            d.area = hubert::area(tri);
+            d.centroid = hubert::centroid(tri);
+            d.bounds = Aabb3<T>(tri);
+        }
+
+        inline const FaceData & _face(size_t face) const
+        {
+            if (_stale[face])
+            {
+                _compute(face);
+                _stale[face] = 0;
+                _staleCount--;
+            }
+            return _faces[face];
+        }
+
+        std::vector<PackedPoint3<T>>    _vertices;
+        std::vector<uint8_t>            _normal;
+        std::vector<uint32_t>           _indices;
+        std::vector<size_t>             _faceOffsets;
+        std::vector<size_t>             _vertexFaces;
+        mutable std::vector<FaceData>   _faces;
+        mutable std::vector<uint8_t>    _stale;
+        mutable size_t                  _staleCount = 0;
 };
 
-//
-// Plane.
-//
-// Is considered valid as long as the base Point3 input values and the
-// up UnitVector3 used to define it are valid
-// 
-// A valid Plane is considered degenerate if a non-degenerate up UnitVector3
-// is not provided.
-// 
+/////////////////////////////////////////////////////////////////////////////
+// Plane slicing
+/////////////////////////////////////////////////////////////////////////////
+
+// One piece of a slice: where a triangle crosses a layer plane, from a to
+// b. Seen from above the plane (looking down up), the segments of a closed
+// mesh with outward facing normals run counter clockwise around the
+// material.
 template <typename T>
-class Plane : public HubertBase
+struct SliceSegment
 {
-    public:
-        // constructors
-        Plane() : Plane(Point3<T>(T(0.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0))) {}
-        Plane(const Point3<T> & p, const UnitVector3<T>& v) { _validate(p, v);  }
-        Plane(const Plane &) = default;
-        ~Plane() = default;
+    PackedPoint3<T>     a;
+    PackedPoint3<T>     b;
+    size_t              triangle;
+};
 
-        // public methods
-        inline Plane<T> & operator=(const Plane<T> &) = default;
+// Cuts tri where the signed distances dist of its vertices change sign,
+// counting a vertex exactly on the plane as above it. Returns false if the
+// triangle does not cross, or if a and b coincide (a degenerate triangle
+// folded over the plane), which could only add a point to a contour.
+// Crossing points are always interpolated from
+// the vertex below, so the triangle on the other side of a shared edge
+// computes a bitwise identical point.
+template <typename T>
+inline bool sliceTriangle(const PackedTriangle3<T> & tri, const T dist[3], PackedPoint3<T> & a, PackedPoint3<T> & b)
+{
+    const PackedPoint3<T> * p[3] = { &tri.p1, &tri.p2, &tri.p3 };
+    int crossings = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3;
+        bool belowI = dist[i] < T(0.0);
+        bool belowJ = dist[j] < T(0.0);
+        if (belowI == belowJ)
+        {
+            continue;
+        }
 
-        // public medthods
-        inline const Point3<T>& base() const { return _base; }
-        inline const UnitVector3<T>& up() const { return _up; }
+        int lo = belowI ? i : j;
+        int hi = belowI ? j : i;
+        T t = dist[lo] / (dist[lo] - dist[hi]);
+        PackedPoint3<T> q{ p[lo]->x + (p[hi]->x - p[lo]->x) * t, p[lo]->y + (p[hi]->y - p[lo]->y) * t, p[lo]->z + (p[hi]->z - p[lo]->z) * t };
 
-    private:
-        void _validate(const Point3<T>& p, const UnitVector3<T>& v)
+        // going round the triangle, the contour enters where the edge
+        // goes below the plane and leaves where it comes back up
+        if (belowJ)
         {
-            _base = p;
-            _up = v;
+            a = q;
+        }
+        else
+        {
+            b = q;
+        }
+        crossings++;
+    }
+    return crossings == 2 && !(a.x == b.x && a.y == b.y && a.z == b.z);
+}
 
-            uint64_t newFlags = 0;
+// The heights of the vertices of tri above basePlane, as slice() and
+// MeshSlicer measure them. Returns false if any is not finite.
+template <typename T>
+inline bool sliceHeights(const PackedTriangle3<T> & tri, const Plane<T> & basePlane, T height[3])
+{
+    const PackedPoint3<T> * p[3] = { &tri.p1, &tri.p2, &tri.p3 };
+    const UnitVector3<T> & up = basePlane.up();
+    const Point3<T> & base = basePlane.base();
+    for (int i = 0; i < 3; i++)
+    {
+        height[i] = up.x() * (p[i]->x - base.x()) + up.y() * (p[i]->y - base.y()) + up.z() * (p[i]->z - base.z());
+    }
+    return isValid(height[0]) && isValid(height[1]) && isValid(height[2]);
+}
 
-            // only do normalization and degeneracy checks if valid
-            if (!(isValid(_base) && isValid(_up)))
-            {
-                newFlags |= cInvalid;
-            }
-            else {
-                // if subnormal, we will do the calculations, but set the subnormal flag
-                // so that everyone knows that the calculations are reduced precision
-                if (isSubnormal(_base) || isSubnormal(_up))
-                {
-                    newFlags |= cSubnormalData;
-                }
+// The range [k0, k1] of the first layers layers, step apart, that a
+// triangle with the given vertex heights may cross. It is widened by one
+// to allow for rounding, and sliceTriangle() makes the final decision.
+// Returns false if the range is empty.
+template <typename T>
+inline bool sliceLayerRange(const T height[3], T step, size_t layers, size_t & k0, size_t & k1)
+{
+    T first = std::floor(std::min({ height[0], height[1], height[2] }) / step);
+    T last = std::floor(std::max({ height[0], height[1], height[2] }) / step) + T(1.0);
+    if (layers == 0 || last < T(0.0) || first >= T(layers))
+    {
+        return false;
+    }
+    k0 = (first > T(0.0)) ? size_t(first) : 0;
+    k1 = (last < T(layers - 1)) ? size_t(last) : layers - 1;
+    return true;
+}
 
-                if (isDegenerate(_up))
-                {
-                    newFlags |= cDegenerate;
-                }
-            }
+// Slices count triangles by layers parallel planes: basePlane, then
+// basePlane moved step along up, and so on. segments is resized to layers
+// and the crossings of layer k are appended to segments[k], in triangle
+// order. Each triangle only visits the layers between its lowest and
+// highest vertex.
+//
+// Unlike intersect(Triangle3, Plane) there is no epsilon here: a vertex
+// exactly on a layer counts as above it, so that the segments of a closed
+// mesh form closed loops without duplicates, and triangles lying in or
+// just touching a layer add nothing. Triangles with non-finite vertices
+// are skipped. Returns eDegenerate for a degenerate plane or a step that
+// is not positive and finite.
+//
+// segments can be any vector of vectors of SliceSegment, such as one of
+// std::pmr vectors, or a std::vector with a std::scoped_allocator_adaptor
+// so that the layers take their memory from the same place.
+template <typename T, typename Layers>
+inline ResultCode slice(const PackedTriangle3<T> * tris, size_t count, const Plane<T> & basePlane, T step, size_t layers, Layers & segments)
+{
+    segments.clear();
+    segments.resize(layers);
+    if (isDegenerate(basePlane) || !(step > T(0.0)) || !isValid(step))
+    {
+        return ResultCode::eDegenerate;
+    }
+    if (layers == 0)
+    {
+        return ResultCode::eOk;
+    }
 
-            setValidityFlags(newFlags);
+    for (size_t n = 0; n < count; n++)
+    {
+        const PackedTriangle3<T> & tri = tris[n];
+        T height[3];
+        size_t k0;
+        size_t k1;
+        if (!sliceHeights(tri, basePlane, height) || !sliceLayerRange(height, step, layers, k0, k1))
+        {
+            continue;
         }
 
+        for (size_t k = k0; k <= k1; k++)
+        {
+            T offset = T(k) * step;
+            const T dist[3] = { height[0] - offset, height[1] - offset, height[2] - offset };
+            SliceSegment<T> seg;
+            if (sliceTriangle(tri, dist, seg.a, seg.b))
+            {
+                seg.triangle = n;
+                segments[k].push_back(seg);
+            }
+        }
+    }
+    return ResultCode::eOk;
+}
 
-        // public data
-        Point3<T>       _base;
-        UnitVector3<T>  _up;
-};
+// the same for the faces of a mesh, in face order
+template <typename T, typename Layers>
+inline ResultCode slice(const IndexedMesh<T> & mesh, const Plane<T> & basePlane, T step, size_t layers, Layers & segments)
+{
+    std::vector<PackedTriangle3<T>> tris;
+    mesh.packedTriangles(tris);
+    return slice(tris.data(), tris.size(), basePlane, step, layers, segments);
+}
 
 //
-// Ray3.
+// SliceContour.
+//
+// A polyline where a mesh crosses a layer plane. A closed contour joins its
+// last point back to the first, which is not repeated. Seen from above,
+// contours of a closed mesh with outward facing normals run counter
+// clockwise around material, so holes run clockwise. Meshes that are not
+// closed can leave open contours.
 //
-// Is considered valid as long as the base Point3 input values and the
-// direction UnitVector3 used to define it are valid
-// 
-// A valid Ray3 is considered degenerate if a non-degenerate direction UnitVector3
-// is not provided.
-// 
 template <typename T>
-class Ray3 : public HubertBase
+struct SliceContour
 {
-    public:
-        // constructors
-        Ray3() : Ray3(Point3<T>(T(0.0), T(0.0), T(0.0)), UnitVector3<T>(T(0.0), T(0.0), T(1.0))) {}
-        Ray3(const Point3<T>& p, const UnitVector3<T>& v) { _validate(p, v); }
-        Ray3(const Ray3 &) = default;
-        ~Ray3() = default;
-
-        // public operators
-        inline Ray3<T> & operator=(const Ray3<T> &) = default;
+    std::vector<PackedPoint3<T>>    points;
+    bool                            closed = false;
+};
 
-        // public medthods
-        inline const Point3<T>& base() const { return _base; }
-        inline const UnitVector3<T> & unitDirection() const { return _direction; }
+// Hashes slice points by their exact coordinates. sliceTriangle() gives
+// both triangles on a shared edge a bitwise identical crossing point, so
+// this is in effect a hash on the crossed edge, which also joins contours
+// at mesh vertices lying exactly on the layer.
+template <typename T>
+struct SlicePointHash
+{
+    inline size_t operator()(const PackedPoint3<T> & p) const
+    {
+        std::hash<T> h;
+        size_t seed = h(p.x);
+        seed ^= h(p.y) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        seed ^= h(p.z) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
 
-    private:
-        void _validate(const Point3<T>& p, const UnitVector3<T>& v)
-        {
-            _base = p;
-            _direction = v;
+template <typename T>
+struct SlicePointEqual
+{
+    inline bool operator()(const PackedPoint3<T> & p, const PackedPoint3<T> & q) const
+    {
+        return p.x == q.x && p.y == q.y && p.z == q.z;
+    }
+};
 
-            uint64_t newFlags = 0;
+// Chains the segments of one layer into contours, appending them to
+// contours. Each segment is used once. Chains with a loose end are
+// followed from it first and come out open, and what is left are loops.
+template <typename T>
+inline void stitchContours(const std::vector<SliceSegment<T>> & segments, std::vector<SliceContour<T>> & contours)
+{
+    std::unordered_multimap<PackedPoint3<T>, size_t, SlicePointHash<T>, SlicePointEqual<T>> starts(segments.size());
+    std::unordered_set<PackedPoint3<T>, SlicePointHash<T>, SlicePointEqual<T>> ends(segments.size());
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        starts.emplace(segments[i].a, i);
+        ends.insert(segments[i].b);
+    }
 
-            // only do normalization and degeneracy checks if valid
-            if (!(isValid(_base) && isValid(_direction)))
+    std::vector<bool> used(segments.size(), false);
+    SlicePointEqual<T> same;
+    auto follow = [&](size_t i) {
+        SliceContour<T> contour;
+        contour.points.push_back(segments[i].a);
+        for (;;)
+        {
+            used[i] = true;
+            const PackedPoint3<T> & p = segments[i].b;
+            if (same(p, contour.points.front()))
             {
-                newFlags |= cInvalid;
+                contour.closed = true;
+                break;
             }
-            else {
-                // if subnormal, we will do the calculations, but set the subnormal flag
-                // so that everyone knows that the calculations are reduced precision
-                if (isSubnormal(_base) || isSubnormal(_direction))
-                {
-                    newFlags |= cSubnormalData;
-                }
+            contour.points.push_back(p);
 
-                if (isDegenerate(_direction))
-                {
-                    newFlags |= cDegenerate;
-                }
+            auto range = starts.equal_range(p);
+            auto next = range.first;
+            while (next != range.second && used[next->second])
+            {
+                ++next;
             }
-
-            setValidityFlags(newFlags);
+            if (next == range.second)
+            {
+                break;
+            }
+            i = next->second;
         }
+        contours.push_back(std::move(contour));
+    };
 
-        Point3<T>       _base;
-        UnitVector3<T>  _direction;
-};
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (!used[i] && ends.count(segments[i].a) == 0)
+        {
+            follow(i);
+        }
+    }
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (!used[i])
+        {
+            follow(i);
+        }
+    }
+}
 
 //
-// Segment3.
+// MeshSlicer.
+//
+// Cuts a triangle mesh by a stack of parallel planes, basePlane and then
+// basePlane moved step along up for each further layer, and stitches the
+// crossings of each layer into contours (see slice() for how triangles on
+// a layer are treated). The vertex heights are computed once, and each
+// triangle is bucketed into the layers its height range spans, so that a
+// layer only looks at the triangles that can cross it. Layers are
+// independent and are sliced in parallel.
+//
+// layers == 0 makes enough layers to reach the top of the mesh. A
+// degenerate plane, a step that is not positive and finite, more than
+// cMaxLayers layers asked for, or a step so small against the mesh that
+// reaching the top would take more than cMaxLayers layers, gives a slicer
+// with no layers, for which slice() reports eDegenerate.
 //
-// Is considered valid as long as both Point3 input values used to 
-// define it are valid. 
-// 
-// A valid Segment3 is considered degenerate if a valid unit vector could
-// not be computed from the input Vector3 from which the UnitVector3 
-// was constructed. This condition would happen if the input vector is
-// zero length, or if calculation of the unit vector overflowed the 
-// available range of the specified floating point type.
-// 
 template <typename T>
-class Segment3 : public HubertBase
+class MeshSlicer
 {
     public:
+        static constexpr size_t cMaxLayers = size_t(1) << 24;
+
         // constructors
-        Segment3() : Segment3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(1.0), T(1.0))) {}
-        Segment3(const Point3<T>& inP1, const Point3<T>& inP2) { _validate(inP1, inP2); }
-        Segment3(const Segment3 &) = default;
-        ~Segment3() = default;
+        MeshSlicer() = default;
+        MeshSlicer(const PackedTriangle3<T> * tris, size_t count, const Plane<T> & basePlane, T step, size_t layers = 0)
+            : _basePlane(basePlane), _step(step) { _build(tris, count, layers); }
+        MeshSlicer(const IndexedMesh<T> & mesh, const Plane<T> & basePlane, T step, size_t layers = 0)
+            : _basePlane(basePlane), _step(step)
+        {
+            std::vector<PackedTriangle3<T>> tris;
+            mesh.packedTriangles(tris);
+            _build(tris.data(), tris.size(), layers);
+        }
+        MeshSlicer(const MeshSlicer &) = default;
+        ~MeshSlicer() = default;
 
         // public operators
-        inline Segment3<T> & operator=(const Segment3<T> &) = default;
+        inline MeshSlicer<T> & operator=(const MeshSlicer<T> &) = default;
+
+        // public methods
+        inline size_t layers() const { return _offsets.empty() ? 0 : _offsets.size() - 1; }
+        inline const Plane<T> & basePlane() const { return _basePlane; }
+        inline T step() const { return _step; }
+
+        // the number of triangles bucketed into a layer
+        inline size_t candidates(size_t layer) const { return _offsets[layer + 1] - _offsets[layer]; }
+
+        // the crossing segments of one layer, in triangle order
+        void segments(size_t layer, std::vector<SliceSegment<T>> & segs) const
+        {
+            segs.clear();
+            T offset = T(layer) * _step;
+            for (size_t b = _offsets[layer]; b < _offsets[layer + 1]; b++)
+            {
+                size_t n = _bucket[b];
+                const T dist[3] = { _heights[3 * n] - offset, _heights[3 * n + 1] - offset, _heights[3 * n + 2] - offset };
+                SliceSegment<T> seg;
+                if (sliceTriangle(_tris[n], dist, seg.a, seg.b))
+                {
+                    seg.triangle = n;
+                    segs.push_back(seg);
+                }
+            }
+        }
+
+        // replaces contours with those of one layer
+        ResultCode sliceLayer(size_t layer, std::vector<SliceContour<T>> & contours) const
+        {
+            contours.clear();
+            if (layer >= layers())
+            {
+                return _degenerate ? ResultCode::eDegenerate : ResultCode::eNoIntersection;
+            }
+            std::vector<SliceSegment<T>> segs;
+            segments(layer, segs);
+            stitchContours(segs, contours);
+            return ResultCode::eOk;
+        }
 
-        // public methods
-        inline const Point3<T> & base() const { return _base; }
-        inline const Point3<T> & target() const { return _target; }
+        // the contours of every layer, spread over threads (see parallelFor(),
+        // 0 for one per hardware thread)
+        ResultCode slice(std::vector<std::vector<SliceContour<T>>> & contours, unsigned threads = 0) const
+        {
+            contours.assign(layers(), std::vector<SliceContour<T>>());
+            if (_degenerate)
+            {
+                return ResultCode::eDegenerate;
+            }
+            parallelFor(layers(), 1, threads, [&](size_t begin, size_t end, unsigned) {
+                for (size_t k = begin; k < end; k++)
+                {
+                    sliceLayer(k, contours[k]);
+                }
+            });
+            return ResultCode::eOk;
+        }
 
     private:
-        void _validate(const Point3<T>& p1, const Point3<T>& p2)
+        void _build(const PackedTriangle3<T> * tris, size_t count, size_t layers)
         {
-            _base = p1;
-            _target = p2;
-
-            uint64_t newFlags = 0;
+            _degenerate = isDegenerate(_basePlane) || !(_step > T(0.0)) || !isValid(_step) || layers > cMaxLayers;
+            if (_degenerate)
+            {
+                return;
+            }
 
-            // only do subnormal and degeneracy checks if valid
-            if (!(isValid(_base) && isValid(_target)))
+            _tris.assign(tris, tris + count);
+            _heights.resize(3 * count);
+            std::vector<bool> valid(count);
+            T top = T(0.0);
+            for (size_t n = 0; n < count; n++)
             {
-                newFlags |= cInvalid;
+                valid[n] = sliceHeights(_tris[n], _basePlane, &_heights[3 * n]);
+                if (valid[n])
+                {
+                    top = std::max({ top, _heights[3 * n], _heights[3 * n + 1], _heights[3 * n + 2] });
+                }
             }
-            else {
-                // if subnormal, we will do the calculations, but set the subnormal flag
-                // so that everyone knows that the calculations are reduced precision
-                if (isSubnormal(_base) || isSubnormal(_target))
+            if (layers == 0)
+            {
+                // up to the highest vertex, including a layer through it
+                T needed = std::floor(top / _step) + T(1.0);
+                if (!(needed <= T(cMaxLayers)))
                 {
-                    newFlags |= cSubnormalData;
+                    _tris.clear();
+                    _heights.clear();
+                    _degenerate = true;
+                    return;
                 }
+                layers = size_t(needed);
+            }
 
-                T dist = distance(p1, p2);
-                if (isEqual(dist, T(0.0)) || !isValid(dist))
+            // two passes over the triangles: count the bucket sizes, then
+            // fill them
+            _offsets.assign(layers + 1, 0);
+            for (size_t n = 0; n < count; n++)
+            {
+                size_t k0;
+                size_t k1;
+                if (valid[n] && sliceLayerRange(&_heights[3 * n], _step, layers, k0, k1))
                 {
-                    newFlags |= cDegenerate;
+                    for (size_t k = k0; k <= k1; k++)
+                    {
+                        _offsets[k + 1]++;
+                    }
                 }
             }
+            for (size_t k = 0; k < layers; k++)
+            {
+                _offsets[k + 1] += _offsets[k];
+            }
 
-            setValidityFlags(newFlags);
+            _bucket.resize(_offsets[layers]);
+            std::vector<size_t> fill(_offsets.begin(), _offsets.end() - 1);
+            for (size_t n = 0; n < count; n++)
+            {
+                size_t k0;
+                size_t k1;
+                if (valid[n] && sliceLayerRange(&_heights[3 * n], _step, layers, k0, k1))
+                {
+                    for (size_t k = k0; k <= k1; k++)
+                    {
+                        _bucket[fill[k]++] = n;
+                    }
+                }
+            }
         }
 
-        //private data
-        Point3<T>   _base;
-        Point3<T>   _target;
+        Plane<T>                        _basePlane;
+        T                               _step = T(0.0);
+        bool                            _degenerate = true;
+        std::vector<PackedTriangle3<T>> _tris;
+        std::vector<T>                  _heights;
+        std::vector<size_t>             _offsets;
+        std::vector<size_t>             _bucket;
 };
 
+/////////////////////////////////////////////////////////////////////////////
+// Triangle soup
+/////////////////////////////////////////////////////////////////////////////
+
 //
-// Triangle3.
+// TriangleSoup.
+//
+// A structure-of-arrays container for large numbers of triangles. The
+// coordinates of each of the three vertices are kept in separate x, y and z
+// arrays, and instead of a flags word per entity the soup keeps a single
+// bitset with one bit per triangle, which is set if the triangle is
+// degenerate (and therefore also if it is invalid).
+//
+// Triangles are validated when they are added, so the batch routines can
+// skip the unusable ones without revisiting the coordinates.
 //
-// Is considered valid as long as all 3 Point3 input values used to 
-// define it are valid. 
-// 
-// A valid Triangle3 is considered degenerate For a number of reasons:
-//    * Any of the 3 edges is collapsed to 0 length
-//    * Any of the 3 edges overflows when its length is computed
-//    * Are of the triangle is computed to be 0
-//    * Cross product of edge1 & edge2 creates a vector of 0 length
-//    * Cross product of edge1 & edge3 creates a vector of 0 length
-//    * Cross product of edge2 & edge3 creates a vector of 0 length
-// 
-// 
 template <typename T>
-class Triangle3 : public HubertBase
+class TriangleSoup
 {
     public:
         // constructors
-        Triangle3() : Triangle3(Point3<T>(T(0.0), T(0.0), T(0.0)), Point3<T>(T(1.0), T(0.0), T(0.0)), Point3<T>(T(0.0), T(1.0), T(0.0))) {}
-        Triangle3(const Point3<T>& inP1, const Point3<T>& inP2, const Point3<T>& inP3) { _validate(inP1, inP2, inP3); }
-        Triangle3(const Triangle3 &) = default;
-        ~Triangle3() = default;
+        TriangleSoup() = default;
+        template <typename Iter>
+        TriangleSoup(Iter first, Iter last) { for (; first != last; ++first) { push_back(*first); } }
+        explicit TriangleSoup(const IndexedMesh<T> & mesh) { append(mesh); }
+        TriangleSoup(const TriangleSoup &) = default;
+        ~TriangleSoup() = default;
 
         // public operators
-        inline Triangle3<T> & operator=(const Triangle3<T> &) = default;
+        inline TriangleSoup<T> & operator=(const TriangleSoup<T> &) = default;
 
         // public methods
-        inline const Point3<T>& p1() const { return _p1; }
-        inline const Point3<T>& p2() const { return _p2; }
-        inline const Point3<T>& p3() const { return _p3; }
+        inline size_t size() const { return _size; }
+        inline bool empty() const { return _size == 0; }
 
-    private:
-        void _validate(const Point3<T>& p1, const Point3<T>& p2, const Point3<T>& p3)
+        inline void reserve(size_t n)
         {
-            _p1 = p1;
-            _p2 = p2;
-            _p3 = p3;
+            for (int i = 0; i < 3; i++)
+            {
+                _x[i].reserve(n);
+                _y[i].reserve(n);
+                _z[i].reserve(n);
+            }
+            _degenerate.reserve((n + 63) / 64);
+        }
 
-            uint64_t newFlags = 0;
+        inline void clear()
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                _x[i].clear();
+                _y[i].clear();
+                _z[i].clear();
+            }
+            _degenerate.clear();
+            _size = 0;
+        }
 
-            // only do subnormal and degeneracy checks if valid
-            if (!(isValid(_p1) && isValid(_p2) && isValid(_p3)))
+        inline void push_back(const Triangle3<T> & tri)
+        {
+            _push(tri.p1(), 0);
+            _push(tri.p2(), 1);
+            _push(tri.p3(), 2);
+
+            if ((_size & 63) == 0)
             {
-                newFlags |= cInvalid;
+                _degenerate.push_back(0);
             }
-            else {
-                // if subnormal, we will do the calculations, but set the subnormal flag
-                // so that everyone knows that the calculations are reduced precision
-                if (isSubnormal(_p1) || isSubnormal(_p2) || isSubnormal(_p3))
-                {
-                    newFlags |= cSubnormalData;
-                }
+            if (tri.amDegenerate())
+            {
+                _degenerate[_size >> 6] |= uint64_t(1) << (_size & 63);
+            }
+            _size++;
+        }
 
-                // we do multiple degeneracy tests because we need to fail if any of them fail. If we did not
-                // other calculations down stream might fail because we reported a non-degenerate triangle. 
-                // Because of numerical  instability depending on the scale of the numbers, it is possible for 
-                // some approaches to differ in their response.
+        inline void push_back(const PackedTriangle3<T> & tri) { push_back(makeTriangle3(tri)); }
 
-                // first degeneracy test - collapsed edge or overflow edge. Overflow edges basically mean that
-                // even though the points are valid, the length of a side overflows what is representable in the
-                // floating point unit being used. Allowing that to be considered a non-degenerate triangle causes
-                // many downstream calculations to fail, thus prompting our decision to call it degenerate.
-                T dist1 = distance(_p1, _p2);
-                T dist2 = distance(_p2, _p3);
-                T dist3 = distance(_p3, _p1);
-                if (isEqual(dist1, T(0.0)) || !isValid(dist1) || isEqual(dist2, T(0.0)) || !isValid(dist2) || isEqual(dist3, T(0.0)) || !isValid(dist3))
-                {
-                    newFlags |= cDegenerate;
-                }
+        // appends count packed triangles, classified in bulk
+        inline void append(const PackedTriangle3<T> * tris, size_t count, unsigned threads = 1)
+        {
+            std::vector<uint64_t> bits;
+            validateTriangles(tris, count, bits, threads);
+            append(count, [tris](size_t i) { return tris[i]; }, bits.data());
+        }
 
-                // 2nd degeneracy check - the area
-                if (!(newFlags & cDegenerate))
+        // appends the count triangles get(i) returns, with the degeneracy
+        // bits validateTriangles() gave them
+        template <typename Get>
+        inline void append(size_t count, Get get, const uint64_t * bits)
+        {
+            size_t first = _size;
+            for (int k = 0; k < 3; k++)
+            {
+                _x[k].resize(first + count);
+                _y[k].resize(first + count);
+                _z[k].resize(first + count);
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                const PackedTriangle3<T> tri = get(i);
+                const PackedPoint3<T> * pts[3] = { &tri.p1, &tri.p2, &tri.p3 };
+                for (int k = 0; k < 3; k++)
                 {
-                    if (isEqual(area(*this), T(0.0)))
-                    {
-                        newFlags |= cDegenerate;
-                    }
+                    _x[k][first + i] = pts[k]->x;
+                    _y[k][first + i] = pts[k]->y;
+                    _z[k][first + i] = pts[k]->z;
                 }
+            }
 
-                // 3rd degneracy check - cross product one way
-                if (!(newFlags & cDegenerate))
+            // the bits go in a word at a time, shifted to where the soup
+            // has got to
+            _size += count;
+            _degenerate.resize((_size + 63) / 64, 0);
+            size_t shift = first & 63;
+            for (size_t w = 0; w < (count + 63) / 64; w++)
+            {
+                uint64_t word = bits[w];
+                if (count - 64 * w < 64)
                 {
-                    Vector3<T> v = crossProduct(p2 - p1, p3 - p1);
-                    if (isEqual(v.x(), T(0.0)) && isEqual(v.y(), T(0.0)) && isEqual(v.z(), T(0.0)))
-                    {
-                        newFlags |= cDegenerate;
-                    }
+                    word &= (uint64_t(1) << (count - 64 * w)) - 1;
                 }
-                // 3rd degneracy check - cross product second way
-                if (!(newFlags & cDegenerate))
+                _degenerate[(first >> 6) + w] |= word << shift;
+                if (shift != 0 && word >> (64 - shift) != 0)
                 {
-                    Vector3<T> v = crossProduct(p2 - p1, p3 - p2);
-                    if (isEqual(v.x(), T(0.0)) && isEqual(v.y(), T(0.0)) && isEqual(v.z(), T(0.0)))
-                    {
-                        newFlags |= cDegenerate;
-                    }
+                    _degenerate[(first >> 6) + w + 1] |= word >> (64 - shift);
                 }
+            }
+        }
 
-                // 3rd degneracy check - cross product third way
-                if (!(newFlags & cDegenerate))
+        // appends the faces of a mesh, with the degeneracy the mesh has cached
+        inline void append(const IndexedMesh<T> & mesh)
+        {
+            reserve(_size + mesh.faceCount());
+            for (size_t f = 0; f < mesh.faceCount(); f++)
+            {
+                PackedTriangle3<T> tri = mesh.packedTriangle(f);
+                const PackedPoint3<T> * pts[3] = { &tri.p1, &tri.p2, &tri.p3 };
+                for (int k = 0; k < 3; k++)
                 {
-                    Vector3<T> v = crossProduct(p3 - p1, p3 - p2);
-                    if (isEqual(v.x(), T(0.0)) && isEqual(v.y(), T(0.0)) && isEqual(v.z(), T(0.0)))
-                    {
-                        newFlags |= cDegenerate;
-                    }
+                    _x[k].push_back(pts[k]->x);
+                    _y[k].push_back(pts[k]->y);
+                    _z[k].push_back(pts[k]->z);
                 }
 
+                if ((_size & 63) == 0)
+                {
+                    _degenerate.push_back(0);
+                }
+                if (mesh.amDegenerate(f))
+                {
+                    _degenerate[_size >> 6] |= uint64_t(1) << (_size & 63);
+                }
+                _size++;
             }
+        }
 
-            setValidityFlags(newFlags);
+        // rebuilds (and so revalidates) the i-th triangle
+        inline Triangle3<T> triangle(size_t i) const
+        {
+            return Triangle3<T>(
+                Point3<T>(_x[0][i], _y[0][i], _z[0][i]),
+                Point3<T>(_x[1][i], _y[1][i], _z[1][i]),
+                Point3<T>(_x[2][i], _y[2][i], _z[2][i]));
         }
 
-        //private data
-        Point3<T>   _p1;
-        Point3<T>   _p2;
-        Point3<T>   _p3;
+        inline bool amDegenerate(size_t i) const { return (_degenerate[i >> 6] >> (i & 63)) & 1; }
+
+        // raw access to the coordinate arrays of vertex 0, 1 or 2, and to the
+        // degeneracy bitset, for use by batch routines
+        inline const T * x(uint32_t vertex) const { return _x[vertex].data(); }
+        inline const T * y(uint32_t vertex) const { return _y[vertex].data(); }
+        inline const T * z(uint32_t vertex) const { return _z[vertex].data(); }
+        inline const uint64_t * degenerateBits() const { return _degenerate.data(); }
+
+    private:
+        inline void _push(const Point3<T> & p, int vertex)
+        {
+            _x[vertex].push_back(p.x());
+            _y[vertex].push_back(p.y());
+            _z[vertex].push_back(p.z());
+        }
+
+        // private data
+        std::vector<T>          _x[3];
+        std::vector<T>          _y[3];
+        std::vector<T>          _z[3];
+        std::vector<uint64_t>   _degenerate;
+        size_t                  _size = 0;
 };
 
 /////////////////////////////////////////////////////////////////////////////
-// Special invalid entity instances
+// SIMD ray/triangle kernels
+//
+// These run the Moller-Trumbore test on several rays/triangles at once. The
+// arithmetic is performed in the same order as in mollerTrumbore() (no fused
+// multiply-adds, true divisions), and the epsilon comparisons are the
+// branch-free equivalents of isEqual(), isGreaterOrEqual() and
+// isLessOrEqual(), so each lane gives bit for bit the same answer as the
+// scalar code. That only holds if the compiler is not allowed to contract
+// the scalar code into fused multiply-adds either (e.g. GCC with -mfma or
+// -march=native needs -ffp-contract=off).
 /////////////////////////////////////////////////////////////////////////////
 
-template <typename T>
-inline T invalidValue()
+enum class SimdLevel : uint32_t
 {
-    return infinity<T>();
-}
+    eScalar = 0,
+    eNeon,
+    eAvx2,
+    eAvx512
+};
 
-template <typename T>
-inline Point3<T> invalidPoint3()
+inline SimdLevel detectSimdLevel()
 {
-    return Point3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+#if defined(HUBERT_SIMD_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || maxLeaf < 7)
+    {
+        return SimdLevel::eScalar;
+    }
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6)
+    {
+        return SimdLevel::eAvx512;
+    }
+    if ((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6)
+    {
+        return SimdLevel::eAvx2;
+    }
+    return SimdLevel::eScalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return SimdLevel::eAvx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::eAvx2;
+    }
+    return SimdLevel::eScalar;
+#endif
+#elif defined(HUBERT_SIMD_NEON)
+    return SimdLevel::eNeon;
+#else
+    return SimdLevel::eScalar;
+#endif
 }
 
-template <typename T>
-inline Vector3<T> invalidVector3()
+// the best instruction set available on this machine, detected once
+inline SimdLevel simdLevel()
 {
-    return Vector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
+    static const SimdLevel level = detectSimdLevel();
+    return level;
 }
 
+// Results of a packet test. Bit i of each mask corresponds to lane i, and
+// every in-range lane has exactly one bit set across the four masks. t is
+// only meaningful for the lanes set in ok.
 template <typename T>
-inline UnitVector3<T> invalidUnitVector3()
+struct PacketResult
 {
-    return UnitVector3<T>(infinity<T>(), infinity<T>(), infinity<T>());
-}
+    static constexpr uint32_t cMaxLanes = 16;
 
-/////////////////////////////////////////////////////////////////////////////
-// Creation functions - (alternates to provided constructor)
-/////////////////////////////////////////////////////////////////////////////
+    uint32_t    ok = 0;
+    uint32_t    coplanar = 0;
+    uint32_t    noIntersection = 0;
+    uint32_t    degenerate = 0;
+    T           t[cMaxLanes];
+};
 
+// Input of the lane kernels: each coordinate is a pointer to an array of
+// lanes, or to a single value that is broadcast to all lanes when the
+// corresponding stride is 0.
 template <typename T>
-inline Vector3<T> makeVector3(const Point3<T> & from, const Point3<T> to)
+struct MollerLanes
 {
-    return Vector3<T>(to.x() - from.x(), to.y() - from.y(), to.z() - from.z());
-}
+    const T *   orig[3];
+    const T *   dir[3];
+    const T *   vert[3][3];
+    size_t      rayStride;
+    size_t      triStride;
+};
 
 template <typename T>
-inline Vector3<T> makeVector3(const UnitVector3<T> & u)
+inline void mollerLanesScalar(const MollerLanes<T> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, T * tOut)
 {
-    return Vector3<T>(u.x(), u.y(), u.z());
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t r = i * in.rayStride;
+        size_t k = i * in.triStride;
+        const T orig[3] = { in.orig[0][r], in.orig[1][r], in.orig[2][r] };
+        const T dir[3] = { in.dir[0][r], in.dir[1][r], in.dir[2][r] };
+        const T vert0[3] = { in.vert[0][0][k], in.vert[0][1][k], in.vert[0][2][k] };
+        const T edge1[3] = { in.vert[1][0][k] - vert0[0], in.vert[1][1][k] - vert0[1], in.vert[1][2][k] - vert0[2] };
+        const T edge2[3] = { in.vert[2][0][k] - vert0[0], in.vert[2][1][k] - vert0[1], in.vert[2][2][k] - vert0[2] };
+
+        T t = T(0.0);
+        ResultCode ret = mollerTrumbore(orig, dir, vert0, edge1, edge2, t);
+        if (ret == ResultCode::eCoplanar)
+        {
+            coplanarBits |= uint32_t(1) << i;
+        }
+        else if (ret == ResultCode::eOk && isGreaterOrEqual(t, T(0.0)))
+        {
+            okBits |= uint32_t(1) << i;
+        }
+        tOut[i] = t;
+    }
+}
+
+// The body of the vector kernels, shared by all the instruction sets. V is
+// one of the Simd* operation sets below.
+#define HUBERT_MOLLER_LANES_BODY(V)                                                     \
+{                                                                                       \
+    typedef typename V::Scalar S;                                                       \
+    typedef typename V::Reg Reg;                                                        \
+    typedef typename V::Mask Mask;                                                      \
+    const Reg eps = V::set1(epsilon<S>());                                              \
+    const Reg negEps = V::set1(-epsilon<S>());                                          \
+    const Reg one = V::set1(S(1.0));                                                    \
+    const Reg maxVal = V::set1(std::numeric_limits<S>::max());                          \
+    for (size_t c = 0; c < n; c += V::cWidth)                                           \
+    {                                                                                   \
+        size_t rem = n - c;                                                             \
+        Reg ox = V::load(in.orig[0], in.rayStride, c, rem);                             \
+        Reg oy = V::load(in.orig[1], in.rayStride, c, rem);                             \
+        Reg oz = V::load(in.orig[2], in.rayStride, c, rem);                             \
+        Reg dx = V::load(in.dir[0], in.rayStride, c, rem);                              \
+        Reg dy = V::load(in.dir[1], in.rayStride, c, rem);                              \
+        Reg dz = V::load(in.dir[2], in.rayStride, c, rem);                              \
+        Reg v0x = V::load(in.vert[0][0], in.triStride, c, rem);                         \
+        Reg v0y = V::load(in.vert[0][1], in.triStride, c, rem);                         \
+        Reg v0z = V::load(in.vert[0][2], in.triStride, c, rem);                         \
+        Reg e1x = V::sub(V::load(in.vert[1][0], in.triStride, c, rem), v0x);            \
+        Reg e1y = V::sub(V::load(in.vert[1][1], in.triStride, c, rem), v0y);            \
+        Reg e1z = V::sub(V::load(in.vert[1][2], in.triStride, c, rem), v0z);            \
+        Reg e2x = V::sub(V::load(in.vert[2][0], in.triStride, c, rem), v0x);            \
+        Reg e2y = V::sub(V::load(in.vert[2][1], in.triStride, c, rem), v0y);            \
+        Reg e2z = V::sub(V::load(in.vert[2][2], in.triStride, c, rem), v0z);            \
+        /* pvec = dir x edge2 */                                                        \
+        Reg px = V::sub(V::mul(dy, e2z), V::mul(dz, e2y));                              \
+        Reg py = V::sub(V::mul(dz, e2x), V::mul(dx, e2z));                              \
+        Reg pz = V::sub(V::mul(dx, e2y), V::mul(dy, e2x));                              \
+        Mask pvecValid = V::mand(V::mand(V::cmple(V::abs(px), maxVal),                  \
+            V::cmple(V::abs(py), maxVal)), V::cmple(V::abs(pz), maxVal));               \
+        Reg det = V::add(V::add(V::mul(e1x, px), V::mul(e1y, py)), V::mul(e1z, pz));    \
+        Mask coplanar = V::mand(pvecValid, V::cmple(V::abs(det), eps));                 \
+        /* tvec = orig - vert0 */                                                       \
+        Reg tx = V::sub(ox, v0x);                                                       \
+        Reg ty = V::sub(oy, v0y);                                                       \
+        Reg tz = V::sub(oz, v0z);                                                       \
+        Reg u = V::div(V::add(V::add(V::mul(tx, px), V::mul(ty, py)), V::mul(tz, pz)), det); \
+        Mask ok = V::mand(V::cmpge(u, negEps), V::lessOrEqualOne(u, one, eps));         \
+        /* qvec = tvec x edge1 */                                                       \
+        Reg qx = V::sub(V::mul(ty, e1z), V::mul(tz, e1y));                              \
+        Reg qy = V::sub(V::mul(tz, e1x), V::mul(tx, e1z));                              \
+        Reg qz = V::sub(V::mul(tx, e1y), V::mul(ty, e1x));                              \
+        Reg v = V::div(V::add(V::add(V::mul(dx, qx), V::mul(dy, qy)), V::mul(dz, qz)), det); \
+        ok = V::mand(ok, V::mand(V::cmpge(v, negEps), V::lessOrEqualOne(V::add(u, v), one, eps))); \
+        Reg t = V::div(V::add(V::add(V::mul(e2x, qx), V::mul(e2y, qy)), V::mul(e2z, qz)), det); \
+        ok = V::mand(ok, V::mand(pvecValid, V::cmpge(t, negEps)));                      \
+        uint32_t laneMask = (rem >= V::cWidth) ? uint32_t((uint64_t(1) << V::cWidth) - 1) : uint32_t((1u << rem) - 1); \
+        uint32_t coplanarLanes = V::bits(coplanar) & laneMask;                          \
+        coplanarBits |= coplanarLanes << c;                                             \
+        okBits |= (V::bits(ok) & laneMask & ~coplanarLanes) << c;                       \
+        V::store(tOut + c, t, rem);                                                     \
+    }                                                                                   \
+}
+
+// Error bounds of the float filter of intersect(mixedPrecision, ...). The
+// determinant and the numerators of u, v and t are each a sum of products
+// of at most nine rounded operations, the ray's rounding to float
+// included, so their float values are off the exact ones by less than 16
+// unit roundoffs of their absolute evaluation; cMixedBound leaves four
+// times that for the rounding of the bounds and of the tests themselves.
+// cMixedMargin covers the epsilon of the double comparisons and the
+// rounding of the double test. The bounds only hold while no product can
+// overflow or underflow, so the largest magnitude of each factor has to
+// lie in [cMixedMin, cMixedMax].
+constexpr float cMixedBound = 1.0f / 262144.0f;         // 2^-18
+constexpr float cMixedMargin = 1.0f / 1048576.0f;       // 2^-20
+constexpr float cMixedMin = 1.0f / 4294967296.0f;       // 2^-32
+constexpr float cMixedMax = 4294967296.0f;              // 2^32
+
+// The body of the float filter kernels. A lane is settled when the
+// determinant is certainly not zero and, with its sign known, u, v, u + v
+// or t is certainly outside the range the double test accepts; every
+// other lane is set in maybeBits. NaNs fail every test, so they are never
+// settled. Where the bounds hold and the determinant is certainly not
+// zero, the lane is set in boundedBits too and tLow has a lower bound on
+// the double t, as far as that bound is positive.
+#define HUBERT_MIXED_FILTER_BODY(V)                                                     \
+{                                                                                       \
+    typedef typename V::Reg Reg;                                                        \
+    typedef typename V::Mask Mask;                                                      \
+    const Reg zero = V::set1(0.0f);                                                     \
+    const Reg bound6 = V::set1(6.0f * cMixedBound);                                     \
+    const Reg bound12 = V::set1(12.0f * cMixedBound);                                   \
+    const Reg margin = V::set1(cMixedMargin);                                           \
+    const Reg lo = V::set1(cMixedMin);                                                  \
+    const Reg hi = V::set1(cMixedMax);                                                  \
+    for (size_t c = 0; c < n; c += V::cWidth)                                           \
+    {                                                                                   \
+        size_t rem = n - c;                                                             \
+        Reg ox = V::load(in.orig[0], in.rayStride, c, rem);                             \
+        Reg oy = V::load(in.orig[1], in.rayStride, c, rem);                             \
+        Reg oz = V::load(in.orig[2], in.rayStride, c, rem);                             \
+        Reg dx = V::load(in.dir[0], in.rayStride, c, rem);                              \
+        Reg dy = V::load(in.dir[1], in.rayStride, c, rem);                              \
+        Reg dz = V::load(in.dir[2], in.rayStride, c, rem);                              \
+        Reg v0x = V::load(in.vert[0][0], in.triStride, c, rem);                         \
+        Reg v0y = V::load(in.vert[0][1], in.triStride, c, rem);                         \
+        Reg v0z = V::load(in.vert[0][2], in.triStride, c, rem);                         \
+        Reg e1x = V::sub(V::load(in.vert[1][0], in.triStride, c, rem), v0x);            \
+        Reg e1y = V::sub(V::load(in.vert[1][1], in.triStride, c, rem), v0y);            \
+        Reg e1z = V::sub(V::load(in.vert[1][2], in.triStride, c, rem), v0z);            \
+        Reg e2x = V::sub(V::load(in.vert[2][0], in.triStride, c, rem), v0x);            \
+        Reg e2y = V::sub(V::load(in.vert[2][1], in.triStride, c, rem), v0y);            \
+        Reg e2z = V::sub(V::load(in.vert[2][2], in.triStride, c, rem), v0z);            \
+        Reg px = V::sub(V::mul(dy, e2z), V::mul(dz, e2y));                              \
+        Reg py = V::sub(V::mul(dz, e2x), V::mul(dx, e2z));                              \
+        Reg pz = V::sub(V::mul(dx, e2y), V::mul(dy, e2x));                              \
+        Reg det = V::add(V::add(V::mul(e1x, px), V::mul(e1y, py)), V::mul(e1z, pz));    \
+        Reg tx = V::sub(ox, v0x);                                                       \
+        Reg ty = V::sub(oy, v0y);                                                       \
+        Reg tz = V::sub(oz, v0z);                                                       \
+        Reg qx = V::sub(V::mul(ty, e1z), V::mul(tz, e1y));                              \
+        Reg qy = V::sub(V::mul(tz, e1x), V::mul(tx, e1z));                              \
+        Reg qz = V::sub(V::mul(tx, e1y), V::mul(ty, e1x));                              \
+        Reg nu = V::add(V::add(V::mul(tx, px), V::mul(ty, py)), V::mul(tz, pz));        \
+        Reg nv = V::add(V::add(V::mul(dx, qx), V::mul(dy, qy)), V::mul(dz, qz));        \
+        Reg nt = V::add(V::add(V::mul(e2x, qx), V::mul(e2y, qy)), V::mul(e2z, qz));     \
+        /* the largest magnitude of each factor, |orig - vert0| <= 2 * mT */            \
+        Reg mD = V::max(V::max(V::abs(dx), V::abs(dy)), V::abs(dz));                    \
+        Reg mE1 = V::max(V::max(V::abs(e1x), V::abs(e1y)), V::abs(e1z));                \
+        Reg mE2 = V::max(V::max(V::abs(e2x), V::abs(e2y)), V::abs(e2z));                \
+        Reg mT = V::max(V::max(V::max(V::abs(ox), V::abs(oy)), V::abs(oz)),             \
+            V::max(V::max(V::abs(v0x), V::abs(v0y)), V::abs(v0z)));                     \
+        Mask inRange = V::mand(V::mand(V::mand(V::cmpge(mD, lo), V::cmple(mD, hi)),     \
+            V::mand(V::cmpge(mE1, lo), V::cmple(mE1, hi))),                             \
+            V::mand(V::mand(V::cmpge(mE2, lo), V::cmple(mE2, hi)),                      \
+            V::mand(V::cmpge(mT, lo), V::cmple(mT, hi))));                              \
+        /* bounds on the errors, and the numerators signed as the determinant */        \
+        Reg eD = V::mul(V::mul(bound6, mE1), V::mul(mD, mE2));                          \
+        Reg a = V::abs(det);                                                            \
+        Reg w = V::add(a, eD);                                                          \
+        Reg wMargin = V::mul(margin, w);                                                \
+        Reg sgn = V::div(det, a);                                                       \
+        Reg su = V::mul(nu, sgn);                                                       \
+        Reg sv = V::mul(nv, sgn);                                                       \
+        Reg st = V::mul(nt, sgn);                                                       \
+        Reg mu = V::add(V::mul(V::mul(bound12, mT), V::mul(mD, mE2)), wMargin);         \
+        Reg mv = V::add(V::mul(V::mul(bound12, mT), V::mul(mD, mE1)), wMargin);         \
+        Reg mt = V::add(V::mul(V::mul(bound12, mT), V::mul(mE1, mE2)), wMargin);        \
+        Mask miss = V::mor(V::mor(V::cmplt(V::add(su, mu), zero), V::cmplt(w, V::sub(su, mu))), \
+            V::mor(V::mor(V::cmplt(V::add(sv, mv), zero),                               \
+            V::cmplt(w, V::sub(V::add(su, sv), V::add(mu, mv)))), V::cmplt(V::add(st, mt), zero))); \
+        Mask bounded = V::mand(inRange, V::cmplt(eD, a));                               \
+        Mask settled = V::mand(bounded, miss);                                          \
+        uint32_t laneMask = (rem >= V::cWidth) ? uint32_t((uint64_t(1) << V::cWidth) - 1) : uint32_t((1u << rem) - 1); \
+        maybeBits |= (laneMask & ~V::bits(settled)) << c;                               \
+        boundedBits |= (laneMask & V::bits(bounded)) << c;                              \
+        V::store(tLow + c, V::div(V::sub(st, mt), w), rem);                             \
+    }                                                                                   \
 }
 
-template <typename T>
-inline UnitVector3<T> makeUnitVector3(const Vector3<T> & v)
-{
-    return UnitVector3<T>(v.x(), v.y(), v.z());
-}
+#if defined(HUBERT_SIMD_X86)
+
+struct SimdAvx2Double
+{
+    typedef double Scalar;
+    typedef __m256d Reg;
+    typedef __m256d Mask;
+    static constexpr size_t cWidth = 4;
+
+    HUBERT_TARGET_AVX2 static inline Reg set1(double v) { return _mm256_set1_pd(v); }
+    HUBERT_TARGET_AVX2 static inline Reg load(const double * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return _mm256_set1_pd(p[0]); }
+        if (rem >= cWidth) { return _mm256_loadu_pd(p + c); }
+        double buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return _mm256_loadu_pd(buf);
+    }
+    HUBERT_TARGET_AVX2 static inline void store(double * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { _mm256_storeu_pd(p, v); return; }
+        double buf[cWidth];
+        _mm256_storeu_pd(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    HUBERT_TARGET_AVX2 static inline Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg abs(Reg a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    HUBERT_TARGET_AVX2 static inline Reg max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Mask cmple(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask cmplt(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask cmpge(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask mand(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline Mask mor(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+    HUBERT_TARGET_AVX2 static inline uint32_t bits(Mask m) { return uint32_t(_mm256_movemask_pd(m)); }
+
+    // isLessOrEqual(a, 1)
+    HUBERT_TARGET_AVX2 static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+struct SimdAvx2Float
+{
+    typedef float Scalar;
+    typedef __m256 Reg;
+    typedef __m256 Mask;
+    static constexpr size_t cWidth = 8;
+
+    HUBERT_TARGET_AVX2 static inline Reg set1(float v) { return _mm256_set1_ps(v); }
+    HUBERT_TARGET_AVX2 static inline Reg load(const float * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return _mm256_set1_ps(p[0]); }
+        if (rem >= cWidth) { return _mm256_loadu_ps(p + c); }
+        float buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return _mm256_loadu_ps(buf);
+    }
+    HUBERT_TARGET_AVX2 static inline void store(float * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { _mm256_storeu_ps(p, v); return; }
+        float buf[cWidth];
+        _mm256_storeu_ps(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    HUBERT_TARGET_AVX2 static inline Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Reg abs(Reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    HUBERT_TARGET_AVX2 static inline Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Mask cmple(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask cmplt(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask cmpge(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    HUBERT_TARGET_AVX2 static inline Mask mand(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline Mask mor(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+    HUBERT_TARGET_AVX2 static inline uint32_t bits(Mask m) { return uint32_t(_mm256_movemask_ps(m)); }
+
+    // isLessOrEqual(a, 1)
+    HUBERT_TARGET_AVX2 static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+struct SimdAvx512Double
+{
+    typedef double Scalar;
+    typedef __m512d Reg;
+    typedef __mmask8 Mask;
+    static constexpr size_t cWidth = 8;
+
+    HUBERT_TARGET_AVX512 static inline Reg set1(double v) { return _mm512_set1_pd(v); }
+    HUBERT_TARGET_AVX512 static inline Reg load(const double * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return _mm512_set1_pd(p[0]); }
+        if (rem >= cWidth) { return _mm512_loadu_pd(p + c); }
+        double buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return _mm512_loadu_pd(buf);
+    }
+    HUBERT_TARGET_AVX512 static inline void store(double * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { _mm512_storeu_pd(p, v); return; }
+        double buf[cWidth];
+        _mm512_storeu_pd(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    HUBERT_TARGET_AVX512 static inline Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg abs(Reg a) { return _mm512_abs_pd(a); }
+    HUBERT_TARGET_AVX512 static inline Reg max(Reg a, Reg b) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ), a, b); }
+    HUBERT_TARGET_AVX512 static inline Mask cmple(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask cmplt(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask cmpge(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask mand(Mask a, Mask b) { return Mask(a & b); }
+    HUBERT_TARGET_AVX512 static inline Mask mor(Mask a, Mask b) { return Mask(a | b); }
+    HUBERT_TARGET_AVX512 static inline uint32_t bits(Mask m) { return uint32_t(m); }
+
+    // isLessOrEqual(a, 1)
+    HUBERT_TARGET_AVX512 static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+struct SimdAvx512Float
+{
+    typedef float Scalar;
+    typedef __m512 Reg;
+    typedef __mmask16 Mask;
+    static constexpr size_t cWidth = 16;
+
+    HUBERT_TARGET_AVX512 static inline Reg set1(float v) { return _mm512_set1_ps(v); }
+    HUBERT_TARGET_AVX512 static inline Reg load(const float * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return _mm512_set1_ps(p[0]); }
+        if (rem >= cWidth) { return _mm512_loadu_ps(p + c); }
+        float buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return _mm512_loadu_ps(buf);
+    }
+    HUBERT_TARGET_AVX512 static inline void store(float * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { _mm512_storeu_ps(p, v); return; }
+        float buf[cWidth];
+        _mm512_storeu_ps(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    HUBERT_TARGET_AVX512 static inline Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+    HUBERT_TARGET_AVX512 static inline Reg abs(Reg a) { return _mm512_abs_ps(a); }
+    HUBERT_TARGET_AVX512 static inline Reg max(Reg a, Reg b) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), a, b); }
+    HUBERT_TARGET_AVX512 static inline Mask cmple(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask cmplt(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask cmpge(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    HUBERT_TARGET_AVX512 static inline Mask mand(Mask a, Mask b) { return Mask(a & b); }
+    HUBERT_TARGET_AVX512 static inline Mask mor(Mask a, Mask b) { return Mask(a | b); }
+    HUBERT_TARGET_AVX512 static inline uint32_t bits(Mask m) { return uint32_t(m); }
+
+    // isLessOrEqual(a, 1)
+    HUBERT_TARGET_AVX512 static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+template <typename V>
+HUBERT_TARGET_AVX2 inline void mollerLanesAvx2(const MollerLanes<typename V::Scalar> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, typename V::Scalar * tOut)
+HUBERT_MOLLER_LANES_BODY(V)
+
+template <typename V>
+HUBERT_TARGET_AVX512 inline void mollerLanesAvx512(const MollerLanes<typename V::Scalar> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, typename V::Scalar * tOut)
+HUBERT_MOLLER_LANES_BODY(V)
+
+template <typename V>
+HUBERT_TARGET_AVX2 inline void mixedFilterAvx2(const MollerLanes<float> & in, size_t n, uint32_t & maybeBits, uint32_t & boundedBits, float * tLow)
+HUBERT_MIXED_FILTER_BODY(V)
+
+template <typename V>
+HUBERT_TARGET_AVX512 inline void mixedFilterAvx512(const MollerLanes<float> & in, size_t n, uint32_t & maybeBits, uint32_t & boundedBits, float * tLow)
+HUBERT_MIXED_FILTER_BODY(V)
+
+#endif // HUBERT_SIMD_X86
+
+#if defined(HUBERT_SIMD_NEON)
+
+struct SimdNeonDouble
+{
+    typedef double Scalar;
+    typedef float64x2_t Reg;
+    typedef uint64x2_t Mask;
+    static constexpr size_t cWidth = 2;
+
+    static inline Reg set1(double v) { return vdupq_n_f64(v); }
+    static inline Reg load(const double * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return vdupq_n_f64(p[0]); }
+        if (rem >= cWidth) { return vld1q_f64(p + c); }
+        double buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return vld1q_f64(buf);
+    }
+    static inline void store(double * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { vst1q_f64(p, v); return; }
+        double buf[cWidth];
+        vst1q_f64(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    static inline Reg add(Reg a, Reg b) { return vaddq_f64(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return vsubq_f64(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return vmulq_f64(a, b); }
+    static inline Reg div(Reg a, Reg b) { return vdivq_f64(a, b); }
+    static inline Reg abs(Reg a) { return vabsq_f64(a); }
+    static inline Reg max(Reg a, Reg b) { return vmaxq_f64(a, b); }
+    static inline Mask cmple(Reg a, Reg b) { return vcleq_f64(a, b); }
+    static inline Mask cmplt(Reg a, Reg b) { return vcltq_f64(a, b); }
+    static inline Mask cmpge(Reg a, Reg b) { return vcgeq_f64(a, b); }
+    static inline Mask mand(Mask a, Mask b) { return vandq_u64(a, b); }
+    static inline Mask mor(Mask a, Mask b) { return vorrq_u64(a, b); }
+    static inline uint32_t bits(Mask m) { return uint32_t(vgetq_lane_u64(m, 0) & 1) | (uint32_t(vgetq_lane_u64(m, 1) & 1) << 1); }
+
+    // isLessOrEqual(a, 1)
+    static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+struct SimdNeonFloat
+{
+    typedef float Scalar;
+    typedef float32x4_t Reg;
+    typedef uint32x4_t Mask;
+    static constexpr size_t cWidth = 4;
+
+    static inline Reg set1(float v) { return vdupq_n_f32(v); }
+    static inline Reg load(const float * p, size_t stride, size_t c, size_t rem)
+    {
+        if (stride == 0) { return vdupq_n_f32(p[0]); }
+        if (rem >= cWidth) { return vld1q_f32(p + c); }
+        float buf[cWidth] = {};
+        for (size_t i = 0; i < rem; i++) { buf[i] = p[c + i]; }
+        return vld1q_f32(buf);
+    }
+    static inline void store(float * p, Reg v, size_t rem)
+    {
+        if (rem >= cWidth) { vst1q_f32(p, v); return; }
+        float buf[cWidth];
+        vst1q_f32(buf, v);
+        for (size_t i = 0; i < cWidth && i < rem; i++) { p[i] = buf[i]; }
+    }
+    static inline Reg add(Reg a, Reg b) { return vaddq_f32(a, b); }
+    static inline Reg sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+    static inline Reg mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+    static inline Reg div(Reg a, Reg b) { return vdivq_f32(a, b); }
+    static inline Reg abs(Reg a) { return vabsq_f32(a); }
+    static inline Reg max(Reg a, Reg b) { return vmaxq_f32(a, b); }
+    static inline Mask cmple(Reg a, Reg b) { return vcleq_f32(a, b); }
+    static inline Mask cmplt(Reg a, Reg b) { return vcltq_f32(a, b); }
+    static inline Mask cmpge(Reg a, Reg b) { return vcgeq_f32(a, b); }
+    static inline Mask mand(Mask a, Mask b) { return vandq_u32(a, b); }
+    static inline Mask mor(Mask a, Mask b) { return vorrq_u32(a, b); }
+    static inline uint32_t bits(Mask m)
+    {
+        return (vgetq_lane_u32(m, 0) & 1) | ((vgetq_lane_u32(m, 1) & 1) << 1) | ((vgetq_lane_u32(m, 2) & 1) << 2) | ((vgetq_lane_u32(m, 3) & 1) << 3);
+    }
+
+    // isLessOrEqual(a, 1)
+    static inline Mask lessOrEqualOne(Reg a, Reg one, Reg eps)
+    {
+        Reg diff = abs(sub(a, one));
+        return mor(cmplt(a, one), mand(cmple(div(diff, abs(a)), eps), cmple(diff, eps)));
+    }
+};
+
+template <typename V>
+inline void mollerLanesNeon(const MollerLanes<typename V::Scalar> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, typename V::Scalar * tOut)
+HUBERT_MOLLER_LANES_BODY(V)
+
+template <typename V>
+inline void mixedFilterNeon(const MollerLanes<float> & in, size_t n, uint32_t & maybeBits, uint32_t & boundedBits, float * tLow)
+HUBERT_MIXED_FILTER_BODY(V)
 
-template <typename T>
-inline UnitVector3<T> makeUnitVector3(const Point3<T> & from, const Point3<T> to)
-{
-    return UnitVector3<T>(to.x() - from.x(), to.y() - from.y(), to.z() - from.z());
-}
+#endif // HUBERT_SIMD_NEON
 
+#undef HUBERT_MOLLER_LANES_BODY
+#undef HUBERT_MIXED_FILTER_BODY
 
+// Runs the lane kernel for the requested instruction set, falling back to
+// the scalar code for the types and instruction sets without a vector kernel.
 template <typename T>
-inline Line3<T> makeLine3(const Point3<T> & p, const Vector3<T> v)
+inline void mollerLanes(const MollerLanes<T> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, T * tOut, SimdLevel)
 {
-    return Line3<T>(p, p + v);
+    mollerLanesScalar(in, n, okBits, coplanarBits, tOut);
 }
 
-template <typename T>
-inline Line3<T> makeLine3(const Point3<T> & p, const UnitVector3<T> v)
+inline void mollerLanes(const MollerLanes<double> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, double * tOut, SimdLevel level)
 {
-    return Line3<T>(p, p + makeVector3(v));
+#if defined(HUBERT_SIMD_X86)
+    if (level == SimdLevel::eAvx512)
+    {
+        mollerLanesAvx512<SimdAvx512Double>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+    if (level == SimdLevel::eAvx2)
+    {
+        mollerLanesAvx2<SimdAvx2Double>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+#elif defined(HUBERT_SIMD_NEON)
+    if (level == SimdLevel::eNeon)
+    {
+        mollerLanesNeon<SimdNeonDouble>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+#endif
+    mollerLanesScalar(in, n, okBits, coplanarBits, tOut);
 }
 
+inline void mollerLanes(const MollerLanes<float> & in, size_t n, uint32_t & okBits, uint32_t & coplanarBits, float * tOut, SimdLevel level)
+{
+#if defined(HUBERT_SIMD_X86)
+    if (level == SimdLevel::eAvx512)
+    {
+        mollerLanesAvx512<SimdAvx512Float>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+    if (level == SimdLevel::eAvx2)
+    {
+        mollerLanesAvx2<SimdAvx2Float>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+#elif defined(HUBERT_SIMD_NEON)
+    if (level == SimdLevel::eNeon)
+    {
+        mollerLanesNeon<SimdNeonFloat>(in, n, okBits, coplanarBits, tOut);
+        return;
+    }
+#endif
+    mollerLanesScalar(in, n, okBits, coplanarBits, tOut);
+}
 
-template <typename T>
-inline Plane<T> makePlane( const Point3<T> & p1, const Point3<T> & p2, const Point3<T> & p3)
+// Runs the float filter for the requested instruction set. Without a
+// vector kernel a float filter gains nothing over the double test, so
+// every lane is left to it, unbounded.
+inline void mixedFilterLanes(const MollerLanes<float> & in, size_t n, uint32_t & maybeBits, uint32_t & boundedBits, float * tLow, SimdLevel level)
 {
-    return Plane<T>(p1, makeUnitVector3(crossProduct(p2 - p1, p3 - p1)));
+#if defined(HUBERT_SIMD_X86)
+    if (level == SimdLevel::eAvx512)
+    {
+        mixedFilterAvx512<SimdAvx512Float>(in, n, maybeBits, boundedBits, tLow);
+        return;
+    }
+    if (level == SimdLevel::eAvx2)
+    {
+        mixedFilterAvx2<SimdAvx2Float>(in, n, maybeBits, boundedBits, tLow);
+        return;
+    }
+#elif defined(HUBERT_SIMD_NEON)
+    if (level == SimdLevel::eNeon)
+    {
+        mixedFilterNeon<SimdNeonFloat>(in, n, maybeBits, boundedBits, tLow);
+        return;
+    }
+#else
+    (void)in;
+    (void)boundedBits;
+    (void)tLow;
+    (void)level;
+#endif
+    maybeBits |= (n >= 32) ? ~uint32_t(0) : (uint32_t(1) << n) - 1;
 }
 
+// One ray against up to 16 consecutive triangles of a soup, starting at
+// index first. Lane i holds the result for triangle first + i, with the
+// same meaning as the ResultCode of intersect(Triangle3, Ray3). Returns
+// eDegenerate (and flags every lane degenerate) for a degenerate ray,
+// otherwise eOk.
 template <typename T>
-inline Ray3<T> makeRay3(const Point3<T> & p1, const Point3<T> & p2)
+inline ResultCode intersectPacket(const TriangleSoup<T> & theSoup, size_t first, size_t count, const Ray3<T> & theRay, PacketResult<T> & result, SimdLevel level = simdLevel())
 {
-    return Ray3<T>(p1, makeUnitVector3(p2 - p1));
-}
+    if (first >= theSoup.size())
+    {
+        count = 0;
+    }
+    else if (count > theSoup.size() - first)
+    {
+        count = theSoup.size() - first;
+    }
+    if (count > PacketResult<T>::cMaxLanes)
+    {
+        count = PacketResult<T>::cMaxLanes;
+    }
 
+    uint32_t laneMask = (uint32_t(1) << count) - 1;
+    result.ok = 0;
+    result.coplanar = 0;
+    result.noIntersection = 0;
+    result.degenerate = 0;
 
-/////////////////////////////////////////////////////////////////////////////
-// Validity checks
-//
-// These are checks for numerical validity, rather than any sort of
-// contextual checks. They simly care whether the floating point 
-// numbers are valid.
-/////////////////////////////////////////////////////////////////////////////
+    if (isDegenerate(theRay))
+    {
+        result.degenerate = laneMask;
+        return ResultCode::eDegenerate;
+    }
 
-template <typename T>
-inline bool isValid(const Point3<T> & v)
-{
-    return v.amValid();
-}
+    for (size_t i = 0; i < count; i++)
+    {
+        if (theSoup.amDegenerate(first + i))
+        {
+            result.degenerate |= uint32_t(1) << i;
+        }
+    }
 
-template <typename T>
-inline bool isValid(const Vector3<T> & v)
-{
-    return v.amValid();
-}
+    const T orig[3] = { theRay.base().x(), theRay.base().y(), theRay.base().z() };
+    const T dir[3] = { theRay.unitDirection().x(), theRay.unitDirection().y(), theRay.unitDirection().z() };
 
-template <typename T>
-inline bool isValid(const UnitVector3<T> & v)
-{
-    return v.amValid();
-}
+    MollerLanes<T> in;
+    for (int a = 0; a < 3; a++)
+    {
+        in.orig[a] = &orig[a];
+        in.dir[a] = &dir[a];
+    }
+    for (uint32_t k = 0; k < 3; k++)
+    {
+        in.vert[k][0] = theSoup.x(k) + first;
+        in.vert[k][1] = theSoup.y(k) + first;
+        in.vert[k][2] = theSoup.z(k) + first;
+    }
+    in.rayStride = 0;
+    in.triStride = 1;
 
-template <typename T>
-inline bool isValid(const Matrix3<T>& v)
-{
-    return v.amValid();
-}
+    mollerLanes(in, count, result.ok, result.coplanar, result.t, level);
 
-template <typename T>
-inline bool isValid(const MatrixRotation3<T>& v)
-{
-    return v.amValid();
-}
+    result.ok &= ~result.degenerate;
+    result.coplanar &= ~result.degenerate;
+    result.noIntersection = laneMask & ~(result.ok | result.coplanar | result.degenerate);
 
-template <typename T>
-inline bool isValid(const Line3<T> & v)
-{
-    return v.amValid();
+    return ResultCode::eOk;
 }
 
+// A packet of up to 16 rays against one triangle. Lane i holds the result
+// for theRays[i].
 template <typename T>
-inline bool isValid(const Plane<T>& v)
+inline ResultCode intersectPacket(const Triangle3<T> & theTri, const Ray3<T> * theRays, size_t count, PacketResult<T> & result, SimdLevel level = simdLevel())
 {
-    return v.amValid();
-}
+    const uint32_t n = PacketResult<T>::cMaxLanes;
+    if (count > n)
+    {
+        count = n;
+    }
 
-template <typename T>
-inline bool isValid(const Ray3<T>& v)
-{
-    return v.amValid();
-}
+    uint32_t laneMask = (uint32_t(1) << count) - 1;
+    result.ok = 0;
+    result.coplanar = 0;
+    result.noIntersection = 0;
+    result.degenerate = 0;
 
-template <typename T>
-inline bool isValid(const Segment3<T>& v)
-{
-    return v.amValid();
-}
+    if (isDegenerate(theTri))
+    {
+        result.degenerate = laneMask;
+        return ResultCode::eDegenerate;
+    }
 
-template <typename T>
-inline bool isValid(const Triangle3<T>& v)
-{
-    return v.amValid();
-}
+    T orig[3][n];
+    T dir[3][n];
+    for (size_t i = 0; i < count; i++)
+    {
+        if (isDegenerate(theRays[i]))
+        {
+            result.degenerate |= uint32_t(1) << i;
+        }
+        orig[0][i] = theRays[i].base().x();
+        orig[1][i] = theRays[i].base().y();
+        orig[2][i] = theRays[i].base().z();
+        dir[0][i] = theRays[i].unitDirection().x();
+        dir[1][i] = theRays[i].unitDirection().y();
+        dir[2][i] = theRays[i].unitDirection().z();
+    }
 
+    const T vert[3][3] = {
+        { theTri.p1().x(), theTri.p1().y(), theTri.p1().z() },
+        { theTri.p2().x(), theTri.p2().y(), theTri.p2().z() },
+        { theTri.p3().x(), theTri.p3().y(), theTri.p3().z() } };
 
-/////////////////////////////////////////////////////////////////////////////
-// Degeneracy checks
-//
-// These are checks for degenerate forms of the entities we support. This
-// is a superset of the validity checks in that if one of the components
-// of an entity is invalid. Degeneracy, however, by no means implies that
-// andy of the individual components are invalid.
-/////////////////////////////////////////////////////////////////////////////
+    MollerLanes<T> in;
+    for (int a = 0; a < 3; a++)
+    {
+        in.orig[a] = orig[a];
+        in.dir[a] = dir[a];
+        for (int k = 0; k < 3; k++)
+        {
+            in.vert[k][a] = &vert[k][a];
+        }
+    }
+    in.rayStride = 1;
+    in.triStride = 0;
 
-template <typename T>
-inline bool isDegenerate(const Point3<T> & v)
-{
-     return v.amDegenerate();
-}
+    mollerLanes(in, count, result.ok, result.coplanar, result.t, level);
 
-template <typename T>
-inline bool isDegenerate(const Vector3<T> & v)
-{
-   return v.amDegenerate();
-}
+    result.ok &= ~result.degenerate;
+    result.coplanar &= ~result.degenerate;
+    result.noIntersection = laneMask & ~(result.ok | result.coplanar | result.degenerate);
 
-template <typename T>
-inline bool isDegenerate(const UnitVector3<T> & v)
-{
-   return v.amDegenerate();
+    return ResultCode::eOk;
 }
 
+// Finds the nearest triangle of the soup hit by the ray, using the same
+// math as intersect(Triangle3, Ray3). Degenerate triangles are skipped. On
+// success hitIndex is the index of the triangle and t the distance along
+// the ray. If several triangles are hit at the same distance, the lowest
+// index wins.
 template <typename T>
-inline bool isDegenerate(const Matrix3<T>& v)
+inline ResultCode intersect(const TriangleSoup<T> & theSoup, const Ray3<T> & theRay, size_t & hitIndex, T & t, SimdLevel level = simdLevel())
 {
-    return v.amDegenerate();
-}
+    hitIndex = invalidIndex();
+    t = invalidValue<T>();
 
-template <typename T>
-inline bool isDegenerate(const MatrixRotation3<T>& v)
-{
-    return v.amDegenerate();
-}
+    if (isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eSoupRay, ResultCode::eDegenerate);
+    }
 
-template <typename T>
-inline bool isDegenerate(const Line3<T> & v)
-{
-    return v.amDegenerate();
-}
+    PacketResult<T> packet;
+    for (size_t first = 0; first < theSoup.size(); first += PacketResult<T>::cMaxLanes)
+    {
+        intersectPacket(theSoup, first, PacketResult<T>::cMaxLanes, theRay, packet, level);
 
-template <typename T>
-inline bool isDegenerate(const Plane<T> & v)
-{
-    return v.amDegenerate();
-}
+        for (uint32_t hits = packet.ok; hits != 0; hits &= hits - 1)
+        {
+            uint32_t lane = 0;
+            while (!(hits & (uint32_t(1) << lane)))
+            {
+                lane++;
+            }
+            if (hitIndex == invalidIndex() || packet.t[lane] < t)
+            {
+                hitIndex = first + lane;
+                t = packet.t[lane];
+            }
+        }
+    }
 
-template <typename T>
-inline bool isDegenerate(const Triangle3<T> & v)
-{
-    return v.amDegenerate();
+    return countResult(InstrumentedQuery::eSoupRay, (hitIndex == invalidIndex()) ? ResultCode::eNoIntersection : ResultCode::eOk);
 }
 
-template <typename T>
-inline bool isDegenerate(const Segment3<T> & v)
+// Tag for the mixed precision ray queries, e.g.
+// intersect(mixedPrecision, soup, ray, hitIndex, t).
+struct MixedPrecision
 {
-    return v.amDegenerate();
+    explicit MixedPrecision() = default;
+};
+inline constexpr MixedPrecision mixedPrecision{};
+
+// Triangle i of a float soup against a ray in double, exactly as a double
+// soup holding the same vertices tests it: the triangle is classified in
+// double, as Triangle3<double> would be, and the Moller test run on the
+// double coordinates. Returns true
+// on a hit, with its distance in t.
+inline bool mixedLaneHit(const TriangleSoup<float> & theSoup, size_t i, const double orig[3], const double dir[3], double & t)
+{
+    double vert[3][3];
+    for (uint32_t k = 0; k < 3; k++)
+    {
+        vert[k][0] = theSoup.x(k)[i];
+        vert[k][1] = theSoup.y(k)[i];
+        vert[k][2] = theSoup.z(k)[i];
+    }
+    if (isDegenerateTriangle(vert[0], vert[1], vert[2]))
+    {
+        return false;
+    }
+
+    const double edge1[3] = { vert[1][0] - vert[0][0], vert[1][1] - vert[0][1], vert[1][2] - vert[0][2] };
+    const double edge2[3] = { vert[2][0] - vert[0][0], vert[2][1] - vert[0][1], vert[2][2] - vert[0][2] };
+    t = 0.0;
+    return mollerTrumbore(orig, dir, vert[0], edge1, edge2, t) == ResultCode::eOk && isGreaterOrEqual(t, 0.0);
 }
 
-template <typename T>
-inline bool isDegenerate(const Ray3<T>& v)
+// Finds the nearest triangle of a float soup hit by a double ray, with
+// the answer, t included, of intersect(TriangleSoup, Ray3) over a double
+// soup holding the same vertices. The Moller test runs in float SIMD
+// lanes first, with a bound on its rounding error; the lanes where the
+// bound cannot rule out a hit (the hits themselves, and the near misses
+// along edges and vertices or with a near zero determinant) are then
+// tested again in double, unless the float bounds already place them
+// beyond the nearest hit found so far. Most of the soup is settled in
+// float, at twice the lanes per instruction and half the memory traffic
+// of a double soup. Without a vector kernel every lane goes to the double
+// test.
+inline ResultCode intersect(MixedPrecision, const TriangleSoup<float> & theSoup, const Ray3<double> & theRay, size_t & hitIndex, double & t, SimdLevel level = simdLevel())
 {
-    return v.amDegenerate();
-}
+    hitIndex = invalidIndex();
+    t = invalidValue<double>();
 
-/////////////////////////////////////////////////////////////////////////////
-// Subnormal checks
-//
-// 
-/////////////////////////////////////////////////////////////////////////////
+    if (isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eSoupRay, ResultCode::eDegenerate);
+    }
 
-template <typename T>
-inline bool isSubnormal(const Point3<T> & v)
-{
-    return v.amSubnormal();
-}
+    const double orig[3] = { theRay.base().x(), theRay.base().y(), theRay.base().z() };
+    const double dir[3] = { theRay.unitDirection().x(), theRay.unitDirection().y(), theRay.unitDirection().z() };
+    const float origF[3] = { float(orig[0]), float(orig[1]), float(orig[2]) };
+    const float dirF[3] = { float(dir[0]), float(dir[1]), float(dir[2]) };
 
-template <typename T>
-inline bool isSubnormal(const Vector3<T> & v)
-{
-    return v.amSubnormal();
-}
+    MollerLanes<float> in;
+    for (int a = 0; a < 3; a++)
+    {
+        in.orig[a] = &origF[a];
+        in.dir[a] = &dirF[a];
+    }
+    in.rayStride = 0;
+    in.triStride = 1;
 
-template <typename T>
-inline bool isSubnormal(const UnitVector3<T> & v)
-{
-    return v.amSubnormal();
-}
+    const size_t cLanes = PacketResult<float>::cMaxLanes;
+    for (size_t first = 0; first < theSoup.size(); first += cLanes)
+    {
+        size_t count = std::min(cLanes, theSoup.size() - first);
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            in.vert[k][0] = theSoup.x(k) + first;
+            in.vert[k][1] = theSoup.y(k) + first;
+            in.vert[k][2] = theSoup.z(k) + first;
+        }
 
-template <typename T>
-inline bool isSubnormal(const Matrix3<T>& v)
-{
-    return v.amSubnormal();
-}
+        uint32_t maybe = 0;
+        uint32_t bounded = 0;
+        float tLow[cLanes];
+        mixedFilterLanes(in, count, maybe, bounded, tLow, level);
 
-template <typename T>
-inline bool isSubnormal(const MatrixRotation3<T>& v)
-{
-    return v.amSubnormal();
-}
+        for (; maybe != 0; maybe &= maybe - 1)
+        {
+            uint32_t lane = 0;
+            while (!(maybe & (uint32_t(1) << lane)))
+            {
+                lane++;
+            }
 
-template <typename T>
-inline bool isSubnormal(const Line3<T> & v)
-{
-    return v.amSubnormal();
-}
+            // a lane that cannot come nearer than the hit so far needs no
+            // double test; the factor covers the rounding of the bound
+            if (hitIndex != invalidIndex() && (bounded & (uint32_t(1) << lane)) && tLow[lane] > 0.0f && double(tLow[lane]) * (1.0 - double(cMixedMargin)) > t)
+            {
+                continue;
+            }
 
-template <typename T>
-inline bool isSubnormal(const Plane<T>& v)
-{
-    return v.amSubnormal();
+            double laneT;
+            if (mixedLaneHit(theSoup, first + lane, orig, dir, laneT) && (hitIndex == invalidIndex() || laneT < t))
+            {
+                hitIndex = first + lane;
+                t = laneT;
+            }
+        }
+    }
+
+    return countResult(InstrumentedQuery::eSoupRay, (hitIndex == invalidIndex()) ? ResultCode::eNoIntersection : ResultCode::eOk);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Batch transforms
+//
+// Transform arrays of points (p * m + t) and vectors (v * m), with the row
+// vector convention of multiply(Vector3, Matrix3) and the same order of
+// operations, so each component is bit for bit what the single transform
+// gives. The work is done by SIMD kernels over structure of arrays data;
+// arrays of Point3, Vector3 and PackedPoint3 are passed through them in
+// blocks. The matrix and translation are validated once per call, not per
+// element. Input and output may be the same array, which transforms in
+// place, but must not otherwise overlap.
+/////////////////////////////////////////////////////////////////////////////
+
+// Input of the transform kernels. The translation is only added when
+// translate is set, so that vectors come out exactly as multiply() makes
+// them (adding 0 would turn -0 into +0). The kernels return whether every
+// result component is valid and not subnormal, as areNormalOrZero()
+// decides it, if check is set, and true otherwise.
 template <typename T>
-inline bool isSubnormal(const Ray3<T>& v)
+struct TransformLanes
 {
-    return v.amSubnormal();
-}
+    T           m[3][3];
+    T           t[3];
+    bool        translate;
+    bool        check;
+    const T *   in[3];
+    T *         out[3];
+};
 
 template <typename T>
-inline bool isSubnormal(const Segment3<T>& v)
+inline bool transformLanesScalar(const TransformLanes<T> & tl, size_t n)
 {
-    return v.amSubnormal();
+    bool normal = true;
+    for (size_t i = 0; i < n; i++)
+    {
+        T x = tl.in[0][i];
+        T y = tl.in[1][i];
+        T z = tl.in[2][i];
+        for (int c = 0; c < 3; c++)
+        {
+            T r = x * tl.m[0][c] + y * tl.m[1][c] + z * tl.m[2][c];
+            tl.out[c][i] = tl.translate ? r + tl.t[c] : r;
+        }
+        if (tl.check)
+        {
+            normal &= areNormalOrZero(tl.out[0][i], tl.out[1][i], tl.out[2][i]);
+        }
+    }
+    return normal;
 }
 
-template <typename T>
-inline bool isSubnormal(const Triangle3<T>& v)
-{
-    return v.amSubnormal();
+#define HUBERT_TRANSFORM_LANES_BODY(V)                                                  \
+{                                                                                       \
+    typedef typename V::Scalar S;                                                       \
+    typedef typename V::Reg Reg;                                                        \
+    typedef typename V::Mask Mask;                                                      \
+    const Reg zero = V::set1(S(0.0));                                                   \
+    const Reg lo = V::set1(std::numeric_limits<S>::min());                              \
+    const Reg hi = V::set1(std::numeric_limits<S>::max());                              \
+    uint32_t abnormal = 0;                                                              \
+    Reg m[3][3];                                                                        \
+    Reg t[3];                                                                           \
+    for (int r = 0; r < 3; r++)                                                         \
+    {                                                                                   \
+        for (int c = 0; c < 3; c++)                                                     \
+        {                                                                               \
+            m[r][c] = V::set1(tl.m[r][c]);                                              \
+        }                                                                               \
+        t[r] = V::set1(tl.t[r]);                                                        \
+    }                                                                                   \
+    for (size_t i = 0; i < n; i += V::cWidth)                                           \
+    {                                                                                   \
+        size_t rem = n - i;                                                             \
+        uint32_t laneMask = (rem >= V::cWidth) ? uint32_t((uint64_t(1) << V::cWidth) - 1) : uint32_t((uint64_t(1) << rem) - 1); \
+        Reg x = V::load(tl.in[0], 1, i, rem);                                           \
+        Reg y = V::load(tl.in[1], 1, i, rem);                                           \
+        Reg z = V::load(tl.in[2], 1, i, rem);                                           \
+        for (int c = 0; c < 3; c++)                                                     \
+        {                                                                               \
+            Reg r = V::add(V::add(V::mul(x, m[0][c]), V::mul(y, m[1][c])), V::mul(z, m[2][c])); \
+            if (tl.translate)                                                           \
+            {                                                                           \
+                r = V::add(r, t[c]);                                                    \
+            }                                                                           \
+            V::store(tl.out[c] + i, r, rem);                                            \
+            if (tl.check)                                                               \
+            {                                                                           \
+                /* areNormalOrZero(), lane by lane */                                   \
+                Reg a = V::abs(r);                                                      \
+                Mask normal = V::mor(V::cmple(a, zero), V::mand(V::cmpge(a, lo), V::cmple(a, hi))); \
+                abnormal |= ~V::bits(normal) & laneMask;                                \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+    return abnormal == 0;                                                               \
 }
 
+#if defined(HUBERT_SIMD_X86)
 
-/////////////////////////////////////////////////////////////////////////////
-// Vector Math
-/////////////////////////////////////////////////////////////////////////////
+template <typename V>
+HUBERT_TARGET_AVX2 inline bool transformLanesAvx2(const TransformLanes<typename V::Scalar> & tl, size_t n)
+HUBERT_TRANSFORM_LANES_BODY(V)
 
-// dot product
+template <typename V>
+HUBERT_TARGET_AVX512 inline bool transformLanesAvx512(const TransformLanes<typename V::Scalar> & tl, size_t n)
+HUBERT_TRANSFORM_LANES_BODY(V)
+
+#endif // HUBERT_SIMD_X86
+
+#if defined(HUBERT_SIMD_NEON)
+
+template <typename V>
+inline bool transformLanesNeon(const TransformLanes<typename V::Scalar> & tl, size_t n)
+HUBERT_TRANSFORM_LANES_BODY(V)
+
+#endif // HUBERT_SIMD_NEON
+
+#undef HUBERT_TRANSFORM_LANES_BODY
 
 template <typename T>
-inline T dotProduct(const Vector3<T> & v1, const Vector3<T> & v2)
+inline bool transformLanes(const TransformLanes<T> & tl, size_t n, SimdLevel)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+    return transformLanesScalar(tl, n);
+}
+
+inline bool transformLanes(const TransformLanes<double> & tl, size_t n, SimdLevel level)
+{
+#if defined(HUBERT_SIMD_X86)
+    if (level == SimdLevel::eAvx512)
     {
-        return infinity<T>();
+        return transformLanesAvx512<SimdAvx512Double>(tl, n);
     }
-    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    if (level == SimdLevel::eAvx2)
+    {
+        return transformLanesAvx2<SimdAvx2Double>(tl, n);
+    }
+#elif defined(HUBERT_SIMD_NEON)
+    if (level == SimdLevel::eNeon)
+    {
+        return transformLanesNeon<SimdNeonDouble>(tl, n);
+    }
+#endif
+    return transformLanesScalar(tl, n);
 }
 
-template <typename T>
-inline T dotProduct(const UnitVector3<T> & v1, const Vector3<T> & v2)
+inline bool transformLanes(const TransformLanes<float> & tl, size_t n, SimdLevel level)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+#if defined(HUBERT_SIMD_X86)
+    if (level == SimdLevel::eAvx512)
     {
-        return infinity<T>();
+        return transformLanesAvx512<SimdAvx512Float>(tl, n);
     }
-    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    if (level == SimdLevel::eAvx2)
+    {
+        return transformLanesAvx2<SimdAvx2Float>(tl, n);
+    }
+#elif defined(HUBERT_SIMD_NEON)
+    if (level == SimdLevel::eNeon)
+    {
+        return transformLanesNeon<SimdNeonFloat>(tl, n);
+    }
+#endif
+    return transformLanesScalar(tl, n);
 }
 
+// The kernel input for m and (if not null) translation t, or false if
+// either is degenerate.
 template <typename T>
-inline T dotProduct(const Vector3<T> & v1, const UnitVector3<T> & v2)
+inline bool makeTransformLanes(const Matrix3<T> & m, const Vector3<T> * t, TransformLanes<T> & tl)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+    if (isDegenerate(m) || (t && !isValid(*t)))
     {
-        return infinity<T>();
+        return false;
     }
-    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    for (uint32_t r = 0; r < 3; r++)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            tl.m[r][c] = m.get(r, c);
+        }
+    }
+    tl.translate = (t != nullptr);
+    tl.check = true;
+    tl.t[0] = t ? t->x() : T(0.0);
+    tl.t[1] = t ? t->y() : T(0.0);
+    tl.t[2] = t ? t->z() : T(0.0);
+    return true;
 }
 
-template <typename T>
-inline T dotProduct(const UnitVector3<T> & v1, const UnitVector3<T> & v2)
+// Runs count elements through the kernel in blocks. get(i, xyz) reads
+// element i and returns whether it is valid; put(i, xyz, valid) writes the
+// result for it, and returns false if a valid element gave an invalid
+// result. When every input in a block is valid and the kernel found every
+// result plainly valid and not subnormal, the block is written with
+// putTrusted(i, xyz) instead and nothing is checked per element. Returns
+// eOverflow if some valid element gave an invalid result, otherwise eOk.
+template <typename T, typename Get, typename Put, typename PutTrusted>
+inline ResultCode transformBlocks(TransformLanes<T> tl, size_t count, Get get, Put put, PutTrusted putTrusted)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+    constexpr size_t cBlock = 256;
+    T buffer[3][cBlock];
+    bool valid[cBlock];
+    tl.in[0] = tl.out[0] = buffer[0];
+    tl.in[1] = tl.out[1] = buffer[1];
+    tl.in[2] = tl.out[2] = buffer[2];
+    SimdLevel level = simdLevel();
+
+    bool overflow = false;
+    for (size_t b = 0; b < count; b += cBlock)
     {
-        return infinity<T>();
+        size_t n = std::min(cBlock, count - b);
+        bool allValid = true;
+        for (size_t i = 0; i < n; i++)
+        {
+            T xyz[3];
+            valid[i] = get(b + i, xyz);
+            allValid &= valid[i];
+            buffer[0][i] = xyz[0];
+            buffer[1][i] = xyz[1];
+            buffer[2][i] = xyz[2];
+        }
+        bool allNormal = transformLanes(tl, n, level) && allValid;
+        for (size_t i = 0; i < n; i++)
+        {
+            const T xyz[3] = { buffer[0][i], buffer[1][i], buffer[2][i] };
+            if (allNormal)
+            {
+                putTrusted(b + i, xyz);
+            }
+            else
+            {
+                overflow |= !put(b + i, xyz, valid[i]);
+            }
+        }
     }
-    return v1.x() * v2.x() + v1.y() * v2.y() + v1.z() * v2.z();
+    return overflow ? ResultCode::eOverflow : ResultCode::eOk;
 }
 
-// scalar multiply
-
 template <typename T>
-inline Vector3<T> multiply(const Vector3<T>  &v , T m)
+inline ResultCode transformPointArray(const Matrix3<T> & m, const Vector3<T> * t, const Point3<T> * in, size_t count, Point3<T> * out)
 {
-    return Vector3<T>(v.x() * m, v.y() * m, v.z() * m);
+    TransformLanes<T> tl;
+    if (!makeTransformLanes(m, t, tl))
+    {
+        std::fill(out, out + count, invalidPoint3<T>());
+        return ResultCode::eDegenerate;
+    }
+    return transformBlocks(tl, count,
+        [&](size_t i, T xyz[3]) { xyz[0] = in[i].x(); xyz[1] = in[i].y(); xyz[2] = in[i].z(); return isValid(in[i]); },
+        [&](size_t i, const T xyz[3], bool valid) {
+            out[i] = valid ? makePoint3Fast(xyz[0], xyz[1], xyz[2]) : invalidPoint3<T>();
+            return !valid || isValid(out[i]);
+        },
+        [&](size_t i, const T xyz[3]) { out[i] = Point3<T>(trusted, xyz[0], xyz[1], xyz[2]); });
 }
 
+// Points, rotated (or transformed by any matrix) into out. Invalid input
+// points give invalid output points. Returns eDegenerate (and invalid
+// points) if the matrix is degenerate, eOverflow if some result
+// overflowed, otherwise eOk.
 template <typename T>
-inline Vector3<T> operator*(const Vector3<T>& v, T m)
+inline ResultCode transformPoints(const Matrix3<T> & m, const Point3<T> * in, size_t count, Point3<T> * out)
 {
-    return multiply(v, m);
+    return transformPointArray(m, static_cast<const Vector3<T> *>(nullptr), in, count, out);
 }
 
+// Points, transformed by m and then translated by t into out. Returns
+// eDegenerate if either is degenerate, eOverflow if some result overflowed.
 template <typename T>
-inline Vector3<T> multiply(const UnitVector3<T> & v, T m)
+inline ResultCode transformPoints(const Matrix3<T> & m, const Vector3<T> & t, const Point3<T> * in, size_t count, Point3<T> * out)
 {
-    return Vector3<T>(v.x() * m, v.y() * m, v.z() * m);
+    return transformPointArray(m, &t, in, count, out);
 }
 
+// in place
 template <typename T>
-inline Vector3<T> operator*(const UnitVector3<T>& v, T m)
+inline ResultCode transformPoints(const Matrix3<T> & m, Point3<T> * points, size_t count)
 {
-    return multiply(v, m);
+    return transformPointArray(m, static_cast<const Vector3<T> *>(nullptr), points, count, points);
 }
 
-// cross product
-
 template <typename T>
-inline Vector3<T> crossProduct(const Vector3<T>& v1, const Vector3<T>& v2)
+inline ResultCode transformPoints(const Matrix3<T> & m, const Vector3<T> & t, Point3<T> * points, size_t count)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
-    {
-        return invalidVector3<T>();
-    }
-
-    return Vector3<T>(
-        v1.y() * v2.z() - v1.z() * v2.y(),
-        v1.z() * v2.x() - v1.x() * v2.z(),
-        v1.x() * v2.y() - v1.y() * v2.x()
-    );
+    return transformPointArray(m, &t, points, count, points);
 }
 
+// Points, transformed by xf into out, each as transform(Transform3, Point3)
+// gives it.
 template <typename T>
-inline Vector3<T> crossProduct(const Vector3<T>& v1, const UnitVector3<T>& v2)
+inline ResultCode transformPoints(const Transform3<T> & xf, const Point3<T> * in, size_t count, Point3<T> * out)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+    if (isDegenerate(xf))
     {
-        return invalidVector3<T>();
+        std::fill(out, out + count, invalidPoint3<T>());
+        return ResultCode::eDegenerate;
     }
-
-    return Vector3<T>(
-        v1.y() * v2.z() - v1.z() * v2.y(),
-        v1.z() * v2.x() - v1.x() * v2.z(),
-        v1.x() * v2.y() - v1.y() * v2.x()
-        );
+    return transformPointArray(static_cast<const Matrix3<T> &>(xf.rotation()), &xf.translation(), in, count, out);
 }
 
+// in place
 template <typename T>
-inline Vector3<T> crossProduct(const UnitVector3<T>& v1, const Vector3<T>& v2)
+inline ResultCode transformPoints(const Transform3<T> & xf, Point3<T> * points, size_t count)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
-    {
-        return invalidVector3<T>();
-    }
-
-    return Vector3<T>(
-        v1.y() * v2.z() - v1.z() * v2.y(),
-        v1.z() * v2.x() - v1.x() * v2.z(),
-        v1.x() * v2.y() - v1.y() * v2.x()
-        );
+    return transformPoints(xf, points, count, points);
 }
 
+// Vectors, transformed by m into out, each as multiply(Vector3, Matrix3)
+// gives it.
 template <typename T>
-inline Vector3<T> crossProduct(const UnitVector3<T>& v1, const UnitVector3<T>& v2)
+inline ResultCode transformVectors(const Matrix3<T> & m, const Vector3<T> * in, size_t count, Vector3<T> * out)
 {
-    if (v1.amDegenerate() || v2.amDegenerate())
+    TransformLanes<T> tl;
+    if (!makeTransformLanes(m, static_cast<const Vector3<T> *>(nullptr), tl))
     {
-        return invalidVector3<T>();
+        std::fill(out, out + count, invalidVector3<T>());
+        return ResultCode::eDegenerate;
     }
-
-    return Vector3<T>(
-        v1.y() * v2.z() - v1.z() * v2.y(),
-        v1.z() * v2.x() - v1.x() * v2.z(),
-        v1.x() * v2.y() - v1.y() * v2.x()
-        );
+    return transformBlocks(tl, count,
+        [&](size_t i, T xyz[3]) { xyz[0] = in[i].x(); xyz[1] = in[i].y(); xyz[2] = in[i].z(); return isValid(in[i]); },
+        [&](size_t i, const T xyz[3], bool valid) {
+            out[i] = valid ? makeVector3Fast(xyz[0], xyz[1], xyz[2]) : invalidVector3<T>();
+            return !valid || isValid(out[i]);
+        },
+        [&](size_t i, const T xyz[3]) { out[i] = Vector3<T>(trusted, xyz[0], xyz[1], xyz[2]); });
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// Distance functions
-/////////////////////////////////////////////////////////////////////////////
-
+// in place
 template <typename T>
-inline T distance(const Point3<T> & p1, const Point3<T> & p2)
+inline ResultCode transformVectors(const Matrix3<T> & m, Vector3<T> * vectors, size_t count)
 {
-    T dx = p1.x() - p2.x();
-    T dy = p1.y() - p2.y();
-    T dz = p1.z() - p2.z();
-
-    T tot = std::hypot(dx, dy, dz);
-
-    return tot;
- }
+    return transformVectors(m, vectors, count, vectors);
+}
 
 template <typename T>
-inline T distance(const Point3<T> & thePoint, const Plane<T> & thePlane)
+inline ResultCode transformPackedArray(const Matrix3<T> & m, const Vector3<T> * t, const PackedPoint3<T> * in, size_t count, PackedPoint3<T> * out)
 {
-    return dotProduct(thePlane.up(), thePoint - thePlane.base());
+    TransformLanes<T> tl;
+    if (!makeTransformLanes(m, t, tl))
+    {
+        return ResultCode::eDegenerate;
+    }
+    tl.check = false;
+    auto write = [&](size_t i, const T xyz[3]) { out[i] = PackedPoint3<T>{ xyz[0], xyz[1], xyz[2] }; };
+    transformBlocks(tl, count,
+        [&](size_t i, T xyz[3]) { xyz[0] = in[i].x; xyz[1] = in[i].y; xyz[2] = in[i].z; return true; },
+        [&](size_t i, const T xyz[3], bool) { write(i, xyz); return true; },
+        write);
+    return ResultCode::eOk;
 }
 
+// Packed points carry no flags, so nothing is checked per point: the
+// coordinates are transformed as they are, and infinities or NaNs go
+// through as the arithmetic leaves them. Returns eDegenerate (and leaves
+// out untouched) if the matrix or translation is degenerate.
 template <typename T>
-inline T distance(const Plane<T> & thePlane, const Point3<T> & thePoint)
+inline ResultCode transformPoints(const Matrix3<T> & m, const PackedPoint3<T> * in, size_t count, PackedPoint3<T> * out)
 {
-    return distance(thePoint, thePlane);
+    return transformPackedArray(m, static_cast<const Vector3<T> *>(nullptr), in, count, out);
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// vector magnitude functions
-/////////////////////////////////////////////////////////////////////////////
-
 template <typename T>
-inline T magnitude(const Vector3<T>& v)
+inline ResultCode transformPoints(const Matrix3<T> & m, const Vector3<T> & t, const PackedPoint3<T> * in, size_t count, PackedPoint3<T> * out)
 {
-    if (!isValid(v))
-    {
-        return infinity<T>();
-    }
-
-    return std::hypot(v.x(), v.y(), v.z());
+    return transformPackedArray(m, &t, in, count, out);
 }
 
 template <typename T>
-inline T magnitude(const UnitVector3<T>& v)
+inline ResultCode transformSoaArray(const Matrix3<T> & m, const Vector3<T> * t, const T * inX, const T * inY, const T * inZ, size_t count, T * outX, T * outY, T * outZ)
 {
-    if (v.amDegenerate())
+    TransformLanes<T> tl;
+    if (!makeTransformLanes(m, t, tl))
     {
-        if (v.amValid())
-        {
-            return T(0.0);
-        }
-        else
-        {
-            return infinity<T>();
-        }
+        return ResultCode::eDegenerate;
     }
-    return T(1.0);
+    tl.check = false;
+    tl.in[0] = inX;
+    tl.in[1] = inY;
+    tl.in[2] = inZ;
+    tl.out[0] = outX;
+    tl.out[1] = outY;
+    tl.out[2] = outZ;
+    transformLanes(tl, count, simdLevel());
+    return ResultCode::eOk;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// Transforms
-/////////////////////////////////////////////////////////////////////////////
-
+// Structure of arrays coordinates, transformed straight through the
+// kernel with nothing checked per point, as for packed points. Each output
+// array may be the matching input array.
 template <typename T>
-inline Matrix3<T> transpose(const Matrix3<T>& v)
+inline ResultCode transformPoints(const Matrix3<T> & m, const T * inX, const T * inY, const T * inZ, size_t count, T * outX, T * outY, T * outZ)
 {
-    return v.transpose();
+    return transformSoaArray(m, static_cast<const Vector3<T> *>(nullptr), inX, inY, inZ, count, outX, outY, outZ);
 }
 
 template <typename T>
-inline MatrixRotation3<T> transpose(const MatrixRotation3<T>& v)
+inline ResultCode transformPoints(const Matrix3<T> & m, const Vector3<T> & t, const T * inX, const T * inY, const T * inZ, size_t count, T * outX, T * outY, T * outZ)
 {
-    return v.transpose();
+    return transformSoaArray(m, &t, inX, inY, inZ, count, outX, outY, outZ);
 }
 
-template <typename T>
-inline Matrix3<T> multiply(const Matrix3<T>& v1, const Matrix3<T>& v2)
-{
-    return v1.multiply(v2);
-}
+/////////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchy
+/////////////////////////////////////////////////////////////////////////////
 
-// two valid rotation matrices are guaranteed to result in a rotation matrix
+//
+// BvhNode.
+//
+// One node of a Bvh. Interior nodes have count == 0 and their two children
+// are stored next to each other starting at index first. Leaves reference
+// count triangles starting at index first in the Bvh's triangle order. A
+// node is exactly 32 bytes for float and 64 bytes for double, and aligned
+// to that size, so that a node never straddles a cache line.
+//
 template <typename T>
-inline MatrixRotation3<T> multiply(const MatrixRotation3<T> & v1, const MatrixRotation3<T> & v2)
+struct alignas(sizeof(T) * 8) BvhNode
 {
-    return v1.multiply(v2);
-}
+    T           bmin[3];
+    T           bmax[3];
+    uint32_t    first;
+    uint32_t    count;
+};
 
+//
+// Bvh.
+//
+// A bounding volume hierarchy over a set of triangles, built with the
+// surface area heuristic (binned) into a flat array of nodes. Degenerate
+// triangles cannot be hit by anything and are left out of the tree. The
+// triangles are stored in tree order, and queries report the index of the
+// triangle in the range the Bvh was built from.
+//
 template <typename T>
-inline Vector3<T> multiply(const Vector3<T>& v, const Matrix3<T>& m)
+class Bvh
 {
-    Vector3<T> ret(
-        v.x() * m.get(0, 0) + v.y() * m.get(1, 0) + v.z() * m.get(2, 0),
-        v.x() * m.get(0, 1) + v.y() * m.get(1, 1) + v.z() * m.get(2, 1),
-        v.x() * m.get(0, 2) + v.y() * m.get(1, 2) + v.z() * m.get(2, 2)
-    );
+    public:
+        // constructors
+        Bvh() = default;
+        template <typename Iter>
+        Bvh(Iter first, Iter last, uint32_t maxLeafSize = 4) { _build(std::vector<Triangle3<T>>(first, last), maxLeafSize); }
+        // over the faces of a mesh, reporting face indices
+        explicit Bvh(const IndexedMesh<T> & mesh, uint32_t maxLeafSize = 4)
+        {
+            std::vector<Triangle3<T>> tris;
+            tris.reserve(mesh.faceCount());
+            for (size_t f = 0; f < mesh.faceCount(); f++)
+            {
+                tris.push_back(mesh.triangle(f));
+            }
+            _build(std::move(tris), maxLeafSize);
+        }
+        Bvh(const Bvh &) = default;
+        ~Bvh() = default;
 
-    return ret;
-}
+        // public operators
+        inline Bvh<T> & operator=(const Bvh<T> &) = default;
 
+        // public methods
+        inline const std::vector<BvhNode<T>> & nodes() const { return _nodes; }
 
-/////////////////////////////////////////////////////////////////////////////
-// normal functions
-/////////////////////////////////////////////////////////////////////////////
+        // the triangles in tree order, and their index in the original range
+        inline const std::vector<Triangle3<T>> & triangles() const { return _tris; }
+        inline size_t originalIndex(size_t i) const { return _index[i]; }
 
-template <typename T>
-inline UnitVector3<T> unitNormal(const Triangle3<T> & tri)
-{
-    // degenerate triangles do not have normals
-    if (isDegenerate(tri))
-    {
-        return invalidUnitVector3<T>();
-    }
+    private:
+        static constexpr uint32_t cBins = 16;
 
-    // Ordering of points is not arbitrary. This follows from the hubert
-    // convention for a triangle
-    Vector3<T> v1 = tri.p2() - tri.p1();
-    Vector3<T> v2 = tri.p3() - tri.p1();
+        struct Bounds
+        {
+            T   bmin[3] = { infinity<T>(), infinity<T>(), infinity<T>() };
+            T   bmax[3] = { -infinity<T>(), -infinity<T>(), -infinity<T>() };
 
-    Vector3<T> norm = crossProduct(v1, v2);
-    if (!isValid(norm))
-    {
-        return invalidUnitVector3<T>();
-    }
+            inline void grow(const T lo[3], const T hi[3])
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    bmin[a] = std::min(bmin[a], lo[a]);
+                    bmax[a] = std::max(bmax[a], hi[a]);
+                }
+            }
+            inline void grow(const Bounds & b) { grow(b.bmin, b.bmax); }
+            inline T area() const
+            {
+                T dx = bmax[0] - bmin[0];
+                T dy = bmax[1] - bmin[1];
+                T dz = bmax[2] - bmin[2];
+                return (dx < T(0.0)) ? T(0.0) : T(2.0) * (dx * dy + dy * dz + dz * dx);
+            }
+        };
 
-    // the unit normal could be degenerate (e.g. zero length or overflow)
-    // but it is up to the caller to detect that and deal with it.
-    UnitVector3<T> unorm = makeUnitVector3(norm);
+        void _build(std::vector<Triangle3<T>> tris, uint32_t maxLeafSize)
+        {
+            if (maxLeafSize == 0)
+            {
+                maxLeafSize = 1;
+            }
 
-    return unorm;
-}
+            std::vector<uint32_t> prims;
+            std::vector<Bounds> primBounds(tris.size());
+            std::vector<T> centroids(tris.size() * 3);
+            for (size_t i = 0; i < tris.size(); i++)
+            {
+                if (isDegenerate(tris[i]))
+                {
+                    continue;
+                }
+                prims.push_back(uint32_t(i));
 
+                const Point3<T> * pts[3] = { &tris[i].p1(), &tris[i].p2(), &tris[i].p3() };
+                for (int k = 0; k < 3; k++)
+                {
+                    const T p[3] = { pts[k]->x(), pts[k]->y(), pts[k]->z() };
+                    primBounds[i].grow(p, p);
+                }
+                for (int a = 0; a < 3; a++)
+                {
+                    centroids[i * 3 + a] = primBounds[i].bmin[a] * T(0.5) + primBounds[i].bmax[a] * T(0.5);
+                }
+            }
 
-/////////////////////////////////////////////////////////////////////////////
-// Closest point functions
-/////////////////////////////////////////////////////////////////////////////
+            _nodes.clear();
+            _tris.clear();
+            _index.clear();
+            if (prims.empty())
+            {
+                return;
+            }
 
-template <typename T>
-inline Point3<T> closestPoint(const Line3<T> & theLine, const Point3<T> & thePoint)
-{
-    Vector3<T> v2 = makeVector3(theLine.base(), thePoint);
+            _nodes.reserve(2 * prims.size() / maxLeafSize + 1);
+            _nodes.push_back(BvhNode<T>{ { T(0.0), T(0.0), T(0.0) }, { T(0.0), T(0.0), T(0.0) }, 0, uint32_t(prims.size()) });
 
-    T f = dotProduct(theLine.unitDirection(), v2) ;
+            std::vector<uint32_t> stack{ 0 };
+            while (!stack.empty())
+            {
+                uint32_t nodeIndex = stack.back();
+                stack.pop_back();
 
-    return theLine.base() + multiply(theLine.unitDirection(), f);
-}
+                uint32_t begin = _nodes[nodeIndex].first;
+                uint32_t count = _nodes[nodeIndex].count;
 
-template <typename T>
-inline Point3<T> closestPoint(const Plane<T>& thePlane, const Point3<T>& thePoint)
-{
-    Vector3<T> v = makeVector3(thePlane.base(), thePoint);
-    T distance = dotProduct(v, thePlane.up());
-    return (thePoint - multiply(thePlane.up(), distance));
-}
+                Bounds bounds;
+                Bounds centroidBounds;
+                for (uint32_t i = begin; i < begin + count; i++)
+                {
+                    bounds.grow(primBounds[prims[i]]);
+                    centroidBounds.grow(&centroids[prims[i] * 3], &centroids[prims[i] * 3]);
+                }
+                _setBounds(_nodes[nodeIndex], bounds);
 
-/////////////////////////////////////////////////////////////////////////////
-// Addition functions
-/////////////////////////////////////////////////////////////////////////////
+                if (count <= maxLeafSize)
+                {
+                    continue;
+                }
 
-// Vector3 + Vector3 -> Vector3
+                // find the best binned split over all three axes
+                T bestCost = infinity<T>();
+                int bestAxis = -1;
+                uint32_t bestBin = 0;
+                for (int a = 0; a < 3; a++)
+                {
+                    T lo = centroidBounds.bmin[a];
+                    T extent = centroidBounds.bmax[a] - lo;
+                    if (!(extent > T(0.0)))
+                    {
+                        continue;
+                    }
 
-template <typename T>
-inline Vector3<T> add(const Vector3<T> & v1, const Vector3<T> & v2)
-{
-    return Vector3<T>(v1.x() + v2.x(), v1.y() + v2.y(), v1.z() + v2.z());
-}
+                    Bounds binBounds[cBins];
+                    uint32_t binCount[cBins] = {};
+                    for (uint32_t i = begin; i < begin + count; i++)
+                    {
+                        uint32_t b = _bin(centroids[prims[i] * 3 + a], lo, extent);
+                        binCount[b]++;
+                        binBounds[b].grow(primBounds[prims[i]]);
+                    }
+
+                    // sweep from the right to get the cost of the right hand sides
+                    T rightArea[cBins];
+                    uint32_t rightCount[cBins];
+                    Bounds acc;
+                    uint32_t n = 0;
+                    for (uint32_t b = cBins - 1; b > 0; b--)
+                    {
+                        acc.grow(binBounds[b]);
+                        n += binCount[b];
+                        rightArea[b] = acc.area();
+                        rightCount[b] = n;
+                    }
 
-template <typename T>
-inline Vector3<T> operator+(const Vector3<T> & v1, const Vector3<T> & v2)
-{
-    return add(v1, v2);
-}
+                    acc = Bounds();
+                    n = 0;
+                    for (uint32_t b = 0; b < cBins - 1; b++)
+                    {
+                        acc.grow(binBounds[b]);
+                        n += binCount[b];
+                        if (n == 0 || rightCount[b + 1] == 0)
+                        {
+                            continue;
+                        }
+                        T cost = acc.area() * T(n) + rightArea[b + 1] * T(rightCount[b + 1]);
+                        if (cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = a;
+                            bestBin = b;
+                        }
+                    }
+                }
 
-// Point3 + Vector3 -> Point3
+                uint32_t mid;
+                if (bestAxis < 0)
+                {
+                    // all the centroids coincide, so there is nothing the heuristic can
+                    // do. Large sets are still split down the middle to bound leaf size.
+                    if (count <= 4 * maxLeafSize)
+                    {
+                        continue;
+                    }
+                    mid = begin + count / 2;
+                }
+                else
+                {
+                    // traversal cost of 1 relative to the cost of a triangle test
+                    T splitCost = T(1.0) + bestCost / bounds.area();
+                    if (splitCost >= T(count) && count <= 4 * maxLeafSize)
+                    {
+                        continue;
+                    }
 
-template <typename T>
-inline Point3<T> add(const Point3<T> & p1, const Vector3<T> & v1)
-{
-    return Point3<T>(v1.x() + p1.x(), v1.y() + p1.y(), v1.z() + p1.z());
-}
+                    T lo = centroidBounds.bmin[bestAxis];
+                    T extent = centroidBounds.bmax[bestAxis] - lo;
+                    mid = uint32_t(std::partition(prims.begin() + begin, prims.begin() + begin + count, [&](uint32_t p) {
+                        return _bin(centroids[p * 3 + bestAxis], lo, extent) <= bestBin;
+                    }) - prims.begin());
+                }
 
-template <typename T>
-inline Point3<T> operator+(const Point3<T> & p1, const Vector3<T> & v1)
-{
-    return add(p1, v1);
-}
+                uint32_t left = uint32_t(_nodes.size());
+                _nodes.push_back(BvhNode<T>{ { T(0.0), T(0.0), T(0.0) }, { T(0.0), T(0.0), T(0.0) }, begin, mid - begin });
+                _nodes.push_back(BvhNode<T>{ { T(0.0), T(0.0), T(0.0) }, { T(0.0), T(0.0), T(0.0) }, mid, begin + count - mid });
+                _nodes[nodeIndex].first = left;
+                _nodes[nodeIndex].count = 0;
+                stack.push_back(left + 1);
+                stack.push_back(left);
+            }
 
-/////////////////////////////////////////////////////////////////////////////
-// Subtraction functions
-/////////////////////////////////////////////////////////////////////////////
+            _tris.reserve(prims.size());
+            _index.reserve(prims.size());
+            for (uint32_t p : prims)
+            {
+                _tris.push_back(tris[p]);
+                _index.push_back(p);
+            }
+        }
 
-// Vector3 - Vector3 -> Vector3
+        // Clamped before the conversion: centroids spread over most of the
+        // range of T overflow extent, and the ratio is then inf or NaN
+        // (which lands in bin 0).
+        static inline uint32_t _bin(T c, T lo, T extent)
+        {
+            T b = T(cBins) * ((c - lo) / extent);
+            if (!(b > T(0.0)))
+            {
+                return 0;
+            }
+            return (b < T(cBins - 1)) ? uint32_t(b) : cBins - 1;
+        }
 
-template <typename T>
-inline Vector3<T> subtract(const Vector3<T> & v1, const Vector3<T> & v2)
-{
-    return Vector3<T>(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
-}
+        // The boxes are padded a little, so that hits the epsilon tolerant
+        // intersection routines report just outside a triangle are not culled.
+        static inline void _setBounds(BvhNode<T> & node, const Bounds & b)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                T pad = (std::abs(b.bmin[a]) + std::abs(b.bmax[a])) * T(8.0) * epsilon<T>();
+                node.bmin[a] = b.bmin[a] - pad;
+                node.bmax[a] = b.bmax[a] + pad;
+            }
+        }
 
-template <typename T>
-inline Vector3<T> operator-(const Vector3<T> & v1, const Vector3<T> & v2)
-{
-    return subtract(v1, v2);
-}
+        // private data
+        std::vector<BvhNode<T>>     _nodes;
+        std::vector<Triangle3<T>>   _tris;
+        std::vector<size_t>         _index;
+};
 
-// Point3 - Vector3 -> Point3
+static_assert(sizeof(BvhNode<float>) == 32, "BvhNode<float> should fill half a cache line");
+static_assert(sizeof(BvhNode<double>) == 64, "BvhNode<double> should fill a cache line");
 
-template <typename T>
-inline Point3<T> subtract(const Point3<T> & v1, const Vector3<T> & v2)
+// The node stack of a Bvh traversal. Trees up to 64 levels deep, which is
+// nearly all of them, fit in the array; deeper ones (the SAH will build
+// them for badly skewed input) spill over onto the heap.
+class BvhStack
 {
-    return Point3<T>(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
-}
+    public:
+        inline bool empty() const { return _depth == 0; }
 
-template <typename T>
-inline Point3<T> operator-(const Point3<T> & v1, const Vector3<T> & v2)
-{
-    return subtract(v1, v2);
-}
+        inline void push(uint32_t node)
+        {
+            if (_depth < cLocal)
+            {
+                _local[_depth] = node;
+            }
+            else
+            {
+                _spill.push_back(node);
+            }
+            _depth++;
+        }
 
-// Point3 - Point3 -> Vector3
+        inline uint32_t pop()
+        {
+            _depth--;
+            if (_depth < cLocal)
+            {
+                return _local[_depth];
+            }
+            uint32_t node = _spill.back();
+            _spill.pop_back();
+            return node;
+        }
 
-template <typename T>
-inline Vector3<T> subtract(const Point3<T> & v1, const Point3<T> & v2)
-{
-    return Vector3<T>(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
-}
+    private:
+        static constexpr uint32_t cLocal = 64;
 
+        uint32_t                _local[cLocal];
+        uint32_t                _depth = 0;
+        std::vector<uint32_t>   _spill;
+};
+
+// Slab test of a Bvh node against the parametric range [tNear, tFar] of
+// orig + t * dir.
 template <typename T>
-inline Vector3<T> operator-(const Point3<T> & v1, const Point3<T> & v2)
+inline bool slabTest(const BvhNode<T> & node, const T orig[3], const T invDir[3], T & tNear, T & tFar)
 {
-    return subtract(v1, v2);
+    return slabTest(node.bmin, node.bmax, orig, invDir, tNear, tFar);
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// area functions
-/////////////////////////////////////////////////////////////////////////////
-
-template <typename T>
-inline T area(const Triangle3<T>& tri)
+// Traverses the Bvh with orig + t * dir for t in [tMin, tMax], calling
+// test(triangleIndex) for the triangles of the leaves whose box can still
+// hold something closer to orig than bestDistance, which the caller may
+// lower as it goes (dir is a unit vector, so the distance is |t|). test
+// returns true to stop the traversal.
+template <typename T, typename Test>
+inline void traverse(const Bvh<T> & theBvh, const T orig[3], const T dir[3], T tMin, T tMax, const T & bestDistance, Test test)
 {
-    // if we are invalid due to an invalid nubmer, there is nothing we can do.
-    // However the same is not true if we are degenerate. A degenerate triangle
-    // that is valid has an area of 0.
-    if (!isValid(tri))
-    {
-        return infinity<T>();
-    }
-    if (isDegenerate(tri))
+    const std::vector<BvhNode<T>> & nodes = theBvh.nodes();
+    if (nodes.empty())
     {
-        return T(0.0);
+        return;
     }
 
-    T dx1 = tri.p2().x() - tri.p1().x();
-    T dy1 = tri.p2().y() - tri.p1().y();
-    T dz1 = tri.p2().z() - tri.p1().z();
+    const T invDir[3] = { T(1.0) / dir[0], T(1.0) / dir[1], T(1.0) / dir[2] };
 
-    T dx2 = tri.p3().x() - tri.p1().x();
-    T dy2 = tri.p3().y() - tri.p1().y();
-    T dz2 = tri.p3().z() - tri.p1().z();
+    // distance from the origin to the closest point of [tNear, tFar]
+    auto closest = [](T tNear, T tFar) {
+        return (tNear > T(0.0)) ? tNear : ((tFar < T(0.0)) ? -tFar : T(0.0));
+    };
 
-    T cx = dy1 * dz2 - dy2 * dz1;
-    T cy = dx2 * dz1 - dx1 * dz2;
-    T cz = dx1 * dy2 - dx2 * dy1;
+    BvhStack stack;
 
-    // the above calculations can overflow
-    if (!(isValid(cx) && isValid(cy) && isValid(cz)))
+    T tNear = tMin;
+    T tFar = tMax;
+    if (!slabTest(nodes[0], orig, invDir, tNear, tFar))
     {
-        return infinity<T>();
+        return;
     }
+    stack.push(0);
 
-    // hypot() will return inifinity if it overflows
-    return std::hypot(cx, cy, cz) * T(0.5);
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// centroid functions
-/////////////////////////////////////////////////////////////////////////////
-
-template <typename T>
-inline Point3<T> centroid(const Triangle3<T>& tri)
-{
-    // if we are invalid due to an invalid nubmer, there is nothing we can do.
-    // However the same is not true if we are degenerate. A degenerate triangle
-    // will  have a valid centroid which we just calculate.
-    if (!isValid(tri))
+    while (!stack.empty())
     {
-        return invalidPoint3<T>();
-    }
-
-    return Point3<T>((tri.p1().x() + tri.p2().x() + tri.p3().x()) / 3.0, (tri.p1().y() + tri.p2().y() + tri.p3().y()) / 3.0, (tri.p1().z() + tri.p2().z() + tri.p3().z()) / 3.0);
-}
+        const BvhNode<T> & node = nodes[stack.pop()];
 
-/////////////////////////////////////////////////////////////////////////////
-// intersection functions
-/////////////////////////////////////////////////////////////////////////////
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                if (test(i))
+                {
+                    return;
+                }
+            }
+            continue;
+        }
 
-template <typename T>
-inline ResultCode intersect(const Plane<T> & thePlane, const Line3<T> & theLine, Point3<T> & intersection)
-{
-    // Check for degnerate inputs
-    if (isDegenerate(thePlane) || isDegenerate(theLine))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eDegenerate;
-    }
+        // visit the nearer child first
+        T near0 = tMin, far0 = tMax;
+        T near1 = tMin, far1 = tMax;
+        bool hit0 = slabTest(nodes[node.first], orig, invDir, near0, far0) && !(closest(near0, far0) > bestDistance);
+        bool hit1 = slabTest(nodes[node.first + 1], orig, invDir, near1, far1) && !(closest(near1, far1) > bestDistance);
 
-    // check for parallel or coplanar
-    T dp = dotProduct(theLine.unitDirection(), thePlane.up());
-    if (isEqual(dp, T(0.0)))
-    {
-        if (isEqual(distance(theLine.base(), thePlane), T(0.0)))
+        if (hit0 && hit1)
         {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eCoplanar;
+            if (closest(near0, far0) <= closest(near1, far1))
+            {
+                stack.push(node.first + 1);
+                stack.push(node.first);
+            }
+            else
+            {
+                stack.push(node.first);
+                stack.push(node.first + 1);
+            }
         }
-        else
+        else if (hit0)
         {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eParallel;
+            stack.push(node.first);
+        }
+        else if (hit1)
+        {
+            stack.push(node.first + 1);
         }
     }
-
-    // inputs are valid and we are not parallel
-    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
-    T d = dotProduct(thePlane.base() - theLine.base(), thePlane.up()) / dotProduct(theLine.unitDirection(), thePlane.up());
-    intersection = theLine.base() + multiply(theLine.unitDirection(), d);
-
-    if (!isValid(intersection))
-    {
-        return ResultCode::eOverflow;
-    }
-
-    return ResultCode::eOk;
 }
 
-template <typename T>
-inline ResultCode intersect(const Line3<T> & theLine, const Plane<T> & thePlane, Point3<T> & intersection)
+// Shared implementation of the closest and any hit queries. Query is the
+// Ray3, Line3 or Segment3 that is handed to the Triangle3 intersect()
+// overload at the leaves.
+template <typename T, typename Query>
+inline ResultCode intersectBvh(const Bvh<T> & theBvh, const Query & theQuery, const Point3<T> & base, const UnitVector3<T> & dir, T tMin, T tMax, bool anyHit, size_t & triIndex, Point3<T> & intersection)
 {
-    return intersect(thePlane, theLine, intersection);
-}
-
+    const T orig[3] = { base.x(), base.y(), base.z() };
+    const T d[3] = { dir.x(), dir.y(), dir.z() };
 
-template <typename T>
-inline ResultCode intersect(const Plane<T>& thePlane, const Ray3<T>& theRay, Point3<T>& intersection)
-{
-    // Check for degnerate inputs
-    if (isDegenerate(thePlane) || isDegenerate(theRay))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eDegenerate;
-    }
+    size_t best = invalidIndex();
+    T bestDistance = infinity<T>();
+    Point3<T> bestPoint = invalidPoint3<T>();
 
-    // check for parallel or coplanar
-    T dp = dotProduct(theRay.unitDirection(), thePlane.up());
-    if (isEqual(dp, T(0.0)))
-    {
-        if (isEqual(distance(theRay.base(), thePlane), T(0.0)))
+    traverse(theBvh, orig, d, tMin, tMax, bestDistance, [&](uint32_t i) {
+        Point3<T> intPoint;
+        if (intersect(theBvh.triangles()[i], theQuery, intPoint) != ResultCode::eOk)
         {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eCoplanar;
+            return false;
         }
-        else
+        T dist = distance(base, intPoint);
+        if (dist < bestDistance || (dist == bestDistance && theBvh.originalIndex(i) < best))
         {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eParallel;
+            best = theBvh.originalIndex(i);
+            bestDistance = dist;
+            bestPoint = intPoint;
         }
-    }
-
-    // inputs are valid and we are not parallel
-    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
-    T d = dotProduct(thePlane.base() - theRay.base(), thePlane.up()) / dotProduct(theRay.unitDirection(), thePlane.up());
-
-    // 0.0 would be touching, which is an interseciton, so we don't need to do a epsilon compare
-    if (d < 0.0)
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
-    }
-
-    intersection = theRay.base() + multiply(theRay.unitDirection(), d);
-
-    if (!isValid(intersection))
-    {
-        return ResultCode::eOverflow;
-    }
+        return anyHit;
+    });
 
-    return ResultCode::eOk;
+    triIndex = best;
+    intersection = bestPoint;
+    return (best == invalidIndex()) ? ResultCode::eNoIntersection : ResultCode::eOk;
 }
 
+// Closest hit: the triangle whose intersection with the ray, segment or
+// line is nearest to its base point, as reported by the Triangle3
+// intersect() overloads. triIndex is the index in the range the Bvh was
+// built from.
 template <typename T>
-inline ResultCode intersect(const Ray3<T>& theRay, const Plane<T>& thePlane, Point3<T>& intersection)
+inline ResultCode intersect(const Bvh<T> & theBvh, const Ray3<T> & theRay, size_t & triIndex, Point3<T> & intersection)
 {
-    return intersect(thePlane, theRay, intersection);
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theRay))
+    {
+        return countResult(InstrumentedQuery::eBvhRay, ResultCode::eDegenerate);
+    }
+    return countResult(InstrumentedQuery::eBvhRay, intersectBvh(theBvh, theRay, theRay.base(), theRay.unitDirection(), T(0.0), infinity<T>(), false, triIndex, intersection));
 }
 
-
 template <typename T>
-inline ResultCode intersect(const Plane<T>& thePlane, const Segment3<T>& theSegment, Point3<T>& intersection)
+inline ResultCode intersect(const Bvh<T> & theBvh, const Segment3<T> & theSegment, size_t & triIndex, Point3<T> & intersection)
 {
-    // Check for degnerate inputs
-    if (isDegenerate(thePlane) || isDegenerate(theSegment))
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theSegment))
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eDegenerate;
+        return countResult(InstrumentedQuery::eBvhSegment, ResultCode::eDegenerate);
     }
-
     UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+    return countResult(InstrumentedQuery::eBvhSegment, intersectBvh(theBvh, theSegment, theSegment.base(), segDir, T(0.0), distance(theSegment.base(), theSegment.target()), false, triIndex, intersection));
+}
 
-    // check for parallel or coplanar
-    T dp = dotProduct(segDir, thePlane.up());
-    if (isEqual(dp, T(0.0)))
+template <typename T>
+inline ResultCode intersect(const Bvh<T> & theBvh, const Line3<T> & theLine, size_t & triIndex, Point3<T> & intersection)
+{
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theLine))
     {
-        if (isEqual(distance(theSegment.base(), thePlane), T(0.0)))
-        {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eCoplanar;
-        }
-        else
-        {
-            intersection = invalidPoint3<T>();
-            return ResultCode::eParallel;
-        }
+        return countResult(InstrumentedQuery::eBvhLine, ResultCode::eDegenerate);
     }
+    return countResult(InstrumentedQuery::eBvhLine, intersectBvh(theBvh, theLine, theLine.base(), theLine.unitDirection(), -infinity<T>(), infinity<T>(), false, triIndex, intersection));
+}
 
-    // inputs are valid and we are not parallel
-    // from https://en.wikipedia.org/wiki/Line%E2%80%93plane_intersection
-    T d = dotProduct(thePlane.base() - theSegment.base(), thePlane.up()) / dotProduct(segDir, thePlane.up());
-
-    // 0.0 would be touching, which is an interseciton, so we don't need to do a epsilon compare
-    if (d < 0.0 || d > distance(theSegment.base(), theSegment.target()))
+// Any hit: stops at the first triangle found, which is not necessarily the
+// closest one. Intended for occlusion queries.
+template <typename T>
+inline ResultCode intersectAny(const Bvh<T> & theBvh, const Ray3<T> & theRay, size_t & triIndex, Point3<T> & intersection)
+{
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theRay))
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
+        return countResult(InstrumentedQuery::eBvhRay, ResultCode::eDegenerate);
     }
+    return countResult(InstrumentedQuery::eBvhRay, intersectBvh(theBvh, theRay, theRay.base(), theRay.unitDirection(), T(0.0), infinity<T>(), true, triIndex, intersection));
+}
 
-    intersection = theSegment.base() + multiply(segDir, d);
-
-    if (!isValid(intersection))
+template <typename T>
+inline ResultCode intersectAny(const Bvh<T> & theBvh, const Segment3<T> & theSegment, size_t & triIndex, Point3<T> & intersection)
+{
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theSegment))
     {
-        return ResultCode::eOverflow;
+        return countResult(InstrumentedQuery::eBvhSegment, ResultCode::eDegenerate);
     }
-
-    return ResultCode::eOk;
+    UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+    return countResult(InstrumentedQuery::eBvhSegment, intersectBvh(theBvh, theSegment, theSegment.base(), segDir, T(0.0), distance(theSegment.base(), theSegment.target()), true, triIndex, intersection));
 }
 
 template <typename T>
-inline ResultCode intersect(const Segment3<T>& theSegment, const Plane<T>& thePlane, Point3<T>& intersection)
+inline ResultCode intersectAny(const Bvh<T> & theBvh, const Line3<T> & theLine, size_t & triIndex, Point3<T> & intersection)
 {
-    return intersect(thePlane, theSegment, intersection);
+    triIndex = invalidIndex();
+    intersection = invalidPoint3<T>();
+    if (isDegenerate(theLine))
+    {
+        return countResult(InstrumentedQuery::eBvhLine, ResultCode::eDegenerate);
+    }
+    return countResult(InstrumentedQuery::eBvhLine, intersectBvh(theBvh, theLine, theLine.base(), theLine.unitDirection(), -infinity<T>(), infinity<T>(), true, triIndex, intersection));
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Batch triangle - triangle intersection
+/////////////////////////////////////////////////////////////////////////////
 
+// The bounding box of a triangle, as used by the sort and sweep broad phase.
+// The boxes are padded slightly because the narrow phase snaps distances
+// within epsilon of a plane onto it.
 template <typename T>
-inline ResultCode intersect(const Triangle3<T> & theTri,  const Ray3<T> & theRay, Point3<T> & intersection)
+struct TriangleBox
 {
-    // Check for degnerate inputs
-    if (isDegenerate(theTri) || isDegenerate(theRay))
+    T       lo[3];
+    T       hi[3];
+    size_t  index;
+    bool    second;
+};
+
+template <typename T>
+inline TriangleBox<T> makeTriangleBox(const Triangle3<T> & tri, size_t index, bool second)
+{
+    TriangleBox<T> box;
+    const T x[3] = { tri.p1().x(), tri.p2().x(), tri.p3().x() };
+    const T y[3] = { tri.p1().y(), tri.p2().y(), tri.p3().y() };
+    const T z[3] = { tri.p1().z(), tri.p2().z(), tri.p3().z() };
+    const T * c[3] = { x, y, z };
+    for (int a = 0; a < 3; a++)
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eDegenerate;
+        T lo = std::min(c[a][0], std::min(c[a][1], c[a][2]));
+        T hi = std::max(c[a][0], std::max(c[a][1], c[a][2]));
+        T pad = (std::abs(lo) + std::abs(hi)) * T(8.0) * epsilon<T>() + epsilon<T>();
+        box.lo[a] = lo - pad;
+        box.hi[a] = hi + pad;
     }
+    box.index = index;
+    box.second = second;
+    return box;
+}
 
+// true if the two triangles have a vertex in common (exactly equal)
+template <typename T>
+inline bool shareVertex(const Triangle3<T> & tri1, const Triangle3<T> & tri2)
+{
+    const Point3<T> * v1[3] = { &tri1.p1(), &tri1.p2(), &tri1.p3() };
+    const Point3<T> * v2[3] = { &tri2.p1(), &tri2.p2(), &tri2.p3() };
+    for (auto a : v1)
+    {
+        for (auto b : v2)
+        {
+            if (a->x() == b->x() && a->y() == b->y() && a->z() == b->z())
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
-
-    Vector3<T> edge1 = theTri.p2() - theTri.p1();
-    Vector3<T> edge2 = theTri.p3() - theTri.p1();
+// Sort and sweep along x over the boxes, calling test(box1, box2) for every
+// pair whose boxes overlap, with box1 earlier in the sweep order. The sweep
+// is split across threads, and test receives the thread index as well.
+template <typename T, typename Test>
+inline void sweepAndPrune(std::vector<TriangleBox<T>> & boxes, unsigned threads, Test test)
+{
+    std::sort(boxes.begin(), boxes.end(), [](const TriangleBox<T> & b1, const TriangleBox<T> & b2) {
+        return b1.lo[0] < b2.lo[0];
+    });
 
-    Vector3<T> pvec = crossProduct(theRay.unitDirection(), edge2);
+    parallelFor(boxes.size(), 256, threads, [&](size_t begin, size_t end, unsigned thread) {
+        for (size_t i = begin; i < end; i++)
+        {
+            const TriangleBox<T> & b1 = boxes[i];
+            for (size_t j = i + 1; j < boxes.size() && boxes[j].lo[0] <= b1.hi[0]; j++)
+            {
+                const TriangleBox<T> & b2 = boxes[j];
+                if (b1.lo[1] <= b2.hi[1] && b2.lo[1] <= b1.hi[1] && b1.lo[2] <= b2.hi[2] && b2.lo[2] <= b1.hi[2])
+                {
+                    test(b1, b2, thread);
+                }
+            }
+        }
+    });
+}
 
-    T det = dotProduct(edge1, pvec);
-    if (isEqual(det, T(0.0)))
+// Joins the per thread results into one list sorted by index pair.
+template <typename Pairs, typename Alloc>
+inline void gatherPairs(std::vector<Pairs> & perThread, std::vector<std::pair<size_t, size_t>, Alloc> & pairs)
+{
+    size_t total = 0;
+    for (auto & p : perThread)
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eCoplanar;
+        total += p.size();
     }
+    pairs.clear();
+    pairs.reserve(total);
+    for (auto & p : perThread)
+    {
+        pairs.insert(pairs.end(), p.begin(), p.end());
+    }
+    std::sort(pairs.begin(), pairs.end());
+}
 
-    Vector3<T> tvec = theRay.base() - theTri.p1();
-
-    T u = dotProduct(tvec, pvec) / det;
-    if (!(isGreaterOrEqual(u, T(0.0)) && isLessOrEqual(u, T(1.0))))
+// Calls sink(thread, i, j) for every pair (i, j), i < j, of intersecting
+// triangles in a mesh, as intersectSelf() finds them, from the thread
+// that found it: thread is its index, 0 .. threadCount(threads) - 1, so a
+// sink with a slot per thread needs no locking. The pairs come in no
+// particular order.
+template <typename T, typename Sink>
+inline void forEachSelfIntersection(const Triangle3<T> * tris, size_t count, Sink && sink, bool skipNeighbours = true, unsigned threads = 0, Predicates predicates = Predicates::eEpsilon)
+{
+    std::vector<TriangleBox<T>> boxes;
+    boxes.reserve(count);
+    for (size_t i = 0; i < count; i++)
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
+        if (!isDegenerate(tris[i]))
+        {
+            boxes.push_back(makeTriangleBox(tris[i], i, false));
+        }
     }
 
-    Vector3<T> qvec = crossProduct(tvec, edge1);
+    sweepAndPrune(boxes, threads, [&](const TriangleBox<T> & b1, const TriangleBox<T> & b2, unsigned thread) {
+        const Triangle3<T> & tri1 = tris[b1.index];
+        const Triangle3<T> & tri2 = tris[b2.index];
+        if (skipNeighbours && shareVertex(tri1, tri2))
+        {
+            return;
+        }
+        ResultCode result = (predicates == Predicates::eExact) ? intersect(exact, tri1, tri2) : intersect(tri1, tri2);
+        if (result == ResultCode::eOk)
+        {
+            sink(thread, std::min(b1.index, b2.index), std::max(b1.index, b2.index));
+        }
+    });
+}
 
-    T v =  dotProduct(theRay.unitDirection(), qvec) / det;
-    if (!(isGreaterOrEqual(v, T(0.0)) && isLessOrEqual(u + v, T(1.0))))
+// Calls sink(thread, i, j) for every pair where triangle i of meshA
+// intersects triangle j of meshB, as intersectMeshes() finds them, in the
+// way of forEachSelfIntersection().
+template <typename T, typename Sink>
+inline void forEachMeshIntersection(const Triangle3<T> * meshA, size_t countA, const Triangle3<T> * meshB, size_t countB, Sink && sink, unsigned threads = 0, Predicates predicates = Predicates::eEpsilon)
+{
+    std::vector<TriangleBox<T>> boxes;
+    boxes.reserve(countA + countB);
+    for (size_t i = 0; i < countA; i++)
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
+        if (!isDegenerate(meshA[i]))
+        {
+            boxes.push_back(makeTriangleBox(meshA[i], i, false));
+        }
     }
-
-    T t = dotProduct(edge2, qvec) / det;
-    if (!isGreaterOrEqual(t, T(0.0)))
+    for (size_t i = 0; i < countB; i++)
     {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
+        if (!isDegenerate(meshB[i]))
+        {
+            boxes.push_back(makeTriangleBox(meshB[i], i, true));
+        }
     }
 
-    intersection = theRay.base() + multiply(theRay.unitDirection(), t);
+    sweepAndPrune(boxes, threads, [&](const TriangleBox<T> & b1, const TriangleBox<T> & b2, unsigned thread) {
+        if (b1.second == b2.second)
+        {
+            return;
+        }
+        const TriangleBox<T> & a = b1.second ? b2 : b1;
+        const TriangleBox<T> & b = b1.second ? b1 : b2;
+        const Triangle3<T> & tri1 = meshA[a.index];
+        const Triangle3<T> & tri2 = meshB[b.index];
+        ResultCode result = (predicates == Predicates::eExact) ? intersect(exact, tri1, tri2) : intersect(tri1, tri2);
+        if (result == ResultCode::eOk)
+        {
+            sink(thread, a.index, b.index);
+        }
+    });
+}
 
-    if (!isValid(intersection))
+// Per thread pair lists in arenas of their own, so that the threads do
+// not meet in the heap while the lists grow.
+struct PairCollector
+{
+    using Pairs = ArenaVector<std::pair<size_t, size_t>>;
+
+    explicit PairCollector(unsigned threads) : arenas(new MonotonicArena[threads])
     {
-        return ResultCode::eOverflow;
+        perThread.reserve(threads);
+        for (unsigned t = 0; t < threads; t++)
+        {
+            perThread.emplace_back(ArenaAllocator<std::pair<size_t, size_t>>(arenas[t]));
+        }
     }
 
-    return ResultCode::eOk;
+    inline void operator()(unsigned thread, size_t i, size_t j) { perThread[thread].emplace_back(i, j); }
+
+    std::unique_ptr<MonotonicArena[]>   arenas;
+    std::vector<Pairs>                  perThread;
+};
+
+// All pairs (i, j), i < j, of intersecting triangles in a mesh, according
+// to intersect(Triangle3, Triangle3), or to intersect(exact, Triangle3,
+// Triangle3) with Predicates::eExact. With skipNeighbours set, triangles
+// that share a vertex are taken to be neighbours in the mesh and are not
+// tested. Degenerate triangles are never reported. Returns eOk if there
+// is at least one pair.
+template <typename T, typename Alloc>
+inline ResultCode intersectSelf(const Triangle3<T> * tris, size_t count, std::vector<std::pair<size_t, size_t>, Alloc> & pairs, bool skipNeighbours = true, unsigned threads = 0, Predicates predicates = Predicates::eEpsilon)
+{
+    PairCollector collector(threadCount(threads));
+    forEachSelfIntersection(tris, count, collector, skipNeighbours, threads, predicates);
+    gatherPairs(collector.perThread, pairs);
+    return pairs.empty() ? ResultCode::eNoIntersection : ResultCode::eOk;
 }
 
-template <typename T>
-inline ResultCode intersect(const Ray3<T> & theRay, const Triangle3<T> & theTri, Point3<T> & intersection)
+// All pairs (i, j) where triangle i of meshA intersects triangle j of
+// meshB, decided as in intersectSelf(). Degenerate triangles are never
+// reported. Returns eOk if there is at least one pair.
+template <typename T, typename Alloc>
+inline ResultCode intersectMeshes(const Triangle3<T> * meshA, size_t countA, const Triangle3<T> * meshB, size_t countB, std::vector<std::pair<size_t, size_t>, Alloc> & pairs, unsigned threads = 0, Predicates predicates = Predicates::eEpsilon)
 {
-    return intersect(theTri, theRay, intersection);
+    PairCollector collector(threadCount(threads));
+    forEachMeshIntersection(meshA, countA, meshB, countB, collector, threads, predicates);
+    gatherPairs(collector.perThread, pairs);
+    return pairs.empty() ? ResultCode::eNoIntersection : ResultCode::eOk;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Batch queries
+//
+// The scalar queries applied to arrays, split into cache sized chunks (see
+// batchGrain()) and run on an executor: SerialExecutor (the default),
+// ThreadExecutor, ThreadPool, ParallelStlExecutor (with
+// HUBERT_PARALLEL_STL defined) or anything with the same forChunks().
+// Results are written to out[i] for input i, exactly as the scalar
+// function would compute them, whatever the executor.
+/////////////////////////////////////////////////////////////////////////////
+
+// The result of one query in intersectBatch(): what the scalar intersect()
+// returned, and its triIndex and intersection out parameters.
 template <typename T>
-inline ResultCode intersect(const Triangle3<T> & theTri,  const Line3<T> & theLine, Point3<T> & intersection)
+struct BatchHit
 {
-    // Check for degnerate inputs
-    if (isDegenerate(theTri) || isDegenerate(theLine))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eDegenerate;
-    }
+    ResultCode  result;
+    size_t      triangle;
+    Point3<T>   point;
+};
 
+template <typename T, typename Executor = SerialExecutor>
+inline void distanceBatch(const Point3<T> * points, size_t count, const Plane<T> & thePlane, T * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(sizeof(Point3<T>) + sizeof(T)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = distance(points[i], thePlane);
+        }
+    });
+}
 
-    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
+template <typename T, typename Executor = SerialExecutor>
+inline void distanceBatch(const Point3<T> * points, size_t count, const Point3<T> & thePoint, T * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(sizeof(Point3<T>) + sizeof(T)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = distance(points[i], thePoint);
+        }
+    });
+}
 
-    Vector3<T> edge1 = theTri.p2() - theTri.p1();
-    Vector3<T> edge2 = theTri.p3() - theTri.p1();
+template <typename T, typename Executor = SerialExecutor>
+inline void closestPointBatch(const Point3<T> * points, size_t count, const Plane<T> & thePlane, Point3<T> * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(2 * sizeof(Point3<T>)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = closestPoint(thePlane, points[i]);
+        }
+    });
+}
 
-    Vector3<T> pvec = crossProduct(theLine.unitDirection(), edge2);
+template <typename T, typename Executor = SerialExecutor>
+inline void closestPointBatch(const Point3<T> * points, size_t count, const Line3<T> & theLine, Point3<T> * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(2 * sizeof(Point3<T>)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = closestPoint(theLine, points[i]);
+        }
+    });
+}
 
-    T det = dotProduct(edge1, pvec);
-    if (isEqual(det, T(0.0)))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eCoplanar;
-    }
+// Closest hits of an array of Ray3, Segment3 or Line3 against a mesh in a
+// Bvh. Returns the number of queries that hit.
+template <typename T, typename Query, typename Executor = SerialExecutor>
+inline size_t intersectBatch(const Query * queries, size_t count, const Bvh<T> & theBvh, BatchHit<T> * hits, Executor && exec = Executor())
+{
+    std::atomic<size_t> hitCount(0);
+    exec.forChunks(count, batchGrain(sizeof(Query) + sizeof(BatchHit<T>)), [&](size_t begin, size_t end) {
+        size_t n = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            hits[i].result = intersect(theBvh, queries[i], hits[i].triangle, hits[i].point);
+            n += (hits[i].result == ResultCode::eOk) ? 1 : 0;
+        }
+        hitCount += n;
+    });
+    return hitCount;
+}
 
-    Vector3<T> tvec = theLine.base() - theTri.p1();
+// Any hit version of intersectBatch(), for occlusion queries.
+template <typename T, typename Query, typename Executor = SerialExecutor>
+inline size_t intersectAnyBatch(const Query * queries, size_t count, const Bvh<T> & theBvh, BatchHit<T> * hits, Executor && exec = Executor())
+{
+    std::atomic<size_t> hitCount(0);
+    exec.forChunks(count, batchGrain(sizeof(Query) + sizeof(BatchHit<T>)), [&](size_t begin, size_t end) {
+        size_t n = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            hits[i].result = intersectAny(theBvh, queries[i], hits[i].triangle, hits[i].point);
+            n += (hits[i].result == ResultCode::eOk) ? 1 : 0;
+        }
+        hitCount += n;
+    });
+    return hitCount;
+}
 
-    T u = dotProduct(tvec, pvec) / det;
-    if (!(isGreaterOrEqual(u, T(0.0)) && isLessOrEqual(u, T(1.0))))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
-    }
+/////////////////////////////////////////////////////////////////////////////
+// Streaming queries
+//
+// Queries against meshes too large to hold in memory. The triangles are
+// read in chunks from a source and each chunk is tested against the whole
+// batch of queries, keeping the best result so far for each. While one
+// chunk is processed on the executor, a second thread reads the next, so
+// only two chunks are ever held and the reading hides behind the work.
+//
+// A source is anything with
+//
+//   size_t size() const;
+//   void read(size_t first, size_t count, TriangleSoup<T> & chunk) const;
+//
+// read() replaces the contents of chunk with triangles [first, first +
+// count), classified as TriangleSoup classifies them. It is called from
+// the reading thread, but never twice at the same time. StlFile and
+// PlyFile (hubertIO.hpp) are sources, and so is PackedTriangleSource.
+//
+// Results are those of the in-core query over all the triangles. The
+// triangle indices are the source's.
+/////////////////////////////////////////////////////////////////////////////
 
-    Vector3<T> qvec = crossProduct(tvec, edge1);
+// The number of triangles the streaming queries read at a time: about 2.4
+// MB of float coordinates per chunk.
+constexpr size_t cStreamChunkSize = 64 * 1024;
 
-    T v =  dotProduct(theLine.unitDirection(), qvec) / det;
-    if (!(isGreaterOrEqual(v, T(0.0)) && isLessOrEqual(u + v, T(1.0))))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
-    }
+// An array of packed triangles as a source
+template <typename T>
+class PackedTriangleSource
+{
+    public:
+        // constructors
+        PackedTriangleSource(const PackedTriangle3<T> * tris, size_t count) : _tris(tris), _count(count) {}
 
-    T t = dotProduct(edge2, qvec) / det;
-    intersection = theLine.base() + multiply(theLine.unitDirection(), t);
+        // public methods
+        inline size_t size() const { return _count; }
 
-    if (!isValid(intersection))
-    {
-        return ResultCode::eOverflow;
-    }
+        inline void read(size_t first, size_t count, TriangleSoup<T> & chunk) const
+        {
+            chunk.clear();
+            chunk.append(_tris + first, count);
+        }
 
-    return ResultCode::eOk;
-}
+    private:
+        // private data
+        const PackedTriangle3<T> *  _tris;
+        size_t                      _count;
+};
 
-template <typename T>
-inline ResultCode intersect(const Line3<T> & theLine, const Triangle3<T> & theTri, Point3<T> & intersection)
+// Reads the source chunk by chunk, calling prepare(chunk) on the reading
+// thread once a chunk has been read and then process(chunk, first) on the
+// calling thread. Chunk i + 1 is read and prepared while chunk i is
+// processed. Buffer holds a TriangleSoup<T> soup and whatever prepare()
+// adds to it. An exception from the source, prepare() or process() is
+// passed on to the caller once the reader has stopped.
+template <typename Buffer, typename Source, typename Prepare, typename Process>
+inline void streamChunks(const Source & source, size_t chunkSize, Prepare prepare, Process process)
 {
-    return intersect(theTri, theLine, intersection);
+    size_t total = source.size();
+    chunkSize = std::max(chunkSize, size_t(1));
+    Buffer buffers[2];
+    auto load = [&](size_t first, Buffer & b) {
+        source.read(first, std::min(chunkSize, total - first), b.soup);
+        prepare(b);
+    };
+
+    if (total == 0)
+    {
+        return;
+    }
+    load(0, buffers[0]);
+    for (size_t first = 0, current = 0; first < total; first += chunkSize, current ^= 1)
+    {
+        // if process() throws, the future waits for the reader as it goes
+        // out of scope, and get() passes on anything the reader threw
+        std::future<void> reader;
+        if (first + chunkSize < total)
+        {
+            reader = std::async(std::launch::async, load, first + chunkSize, std::ref(buffers[current ^ 1]));
+        }
+        process(buffers[current], first);
+        if (reader.valid())
+        {
+            reader.get();
+        }
+    }
 }
 
-
 template <typename T>
-inline ResultCode intersect(const Triangle3<T>& theTri, const Segment3<T>& theSegment, Point3<T>& intersection)
+struct StreamChunk
 {
-    // initialize the output point to an invalid point
-    intersection = invalidPoint3<T>();
+    TriangleSoup<T>     soup;
+};
 
-    // Check for degenerate inputs
-    if (isDegenerate(theTri) || isDegenerate(theSegment))
+// Closest hits of an array of rays against the triangles of a source, as
+// intersect(TriangleSoup, Ray3) finds them over the whole source: hits[i]
+// has the index and point of the nearest triangle ray i hits (the lowest
+// index of those at the same distance), eNoIntersection if it hits none,
+// and eDegenerate for a degenerate ray. Returns the number of rays that
+// hit.
+template <typename T, typename Source, typename Executor = SerialExecutor>
+inline size_t intersectStream(const Ray3<T> * rays, size_t count, const Source & source, BatchHit<T> * hits, Executor && exec = Executor(), size_t chunkSize = cStreamChunkSize)
+{
+    std::vector<T> nearest(count, infinity<T>());
+    for (size_t i = 0; i < count; i++)
     {
-        return ResultCode::eDegenerate;
+        hits[i] = BatchHit<T>{ ResultCode::eNoIntersection, invalidIndex(), invalidPoint3<T>() };
     }
 
-    // from Moller: https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/raytri/raytri.c
-
-    Vector3<T> edge1 = theTri.p2() - theTri.p1();
-    Vector3<T> edge2 = theTri.p3() - theTri.p1();
-
-    Vector3<T> pvec = crossProduct(makeUnitVector3(theSegment.target() - theSegment.base()), edge2);
+    streamChunks<StreamChunk<T>>(source, chunkSize, [](StreamChunk<T> &) {}, [&](const StreamChunk<T> & chunk, size_t first) {
+        exec.forChunks(count, batchGrain(sizeof(Ray3<T>) + sizeof(BatchHit<T>)), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                size_t index;
+                T t;
+                // earlier chunks hold the lower indices, so a tie keeps
+                // the hit already found
+                if (intersect(chunk.soup, rays[i], index, t) == ResultCode::eOk && t < nearest[i])
+                {
+                    nearest[i] = t;
+                    hits[i].triangle = first + index;
+                }
+            }
+        });
+    });
 
-    T det = dotProduct(edge1, pvec);
-    if (isEqual(det, T(0.0)))
+    size_t hitCount = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        return ResultCode::eCoplanar;
+        if (isDegenerate(rays[i]))
+        {
+            hits[i].result = ResultCode::eDegenerate;
+        }
+        else if (hits[i].triangle != invalidIndex())
+        {
+            hits[i].result = ResultCode::eOk;
+            hits[i].point = rays[i].base() + multiply(rays[i].unitDirection(), nearest[i]);
+            hitCount++;
+        }
     }
+    return hitCount;
+}
 
-    Vector3<T> tvec = theSegment.base() - theTri.p1();
+template <typename T>
+struct StreamTriangles
+{
+    TriangleSoup<T>             soup;
+    std::vector<Triangle3<T>>   tris;
+    std::vector<size_t>         index;
+};
 
-    UnitVector3<T> segDir = makeUnitVector3(theSegment.target() - theSegment.base());
+// Distances from an array of points to the triangles of a source:
+// out[i] is the smallest distance(Point3, Triangle3) from point i to a
+// triangle that is not degenerate, and nearest[i] (if nearest is not
+// null) the index of that triangle, the lowest of those at the same
+// distance. A point with no finite distance to any triangle gets infinity
+// and invalidIndex(). Each point is tested against every triangle.
+template <typename T, typename Source, typename Executor = SerialExecutor>
+inline void distanceStream(const Point3<T> * points, size_t count, const Source & source, T * out, size_t * nearest = nullptr, Executor && exec = Executor(), size_t chunkSize = cStreamChunkSize)
+{
+    std::vector<size_t> best(count, invalidIndex());
+    std::fill(out, out + count, infinity<T>());
+
+    // the usable triangles of a chunk are built once, on the reading thread
+    auto prepare = [](StreamTriangles<T> & chunk) {
+        chunk.tris.clear();
+        chunk.index.clear();
+        for (size_t j = 0; j < chunk.soup.size(); j++)
+        {
+            if (!chunk.soup.amDegenerate(j))
+            {
+                chunk.tris.push_back(chunk.soup.triangle(j));
+                chunk.index.push_back(j);
+            }
+        }
+    };
 
+    streamChunks<StreamTriangles<T>>(source, chunkSize, prepare, [&](const StreamTriangles<T> & chunk, size_t first) {
+        exec.forChunks(count, batchGrain(sizeof(Point3<T>) + sizeof(T)), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                for (size_t j = 0; j < chunk.tris.size(); j++)
+                {
+                    T d = distance(points[i], chunk.tris[j]);
+                    if (d < out[i])
+                    {
+                        out[i] = d;
+                        best[i] = first + chunk.index[j];
+                    }
+                }
+            }
+        });
+    });
 
-    T u = dotProduct(tvec, pvec) / det;
-    if (!(isGreaterOrEqual(u, T(0.0)) && isLessOrEqual(u, T(1.0))))
+    if (nearest != nullptr)
     {
-        return ResultCode::eNoIntersection;
+        std::copy(best.begin(), best.end(), nearest);
     }
+}
 
-    Vector3<T> qvec = crossProduct(tvec, edge1);
+/////////////////////////////////////////////////////////////////////////////
+// Device views
+//
+// Plain pointer views of a TriangleSoup and a Bvh, and the closest hit and
+// point to plane queries over them, written on raw coordinates and marked
+// HUBERT_HOST_DEVICE so that one GPU thread can run one query. The views
+// own nothing: on the host they point into the containers, and
+// hubertCuda.hpp fills them with copies uploaded once per mesh. The batch
+// routines validate and pack the rays on the host, so that each thread
+// reads only its base and direction; kernels of their own can also build
+// and query Point3, Ray3, Triangle3 and Plane directly.
+/////////////////////////////////////////////////////////////////////////////
 
-    T v = dotProduct(segDir, qvec) / det;
-    if (!(isGreaterOrEqual(v, T(0.0)) && isLessOrEqual(u + v, T(1.0))))
-    {
-        return ResultCode::eNoIntersection;
-    }
+// A ray as the view queries take it: its base and unit direction.
+template <typename T>
+struct PackedRay3
+{
+    PackedPoint3<T>     base;
+    PackedPoint3<T>     dir;
+};
 
-    T t = dotProduct(edge2, qvec) / det;
+static_assert(std::is_trivially_copyable<PackedRay3<float>>::value && std::is_standard_layout<PackedRay3<float>>::value, "PackedRay3 must be memcpy-able");
 
-    if (!isValid(t))
-    {
-        return ResultCode::eOverflow;
-    }
+template <typename T>
+inline PackedRay3<T> makePackedRay3(const Ray3<T> & theRay)
+{
+    return PackedRay3<T>{ makePackedPoint3(theRay.base()), PackedPoint3<T>{ theRay.unitDirection().x(), theRay.unitDirection().y(), theRay.unitDirection().z() } };
+}
+
+// The result of a view ray query: the index of the closest triangle hit
+// and its distance along the ray, or invalidIndex() and invalidValue().
+template <typename T>
+struct RayHit
+{
+    size_t  triangle;
+    T       t;
+};
+
+template <typename T>
+struct SoupView
+{
+    const T *           x[3];
+    const T *           y[3];
+    const T *           z[3];
+    const uint64_t *    degenerate;     // one bit per triangle
+    size_t              size;
+};
 
-    if (t < 0.0)
+template <typename T>
+inline SoupView<T> makeSoupView(const TriangleSoup<T> & theSoup)
+{
+    SoupView<T> view;
+    for (uint32_t k = 0; k < 3; k++)
     {
-        return ResultCode::eNoIntersection;
+        view.x[k] = theSoup.x(k);
+        view.y[k] = theSoup.y(k);
+        view.z[k] = theSoup.z(k);
     }
+    view.degenerate = theSoup.degenerateBits();
+    view.size = theSoup.size();
+    return view;
+}
 
-    intersection = theSegment.base() + multiply(segDir, t);
+template <typename T>
+struct BvhView
+{
+    const BvhNode<T> *          nodes;
+    const uint32_t *            parents;    // of each node; the root's is 0
+    const PackedTriangle3<T> *  triangles;  // in tree order
+    const size_t *              index;      // index in the original range
+    size_t                      nodeCount;
+};
 
-    if (!isValid(intersection))
+//
+// FlatBvh.
+//
+// The arrays behind a BvhView, copied out of a Bvh, with the parent of
+// each node added for the stackless walk of the view query.
+//
+template <typename T>
+struct FlatBvh
+{
+    FlatBvh() = default;
+    explicit FlatBvh(const Bvh<T> & theBvh) :
+        nodes(theBvh.nodes()), parents(nodes.size(), 0)
     {
-        // generally, if the result is invalid, we return the constant invalidPoint3<T>()
-        // but in this case we simply return the result of the calculation because it is
-        // possibly useful to the caller to figure out what is overflowing.
-        return ResultCode::eOverflow;
+        for (uint32_t n = 0; n < nodes.size(); n++)
+        {
+            if (nodes[n].count == 0)
+            {
+                parents[nodes[n].first] = n;
+                parents[nodes[n].first + 1] = n;
+            }
+        }
+        triangles.reserve(theBvh.triangles().size());
+        index.reserve(theBvh.triangles().size());
+        for (size_t i = 0; i < theBvh.triangles().size(); i++)
+        {
+            triangles.push_back(makePackedTriangle3(theBvh.triangles()[i]));
+            index.push_back(theBvh.originalIndex(i));
+        }
     }
 
-    if (hubert::distance(intersection, theSegment.base()) > hubert::distance(theSegment.base(), theSegment.target()))
-    {
-        intersection = invalidPoint3<T>();
-        return ResultCode::eNoIntersection;
-    }
+    inline BvhView<T> view() const { return BvhView<T>{ nodes.data(), parents.data(), triangles.data(), index.data(), nodes.size() }; }
 
-    // we intersected
-    return ResultCode::eOk;
-}
+    std::vector<BvhNode<T>>             nodes;
+    std::vector<uint32_t>               parents;
+    std::vector<PackedTriangle3<T>>     triangles;
+    std::vector<size_t>                 index;
+};
 
+// The Moller test of one triangle, accepting hits at t >= 0 as the ray
+// queries do.
 template <typename T>
-inline ResultCode intersect(const Segment3<T>& theSegment, const Triangle3<T>& theTri, Point3<T>& intersection)
+HUBERT_HOST_DEVICE inline bool rayHitsTriangle(const T orig[3], const T dir[3], const T vert0[3], const T vert1[3], const T vert2[3], T & t)
 {
-    return intersect(theTri, theSegment, intersection);
+    const T edge1[3] = { vert1[0] - vert0[0], vert1[1] - vert0[1], vert1[2] - vert0[2] };
+    const T edge2[3] = { vert2[0] - vert0[0], vert2[1] - vert0[1], vert2[2] - vert0[2] };
+    t = T(0.0);
+    return mollerTrumbore(orig, dir, vert0, edge1, edge2, t) == ResultCode::eOk && isGreaterOrEqual(t, T(0.0));
 }
 
+// The answer of intersect(TriangleSoup, Ray3) for a valid ray, by brute
+// force over the view.
 template <typename T>
-inline ResultCode intersect(const Triangle3<T>& theTri, const Plane<T>& thePlane)
+HUBERT_HOST_DEVICE inline RayHit<T> intersect(const SoupView<T> & theSoup, const PackedRay3<T> & theRay)
 {
-    // Degenerate triangles and planes are out of scope
-    if (isDegenerate(theTri) || isDegenerate(thePlane))
+    const T orig[3] = { theRay.base.x, theRay.base.y, theRay.base.z };
+    const T dir[3] = { theRay.dir.x, theRay.dir.y, theRay.dir.z };
+
+    RayHit<T> hit{ invalidIndex(), invalidValue<T>() };
+    for (size_t i = 0; i < theSoup.size; i++)
     {
-        return ResultCode::eDegenerate;
+        if ((theSoup.degenerate[i >> 6] >> (i & 63)) & 1)
+        {
+            continue;
+        }
+        const T vert0[3] = { theSoup.x[0][i], theSoup.y[0][i], theSoup.z[0][i] };
+        const T vert1[3] = { theSoup.x[1][i], theSoup.y[1][i], theSoup.z[1][i] };
+        const T vert2[3] = { theSoup.x[2][i], theSoup.y[2][i], theSoup.z[2][i] };
+        T t;
+        if (rayHitsTriangle(orig, dir, vert0, vert1, vert2, t) && (hit.triangle == invalidIndex() || t < hit.t))
+        {
+            hit.triangle = i;
+            hit.t = t;
+        }
     }
+    return hit;
+}
 
-    // since the triangle was not degenerate, we don't bother checking the segments
-    hubert::Segment3<double> s1(theTri.p1(), theTri.p2());
-    hubert::Segment3<double> s2(theTri.p2(), theTri.p3());
-    hubert::Segment3<double> s3(theTri.p3(), theTri.p1());
-
-    hubert::Point3<double> intPoint;
-    auto ret1 = hubert::intersect(s1, thePlane, intPoint);
-    auto ret2 = hubert::intersect(s2, thePlane, intPoint);
-    auto ret3 = hubert::intersect(s3, thePlane, intPoint);
-
-    // as long as one edge of the triangle intersects, it does not matter what the others do
-    if (ret1 == ResultCode::eOk || ret2 == ResultCode::eOk || ret3 == ResultCode::eOk)
+// The children of interior node n in the order a view query visits them:
+// the one whose box the ray enters first, then the other, with a child the
+// ray misses last. It is worked out afresh each time the walk passes n,
+// and always comes out the same.
+template <typename T>
+HUBERT_HOST_DEVICE inline void viewChildOrder(const BvhView<T> & theBvh, uint32_t n, const T orig[3], const T invDir[3], uint32_t & nearChild, uint32_t & farChild)
+{
+    const BvhNode<T> & child0 = theBvh.nodes[theBvh.nodes[n].first];
+    const BvhNode<T> & child1 = theBvh.nodes[theBvh.nodes[n].first + 1];
+    T near0 = T(0.0), far0 = infinity<T>();
+    T near1 = T(0.0), far1 = infinity<T>();
+    if (!slabTest(child0.bmin, child0.bmax, orig, invDir, near0, far0))
     {
-        return ResultCode::eOk;
+        near0 = infinity<T>();
+    }
+    if (!slabTest(child1.bmin, child1.bmax, orig, invDir, near1, far1))
+    {
+        near1 = infinity<T>();
     }
+    nearChild = theBvh.nodes[n].first + ((near0 <= near1) ? 0 : 1);
+    farChild = theBvh.nodes[n].first + ((near0 <= near1) ? 1 : 0);
+}
 
-    // if any of the calculations overflowed
-    if (ret1 == ResultCode::eOverflow || ret2 == ResultCode::eOverflow || ret3 == ResultCode::eOverflow)
+// Closest hit of a valid ray through the view. The nearest hit is the one
+// with the smallest t, and ties go to the lower original index.
+// intersect(Bvh, Ray3) picks by the distance to the computed intersection
+// point instead, so the two can disagree between hits within rounding of
+// each other.
+//
+// The walk keeps no stack, so that a GPU thread needs no memory for it
+// however deep the tree is: it goes down to the nearer child first, and
+// coming back up from a node it moves on to the node's sibling if that
+// comes next in the parent's order, or else on up to the parent.
+template <typename T>
+HUBERT_HOST_DEVICE inline RayHit<T> intersect(const BvhView<T> & theBvh, const PackedRay3<T> & theRay)
+{
+    RayHit<T> hit{ invalidIndex(), invalidValue<T>() };
+    if (theBvh.nodeCount == 0)
     {
-        return ResultCode::eOverflow;
+        return hit;
     }
 
-    // if all three edges are coplanar, then that is a reasonable status
-    if (ret1 == ResultCode::eCoplanar && ret2 == ResultCode::eCoplanar && ret3 == ResultCode::eCoplanar)
+    const T orig[3] = { theRay.base.x, theRay.base.y, theRay.base.z };
+    const T dir[3] = { theRay.dir.x, theRay.dir.y, theRay.dir.z };
+    const T invDir[3] = { T(1.0) / dir[0], T(1.0) / dir[1], T(1.0) / dir[2] };
+
+    uint32_t current = 0;
+    for (;;)
     {
-        return ResultCode::eCoplanar;
+        // entering current, which is skipped if the ray misses its box or
+        // enters it beyond the closest hit so far
+        const BvhNode<T> & node = theBvh.nodes[current];
+        T tNear = T(0.0);
+        T tFar = infinity<T>();
+        if (slabTest(node.bmin, node.bmax, orig, invDir, tNear, tFar) && !(tNear > hit.t))
+        {
+            if (node.count == 0)
+            {
+                uint32_t farChild;
+                viewChildOrder(theBvh, current, orig, invDir, current, farChild);
+                continue;
+            }
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                const PackedTriangle3<T> & tri = theBvh.triangles[i];
+                const T vert0[3] = { tri.p1.x, tri.p1.y, tri.p1.z };
+                const T vert1[3] = { tri.p2.x, tri.p2.y, tri.p2.z };
+                const T vert2[3] = { tri.p3.x, tri.p3.y, tri.p3.z };
+                T t;
+                if (rayHitsTriangle(orig, dir, vert0, vert1, vert2, t) &&
+                    (t < hit.t || (t == hit.t && theBvh.index[i] < hit.triangle)))
+                {
+                    hit.triangle = theBvh.index[i];
+                    hit.t = t;
+                }
+            }
+        }
+
+        // leaving current: on to the next node, or done at the root
+        for (;;)
+        {
+            if (current == 0)
+            {
+                return hit;
+            }
+            uint32_t parent = theBvh.parents[current];
+            uint32_t nearChild;
+            uint32_t farChild;
+            viewChildOrder(theBvh, parent, orig, invDir, nearChild, farChild);
+            if (current == nearChild)
+            {
+                current = farChild;
+                break;
+            }
+            current = parent;
+        }
     }
+}
 
-    // if all three edges are parallel, then that is a reasonable status
-    if (ret1 == ResultCode::eParallel && ret2 == ResultCode::eParallel && ret3 == ResultCode::eParallel)
+// distance(Point3, Plane) on raw coordinates: the signed distance of the
+// point above the plane through base with unit normal up, or infinity if
+// the offset from base overflows.
+template <typename T>
+HUBERT_HOST_DEVICE inline T signedDistance(const PackedPoint3<T> & point, const PackedPoint3<T> & base, const PackedPoint3<T> & up)
+{
+    const T dx = point.x - base.x;
+    const T dy = point.y - base.y;
+    const T dz = point.z - base.z;
+    if (!(isValid(dx) && isValid(dy) && isValid(dz)))
     {
-        return ResultCode::eParallel;
+        return infinity<T>();
     }
+    return up.x * dx + up.y * dy + up.z * dz;
+}
 
-    // catchall - there was no intersection
-    return ResultCode::eNoIntersection;
+/////////////////////////////////////////////////////////////////////////////
+// Point indexes
+//
+// Nearest neighbour and radius queries over a fixed set of points. There
+// are two with the same queries: PointIndex, a k-d tree that suits any
+// distribution, and PointGrid, a hashed uniform grid that is faster when
+// the density is roughly uniform and the cell size is chosen to match it.
+// Invalid points are left out. Queries report points by their index in the
+// input, compare squared distances, and break ties between equally distant
+// points by taking the lowest index, so the results do not depend on the
+// index or on how it was built.
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+inline T coordinate(const PackedPoint3<T> & p, int axis)
+{
+    return (axis == 0) ? p.x : ((axis == 1) ? p.y : p.z);
 }
 
 template <typename T>
-inline ResultCode intersect(const Plane<T>& thePlane, const Triangle3<T>& theTri)
+inline T distanceSquared3(const T q[3], const PackedPoint3<T> & p)
 {
-    return intersect(theTri, thePlane);
+    T dx = q[0] - p.x;
+    T dy = q[1] - p.y;
+    T dz = q[2] - p.z;
+    return dx * dx + dy * dy + dz * dz;
 }
 
+// The k best candidates of a nearest neighbour search, as (squared
+// distance, index) pairs in a max heap so that the worst is at the front.
+template <typename T>
+class NeighbourHeap
+{
+    public:
+        explicit NeighbourHeap(size_t k) : _k(k) { _items.reserve(k); }
 
-/* Triangle/triangle intersection test routine,
-* by Tomas Moller, 1997.
-* See article "A Fast Triangle-Triangle Intersection Test",
-* Journal of Graphics Tools, 2(2), 1997
-*
-* Updated June 1999: removed the divisions -- a little faster now!
-* Updated October 1999: added {} to CROSS and SUB macros
-*
-* int NoDivTriTriIsect(float V0[3],float V1[3],float V2[3],
-*                      float U0[3],float U1[3],float U2[3])
-*
-* parameters: vertices of triangle 1: V0,V1,V2
-*             vertices of triangle 2: U0,U1,U2
-* result    : returns 1 if the triangles intersect, otherwise 0
-*
-*/
+        inline bool full() const { return _items.size() == _k; }
 
-/*
-Copyright 2020 Tomas Akenine-M�ller
+        // the squared distance a candidate has to beat, or tie
+        inline T bound() const { return full() ? _items.front().first : infinity<T>(); }
 
-Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
-documentation files (the "Software"), to deal in the Software without restriction, including without limitation
-the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and
-to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+        inline void offer(T d, size_t index)
+        {
+            std::pair<T, size_t> item(d, index);
+            if (!full())
+            {
+                _items.push_back(item);
+                std::push_heap(_items.begin(), _items.end());
+            }
+            else if (_k > 0 && item < _items.front())
+            {
+                std::pop_heap(_items.begin(), _items.end());
+                _items.back() = item;
+                std::push_heap(_items.begin(), _items.end());
+            }
+        }
 
-The above copyright notice and this permission notice shall be included in all copies or substantial
-portions of the Software.
+        // closest first
+        void result(std::vector<size_t> & out)
+        {
+            std::sort_heap(_items.begin(), _items.end());
+            out.clear();
+            for (auto & item : _items)
+            {
+                out.push_back(item.second);
+            }
+        }
 
-THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
-WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
-OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
-OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
-*/
+    private:
+        size_t                          _k;
+        std::vector<std::pair<T, size_t>> _items;
+};
 
+//
+// PointIndex.
+//
+// A k-d tree stored flat: the points are reordered so that each node is a
+// range of the array, split at its middle element across the axis on which
+// the range is widest, with the two halves on either side. Only the split
+// axis is stored per node. Building is O(n log n); the top levels are
+// split in parallel, level by level, and then the subtrees.
+//
+template <typename T>
+class PointIndex
+{
+    public:
+        // constructors
+        PointIndex() = default;
+        PointIndex(const Point3<T> * points, size_t count, unsigned threads = 1) { _build(points, count, threads); }
+        template <typename Iter>
+        PointIndex(Iter first, Iter last, unsigned threads = 1)
+        {
+            std::vector<Point3<T>> points(first, last);
+            _build(points.data(), points.size(), threads);
+        }
+        PointIndex(const PointIndex &) = default;
+        ~PointIndex() = default;
 
+        // public operators
+        inline PointIndex<T> & operator=(const PointIndex<T> &) = default;
 
-/* some macros */
-#define CROSS(dest,v1,v2){                     \
-              dest[0]=v1[1]*v2[2]-v1[2]*v2[1]; \
-              dest[1]=v1[2]*v2[0]-v1[0]*v2[2]; \
-              dest[2]=v1[0]*v2[1]-v1[1]*v2[0];}
+        // public methods
+        inline size_t size() const { return _points.size(); }
 
-#define DOT(v1,v2) (v1[0]*v2[0]+v1[1]*v2[1]+v1[2]*v2[2])
+        // the points in tree order, and their index in the input
+        inline const std::vector<PackedPoint3<T>> & points() const { return _points; }
+        inline size_t originalIndex(size_t i) const { return _index[i]; }
 
-#define SUB(dest,v1,v2){         \
-            dest[0]=v1[0]-v2[0]; \
-            dest[1]=v1[1]-v2[1]; \
-            dest[2]=v1[2]-v2[2];}
+        // the closest point, or invalidIndex() if there is none
+        size_t nearest(const Point3<T> & thePoint) const
+        {
+            std::vector<size_t> result;
+            nearest(thePoint, 1, result);
+            return result.empty() ? invalidIndex() : result[0];
+        }
 
-/* sort so that a<=b */
-#define SORT(a,b)       \
-             if(a>b)    \
-             {          \
-               T ct; \
-               ct=a;     \
-               a=b;     \
-               b=ct;     \
-             }
+        // the k closest points, closest first (fewer if there are fewer)
+        void nearest(const Point3<T> & thePoint, size_t k, std::vector<size_t> & result) const
+        {
+            NeighbourHeap<T> heap(k);
+            if (isValid(thePoint) && k > 0 && !_points.empty())
+            {
+                const T q[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+                _nearest(q, 0, _points.size(), heap);
+            }
+            heap.result(result);
+        }
 
+        // the points within radius (inclusive), in no particular order
+        void withinRadius(const Point3<T> & thePoint, T radius, std::vector<size_t> & result) const
+        {
+            result.clear();
+            if (isValid(thePoint) && radius >= T(0.0) && !_points.empty())
+            {
+                const T q[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+                _withinRadius(q, radius * radius, 0, _points.size(), result);
+            }
+        }
 
-/* this edge to edge test is based on Franlin Antonio's gem:
-   "Faster Line Segment Intersection", in Graphics Gems III,
-   pp. 199-202 */
-#define EDGE_EDGE_TEST(V0,U0,U1)                      \
-  Bx=U0[i0]-U1[i0];                                   \
-  By=U0[i1]-U1[i1];                                   \
-  Cx=V0[i0]-U0[i0];                                   \
-  Cy=V0[i1]-U0[i1];                                   \
-  f=Ay*Bx-Ax*By;                                      \
-  d=By*Cx-Bx*Cy;                                      \
-  if((f>0 && d>=0 && d<=f) || (f<0 && d<=0 && d>=f))  \
-  {                                                   \
-    e=Ax*Cy-Ay*Cx;                                    \
-    if(f>0)                                           \
-    {                                                 \
-      if(e>=0 && e<=f) return ResultCode::eOk;                      \
-    }                                                 \
-    else                                              \
-    {                                                 \
-      if(e<=0 && e>=f) return ResultCode::eOk;                      \
-    }                                                 \
-  }
+    private:
+        static constexpr size_t cLeafSize = 8;
 
-#define EDGE_AGAINST_TRI_EDGES(V0,V1,U0,U1,U2) \
-{                                              \
-  T Ax,Ay,Bx,By,Cx,Cy,e,d,f;               \
-  Ax=V1[i0]-V0[i0];                            \
-  Ay=V1[i1]-V0[i1];                            \
-  /* test edge U0,U1 against V0,V1 */          \
-  EDGE_EDGE_TEST(V0,U0,U1);                    \
-  /* test edge U1,U2 against V0,V1 */          \
-  EDGE_EDGE_TEST(V0,U1,U2);                    \
-  /* test edge U2,U1 against V0,V1 */          \
-  EDGE_EDGE_TEST(V0,U2,U0);                    \
-}
+        struct Entry
+        {
+            PackedPoint3<T>     p;
+            size_t              index;
+        };
 
-#define POINT_IN_TRI(V0,U0,U1,U2)           \
-{                                           \
-  T a,b,c,d0,d1,d2;                     \
-  /* is T1 completly inside T2? */          \
-  /* check if V0 is inside tri(U0,U1,U2) */ \
-  a=U1[i1]-U0[i1];                          \
-  b=-(U1[i0]-U0[i0]);                       \
-  c=-a*U0[i0]-b*U0[i1];                     \
-  d0=a*V0[i0]+b*V0[i1]+c;                   \
-                                            \
-  a=U2[i1]-U1[i1];                          \
-  b=-(U2[i0]-U1[i0]);                       \
-  c=-a*U1[i0]-b*U1[i1];                     \
-  d1=a*V0[i0]+b*V0[i1]+c;                   \
-                                            \
-  a=U0[i1]-U2[i1];                          \
-  b=-(U0[i0]-U2[i0]);                       \
-  c=-a*U2[i0]-b*U2[i1];                     \
-  d2=a*V0[i0]+b*V0[i1]+c;                   \
-  if(d0*d1>0.0)                             \
-  {                                         \
-    if(d0*d2>0.0) return ResultCode::eOk;                 \
-  }                                         \
-}
+        void _build(const Point3<T> * points, size_t count, unsigned threads)
+        {
+            std::vector<Entry> entries;
+            entries.reserve(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (isValid(points[i]))
+                {
+                    entries.push_back(Entry{ PackedPoint3<T>{ points[i].x(), points[i].y(), points[i].z() }, i });
+                }
+            }
+            _axis.assign(entries.size(), 0);
+
+            // split level by level while there are too few ranges to keep
+            // the threads busy, then build each remaining subtree whole
+            std::vector<std::pair<size_t, size_t>> level;
+            if (entries.size() > cLeafSize)
+            {
+                level.emplace_back(0, entries.size());
+            }
+            unsigned workers = threadCount(threads);
+            while (workers > 1 && !level.empty() && level.size() < 4 * size_t(workers))
+            {
+                parallelFor(level.size(), 1, threads, [&](size_t begin, size_t end, unsigned) {
+                    for (size_t r = begin; r < end; r++)
+                    {
+                        _split(entries, level[r].first, level[r].second);
+                    }
+                });
+                std::vector<std::pair<size_t, size_t>> next;
+                for (auto & r : level)
+                {
+                    size_t mid = (r.first + r.second) / 2;
+                    if (mid - r.first > cLeafSize)
+                    {
+                        next.emplace_back(r.first, mid);
+                    }
+                    if (r.second - mid - 1 > cLeafSize)
+                    {
+                        next.emplace_back(mid + 1, r.second);
+                    }
+                }
+                level.swap(next);
+            }
+            parallelFor(level.size(), 1, threads, [&](size_t begin, size_t end, unsigned) {
+                for (size_t r = begin; r < end; r++)
+                {
+                    _buildRange(entries, level[r].first, level[r].second);
+                }
+            });
 
-#define NEWCOMPUTE_INTERVALS(VV0,VV1,VV2,D0,D1,D2,D0D1,D0D2,A,B,C,X0,X1) \
-{ \
-        if(D0D1>0.0f) \
-        { \
-                /* here we know that D0D2<=0.0 */ \
-            /* that is D0, D1 are on the same side, D2 on the other or on the plane */ \
-                A=VV2; B=(VV0-VV2)*D2; C=(VV1-VV2)*D2; X0=D2-D0; X1=D2-D1; \
-        } \
-        else if(D0D2>0.0f)\
-        { \
-                /* here we know that d0d1<=0.0 */ \
-            A=VV1; B=(VV0-VV1)*D1; C=(VV2-VV1)*D1; X0=D1-D0; X1=D1-D2; \
-        } \
-        else if(D1*D2>0.0f || D0!=0.0f) \
-        { \
-                /* here we know that d0d1<=0.0 or that D0!=0.0 */ \
-                A=VV0; B=(VV1-VV0)*D0; C=(VV2-VV0)*D0; X0=D0-D1; X1=D0-D2; \
-        } \
-        else if(D1!=0.0f) \
-        { \
-                A=VV1; B=(VV0-VV1)*D1; C=(VV2-VV1)*D1; X0=D1-D0; X1=D1-D2; \
-        } \
-        else if(D2!=0.0f) \
-        { \
-                A=VV2; B=(VV0-VV2)*D2; C=(VV1-VV2)*D2; X0=D2-D0; X1=D2-D1; \
-        } \
-        else \
-        { \
-                /* triangles are coplanar */ \
-                return coplanar_tri_tri(N1,V0,V1,V2,U0,U1,U2); \
-        } \
-}
-
-
-
-template <typename T>
-inline ResultCode coplanar_tri_tri(T N[3], T V0[3], T V1[3], T V2[3],
-    T U0[3], T U1[3], T U2[3])
-{
-    T A[3];
-    short i0, i1;
-    /* first project onto an axis-aligned plane, that maximizes the area */
-    /* of the triangles, compute indices: i0,i1. */
-    A[0] = std::abs(N[0]);
-    A[1] = std::abs(N[1]);
-    A[2] = std::abs(N[2]);
-    if (A[0] > A[1])
-    {
-        if (A[0] > A[2])
-        {
-            i0 = 1;      /* A[0] is greatest */
-            i1 = 2;
+            _points.resize(entries.size());
+            _index.resize(entries.size());
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                _points[i] = entries[i].p;
+                _index[i] = entries[i].index;
+            }
         }
-        else
+
+        void _split(std::vector<Entry> & entries, size_t lo, size_t hi)
         {
-            i0 = 0;      /* A[2] is greatest */
-            i1 = 1;
+            T bmin[3] = { infinity<T>(), infinity<T>(), infinity<T>() };
+            T bmax[3] = { -infinity<T>(), -infinity<T>(), -infinity<T>() };
+            for (size_t i = lo; i < hi; i++)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    bmin[a] = std::min(bmin[a], coordinate(entries[i].p, a));
+                    bmax[a] = std::max(bmax[a], coordinate(entries[i].p, a));
+                }
+            }
+            int axis = 0;
+            for (int a = 1; a < 3; a++)
+            {
+                if (bmax[a] - bmin[a] > bmax[axis] - bmin[axis])
+                {
+                    axis = a;
+                }
+            }
+
+            size_t mid = (lo + hi) / 2;
+            std::nth_element(entries.begin() + lo, entries.begin() + mid, entries.begin() + hi, [axis](const Entry & e1, const Entry & e2) {
+                return coordinate(e1.p, axis) < coordinate(e2.p, axis);
+            });
+            _axis[mid] = uint8_t(axis);
         }
-    }
-    else   /* A[0]<=A[1] */
-    {
-        if (A[2] > A[1])
+
+        void _buildRange(std::vector<Entry> & entries, size_t lo, size_t hi)
         {
-            i0 = 0;      /* A[2] is greatest */
-            i1 = 1;
+            if (hi - lo <= cLeafSize)
+            {
+                return;
+            }
+            _split(entries, lo, hi);
+            size_t mid = (lo + hi) / 2;
+            _buildRange(entries, lo, mid);
+            _buildRange(entries, mid + 1, hi);
         }
-        else
+
+        void _nearest(const T q[3], size_t lo, size_t hi, NeighbourHeap<T> & heap) const
         {
-            i0 = 0;      /* A[1] is greatest */
-            i1 = 2;
-        }
-    }
+            if (hi - lo <= cLeafSize)
+            {
+                for (size_t i = lo; i < hi; i++)
+                {
+                    heap.offer(distanceSquared3(q, _points[i]), _index[i]);
+                }
+                return;
+            }
 
-    /* test all edges of triangle 1 against the edges of triangle 2 */
-    EDGE_AGAINST_TRI_EDGES(V0, V1, U0, U1, U2);
-    EDGE_AGAINST_TRI_EDGES(V1, V2, U0, U1, U2);
-    EDGE_AGAINST_TRI_EDGES(V2, V0, U0, U1, U2);
+            size_t mid = (lo + hi) / 2;
+            int axis = _axis[mid];
+            T diff = q[axis] - coordinate(_points[mid], axis);
+            heap.offer(distanceSquared3(q, _points[mid]), _index[mid]);
 
-    /* finally, test if tri1 is totally contained in tri2 or vice versa */
-    POINT_IN_TRI(V0, U0, U1, U2);
-    POINT_IN_TRI(U0, V0, V1, V2);
+            // the side the query is on first, then the other if it can hold
+            // anything as close as the worst candidate (ties included)
+            bool lowFirst = diff < T(0.0);
+            if (lowFirst)
+            {
+                _nearest(q, lo, mid, heap);
+            }
+            else
+            {
+                _nearest(q, mid + 1, hi, heap);
+            }
+            if (diff * diff <= heap.bound())
+            {
+                if (lowFirst)
+                {
+                    _nearest(q, mid + 1, hi, heap);
+                }
+                else
+                {
+                    _nearest(q, lo, mid, heap);
+                }
+            }
+        }
 
-    return ResultCode::eNoIntersection;
-}
+        void _withinRadius(const T q[3], T r2, size_t lo, size_t hi, std::vector<size_t> & result) const
+        {
+            if (hi - lo <= cLeafSize)
+            {
+                for (size_t i = lo; i < hi; i++)
+                {
+                    if (distanceSquared3(q, _points[i]) <= r2)
+                    {
+                        result.push_back(_index[i]);
+                    }
+                }
+                return;
+            }
+
+            size_t mid = (lo + hi) / 2;
+            int axis = _axis[mid];
+            T diff = q[axis] - coordinate(_points[mid], axis);
+            if (distanceSquared3(q, _points[mid]) <= r2)
+            {
+                result.push_back(_index[mid]);
+            }
+            if (diff <= T(0.0) || diff * diff <= r2)
+            {
+                _withinRadius(q, r2, lo, mid, result);
+            }
+            if (diff >= T(0.0) || diff * diff <= r2)
+            {
+                _withinRadius(q, r2, mid + 1, hi, result);
+            }
+        }
 
+        std::vector<PackedPoint3<T>>    _points;
+        std::vector<size_t>             _index;
+        std::vector<uint8_t>            _axis;
+};
 
+//
+// PointGrid.
+//
+// The points bucketed into cubic cells, stored sorted by cell with a hash
+// from each occupied cell to its range. Radius queries visit the cells
+// the sphere's bounding box covers; nearest neighbour queries search shells
+// of cells of growing size around the query point until nothing closer can
+// be found further out. cellSize == 0 picks a size that puts about two
+// points in each cell of the points' bounding box, treating axes narrower
+// than a cell as flat, which suits uniform density; a cell size that is
+// not positive and finite leaves the grid empty.
+//
 template <typename T>
-inline ResultCode intersect(const Triangle3<T>& tri1, const Triangle3<T>& tri2)
+class PointGrid
 {
-    T V0[3], V1[3], V2[3];
-    T U0[3], U1[3], U2[3];
-
-    V0[0] = tri1.p1().x();
-    V0[1] = tri1.p1().y();
-    V0[2] = tri1.p1().z();
-
-    V1[0] = tri1.p2().x();
-    V1[1] = tri1.p2().y();
-    V1[2] = tri1.p2().z();
-
-    V2[0] = tri1.p3().x();
-    V2[1] = tri1.p3().y();
-    V2[2] = tri1.p3().z();
-
-    U0[0] = tri2.p1().x();
-    U0[1] = tri2.p1().y();
-    U0[2] = tri2.p1().z();
-
-    U1[0] = tri2.p2().x();
-    U1[1] = tri2.p2().y();
-    U1[2] = tri2.p2().z();
+    public:
+        // constructors
+        PointGrid() = default;
+        PointGrid(const Point3<T> * points, size_t count, T cellSize = T(0.0), unsigned threads = 1) { _build(points, count, cellSize, threads); }
+        template <typename Iter>
+        PointGrid(Iter first, Iter last, T cellSize = T(0.0), unsigned threads = 1)
+        {
+            std::vector<Point3<T>> points(first, last);
+            _build(points.data(), points.size(), cellSize, threads);
+        }
+        PointGrid(const PointGrid &) = default;
+        ~PointGrid() = default;
 
-    U2[0] = tri2.p3().x();
-    U2[1] = tri2.p3().y();
-    U2[2] = tri2.p3().z();
+        // public operators
+        inline PointGrid<T> & operator=(const PointGrid<T> &) = default;
 
-    T E1[3], E2[3];
-    T N1[3], N2[3], d1, d2;
-    T du0, du1, du2, dv0, dv1, dv2;
-    T D[3];
-    T isect1[2], isect2[2];
-    T du0du1, du0du2, dv0dv1, dv0dv2;
-    short index;
-    T vp0, vp1, vp2;
-    T up0, up1, up2;
-    T bb, cc, max;
+        // public methods
+        inline size_t size() const { return _points.size(); }
+        inline T cellSize() const { return _cellSize; }
+        inline size_t cells() const { return _cells.size(); }
 
-    /* compute plane equation of triangle(V0,V1,V2) */
-    SUB(E1, V1, V0);
-    SUB(E2, V2, V0);
-    CROSS(N1, E1, E2);
-    d1 = -DOT(N1, V0);
-    /* plane equation 1: N1.X+d1=0 */
+        // the points in cell order, and their index in the input
+        inline const std::vector<PackedPoint3<T>> & points() const { return _points; }
+        inline size_t originalIndex(size_t i) const { return _index[i]; }
 
-    /* put U0,U1,U2 into plane equation 1 to compute signed distances to the plane*/
-    du0 = DOT(N1, U0) + d1;
-    du1 = DOT(N1, U1) + d1;
-    du2 = DOT(N1, U2) + d1;
+        size_t nearest(const Point3<T> & thePoint) const
+        {
+            std::vector<size_t> result;
+            nearest(thePoint, 1, result);
+            return result.empty() ? invalidIndex() : result[0];
+        }
 
-    /* coplanarity robustness check */
+        void nearest(const Point3<T> & thePoint, size_t k, std::vector<size_t> & result) const
+        {
+            NeighbourHeap<T> heap(k);
+            if (isValid(thePoint) && k > 0 && !_points.empty())
+            {
+                const T q[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+                int64_t c[3];
+                _cellOf(q, c);
+
+                // start with the first shell that reaches the occupied cells
+                int64_t reach = 0;
+                int64_t first = 0;
+                for (int a = 0; a < 3; a++)
+                {
+                    first = std::max({ first, _lo[a] - c[a], c[a] - _hi[a] });
+                    reach = std::max({ reach, c[a] - _lo[a], _hi[a] - c[a] });
+                }
+                for (int64_t r = first; r <= reach; r++)
+                {
+                    _visitShell(c, r, [&](size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            heap.offer(distanceSquared3(q, _points[i]), _index[i]);
+                        }
+                    });
+
+                    // anything in the next shell is at least r cells away
+                    T gap = T(r) * _cellSize;
+                    if (heap.full() && heap.bound() < gap * gap)
+                    {
+                        break;
+                    }
+                }
+            }
+            heap.result(result);
+        }
 
-    if (isEqual(du0, T(0.0))) du0 = 0.0;
-    if (isEqual(du1, T(0.0))) du1 = 0.0;
-    if (isEqual(du2, T(0.0))) du2 = 0.0;
+        void withinRadius(const Point3<T> & thePoint, T radius, std::vector<size_t> & result) const
+        {
+            result.clear();
+            if (!isValid(thePoint) || !(radius >= T(0.0)) || _points.empty())
+            {
+                return;
+            }
+            const T q[3] = { thePoint.x(), thePoint.y(), thePoint.z() };
+            const T lo[3] = { q[0] - radius, q[1] - radius, q[2] - radius };
+            const T hi[3] = { q[0] + radius, q[1] + radius, q[2] + radius };
+            int64_t c0[3];
+            int64_t c1[3];
+            _cellOf(lo, c0);
+            _cellOf(hi, c1);
+            for (int a = 0; a < 3; a++)
+            {
+                c0[a] = std::max(c0[a], _lo[a]);
+                c1[a] = std::min(c1[a], _hi[a]);
+            }
 
-    du0du1 = du0 * du1;
-    du0du2 = du0 * du2;
+            T r2 = radius * radius;
+            for (int64_t x = c0[0]; x <= c1[0]; x++)
+            {
+                for (int64_t y = c0[1]; y <= c1[1]; y++)
+                {
+                    for (int64_t z = c0[2]; z <= c1[2]; z++)
+                    {
+                        auto found = _cells.find(CellKey{ x, y, z });
+                        if (found == _cells.end())
+                        {
+                            continue;
+                        }
+                        for (size_t i = found->second.first; i < found->second.second; i++)
+                        {
+                            if (distanceSquared3(q, _points[i]) <= r2)
+                            {
+                                result.push_back(_index[i]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
 
-    if (du0du1 > 0.0f && du0du2 > 0.0f) /* same sign on all of them + not equal 0 ? */
-        return ResultCode::eNoIntersection;                    /* no intersection occurs */
+    private:
+        static constexpr int64_t cMaxCellsPerAxis = 4096;
 
-     /* compute plane of triangle (U0,U1,U2) */
-    SUB(E1, U1, U0);
-    SUB(E2, U2, U0);
-    CROSS(N2, E1, E2);
-    d2 = -DOT(N2, U0);
-    /* plane equation 2: N2.X+d2=0 */
+        struct CellKey
+        {
+            int64_t     x;
+            int64_t     y;
+            int64_t     z;
 
-    /* put V0,V1,V2 into plane equation 2 */
-    dv0 = DOT(N2, V0) + d2;
-    dv1 = DOT(N2, V1) + d2;
-    dv2 = DOT(N2, V2) + d2;
+            inline bool operator==(const CellKey & k) const { return x == k.x && y == k.y && z == k.z; }
+            inline bool operator<(const CellKey & k) const { return (x != k.x) ? x < k.x : ((y != k.y) ? y < k.y : z < k.z); }
+        };
 
-    if (isEqual(dv0, T(0.0))) dv0 = 0.0;
-    if (isEqual(dv1, T(0.0))) dv1 = 0.0;
-    if (isEqual(dv2, T(0.0))) dv2 = 0.0;
+        struct CellHash
+        {
+            inline size_t operator()(const CellKey & k) const
+            {
+                uint64_t h = uint64_t(k.x) * 0x9e3779b97f4a7c15ull;
+                h ^= uint64_t(k.y) * 0xc2b2ae3d27d4eb4full + (h >> 29);
+                h ^= uint64_t(k.z) * 0x165667b19e3779f9ull + (h >> 31);
+                return size_t(h);
+            }
+        };
 
-    dv0dv1 = dv0 * dv1;
-    dv0dv2 = dv0 * dv2;
+        // cell coordinates are clamped well inside int64_t, so that far out
+        // query points still land in a (distant) cell
+        inline void _cellOf(const T p[3], int64_t c[3]) const
+        {
+            const T limit = T(int64_t(1) << 40);
+            for (int a = 0; a < 3; a++)
+            {
+                T f = std::floor((p[a] - _origin[a]) / _cellSize);
+                c[a] = int64_t(std::min(std::max(f, -limit), limit));
+            }
+        }
 
-    if (dv0dv1 > 0.0f && dv0dv2 > 0.0f) /* same sign on all of them + not equal 0 ? */
-        return ResultCode::eNoIntersection;                    /* no intersection occurs */
+        // calls visit(begin, end) for the occupied cells at Chebyshev
+        // distance r from cell c
+        template <typename Visit>
+        void _visitShell(const int64_t c[3], int64_t r, Visit visit) const
+        {
+            int64_t lo[3];
+            int64_t hi[3];
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::max(c[a] - r, _lo[a]);
+                hi[a] = std::min(c[a] + r, _hi[a]);
+            }
+            for (int64_t x = lo[0]; x <= hi[0]; x++)
+            {
+                bool xEdge = (x == c[0] - r) || (x == c[0] + r);
+                for (int64_t y = lo[1]; y <= hi[1]; y++)
+                {
+                    bool yEdge = xEdge || (y == c[1] - r) || (y == c[1] + r);
+                    for (int64_t z = lo[2]; z <= hi[2]; z++)
+                    {
+                        if (!yEdge && z != c[2] - r && z != c[2] + r)
+                        {
+                            // inside the shell; jump to its far face
+                            if (z < c[2] + r)
+                            {
+                                z = c[2] + r - 1;
+                            }
+                            continue;
+                        }
+                        auto found = _cells.find(CellKey{ x, y, z });
+                        if (found != _cells.end())
+                        {
+                            visit(found->second.first, found->second.second);
+                        }
+                    }
+                }
+            }
+        }
 
-     /* compute direction of intersection line */
-    CROSS(D, N1, N2);
+        // About two points per cell over the bounding box, counting only the
+        // axes that are wider than a cell, so that a planar or collinear
+        // cloud is spread over its area or length rather than over a
+        // sliver of volume. No axis is cut into more than cMaxCellsPerAxis
+        // cells, which bounds the empty cells a nearest query can scan.
+        static T _autoCellSize(const T bmin[3], const T bmax[3], size_t count)
+        {
+            const T extent[3] = { bmax[0] - bmin[0], bmax[1] - bmin[1], bmax[2] - bmin[2] };
+            int largest = 0;
+            for (int a = 1; a < 3; a++)
+            {
+                if (extent[a] > extent[largest])
+                {
+                    largest = a;
+                }
+            }
+            if (!(extent[largest] > T(0.0)))
+            {
+                // all the points in one place
+                return T(1.0);
+            }
 
-    /* compute and index to the largest component of D */
-    max = std::abs(D[0]);
-    index = 0;
-    bb = std::abs(D[1]);
-    cc = std::abs(D[2]);
-    if (bb > max) max = bb, index = 1;
-    if (cc > max) max = cc, index = 2;
+            bool flat[3] = { !(extent[0] > T(0.0)), !(extent[1] > T(0.0)), !(extent[2] > T(0.0)) };
+            T cellSize = extent[largest];
+            for (bool changed = true; changed; )
+            {
+                T measure = T(1.0);
+                int dims = 0;
+                for (int a = 0; a < 3; a++)
+                {
+                    if (!flat[a])
+                    {
+                        measure *= extent[a];
+                        dims++;
+                    }
+                }
+                cellSize = std::pow(T(2.0) * measure / T(count), T(1.0) / T(dims));
 
-    /* this is the simplified projection onto L*/
-    vp0 = V0[index];
-    vp1 = V1[index];
-    vp2 = V2[index];
+                changed = false;
+                for (int a = 0; a < 3; a++)
+                {
+                    if (!flat[a] && a != largest && extent[a] < cellSize)
+                    {
+                        flat[a] = true;
+                        changed = true;
+                    }
+                }
+            }
+            return std::max(cellSize, extent[largest] / T(cMaxCellsPerAxis));
+        }
 
-    up0 = U0[index];
-    up1 = U1[index];
-    up2 = U2[index];
+        void _build(const Point3<T> * points, size_t count, T cellSize, unsigned threads)
+        {
+            std::vector<size_t> valid;
+            T bmin[3] = { infinity<T>(), infinity<T>(), infinity<T>() };
+            T bmax[3] = { -infinity<T>(), -infinity<T>(), -infinity<T>() };
+            for (size_t i = 0; i < count; i++)
+            {
+                if (isValid(points[i]))
+                {
+                    valid.push_back(i);
+                    const T p[3] = { points[i].x(), points[i].y(), points[i].z() };
+                    for (int a = 0; a < 3; a++)
+                    {
+                        bmin[a] = std::min(bmin[a], p[a]);
+                        bmax[a] = std::max(bmax[a], p[a]);
+                    }
+                }
+            }
+            if (valid.empty())
+            {
+                return;
+            }
 
-    /* compute interval for triangle 1 */
-    T a, b, c, x0, x1;
-    NEWCOMPUTE_INTERVALS(vp0, vp1, vp2, dv0, dv1, dv2, dv0dv1, dv0dv2, a, b, c, x0, x1);
+            if (cellSize == T(0.0))
+            {
+                cellSize = _autoCellSize(bmin, bmax, valid.size());
+            }
+            if (!(cellSize > T(0.0)) || !isValid(cellSize))
+            {
+                return;
+            }
+            _cellSize = cellSize;
+            for (int a = 0; a < 3; a++)
+            {
+                _origin[a] = bmin[a];
+            }
 
-    /* compute interval for triangle 2 */
-    T d, e, f, y0, y1;
-    NEWCOMPUTE_INTERVALS(up0, up1, up2, du0, du1, du2, du0du1, du0du2, d, e, f, y0, y1);
+            // cell of every point, in parallel, then sorted by cell
+            std::vector<std::pair<CellKey, size_t>> keyed(valid.size());
+            parallelFor(valid.size(), 4096, threads, [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Point3<T> & p = points[valid[i]];
+                    const T q[3] = { p.x(), p.y(), p.z() };
+                    int64_t c[3];
+                    _cellOf(q, c);
+                    keyed[i] = std::make_pair(CellKey{ c[0], c[1], c[2] }, valid[i]);
+                }
+            });
+            std::sort(keyed.begin(), keyed.end(), [](const std::pair<CellKey, size_t> & k1, const std::pair<CellKey, size_t> & k2) {
+                return (k1.first == k2.first) ? k1.second < k2.second : k1.first < k2.first;
+            });
+
+            _points.resize(keyed.size());
+            _index.resize(keyed.size());
+            for (int a = 0; a < 3; a++)
+            {
+                _lo[a] = std::numeric_limits<int64_t>::max();
+                _hi[a] = std::numeric_limits<int64_t>::min();
+            }
+            for (size_t i = 0; i < keyed.size(); i++)
+            {
+                const Point3<T> & p = points[keyed[i].second];
+                _points[i] = PackedPoint3<T>{ p.x(), p.y(), p.z() };
+                _index[i] = keyed[i].second;
 
-    T xx, yy, xxyy, tmp;
-    xx = x0 * x1;
-    yy = y0 * y1;
-    xxyy = xx * yy;
+                const CellKey & k = keyed[i].first;
+                if (i == 0 || !(k == keyed[i - 1].first))
+                {
+                    _cells[k] = std::make_pair(i, i);
+                    const int64_t c[3] = { k.x, k.y, k.z };
+                    for (int a = 0; a < 3; a++)
+                    {
+                        _lo[a] = std::min(_lo[a], c[a]);
+                        _hi[a] = std::max(_hi[a], c[a]);
+                    }
+                }
+                _cells[k].second = i + 1;
+            }
+        }
 
-    tmp = a * xxyy;
-    isect1[0] = tmp + b * x1 * yy;
-    isect1[1] = tmp + c * x0 * yy;
+        T                                                           _cellSize = T(0.0);
+        T                                                           _origin[3] = { T(0.0), T(0.0), T(0.0) };
+        int64_t                                                     _lo[3] = { 0, 0, 0 };
+        int64_t                                                     _hi[3] = { -1, -1, -1 };
+        std::unordered_map<CellKey, std::pair<size_t, size_t>, CellHash> _cells;
+        std::vector<PackedPoint3<T>>                                _points;
+        std::vector<size_t>                                         _index;
+};
 
-    tmp = d * xxyy;
-    isect2[0] = tmp + e * xx * y1;
-    isect2[1] = tmp + f * xx * y0;
+// Batch queries against a PointIndex or PointGrid (see "Batch queries").
 
-    SORT(isect1[0], isect1[1]);
-    SORT(isect2[0], isect2[1]);
+// out[i] is the closest point to queries[i]
+template <typename Index, typename T, typename Executor = SerialExecutor>
+inline void nearestBatch(const Index & theIndex, const Point3<T> * queries, size_t count, size_t * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(sizeof(Point3<T>) + sizeof(size_t)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = theIndex.nearest(queries[i]);
+        }
+    });
+}
 
-    if (isect1[1] < isect2[0] || isect2[1] < isect1[0]) 
-        return ResultCode::eNoIntersection;
+// out[i * k] onwards are the k closest points to queries[i], closest
+// first, padded with invalidIndex()
+template <typename Index, typename T, typename Executor = SerialExecutor>
+inline void nearestBatch(const Index & theIndex, const Point3<T> * queries, size_t count, size_t k, size_t * out, Executor && exec = Executor())
+{
+    exec.forChunks(count, batchGrain(sizeof(Point3<T>) + k * sizeof(size_t)), [&](size_t begin, size_t end) {
+        std::vector<size_t> result;
+        for (size_t i = begin; i < end; i++)
+        {
+            theIndex.nearest(queries[i], k, result);
+            for (size_t j = 0; j < k; j++)
+            {
+                out[i * k + j] = (j < result.size()) ? result[j] : invalidIndex();
+            }
+        }
+    });
+}
 
-    return ResultCode::eOk;
+// out is resized to count, and out[i] holds the points within radius of
+// queries[i]
+template <typename Index, typename T, typename Executor = SerialExecutor>
+inline void withinRadiusBatch(const Index & theIndex, const Point3<T> * queries, size_t count, T radius, std::vector<std::vector<size_t>> & out, Executor && exec = Executor())
+{
+    out.resize(count);
+    exec.forChunks(count, batchGrain(sizeof(Point3<T>) + sizeof(std::vector<size_t>)), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            theIndex.withinRadius(queries[i], radius, out[i]);
+        }
+    });
 }
 
 } // end of hubert namespace
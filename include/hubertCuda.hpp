@@ -0,0 +1,420 @@
+/****************************************************************************
+Copyright (c) 2021 Marcel A. Samek
+
+The Hubert library and all its components are supplied under the terms of
+the open source MIT License. The text immediately below, which can also 
+be found at https://opensource.org/licenses/MIT, comprises the entirety
+of the license.
+
+---------------------------------------------------------------------------
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+****************************************************************************/
+
+#ifndef HUBERT_CUDA_H_INCLUDED
+#define HUBERT_CUDA_H_INCLUDED
+
+// GPU offload for hubert with CUDA. It is kept out of hubert.hpp because it
+// needs nvcc and the CUDA runtime. Build with --expt-relaxed-constexpr, so
+// that device code can call std::numeric_limits and std::max. The project
+// in test/hubertCuda builds it and checks the GPU against the host.
+
+#include "hubert.hpp"
+
+#include <cuda_runtime.h>
+
+namespace hubert
+{
+
+/////////////////////////////////////////////////////////////////////////////
+// CUDA offload
+//
+// DeviceSoup and DeviceBvh copy a mesh to the GPU once. The queries below
+// then run any number of rays or points against it in one launch, one
+// thread per query, using the device view queries of hubert.hpp, so a hit
+// on the GPU is the hit the same view query gives on the host. Errors are
+// the cudaError_t of the first CUDA call that failed.
+/////////////////////////////////////////////////////////////////////////////
+
+// Tag for the batch queries that run on the GPU, e.g.
+// intersectBatch(gpu, rays, count, deviceBvh, hits).
+struct Gpu
+{
+    explicit Gpu() = default;
+};
+inline constexpr Gpu gpu{};
+
+//
+// DeviceArray.
+//
+// An array in device memory, freed with the object.
+//
+template <typename V>
+class DeviceArray
+{
+    public:
+        // constructors
+        DeviceArray() = default;
+        DeviceArray(const DeviceArray &) = delete;
+        DeviceArray(DeviceArray && other) noexcept : _data(other._data), _size(other._size)
+        {
+            other._data = nullptr;
+            other._size = 0;
+        }
+        ~DeviceArray() { release(); }
+
+        // public operators
+        DeviceArray & operator=(const DeviceArray &) = delete;
+        DeviceArray & operator=(DeviceArray && other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                _data = other._data;
+                _size = other._size;
+                other._data = nullptr;
+                other._size = 0;
+            }
+            return *this;
+        }
+
+        // public methods
+        inline V * data() { return _data; }
+        inline const V * data() const { return _data; }
+        inline size_t size() const { return _size; }
+
+        // the contents are lost unless the size is unchanged
+        cudaError_t resize(size_t count)
+        {
+            if (count == _size)
+            {
+                return cudaSuccess;
+            }
+            release();
+            if (count == 0)
+            {
+                return cudaSuccess;
+            }
+            cudaError_t error = cudaMalloc(reinterpret_cast<void **>(&_data), count * sizeof(V));
+            if (error != cudaSuccess)
+            {
+                _data = nullptr;
+                return error;
+            }
+            _size = count;
+            return cudaSuccess;
+        }
+
+        cudaError_t upload(const V * host, size_t count)
+        {
+            cudaError_t error = resize(count);
+            if (error != cudaSuccess || count == 0)
+            {
+                return error;
+            }
+            return cudaMemcpy(_data, host, count * sizeof(V), cudaMemcpyHostToDevice);
+        }
+
+        // copies the first count elements back
+        cudaError_t download(V * host, size_t count) const
+        {
+            if (count == 0)
+            {
+                return cudaSuccess;
+            }
+            return cudaMemcpy(host, _data, count * sizeof(V), cudaMemcpyDeviceToHost);
+        }
+
+        void release()
+        {
+            if (_data != nullptr)
+            {
+                cudaFree(_data);
+            }
+            _data = nullptr;
+            _size = 0;
+        }
+
+    private:
+        V *         _data = nullptr;
+        size_t      _size = 0;
+};
+
+//
+// DeviceSoup.
+//
+// A TriangleSoup's coordinates and degenerate bits on the GPU.
+//
+template <typename T>
+class DeviceSoup
+{
+    public:
+        DeviceSoup() = default;
+
+        cudaError_t upload(const TriangleSoup<T> & theSoup)
+        {
+            _size = 0;
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                cudaError_t error;
+                if ((error = _x[k].upload(theSoup.x(k), theSoup.size())) != cudaSuccess ||
+                    (error = _y[k].upload(theSoup.y(k), theSoup.size())) != cudaSuccess ||
+                    (error = _z[k].upload(theSoup.z(k), theSoup.size())) != cudaSuccess)
+                {
+                    return error;
+                }
+            }
+            cudaError_t error = _degenerate.upload(theSoup.degenerateBits(), (theSoup.size() + 63) / 64);
+            if (error == cudaSuccess)
+            {
+                _size = theSoup.size();
+            }
+            return error;
+        }
+
+        inline size_t size() const { return _size; }
+
+        SoupView<T> view() const
+        {
+            SoupView<T> view;
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                view.x[k] = _x[k].data();
+                view.y[k] = _y[k].data();
+                view.z[k] = _z[k].data();
+            }
+            view.degenerate = _degenerate.data();
+            view.size = _size;
+            return view;
+        }
+
+    private:
+        DeviceArray<T>          _x[3];
+        DeviceArray<T>          _y[3];
+        DeviceArray<T>          _z[3];
+        DeviceArray<uint64_t>   _degenerate;
+        size_t                  _size = 0;
+};
+
+//
+// DeviceBvh.
+//
+// A Bvh's nodes, parent links, triangles and original indices on the GPU.
+//
+template <typename T>
+class DeviceBvh
+{
+    public:
+        DeviceBvh() = default;
+
+        cudaError_t upload(const Bvh<T> & theBvh)
+        {
+            FlatBvh<T> flat(theBvh);
+            _nodeCount = 0;
+            cudaError_t error;
+            if ((error = _nodes.upload(flat.nodes.data(), flat.nodes.size())) != cudaSuccess ||
+                (error = _parents.upload(flat.parents.data(), flat.parents.size())) != cudaSuccess ||
+                (error = _triangles.upload(flat.triangles.data(), flat.triangles.size())) != cudaSuccess ||
+                (error = _index.upload(flat.index.data(), flat.index.size())) != cudaSuccess)
+            {
+                return error;
+            }
+            _nodeCount = flat.nodes.size();
+            return cudaSuccess;
+        }
+
+        BvhView<T> view() const { return BvhView<T>{ _nodes.data(), _parents.data(), _triangles.data(), _index.data(), _nodeCount }; }
+
+    private:
+        DeviceArray<BvhNode<T>>             _nodes;
+        DeviceArray<uint32_t>               _parents;
+        DeviceArray<PackedTriangle3<T>>     _triangles;
+        DeviceArray<size_t>                 _index;
+        size_t                              _nodeCount = 0;
+};
+
+constexpr unsigned cGpuBlockSize = 256;
+
+inline unsigned gpuGridSize(size_t count)
+{
+    // the kernels stride over the queries, so the grid can be capped
+    return unsigned(std::min<size_t>((count + cGpuBlockSize - 1) / cGpuBlockSize, 65535));
+}
+
+// Rays with a non finite base are the degenerate rays of the batch, which
+// hit nothing.
+template <typename T, typename View>
+__global__ void intersectKernel(View mesh, const PackedRay3<T> * rays, size_t count, RayHit<T> * hits)
+{
+    for (size_t i = size_t(blockIdx.x) * blockDim.x + threadIdx.x; i < count; i += size_t(gridDim.x) * blockDim.x)
+    {
+        const PackedRay3<T> theRay = rays[i];
+        if (isValid(theRay.base.x) && isValid(theRay.base.y) && isValid(theRay.base.z))
+        {
+            hits[i] = intersect(mesh, theRay);
+        }
+        else
+        {
+            hits[i] = RayHit<T>{ invalidIndex(), invalidValue<T>() };
+        }
+    }
+}
+
+template <typename T>
+__global__ void distanceKernel(const PackedPoint3<T> * points, size_t count, PackedPoint3<T> base, PackedPoint3<T> up, T * out)
+{
+    for (size_t i = size_t(blockIdx.x) * blockDim.x + threadIdx.x; i < count; i += size_t(gridDim.x) * blockDim.x)
+    {
+        out[i] = signedDistance(points[i], base, up);
+    }
+}
+
+// Packs the rays for upload, giving the degenerate ones an infinite base.
+template <typename T>
+inline std::vector<PackedRay3<T>> packRays(const Ray3<T> * rays, size_t count)
+{
+    std::vector<PackedRay3<T>> packed(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (isDegenerate(rays[i]))
+        {
+            packed[i].base = PackedPoint3<T>{ infinity<T>(), infinity<T>(), infinity<T>() };
+            packed[i].dir = PackedPoint3<T>{ T(0.0), T(0.0), T(0.0) };
+        }
+        else
+        {
+            packed[i] = makePackedRay3(rays[i]);
+        }
+    }
+    return packed;
+}
+
+// Shared implementation of the intersectBatch(gpu, ...) overloads.
+template <typename T, typename Mesh>
+inline cudaError_t intersectOnGpu(const Ray3<T> * rays, size_t count, const Mesh & mesh, RayHit<T> * hits)
+{
+    if (count == 0)
+    {
+        return cudaSuccess;
+    }
+
+    std::vector<PackedRay3<T>> packed = packRays(rays, count);
+    DeviceArray<PackedRay3<T>> deviceRays;
+    DeviceArray<RayHit<T>> deviceHits;
+    cudaError_t error;
+    if ((error = deviceRays.upload(packed.data(), count)) != cudaSuccess ||
+        (error = deviceHits.resize(count)) != cudaSuccess)
+    {
+        return error;
+    }
+
+    intersectKernel<<<gpuGridSize(count), cGpuBlockSize>>>(mesh.view(), deviceRays.data(), count, deviceHits.data());
+    if ((error = cudaGetLastError()) != cudaSuccess)
+    {
+        return error;
+    }
+    return deviceHits.download(hits, count);
+}
+
+// Closest hits of rays already on the GPU, queued on stream; nothing is
+// copied and the call does not wait for the kernel. Rays with a non finite
+// base hit nothing; any other ray must be valid.
+template <typename T>
+inline cudaError_t launchIntersect(const PackedRay3<T> * rays, size_t count, const DeviceSoup<T> & theSoup, RayHit<T> * hits, cudaStream_t stream = 0)
+{
+    if (count > 0)
+    {
+        intersectKernel<<<gpuGridSize(count), cGpuBlockSize, 0, stream>>>(theSoup.view(), rays, count, hits);
+    }
+    return cudaGetLastError();
+}
+
+template <typename T>
+inline cudaError_t launchIntersect(const PackedRay3<T> * rays, size_t count, const DeviceBvh<T> & theBvh, RayHit<T> * hits, cudaStream_t stream = 0)
+{
+    if (count > 0)
+    {
+        intersectKernel<<<gpuGridSize(count), cGpuBlockSize, 0, stream>>>(theBvh.view(), rays, count, hits);
+    }
+    return cudaGetLastError();
+}
+
+// Signed distances of points already on the GPU above a valid plane,
+// queued on stream.
+template <typename T>
+inline cudaError_t launchDistance(const PackedPoint3<T> * points, size_t count, const Plane<T> & thePlane, T * out, cudaStream_t stream = 0)
+{
+    if (count > 0)
+    {
+        PackedPoint3<T> base = makePackedPoint3(thePlane.base());
+        PackedPoint3<T> up{ thePlane.up().x(), thePlane.up().y(), thePlane.up().z() };
+        distanceKernel<<<gpuGridSize(count), cGpuBlockSize, 0, stream>>>(points, count, base, up, out);
+    }
+    return cudaGetLastError();
+}
+
+// Closest hits of host rays: the rays are copied over, run in one launch
+// and the hits copied back. A hit is the one intersect(SoupView, ...) or
+// intersect(BvhView, ...) gives; degenerate rays hit nothing.
+template <typename T>
+inline cudaError_t intersectBatch(Gpu, const Ray3<T> * rays, size_t count, const DeviceSoup<T> & theSoup, RayHit<T> * hits)
+{
+    return intersectOnGpu(rays, count, theSoup, hits);
+}
+
+template <typename T>
+inline cudaError_t intersectBatch(Gpu, const Ray3<T> * rays, size_t count, const DeviceBvh<T> & theBvh, RayHit<T> * hits)
+{
+    return intersectOnGpu(rays, count, theBvh, hits);
+}
+
+// distance(Point3, Plane) of host points, computed on the GPU.
+template <typename T>
+inline cudaError_t distanceBatch(Gpu, const Point3<T> * points, size_t count, const Plane<T> & thePlane, T * out)
+{
+    if (count == 0)
+    {
+        return cudaSuccess;
+    }
+    if (isDegenerate(thePlane))
+    {
+        std::fill(out, out + count, infinity<T>());
+        return cudaSuccess;
+    }
+
+    std::vector<PackedPoint3<T>> packed(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        packed[i] = makePackedPoint3(points[i]);
+    }
+    DeviceArray<PackedPoint3<T>> devicePoints;
+    DeviceArray<T> deviceOut;
+    cudaError_t error;
+    if ((error = devicePoints.upload(packed.data(), count)) != cudaSuccess ||
+        (error = deviceOut.resize(count)) != cudaSuccess ||
+        (error = launchDistance(devicePoints.data(), count, thePlane, deviceOut.data())) != cudaSuccess)
+    {
+        return error;
+    }
+    return deviceOut.download(out, count);
+}
+
+} // end of hubert namespace
+
+#endif
@@ -0,0 +1,949 @@
+/****************************************************************************
+Copyright (c) 2021 Marcel A. Samek
+
+The Hubert library and all its components are supplied under the terms of
+the open source MIT License. The text immediately below, which can also 
+be found at https://opensource.org/licenses/MIT, comprises the entirety
+of the license.
+
+---------------------------------------------------------------------------
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+****************************************************************************/
+
+#ifndef HUBERT_IO_H_INCLUDED
+#define HUBERT_IO_H_INCLUDED
+
+// Mesh file loading for hubert. It is kept out of hubert.hpp because it
+// needs the operating system's file mapping calls.
+
+#include "hubert.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hubert
+{
+
+/////////////////////////////////////////////////////////////////////////////
+// Mesh file loading
+//
+// Binary STL and PLY files are mapped into memory read only, and their
+// triangles are read out of the mapping as they are asked for: opening a
+// file neither copies nor validates anything. validate() classifies all
+// the triangles in parallel blocks into a degeneracy bitset, the one
+// TriangleSoup keeps, without building a Triangle3 for each. The
+// triangles can then be appended to a TriangleSoup without being
+// validated again, or be welded into an IndexedMesh.
+//
+// Both formats are little endian. On a big endian host open() returns
+// eUnsupported.
+/////////////////////////////////////////////////////////////////////////////
+
+enum class LoadResult : uint32_t
+{
+    eOk = 0,
+    eOpenFailed,        // the file could not be opened or mapped
+    eBadFormat,         // the file is truncated or not of the format it claims
+    eUnsupported        // a well formed file in a variant that is not read (ASCII, big endian)
+};
+
+inline bool isLittleEndianHost()
+{
+    const uint16_t one = 1;
+    uint8_t first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+//
+// MappedFile.
+//
+// A whole file mapped read only. It can be moved but not copied, and the
+// mapping goes away with it.
+//
+class MappedFile
+{
+    public:
+        // constructors
+        MappedFile() = default;
+        explicit MappedFile(const char * path) { open(path); }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile(MappedFile && other) noexcept { _take(other); }
+        ~MappedFile() { close(); }
+
+        // public operators
+        MappedFile & operator=(const MappedFile &) = delete;
+        MappedFile & operator=(MappedFile && other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                _take(other);
+            }
+            return *this;
+        }
+
+        // public methods
+        inline bool isOpen() const { return _open; }
+        inline const uint8_t * data() const { return _data; }
+        inline size_t size() const { return _size; }
+
+        // an empty file opens, with no data
+        LoadResult open(const char * path)
+        {
+            close();
+#if defined(_WIN32)
+            HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                return LoadResult::eOpenFailed;
+            }
+            LARGE_INTEGER length;
+            if (!GetFileSizeEx(file, &length))
+            {
+                CloseHandle(file);
+                return LoadResult::eOpenFailed;
+            }
+            void * view = nullptr;
+            if (length.QuadPart > 0)
+            {
+                HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr)
+                {
+                    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    CloseHandle(mapping);
+                }
+                if (view == nullptr)
+                {
+                    CloseHandle(file);
+                    return LoadResult::eOpenFailed;
+                }
+            }
+            CloseHandle(file);
+            _size = size_t(length.QuadPart);
+#else
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0)
+            {
+                return LoadResult::eOpenFailed;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                return LoadResult::eOpenFailed;
+            }
+            void * view = nullptr;
+            if (st.st_size > 0)
+            {
+                view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (view == MAP_FAILED)
+                {
+                    ::close(fd);
+                    return LoadResult::eOpenFailed;
+                }
+                // the whole file is about to be read, by several threads
+                madvise(view, size_t(st.st_size), MADV_WILLNEED);
+            }
+            // the mapping holds its own reference to the file
+            ::close(fd);
+            _size = size_t(st.st_size);
+#endif
+            _data = static_cast<const uint8_t *>(view);
+            _open = true;
+            return LoadResult::eOk;
+        }
+
+        void close()
+        {
+            if (_data != nullptr)
+            {
+#if defined(_WIN32)
+                UnmapViewOfFile(_data);
+#else
+                munmap(const_cast<uint8_t *>(_data), _size);
+#endif
+            }
+            _data = nullptr;
+            _size = 0;
+            _open = false;
+        }
+
+    private:
+        void _take(MappedFile & other)
+        {
+            _data = other._data;
+            _size = other._size;
+            _open = other._open;
+            other._data = nullptr;
+            other._size = 0;
+            other._open = false;
+        }
+
+        // private data
+        const uint8_t * _data = nullptr;
+        size_t          _size = 0;
+        bool            _open = false;
+};
+
+// Builds a mesh from the count triangles get(i) returns, making a single
+// vertex of all the corners with the same coordinates. Coordinates are
+// compared with ==, so 0 and -0 weld and a NaN corner stays a vertex of
+// its own. Vertices are numbered in the order they are first used. This
+// turns the triangles of an STL file, which repeat each vertex for every
+// triangle around it, into a mesh.
+template <typename Get, typename T = decltype(std::declval<Get>()(size_t(0)).p1.x)>
+inline IndexedMesh<T> weldTriangles(size_t count, Get get)
+{
+    std::vector<PackedPoint3<T>> vertices;
+    std::vector<uint32_t> indices(3 * count);
+    std::unordered_map<PackedPoint3<T>, uint32_t, SlicePointHash<T>, SlicePointEqual<T>> ids;
+    ids.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const PackedTriangle3<T> tri = get(i);
+        const PackedPoint3<T> * corners[3] = { &tri.p1, &tri.p2, &tri.p3 };
+        for (int c = 0; c < 3; c++)
+        {
+            auto found = ids.emplace(*corners[c], uint32_t(vertices.size()));
+            if (found.second)
+            {
+                vertices.push_back(*corners[c]);
+            }
+            indices[3 * i + c] = found.first->second;
+        }
+    }
+    return IndexedMesh<T>(std::move(vertices), std::move(indices));
+}
+
+template <typename T>
+inline IndexedMesh<T> weldTriangles(const PackedTriangle3<T> * tris, size_t count)
+{
+    return weldTriangles(count, [tris](size_t i) { return tris[i]; });
+}
+
+//
+// StlFile.
+//
+// A mapped binary STL file: an 80 byte header, a uint32_t triangle count,
+// then 50 bytes per triangle (a normal and three vertices as floats, and a
+// uint16_t attribute). The records are not 4 byte aligned, so triangles
+// are copied out of the mapping one at a time rather than pointed at.
+//
+// ASCII STL files are eUnsupported. A binary file whose size does not
+// match its triangle count is eBadFormat.
+//
+class StlFile
+{
+    public:
+        // constructors
+        StlFile() = default;
+        explicit StlFile(const char * path) { open(path); }
+
+        // public methods
+        LoadResult open(const char * path)
+        {
+            close();
+            LoadResult r = _file.open(path);
+            if (r != LoadResult::eOk)
+            {
+                return r;
+            }
+            if (!isLittleEndianHost())
+            {
+                close();
+                return LoadResult::eUnsupported;
+            }
+
+            uint32_t count = 0;
+            if (_file.size() >= cDataOffset)
+            {
+                std::memcpy(&count, _file.data() + cHeaderSize, sizeof(count));
+            }
+            if (_file.size() < cDataOffset || uint64_t(_file.size()) != cDataOffset + cRecordSize * uint64_t(count))
+            {
+                // binary files may start with "solid" too, but then their
+                // size matches
+                bool ascii = (_file.size() >= 5) && (std::memcmp(_file.data(), "solid", 5) == 0);
+                close();
+                return ascii ? LoadResult::eUnsupported : LoadResult::eBadFormat;
+            }
+            _count = count;
+            return LoadResult::eOk;
+        }
+
+        void close()
+        {
+            _file.close();
+            _count = 0;
+            _bits.clear();
+            _validated = false;
+        }
+
+        inline bool isOpen() const { return _file.isOpen(); }
+        inline size_t size() const { return _count; }
+        inline const uint8_t * header() const { return _file.data(); }
+
+        inline PackedTriangle3<float> triangle(size_t i) const
+        {
+            PackedTriangle3<float> tri;
+            std::memcpy(&tri, _record(i) + 12, sizeof(tri));
+            return tri;
+        }
+
+        // the normal as stored in the file, which many writers leave zero
+        inline PackedPoint3<float> normal(size_t i) const
+        {
+            PackedPoint3<float> n;
+            std::memcpy(&n, _record(i), sizeof(n));
+            return n;
+        }
+
+        inline uint16_t attribute(size_t i) const
+        {
+            uint16_t a;
+            std::memcpy(&a, _record(i) + 48, sizeof(a));
+            return a;
+        }
+
+        // classifies the triangles as Triangle3<float> would, spread over
+        // threads (see parallelFor(), all hardware threads by default).
+        // Returns the number of degenerate or invalid triangles.
+        size_t validate(unsigned threads = 0)
+        {
+            size_t flagged = validateTriangles(_count, [this](size_t i) { return triangle(i); }, _bits, threads);
+            _validated = true;
+            return flagged;
+        }
+
+        // the degeneracy bits, valid once validate() has run
+        inline bool validated() const { return _validated; }
+        inline const uint64_t * degenerateBits() const { return _bits.data(); }
+        inline bool amDegenerate(size_t i) const { return (_bits[i >> 6] >> (i & 63)) & 1; }
+
+        // appends the triangles to a soup, validating them first if
+        // validate() has not run
+        void appendTo(TriangleSoup<float> & soup, unsigned threads = 0)
+        {
+            if (!_validated)
+            {
+                validate(threads);
+            }
+            soup.append(_count, [this](size_t i) { return triangle(i); }, _bits.data());
+        }
+
+        // the triangles with their shared corners welded (see weldTriangles())
+        inline IndexedMesh<float> weld() const
+        {
+            return weldTriangles(_count, [this](size_t i) { return triangle(i); });
+        }
+
+        // triangles [first, first + count) as a soup, making the file a
+        // source for the streaming queries (see intersectStream())
+        void read(size_t first, size_t count, TriangleSoup<float> & chunk) const
+        {
+            auto get = [this, first](size_t i) { return triangle(first + i); };
+            std::vector<uint64_t> bits;
+            validateTriangles(count, get, bits);
+            chunk.clear();
+            chunk.append(count, get, bits.data());
+        }
+
+    private:
+        static constexpr size_t cHeaderSize = 80;
+        static constexpr size_t cDataOffset = 84;
+        static constexpr size_t cRecordSize = 50;
+
+        inline const uint8_t * _record(size_t i) const { return _file.data() + cDataOffset + cRecordSize * i; }
+
+        // private data
+        MappedFile              _file;
+        size_t                  _count = 0;
+        std::vector<uint64_t>   _bits;
+        bool                    _validated = false;
+};
+
+// The scalar types of PLY properties
+enum class PlyType : uint8_t
+{
+    eNone = 0,
+    eInt8,
+    eUint8,
+    eInt16,
+    eUint16,
+    eInt32,
+    eUint32,
+    eFloat32,
+    eFloat64
+};
+
+// both the original and the sized type names
+inline PlyType plyType(const std::string & name)
+{
+    if (name == "char" || name == "int8") return PlyType::eInt8;
+    if (name == "uchar" || name == "uint8") return PlyType::eUint8;
+    if (name == "short" || name == "int16") return PlyType::eInt16;
+    if (name == "ushort" || name == "uint16") return PlyType::eUint16;
+    if (name == "int" || name == "int32") return PlyType::eInt32;
+    if (name == "uint" || name == "uint32") return PlyType::eUint32;
+    if (name == "float" || name == "float32") return PlyType::eFloat32;
+    if (name == "double" || name == "float64") return PlyType::eFloat64;
+    return PlyType::eNone;
+}
+
+inline size_t plySize(PlyType t)
+{
+    switch (t)
+    {
+        case PlyType::eInt8:
+        case PlyType::eUint8:
+            return 1;
+        case PlyType::eInt16:
+        case PlyType::eUint16:
+            return 2;
+        case PlyType::eInt32:
+        case PlyType::eUint32:
+        case PlyType::eFloat32:
+            return 4;
+        case PlyType::eFloat64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+template <typename V>
+inline double plyRead(const uint8_t * p)
+{
+    V v;
+    std::memcpy(&v, p, sizeof(v));
+    return double(v);
+}
+
+// the value of type t at p, as a double, which holds all of them exactly
+inline double plyValue(PlyType t, const uint8_t * p)
+{
+    switch (t)
+    {
+        case PlyType::eInt8: return plyRead<int8_t>(p);
+        case PlyType::eUint8: return plyRead<uint8_t>(p);
+        case PlyType::eInt16: return plyRead<int16_t>(p);
+        case PlyType::eUint16: return plyRead<uint16_t>(p);
+        case PlyType::eInt32: return plyRead<int32_t>(p);
+        case PlyType::eUint32: return plyRead<uint32_t>(p);
+        case PlyType::eFloat32: return plyRead<float>(p);
+        case PlyType::eFloat64: return plyRead<double>(p);
+        default: return 0.0;
+    }
+}
+
+// A list entry as a vertex index. Whole numbers out of range, negative
+// ones included, become an index no vertex has, which makes an invalid
+// triangle. Anything else, such as a fraction, NaN or an infinity in a
+// float list, returns false.
+inline bool plyIndex(double value, uint32_t & index)
+{
+    if (!std::isfinite(value) || value != std::floor(value))
+    {
+        return false;
+    }
+    index = (value >= 0.0 && value <= double(std::numeric_limits<uint32_t>::max())) ? uint32_t(value) : std::numeric_limits<uint32_t>::max();
+    return true;
+}
+
+//
+// PlyFile.
+//
+// A mapped binary little endian PLY file. The vertex element must have x,
+// y and z properties of any scalar type, and may have others. The face
+// element (if there is one) must have a vertex_indices (or vertex_index)
+// list; polygons are split into fans of triangles, and faces with fewer
+// than three vertices are dropped.
+//
+// The vertices stay in the mapping. When they are just x, y and z of type
+// T, suitably aligned, packedVertices<T>() points right at them;
+// otherwise they are converted one at a time as they are read. The face
+// lists have a variable length, so the triangle indices are decoded into
+// an array when the file is opened.
+//
+// ASCII and big endian files are eUnsupported, as is a vertex element
+// with list properties.
+//
+class PlyFile
+{
+    public:
+        // constructors
+        PlyFile() = default;
+        explicit PlyFile(const char * path) { open(path); }
+
+        // public methods
+        LoadResult open(const char * path)
+        {
+            close();
+            LoadResult r = _file.open(path);
+            if (r == LoadResult::eOk)
+            {
+                r = isLittleEndianHost() ? _parse() : LoadResult::eUnsupported;
+            }
+            if (r != LoadResult::eOk)
+            {
+                close();
+            }
+            return r;
+        }
+
+        void close()
+        {
+            _file.close();
+            _vertexData = nullptr;
+            _vertexCount = 0;
+            _vertexStride = 0;
+            _indices.clear();
+            _bits.clear();
+            _validatedAs = 0;
+        }
+
+        inline bool isOpen() const { return _file.isOpen(); }
+        inline size_t vertexCount() const { return _vertexCount; }
+
+        // the number of triangles, after the polygons are split
+        inline size_t faceCount() const { return _indices.size() / 3; }
+        inline size_t size() const { return faceCount(); }
+        inline const std::vector<uint32_t> & indices() const { return _indices; }
+
+        template <typename T>
+        inline const PackedPoint3<T> * packedVertices() const
+        {
+            static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "PLY vertices are read as float or double");
+            PlyType want = std::is_same<T, float>::value ? PlyType::eFloat32 : PlyType::eFloat64;
+            bool packed = _vertexStride == sizeof(PackedPoint3<T>);
+            for (size_t k = 0; k < 3; k++)
+            {
+                packed = packed && (_xyz[k].type == want) && (_xyz[k].offset == k * sizeof(T));
+            }
+            if (!packed || (reinterpret_cast<uintptr_t>(_vertexData) % alignof(PackedPoint3<T>)) != 0)
+            {
+                return nullptr;
+            }
+            return reinterpret_cast<const PackedPoint3<T> *>(_vertexData);
+        }
+
+        // a vertex index out of range gives an infinite point
+        template <typename T = float>
+        inline PackedPoint3<T> vertex(size_t v) const
+        {
+            if (v >= _vertexCount)
+            {
+                return PackedPoint3<T>{ infinity<T>(), infinity<T>(), infinity<T>() };
+            }
+            const uint8_t * p = _vertexData + v * _vertexStride;
+            return PackedPoint3<T>{ T(plyValue(_xyz[0].type, p + _xyz[0].offset)), T(plyValue(_xyz[1].type, p + _xyz[1].offset)), T(plyValue(_xyz[2].type, p + _xyz[2].offset)) };
+        }
+
+        template <typename T = float>
+        inline PackedTriangle3<T> triangle(size_t face) const
+        {
+            return PackedTriangle3<T>{ vertex<T>(_indices[3 * face]), vertex<T>(_indices[3 * face + 1]), vertex<T>(_indices[3 * face + 2]) };
+        }
+
+        // classifies the triangles as Triangle3<T> would, spread over
+        // threads (see parallelFor(), all hardware threads by default).
+        // Returns the number of degenerate or invalid triangles.
+        template <typename T = float>
+        size_t validate(unsigned threads = 0)
+        {
+            size_t flagged;
+            const PackedPoint3<T> * packed = packedVertices<T>();
+            if (packed != nullptr)
+            {
+                const uint32_t * idx = _indices.data();
+                size_t count = _vertexCount;
+                auto get = [packed, idx, count](size_t f) {
+                    PackedTriangle3<T> tri;
+                    PackedPoint3<T> * corners[3] = { &tri.p1, &tri.p2, &tri.p3 };
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        uint32_t v = idx[3 * f + c];
+                        *corners[c] = (v < count) ? packed[v] : PackedPoint3<T>{ infinity<T>(), infinity<T>(), infinity<T>() };
+                    }
+                    return tri;
+                };
+                flagged = validateTriangles(faceCount(), get, _bits, threads);
+            }
+            else
+            {
+                flagged = validateTriangles(faceCount(), [this](size_t f) { return triangle<T>(f); }, _bits, threads);
+            }
+            _validatedAs = sizeof(T);
+            return flagged;
+        }
+
+        // the degeneracy bits of the last validate()
+        inline bool validated() const { return _validatedAs != 0; }
+        inline const uint64_t * degenerateBits() const { return _bits.data(); }
+        inline bool amDegenerate(size_t face) const { return (_bits[face >> 6] >> (face & 63)) & 1; }
+
+        // appends the triangles to a soup, validating them first unless
+        // validate<T>() has run
+        template <typename T>
+        void appendTo(TriangleSoup<T> & soup, unsigned threads = 0)
+        {
+            if (_validatedAs != sizeof(T))
+            {
+                validate<T>(threads);
+            }
+            soup.append(faceCount(), [this](size_t f) { return triangle<T>(f); }, _bits.data());
+        }
+
+        // the triangles [first, first + count) as a soup, making the file a
+        // source for the streaming queries (see intersectStream())
+        template <typename T>
+        void read(size_t first, size_t count, TriangleSoup<T> & chunk) const
+        {
+            auto get = [this, first](size_t f) { return triangle<T>(first + f); };
+            std::vector<uint64_t> bits;
+            validateTriangles(count, get, bits);
+            chunk.clear();
+            chunk.append(count, get, bits.data());
+        }
+
+        // the vertices and triangles as a mesh (which has its own copy)
+        template <typename T = float>
+        IndexedMesh<T> mesh() const
+        {
+            const PackedPoint3<T> * packed = packedVertices<T>();
+            if (packed != nullptr)
+            {
+                return IndexedMesh<T>(packed, _vertexCount, _indices.data(), faceCount());
+            }
+            std::vector<PackedPoint3<T>> vertices(_vertexCount);
+            for (size_t v = 0; v < _vertexCount; v++)
+            {
+                vertices[v] = vertex<T>(v);
+            }
+            return IndexedMesh<T>(std::move(vertices), _indices);
+        }
+
+    private:
+        struct Property
+        {
+            std::string     name;
+            PlyType         type = PlyType::eNone;
+            PlyType         countType = PlyType::eNone;       // set for lists
+        };
+
+        struct Element
+        {
+            std::string             name;
+            uint64_t                count = 0;
+            std::vector<Property>   properties;
+        };
+
+        struct Coordinate
+        {
+            PlyType         type = PlyType::eNone;
+            size_t          offset = 0;
+        };
+
+        // the words of the next header line, false at the end of the file
+        bool _headerLine(size_t & pos, std::vector<std::string> & words) const
+        {
+            const char * text = reinterpret_cast<const char *>(_file.data());
+            const char * end = text + _file.size();
+            const char * line = text + pos;
+            const char * eol = static_cast<const char *>(std::memchr(line, '\n', size_t(end - line)));
+            if (eol == nullptr)
+            {
+                return false;
+            }
+            words.clear();
+            for (const char * c = line; c < eol; )
+            {
+                while (c < eol && (*c == ' ' || *c == '\t' || *c == '\r'))
+                {
+                    c++;
+                }
+                const char * w = c;
+                while (c < eol && !(*c == ' ' || *c == '\t' || *c == '\r'))
+                {
+                    c++;
+                }
+                if (c > w)
+                {
+                    words.emplace_back(w, c);
+                }
+            }
+            pos = size_t(eol - text) + 1;
+            return true;
+        }
+
+        LoadResult _parse()
+        {
+            size_t pos = 0;
+            std::vector<std::string> words;
+            if (!_headerLine(pos, words) || words.size() != 1 || words[0] != "ply")
+            {
+                return LoadResult::eBadFormat;
+            }
+
+            std::vector<Element> elements;
+            bool format = false;
+            bool ended = false;
+            while (!ended && _headerLine(pos, words))
+            {
+                if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+                {
+                    continue;
+                }
+                if (words[0] == "format" && words.size() == 3)
+                {
+                    if (words[1] == "ascii" || words[1] == "binary_big_endian")
+                    {
+                        return LoadResult::eUnsupported;
+                    }
+                    if (words[1] != "binary_little_endian")
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    format = true;
+                }
+                else if (words[0] == "element" && words.size() == 3)
+                {
+                    Element e;
+                    e.name = words[1];
+                    char * rest;
+                    e.count = std::strtoull(words[2].c_str(), &rest, 10);
+                    if (*rest != '\0' || words[2][0] == '-')
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    elements.push_back(e);
+                }
+                else if (words[0] == "property" && !elements.empty() && words.size() == 3)
+                {
+                    Property p;
+                    p.type = plyType(words[1]);
+                    p.name = words[2];
+                    if (p.type == PlyType::eNone)
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    elements.back().properties.push_back(p);
+                }
+                else if (words[0] == "property" && !elements.empty() && words.size() == 5 && words[1] == "list")
+                {
+                    Property p;
+                    p.countType = plyType(words[2]);
+                    p.type = plyType(words[3]);
+                    p.name = words[4];
+                    if (p.countType == PlyType::eNone || p.countType == PlyType::eFloat32 || p.countType == PlyType::eFloat64 || p.type == PlyType::eNone)
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    elements.back().properties.push_back(p);
+                }
+                else if (words[0] == "end_header" && words.size() == 1)
+                {
+                    ended = true;
+                }
+                else
+                {
+                    return LoadResult::eBadFormat;
+                }
+            }
+            if (!ended || !format)
+            {
+                return LoadResult::eBadFormat;
+            }
+
+            bool haveVertices = false;
+            for (const Element & e : elements)
+            {
+                LoadResult r = (e.name == "vertex") ? _vertices(e, pos) : _records(e, pos);
+                if (r != LoadResult::eOk)
+                {
+                    return r;
+                }
+                haveVertices = haveVertices || (e.name == "vertex");
+            }
+            return haveVertices ? LoadResult::eOk : LoadResult::eBadFormat;
+        }
+
+        // the fixed size vertex records, located but not read
+        LoadResult _vertices(const Element & e, size_t & pos)
+        {
+            const char * names[3] = { "x", "y", "z" };
+            bool found[3] = { false, false, false };
+            size_t stride = 0;
+            for (const Property & p : e.properties)
+            {
+                if (p.countType != PlyType::eNone)
+                {
+                    return LoadResult::eUnsupported;
+                }
+                for (size_t k = 0; k < 3; k++)
+                {
+                    if (p.name == names[k] && !found[k])
+                    {
+                        _xyz[k].type = p.type;
+                        _xyz[k].offset = stride;
+                        found[k] = true;
+                    }
+                }
+                stride += plySize(p.type);
+            }
+            if (!found[0] || !found[1] || !found[2])
+            {
+                return LoadResult::eBadFormat;
+            }
+            if (e.count > (_file.size() - pos) / stride)
+            {
+                return LoadResult::eBadFormat;
+            }
+            _vertexData = _file.data() + pos;
+            _vertexCount = size_t(e.count);
+            _vertexStride = stride;
+            pos += _vertexCount * stride;
+            return LoadResult::eOk;
+        }
+
+        // steps over the records of any other element, decoding the
+        // vertex lists of faces into triangles
+        LoadResult _records(const Element & e, size_t & pos)
+        {
+            bool face = (e.name == "face");
+            const Property * list = nullptr;
+            size_t stride = 0;
+            for (const Property & p : e.properties)
+            {
+                if (face && list == nullptr && p.countType != PlyType::eNone && (p.name == "vertex_indices" || p.name == "vertex_index"))
+                {
+                    list = &p;
+                }
+                stride += plySize(p.type);
+                if (p.countType != PlyType::eNone)
+                {
+                    stride = 0;
+                    break;
+                }
+            }
+            if (face && list == nullptr)
+            {
+                return LoadResult::eBadFormat;
+            }
+
+            size_t size = _file.size();
+            if (stride != 0 || e.properties.empty())
+            {
+                // fixed size records
+                if (stride != 0 && e.count > (size - pos) / stride)
+                {
+                    return LoadResult::eBadFormat;
+                }
+                pos += size_t(e.count) * stride;
+                return LoadResult::eOk;
+            }
+
+            const uint8_t * data = _file.data();
+            std::vector<uint32_t> polygon;
+            if (face)
+            {
+                _indices.reserve(3 * size_t(std::min<uint64_t>(e.count, size)));
+            }
+            for (uint64_t n = 0; n < e.count; n++)
+            {
+                for (const Property & p : e.properties)
+                {
+                    if (p.countType == PlyType::eNone)
+                    {
+                        if (size - pos < plySize(p.type))
+                        {
+                            return LoadResult::eBadFormat;
+                        }
+                        pos += plySize(p.type);
+                        continue;
+                    }
+
+                    if (size - pos < plySize(p.countType))
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    double count = plyValue(p.countType, data + pos);
+                    pos += plySize(p.countType);
+                    size_t itemSize = plySize(p.type);
+                    if (!(count >= 0.0 && count <= double((size - pos) / itemSize)) || count != std::floor(count))
+                    {
+                        return LoadResult::eBadFormat;
+                    }
+                    size_t length = size_t(count);
+                    if (&p == list)
+                    {
+                        polygon.resize(length);
+                        for (size_t k = 0; k < length; k++)
+                        {
+                            if (!plyIndex(plyValue(p.type, data + pos + k * itemSize), polygon[k]))
+                            {
+                                return LoadResult::eBadFormat;
+                            }
+                        }
+                        for (size_t k = 2; k < length; k++)
+                        {
+                            _indices.push_back(polygon[0]);
+                            _indices.push_back(polygon[k - 1]);
+                            _indices.push_back(polygon[k]);
+                        }
+                    }
+                    pos += length * itemSize;
+                }
+            }
+            return LoadResult::eOk;
+        }
+
+        // private data
+        MappedFile              _file;
+        const uint8_t *         _vertexData = nullptr;
+        size_t                  _vertexCount = 0;
+        size_t                  _vertexStride = 0;
+        Coordinate              _xyz[3];
+        std::vector<uint32_t>   _indices;
+        std::vector<uint64_t>   _bits;
+        size_t                  _validatedAs = 0;
+};
+
+} // end of hubert namespace
+
+#endif
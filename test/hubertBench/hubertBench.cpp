@@ -0,0 +1,621 @@
+// hubertBench.cpp : Micro benchmarks for the hubert primitives.
+//
+// Every benchmark runs over a pool of inputs of one kind - valid, degenerate
+// or subnormal - for float and for double, and reports the time per
+// operation and the throughput. Results can be saved and later compared
+// against, so that a change to the header that makes something slower is
+// caught in the same way as one that breaks it:
+//
+//   hubertBench [filter] [--min-time seconds] [--csv file]
+//               [--baseline file] [--tolerance fraction]
+//
+// filter     only run benchmarks whose name contains this string
+// --min-time the minimum time spent timing each benchmark (default 0.2s)
+// --csv      write the results as name,ns_per_op lines
+// --baseline compare against a file written by --csv, and exit with 1 if
+//            any benchmark got slower by more than --tolerance (default
+//            0.25, i.e. 25%)
+
+
+// system headers
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// hubert header - that's what we are measuring
+#include "hubert.hpp"
+#include "hubertIO.hpp"
+
+
+///////////////////////////////////////////////////////////////////////////
+// Harness
+///////////////////////////////////////////////////////////////////////////
+
+// Keeps the compiler from optimizing away a computation whose result is
+// otherwise unused.
+template <typename V>
+inline void doNotOptimize(const V & v)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    static const void * volatile sink;
+    sink = &v;
+#else
+    asm volatile("" : : "g"(&v) : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    std::string     name;
+    double          nsPerOp;
+    double          opsPerSecond;
+};
+
+struct BenchOptions
+{
+    std::string     filter;
+    double          minTime = 0.2;
+    std::string     csv;
+    std::string     baseline;
+    double          tolerance = 0.25;
+};
+
+// Times body(n), which performs n operations. The number of passes is
+// doubled until a measurement takes a fifth of the minimum time, then five
+// measurements are taken and the fastest is reported, which is the one
+// least disturbed by the rest of the system.
+template <typename Body>
+static BenchResult measure(const std::string & name, size_t n, double minTime, Body body)
+{
+    using clock = std::chrono::steady_clock;
+
+    // warm up the caches and the branch predictors
+    body(n);
+
+    size_t passes = 1;
+    double best = std::numeric_limits<double>::infinity();
+    for (int sample = 0; sample < 5; )
+    {
+        auto start = clock::now();
+        for (size_t pass = 0; pass < passes; pass++)
+        {
+            body(n);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (seconds < minTime / 5 && sample == 0)
+        {
+            passes *= 2;
+            continue;
+        }
+        best = std::min(best, seconds / double(passes * n));
+        sample++;
+    }
+    return BenchResult{ name, best * 1e9, 1.0 / best };
+}
+
+class BenchRunner
+{
+    public:
+        explicit BenchRunner(const BenchOptions & options) : _options(options) {}
+
+        template <typename Body>
+        void run(const std::string & name, size_t n, Body body)
+        {
+            if (name.find(_options.filter) == std::string::npos)
+            {
+                return;
+            }
+            BenchResult r = measure(name, n, _options.minTime, body);
+            std::cout << std::left << std::setw(56) << r.name << std::right << std::fixed
+                << std::setw(12) << std::setprecision(2) << r.nsPerOp << " ns/op"
+                << std::setw(12) << std::setprecision(2) << r.opsPerSecond / 1e6 << " Mop/s" << std::endl;
+            _results.push_back(r);
+        }
+
+        const std::vector<BenchResult> & results() const { return _results; }
+
+    private:
+        BenchOptions                _options;
+        std::vector<BenchResult>    _results;
+};
+
+
+///////////////////////////////////////////////////////////////////////////
+// Inputs
+///////////////////////////////////////////////////////////////////////////
+
+enum class InputKind
+{
+    eValid,
+    eDegenerate,
+    eSubnormal
+};
+
+static const char * kindName(InputKind kind)
+{
+    switch (kind)
+    {
+        case InputKind::eValid:         return "valid";
+        case InputKind::eDegenerate:    return "degenerate";
+        default:                        return "subnormal";
+    }
+}
+
+template <typename T>
+static const char * typeName() { return std::is_same<T, float>::value ? "float" : "double"; }
+
+// The size of each input pool. Small enough for the pools of one benchmark
+// to stay in the L2 cache, so that it is the computation that is measured.
+constexpr size_t cPoolSize = 4096;
+
+// Triangles, as nine coordinates each, from which all the other inputs are
+// made. Valid triangles are random within a small box, so that some pairs
+// of them intersect. Degenerate ones have their first two vertices in the
+// same place, which also makes the first edge a zero vector and the first
+// two rows of a matrix made from them the same. Subnormal ones have all
+// their coordinates in the subnormal range.
+template <typename T>
+static std::vector<T> makeCoordinates(InputKind kind, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> coord(T(-2.0), T(2.0));
+    std::vector<T> c(9 * cPoolSize);
+    for (size_t i = 0; i < c.size(); i++)
+    {
+        c[i] = coord(gen);
+    }
+
+    for (size_t i = 0; i < cPoolSize; i++)
+    {
+        T * t = &c[9 * i];
+        if (kind == InputKind::eDegenerate)
+        {
+            t[3] = t[0];
+            t[4] = t[1];
+            t[5] = t[2];
+        }
+        else if (kind == InputKind::eSubnormal)
+        {
+            for (int k = 0; k < 9; k++)
+            {
+                t[k] *= std::numeric_limits<T>::min() / T(4.0);
+            }
+        }
+    }
+    return c;
+}
+
+template <typename T>
+struct Inputs
+{
+    std::vector<T>                      coords;
+    std::vector<hubert::Vector3<T>>     vectors;
+    std::vector<hubert::Matrix3<T>>     matrices;
+    std::vector<hubert::Triangle3<T>>   triangles;
+    std::vector<hubert::Ray3<T>>        rays;
+    std::vector<hubert::Plane<T>>       planes;
+};
+
+template <typename T>
+static Inputs<T> makeInputs(InputKind kind)
+{
+    Inputs<T> in;
+    in.coords = makeCoordinates<T>(kind, 1);
+    std::vector<T> other = makeCoordinates<T>(InputKind::eValid, 2);
+    for (size_t i = 0; i < cPoolSize; i++)
+    {
+        const T * t = &in.coords[9 * i];
+        const T * o = &other[9 * i];
+        hubert::Point3<T> p1(t[0], t[1], t[2]);
+        hubert::Point3<T> p2(t[3], t[4], t[5]);
+        hubert::Point3<T> p3(t[6], t[7], t[8]);
+        in.vectors.push_back(hubert::Vector3<T>(t[3] - t[0], t[4] - t[1], t[5] - t[2]));
+        in.matrices.push_back(hubert::Matrix3<T>(t[0], t[1], t[2], t[3], t[4], t[5], t[6], t[7], t[8]));
+        in.triangles.push_back(hubert::Triangle3<T>(p1, p2, p3));
+
+        // rays from random points through the centroid of the triangle
+        // (with no direction for degenerate input), and planes through its
+        // first vertex and across its first edge
+        hubert::Point3<T> from(o[0] * T(5.0), o[1] * T(5.0), o[2] * T(5.0));
+        hubert::Point3<T> at((t[0] + t[3] + t[6]) / T(3.0), (t[1] + t[4] + t[7]) / T(3.0), (t[2] + t[5] + t[8]) / T(3.0));
+        in.rays.push_back(hubert::Ray3<T>(from, hubert::makeUnitVector3(kind == InputKind::eDegenerate ? at : from, at)));
+        in.planes.push_back(hubert::Plane<T>(p1, hubert::makeUnitVector3(in.vectors.back())));
+    }
+    return in;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Benchmarks
+///////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static void benchPrimitives(BenchRunner & runner, InputKind kind)
+{
+    const Inputs<T> in = makeInputs<T>(kind);
+    const size_t n = cPoolSize;
+    const size_t mask = cPoolSize - 1;
+    auto name = [&](const char * what) { return std::string(what) + "/" + typeName<T>() + "/" + kindName(kind); };
+
+    runner.run(name("Point3(x, y, z)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            const T * t = &in.coords[9 * i];
+            hubert::Point3<T> p(t[0], t[1], t[2]);
+            doNotOptimize(p);
+        }
+    });
+
+    runner.run(name("UnitVector3(x, y, z)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            const T * t = &in.coords[9 * i];
+            hubert::UnitVector3<T> u(t[3] - t[0], t[4] - t[1], t[5] - t[2]);
+            doNotOptimize(u);
+        }
+    });
+
+    runner.run(name("Vector3::magnitude"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            T m = in.vectors[i].magnitude();
+            doNotOptimize(m);
+        }
+    });
+
+    runner.run(name("crossProduct(Vector3, Vector3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Vector3<T> v = hubert::crossProduct(in.vectors[i], in.vectors[(i + 1) & mask]);
+            doNotOptimize(v);
+        }
+    });
+
+    runner.run(name("Matrix3::multiply"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Matrix3<T> m = in.matrices[i].multiply(in.matrices[(i + 1) & mask]);
+            doNotOptimize(m);
+        }
+    });
+
+    runner.run(name("multiply(Vector3, Matrix3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Vector3<T> v = hubert::multiply(in.vectors[i], in.matrices[(i + 1) & mask]);
+            doNotOptimize(v);
+        }
+    });
+
+    // the same transform over a whole array at once
+    std::vector<hubert::Point3<T>> points;
+    for (size_t i = 0; i < n; i++)
+    {
+        points.push_back(hubert::Point3<T>(in.vectors[i].x(), in.vectors[i].y(), in.vectors[i].z()));
+    }
+    std::vector<hubert::Point3<T>> transformed(n);
+    runner.run(name("transformPoints(Matrix3, Point3[])"), n, [&](size_t count) {
+        hubert::ResultCode r = hubert::transformPoints(in.matrices[1], points.data(), count, transformed.data());
+        doNotOptimize(r);
+        doNotOptimize(transformed[count - 1]);
+    });
+
+    runner.run(name("Triangle3(p1, p2, p3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            const T * t = &in.coords[9 * i];
+            hubert::Triangle3<T> tri(hubert::Point3<T>(t[0], t[1], t[2]), hubert::Point3<T>(t[3], t[4], t[5]), hubert::Point3<T>(t[6], t[7], t[8]));
+            doNotOptimize(tri);
+        }
+    });
+
+    runner.run(name("intersect(Triangle3, Triangle3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::ResultCode r = hubert::intersect(in.triangles[i], in.triangles[(i + 1) & mask]);
+            doNotOptimize(r);
+        }
+    });
+
+    runner.run(name("intersect(Triangle3, Triangle3, Segment3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Segment3<T> segment;
+            hubert::ResultCode r = hubert::intersect(in.triangles[i], in.triangles[(i + 1) & mask], segment);
+            doNotOptimize(r);
+            doNotOptimize(segment);
+        }
+    });
+
+    runner.run(name("intersect(exact, Triangle3, Triangle3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::ResultCode r = hubert::intersect(hubert::exact, in.triangles[i], in.triangles[(i + 1) & mask]);
+            doNotOptimize(r);
+        }
+    });
+
+    runner.run(name("intersect(Triangle3, Ray3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Point3<T> p;
+            hubert::ResultCode r = hubert::intersect(in.triangles[i], in.rays[i], p);
+            doNotOptimize(r);
+            doNotOptimize(p);
+        }
+    });
+
+    runner.run(name("intersect(AbsoluteEpsilon, Triangle3, Ray3)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::Point3<T> p;
+            hubert::ResultCode r = hubert::intersect(hubert::AbsoluteEpsilon<>(), in.triangles[i], in.rays[i], p);
+            doNotOptimize(r);
+            doNotOptimize(p);
+        }
+    });
+
+    runner.run(name("intersect(Triangle3, Plane)"), n, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hubert::ResultCode r = hubert::intersect(in.triangles[i], in.planes[(i + 1) & mask]);
+            doNotOptimize(r);
+        }
+    });
+}
+
+// Queries against a whole mesh, which only make sense for valid input.
+template <typename T>
+static void benchMesh(BenchRunner & runner)
+{
+    const Inputs<T> in = makeInputs<T>(InputKind::eValid);
+    auto name = [&](const char * what) { return std::string(what) + "/" + typeName<T>() + "/valid"; };
+
+    // the pool triangles overlap far too much to make a sensible mesh, so
+    // shrink each of them about its first vertex, spread over a larger box
+    std::vector<hubert::Triangle3<T>> mesh;
+    for (size_t i = 0; i < cPoolSize; i++)
+    {
+        const T * t = &in.coords[9 * i];
+        hubert::Point3<T> p1(t[0] * T(2.0), t[1] * T(2.0), t[2] * T(2.0));
+        auto near = [&](int k) { return hubert::Point3<T>(p1.x() + (t[k] - t[0]) / T(8.0), p1.y() + (t[k + 1] - t[1]) / T(8.0), p1.z() + (t[k + 2] - t[2]) / T(8.0)); };
+        mesh.push_back(hubert::Triangle3<T>(p1, near(3), near(6)));
+    }
+
+    hubert::Bvh<T> bvh(mesh.begin(), mesh.end());
+    runner.run(name("intersect(Bvh, Ray3)"), cPoolSize, [&](size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t tri;
+            hubert::Point3<T> p;
+            hubert::ResultCode r = hubert::intersect(bvh, in.rays[i], tri, p);
+            doNotOptimize(r);
+            doNotOptimize(p);
+        }
+    });
+
+    // the whole pass is one iteration; the arena is reset between passes
+    runner.run(name("intersectSelf(Triangle3[], vector)"), cPoolSize, [&](size_t) {
+        std::vector<std::pair<size_t, size_t>> pairs;
+        hubert::ResultCode r = hubert::intersectSelf(mesh.data(), mesh.size(), pairs, false);
+        doNotOptimize(r);
+        doNotOptimize(pairs.data());
+    });
+
+    hubert::MonotonicArena arena;
+    runner.run(name("intersectSelf(Triangle3[], ArenaVector)"), cPoolSize, [&](size_t) {
+        arena.reset();
+        hubert::ArenaVector<std::pair<size_t, size_t>> pairs{ hubert::ArenaAllocator<std::pair<size_t, size_t>>(arena) };
+        hubert::ResultCode r = hubert::intersectSelf(mesh.data(), mesh.size(), pairs, false);
+        doNotOptimize(r);
+        doNotOptimize(pairs.data());
+    });
+}
+
+// Ingesting a binary STL file: building and validating a Triangle3 per
+// record against StlFile's bulk validation into the soup's bitset. The
+// file is small and stays in the page cache, so this measures the
+// validation rather than the disk.
+static void benchMeshFile(BenchRunner & runner)
+{
+    const Inputs<float> in = makeInputs<float>(InputKind::eValid);
+    std::vector<char> bytes(84 + 50 * cPoolSize, 0);
+    uint32_t count = uint32_t(cPoolSize);
+    std::memcpy(&bytes[80], &count, sizeof(count));
+    for (size_t i = 0; i < cPoolSize; i++)
+    {
+        std::memcpy(&bytes[84 + 50 * i + 12], &in.coords[9 * i], 9 * sizeof(float));
+    }
+    // a name of its own, so that runs at the same time do not share the
+    // file, and removed again on the way out
+    struct RemoveOnExit
+    {
+        std::string path;
+        ~RemoveOnExit()
+        {
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+    };
+    std::random_device rd;
+    RemoveOnExit file{ (std::filesystem::temp_directory_path() / ("hubertBench_" + std::to_string(rd()) + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".stl")).string() };
+    std::ofstream(file.path, std::ios::binary).write(bytes.data(), std::streamsize(bytes.size()));
+
+    hubert::StlFile stl(file.path.c_str());
+    runner.run("push_back(TriangleSoup, Triangle3 from StlFile)/float/valid", cPoolSize, [&](size_t n) {
+        hubert::TriangleSoup<float> soup;
+        soup.reserve(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            soup.push_back(hubert::makeTriangle3(stl.triangle(i)));
+        }
+        doNotOptimize(soup);
+    });
+    runner.run("StlFile::appendTo(TriangleSoup)/float/valid", cPoolSize, [&](size_t) {
+        hubert::TriangleSoup<float> soup;
+        stl.validate(1);
+        stl.appendTo(soup);
+        doNotOptimize(soup);
+    });
+
+    // the same rays against the whole file in core and streamed in four
+    // chunks, one thread each
+    hubert::TriangleSoup<float> soup;
+    stl.appendTo(soup, 1);
+    const size_t rays = 256;
+    runner.run("intersect(TriangleSoup, Ray3)/float/valid", rays, [&](size_t n) {
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t index;
+            float t;
+            hubert::ResultCode r = hubert::intersect(soup, in.rays[i], index, t);
+            doNotOptimize(r);
+            doNotOptimize(t);
+        }
+    });
+
+    // the same soup and rays in double, and the float filter with the
+    // double fallback that gives the double answer
+    std::vector<hubert::Ray3<double>> doubleRays;
+    hubert::TriangleSoup<double> doubleSoup;
+    for (size_t i = 0; i < rays; i++)
+    {
+        const hubert::Ray3<float> & r = in.rays[i];
+        doubleRays.push_back(hubert::Ray3<double>(hubert::Point3<double>(r.base().x(), r.base().y(), r.base().z()),
+            hubert::UnitVector3<double>(r.unitDirection().x(), r.unitDirection().y(), r.unitDirection().z())));
+    }
+    for (size_t i = 0; i < soup.size(); i++)
+    {
+        hubert::Triangle3<float> tri = soup.triangle(i);
+        auto promote = [](const hubert::Point3<float> & p) { return hubert::Point3<double>(p.x(), p.y(), p.z()); };
+        doubleSoup.push_back(hubert::Triangle3<double>(promote(tri.p1()), promote(tri.p2()), promote(tri.p3())));
+    }
+    runner.run("intersect(TriangleSoup, Ray3)/double/valid", rays, [&](size_t n) {
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t index;
+            double t;
+            hubert::ResultCode r = hubert::intersect(doubleSoup, doubleRays[i], index, t);
+            doNotOptimize(r);
+            doNotOptimize(t);
+        }
+    });
+    runner.run("intersect(mixedPrecision, TriangleSoup, Ray3)/float/valid", rays, [&](size_t n) {
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t index;
+            double t;
+            hubert::ResultCode r = hubert::intersect(hubert::mixedPrecision, soup, doubleRays[i], index, t);
+            doNotOptimize(r);
+            doNotOptimize(t);
+        }
+    });
+
+    std::vector<hubert::BatchHit<float>> hits(rays);
+    runner.run("intersectStream(StlFile, Ray3)/float/valid", rays, [&](size_t n) {
+        size_t hitCount = hubert::intersectStream(in.rays.data(), n, stl, hits.data(), hubert::SerialExecutor(), cPoolSize / 4);
+        doNotOptimize(hitCount);
+    });
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////
+
+static std::map<std::string, double> readResults(const std::string & path)
+{
+    std::map<std::string, double> results;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t comma = line.rfind(',');
+        if (comma != std::string::npos)
+        {
+            results[line.substr(0, comma)] = std::atof(line.c_str() + comma + 1);
+        }
+    }
+    return results;
+}
+
+int main(int argc, char * argv[])
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--min-time" && hasValue)
+        {
+            options.minTime = std::atof(argv[++i]);
+        }
+        else if (arg == "--csv" && hasValue)
+        {
+            options.csv = argv[++i];
+        }
+        else if (arg == "--baseline" && hasValue)
+        {
+            options.baseline = argv[++i];
+        }
+        else if (arg == "--tolerance" && hasValue)
+        {
+            options.tolerance = std::atof(argv[++i]);
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            std::cerr << "usage: hubertBench [filter] [--min-time seconds] [--csv file] [--baseline file] [--tolerance fraction]" << std::endl;
+            return 2;
+        }
+        else
+        {
+            options.filter = arg;
+        }
+    }
+
+    BenchRunner runner(options);
+    for (InputKind kind : { InputKind::eValid, InputKind::eDegenerate, InputKind::eSubnormal })
+    {
+        benchPrimitives<float>(runner, kind);
+        benchPrimitives<double>(runner, kind);
+    }
+    benchMesh<float>(runner);
+    benchMesh<double>(runner);
+    benchMeshFile(runner);
+
+    if (!options.csv.empty())
+    {
+        std::ofstream out(options.csv);
+        for (auto & r : runner.results())
+        {
+            out << r.name << "," << std::setprecision(6) << r.nsPerOp << "\n";
+        }
+    }
+
+    int status = 0;
+    if (!options.baseline.empty())
+    {
+        std::map<std::string, double> baseline = readResults(options.baseline);
+        for (auto & r : runner.results())
+        {
+            auto found = baseline.find(r.name);
+            if (found != baseline.end() && r.nsPerOp > found->second * (1.0 + options.tolerance))
+            {
+                std::cout << "REGRESSION " << r.name << ": " << std::setprecision(2) << r.nsPerOp << " ns/op, was " << found->second << std::endl;
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
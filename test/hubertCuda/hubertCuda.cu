@@ -0,0 +1,317 @@
+// hubertCuda.cu : Builds hubertCuda.hpp with nvcc and checks the GPU
+// against the host.
+//
+// The entity classes are built and queried in kernels of this file, and
+// the batch queries of hubertCuda.hpp are run over a random mesh. Every
+// result is compared with the one the host gives for the same input. The
+// program exits with 1 if any differ, and with 0 if they all agree or if
+// there is no CUDA device to run on (so that a machine without one can
+// still check that everything compiles).
+
+
+// system headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// hubert headers - that's what we are testing
+#include "hubert.hpp"
+#include "hubertCuda.hpp"
+
+
+///////////////////////////////////////////////////////////////////////////
+// Kernels on the entity classes
+///////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+__global__ void buildTrianglesKernel(const hubert::PackedTriangle3<T> * in, size_t count, hubert::Triangle3<T> * out)
+{
+    for (size_t i = size_t(blockIdx.x) * blockDim.x + threadIdx.x; i < count; i += size_t(gridDim.x) * blockDim.x)
+    {
+        const hubert::PackedTriangle3<T> & p = in[i];
+        out[i] = hubert::Triangle3<T>(
+            hubert::Point3<T>(p.p1.x, p.p1.y, p.p1.z),
+            hubert::Point3<T>(p.p2.x, p.p2.y, p.p2.z),
+            hubert::Point3<T>(p.p3.x, p.p3.y, p.p3.z));
+    }
+}
+
+template <typename T>
+__global__ void intersectPairsKernel(const hubert::Triangle3<T> * tris, const hubert::Ray3<T> * rays, size_t count, hubert::ResultCode * codes, hubert::Point3<T> * points)
+{
+    for (size_t i = size_t(blockIdx.x) * blockDim.x + threadIdx.x; i < count; i += size_t(gridDim.x) * blockDim.x)
+    {
+        codes[i] = hubert::intersect(tris[i], rays[i], points[i]);
+    }
+}
+
+template <typename T>
+__global__ void planeDistanceKernel(const hubert::Point3<T> * points, size_t count, hubert::Plane<T> thePlane, T * out)
+{
+    for (size_t i = size_t(blockIdx.x) * blockDim.x + threadIdx.x; i < count; i += size_t(gridDim.x) * blockDim.x)
+    {
+        out[i] = hubert::distance(points[i], thePlane);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Harness
+///////////////////////////////////////////////////////////////////////////
+
+static int gFailures = 0;
+
+static void check(bool ok, const char * what, const char * type, size_t i)
+{
+    if (!ok)
+    {
+        if (gFailures < 20)
+        {
+            std::printf("FAILED: %s<%s> at %zu\n", what, type, i);
+        }
+        gFailures++;
+    }
+}
+
+static bool checkCuda(cudaError_t error, const char * what)
+{
+    if (error != cudaSuccess)
+    {
+        std::printf("FAILED: %s: %s\n", what, cudaGetErrorString(error));
+        gFailures++;
+    }
+    return error == cudaSuccess;
+}
+
+// The device may round differently from the host (fused multiply adds,
+// norm3d against std::hypot), so values are compared with a tolerance.
+template <typename T>
+static bool isClose(T a, T b)
+{
+    if (!hubert::isValid(a) || !hubert::isValid(b))
+    {
+        return a == b;
+    }
+    return std::abs(a - b) <= T(64.0) * hubert::epsilon<T>() * std::max(T(1.0), std::max(std::abs(a), std::abs(b)));
+}
+
+template <typename T>
+static std::vector<hubert::Triangle3<T>> makeTriangles(size_t count, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> centre(T(-10.0), T(10.0));
+    std::uniform_real_distribution<T> offset(T(-2.0), T(2.0));
+
+    std::vector<hubert::Triangle3<T>> tris;
+    for (size_t i = 0; i < count; i++)
+    {
+        hubert::Point3<T> c(centre(gen), centre(gen), centre(gen));
+        hubert::Point3<T> p1(c.x() + offset(gen), c.y() + offset(gen), c.z() + offset(gen));
+        if (i % 16 == 0)
+        {
+            // a collapsed one now and then, so the degenerate flags are checked too
+            tris.emplace_back(p1, p1, hubert::Point3<T>(c.x(), c.y(), c.z()));
+            continue;
+        }
+        tris.emplace_back(p1,
+            hubert::Point3<T>(c.x() + offset(gen), c.y() + offset(gen), c.z() + offset(gen)),
+            hubert::Point3<T>(c.x() + offset(gen), c.y() + offset(gen), c.z() + offset(gen)));
+    }
+    return tris;
+}
+
+// Rays from random points towards the centroid of tris[i] (or away from it
+// for every third), so that about two thirds of the pairs hit.
+template <typename T>
+static std::vector<hubert::Ray3<T>> makeRays(const std::vector<hubert::Triangle3<T>> & tris, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> base(T(-12.0), T(12.0));
+
+    std::vector<hubert::Ray3<T>> rays;
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        const hubert::Triangle3<T> & tri = tris[i];
+        hubert::Point3<T> from(base(gen), base(gen), base(gen));
+        T cx = (tri.p1().x() + tri.p2().x() + tri.p3().x()) / T(3.0);
+        T cy = (tri.p1().y() + tri.p2().y() + tri.p3().y()) / T(3.0);
+        T cz = (tri.p1().z() + tri.p2().z() + tri.p3().z()) / T(3.0);
+        T sign = (i % 3 == 2) ? T(-1.0) : T(1.0);
+        rays.emplace_back(from, hubert::UnitVector3<T>(sign * (cx - from.x()), sign * (cy - from.y()), sign * (cz - from.z())));
+    }
+    return rays;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Checks
+///////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static void checkEntities(const char * type)
+{
+    const std::vector<hubert::Triangle3<T>> tris = makeTriangles<T>(4096, 71);
+    const std::vector<hubert::Ray3<T>> rays = makeRays<T>(tris, 72);
+    const size_t count = tris.size();
+
+    std::vector<hubert::PackedTriangle3<T>> packed(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        packed[i] = hubert::PackedTriangle3<T>{ hubert::makePackedPoint3(tris[i].p1()), hubert::makePackedPoint3(tris[i].p2()), hubert::makePackedPoint3(tris[i].p3()) };
+    }
+
+    hubert::DeviceArray<hubert::PackedTriangle3<T>> devicePacked;
+    hubert::DeviceArray<hubert::Triangle3<T>> deviceTris;
+    hubert::DeviceArray<hubert::Ray3<T>> deviceRays;
+    hubert::DeviceArray<hubert::ResultCode> deviceCodes;
+    hubert::DeviceArray<hubert::Point3<T>> devicePoints;
+    if (!checkCuda(devicePacked.upload(packed.data(), count), "upload") ||
+        !checkCuda(deviceTris.resize(count), "resize") ||
+        !checkCuda(deviceRays.upload(rays.data(), count), "upload") ||
+        !checkCuda(deviceCodes.resize(count), "resize") ||
+        !checkCuda(devicePoints.resize(count), "resize"))
+    {
+        return;
+    }
+
+    // Triangle3 built on the device from its coordinates
+    buildTrianglesKernel<<<hubert::gpuGridSize(count), hubert::cGpuBlockSize>>>(devicePacked.data(), count, deviceTris.data());
+    std::vector<hubert::Triangle3<T>> built(count);
+    if (!checkCuda(cudaGetLastError(), "buildTrianglesKernel") ||
+        !checkCuda(deviceTris.download(built.data(), count), "download"))
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        check(hubert::isValid(built[i]) == hubert::isValid(tris[i]) && hubert::isDegenerate(built[i]) == hubert::isDegenerate(tris[i]), "Triangle3 flags", type, i);
+    }
+
+    // intersect(Triangle3, Ray3) on the device
+    intersectPairsKernel<<<hubert::gpuGridSize(count), hubert::cGpuBlockSize>>>(deviceTris.data(), deviceRays.data(), count, deviceCodes.data(), devicePoints.data());
+    std::vector<hubert::ResultCode> codes(count);
+    std::vector<hubert::Point3<T>> points(count);
+    if (!checkCuda(cudaGetLastError(), "intersectPairsKernel") ||
+        !checkCuda(deviceCodes.download(codes.data(), count), "download") ||
+        !checkCuda(devicePoints.download(points.data(), count), "download"))
+    {
+        return;
+    }
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        hubert::Point3<T> point;
+        hubert::ResultCode code = hubert::intersect(tris[i], rays[i], point);
+        check(codes[i] == code, "intersect(Triangle3, Ray3) code", type, i);
+        if (code == hubert::ResultCode::eOk && codes[i] == code)
+        {
+            hits++;
+            check(isClose(points[i].x(), point.x()) && isClose(points[i].y(), point.y()) && isClose(points[i].z(), point.z()), "intersect(Triangle3, Ray3) point", type, i);
+        }
+    }
+    check(hits > 0, "intersect(Triangle3, Ray3) hits", type, 0);
+
+    // distance(Point3, Plane) on the device
+    hubert::Plane<T> thePlane(hubert::Point3<T>(T(1.0), T(2.0), T(3.0)), hubert::UnitVector3<T>(T(1.0), T(-2.0), T(2.0)));
+    std::vector<hubert::Point3<T>> bases(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        bases[i] = rays[i].base();
+    }
+    hubert::DeviceArray<hubert::Point3<T>> deviceBases;
+    hubert::DeviceArray<T> deviceDistances;
+    if (!checkCuda(deviceBases.upload(bases.data(), count), "upload") ||
+        !checkCuda(deviceDistances.resize(count), "resize"))
+    {
+        return;
+    }
+    planeDistanceKernel<<<hubert::gpuGridSize(count), hubert::cGpuBlockSize>>>(deviceBases.data(), count, thePlane, deviceDistances.data());
+    std::vector<T> distances(count);
+    if (!checkCuda(cudaGetLastError(), "planeDistanceKernel") ||
+        !checkCuda(deviceDistances.download(distances.data(), count), "download"))
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        check(isClose(distances[i], hubert::distance(bases[i], thePlane)), "distance(Point3, Plane)", type, i);
+    }
+}
+
+template <typename T>
+static void checkBatches(const char * type)
+{
+    const std::vector<hubert::Triangle3<T>> tris = makeTriangles<T>(2000, 81);
+    const std::vector<hubert::Ray3<T>> rays = makeRays<T>(tris, 82);
+    const size_t count = rays.size();
+
+    hubert::TriangleSoup<T> soup(tris.begin(), tris.end());
+    hubert::Bvh<T> bvh(tris.begin(), tris.end());
+    hubert::DeviceSoup<T> deviceSoup;
+    hubert::DeviceBvh<T> deviceBvh;
+    if (!checkCuda(deviceSoup.upload(soup), "DeviceSoup::upload") ||
+        !checkCuda(deviceBvh.upload(bvh), "DeviceBvh::upload"))
+    {
+        return;
+    }
+
+    std::vector<hubert::RayHit<T>> soupHits(count);
+    std::vector<hubert::RayHit<T>> bvhHits(count);
+    if (!checkCuda(hubert::intersectBatch(hubert::gpu, rays.data(), count, deviceSoup, soupHits.data()), "intersectBatch(gpu, DeviceSoup)") ||
+        !checkCuda(hubert::intersectBatch(hubert::gpu, rays.data(), count, deviceBvh, bvhHits.data()), "intersectBatch(gpu, DeviceBvh)"))
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t index;
+        T t;
+        hubert::ResultCode r = hubert::intersect(soup, rays[i], index, t);
+        check(soupHits[i].triangle == index && bvhHits[i].triangle == index, "intersectBatch(gpu) triangle", type, i);
+        if (r == hubert::ResultCode::eOk)
+        {
+            check(isClose(soupHits[i].t, t) && isClose(bvhHits[i].t, t), "intersectBatch(gpu) t", type, i);
+        }
+    }
+
+    hubert::Plane<T> thePlane(hubert::Point3<T>(T(-1.0), T(0.5), T(2.0)), hubert::UnitVector3<T>(T(0.0), T(3.0), T(4.0)));
+    std::vector<hubert::Point3<T>> points;
+    for (const auto & tri : tris)
+    {
+        points.push_back(tri.p1());
+    }
+    std::vector<T> distances(points.size());
+    if (!checkCuda(hubert::distanceBatch(hubert::gpu, points.data(), points.size(), thePlane, distances.data()), "distanceBatch(gpu)"))
+    {
+        return;
+    }
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        check(isClose(distances[i], hubert::distance(points[i], thePlane)), "distanceBatch(gpu)", type, i);
+    }
+}
+
+int main()
+{
+    int devices = 0;
+    if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0)
+    {
+        std::printf("No CUDA device; hubertCuda built but nothing was run\n");
+        return 0;
+    }
+
+    checkEntities<float>("float");
+    checkEntities<double>("double");
+    checkBatches<float>("float");
+    checkBatches<double>("double");
+
+    if (gFailures > 0)
+    {
+        std::printf("%d checks failed\n", gFailures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
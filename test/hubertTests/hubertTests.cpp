@@ -3,12 +3,22 @@
 
 
 // system headers
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
 #include <vector>
 
 // hubert header - that's what we are testing
 #include "hubert.hpp"
+#include "hubertIO.hpp"
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -144,6 +154,51 @@ struct HubertTestSetup
 };
 static HubertTestSetup gSetup;
 
+///////////////////////////////////////////////////////////////////////////
+// Random scenes for the tests of the batch routines, which are checked
+// against the results of the pairwise routines. The generators are seeded
+// so that failures are reproducible.
+///////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+std::vector<hubert::Triangle3<T>> makeRandomTriangles(size_t count, uint32_t seed, T extent = T(10.0), T size = T(2.0))
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> centre(-extent, extent);
+    std::uniform_real_distribution<T> offset(-size, size);
+
+    std::vector<hubert::Triangle3<T>> tris;
+    for (size_t i = 0; i < count; i++)
+    {
+        T cx = centre(gen);
+        T cy = centre(gen);
+        T cz = centre(gen);
+        tris.emplace_back(
+            hubert::Point3<T>(cx + offset(gen), cy + offset(gen), cz + offset(gen)),
+            hubert::Point3<T>(cx + offset(gen), cy + offset(gen), cz + offset(gen)),
+            hubert::Point3<T>(cx + offset(gen), cy + offset(gen), cz + offset(gen)));
+    }
+    return tris;
+}
+
+template<typename T>
+std::vector<hubert::Ray3<T>> makeRandomRays(size_t count, uint32_t seed, T extent = T(12.0))
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<T> base(-extent, extent);
+    std::uniform_real_distribution<T> dir(T(-1.0), T(1.0));
+
+    std::vector<hubert::Ray3<T>> rays;
+    for (size_t i = 0; i < count; i++)
+    {
+        hubert::Point3<T> p(base(gen), base(gen), base(gen));
+        // aim roughly at the middle of the scene so that most rays hit something
+        hubert::Point3<T> target(dir(gen), dir(gen), dir(gen));
+        rays.push_back(hubert::makeRay3(p, target));
+    }
+    return rays;
+}
+
 // We use the Catch2 open source framework for unit tests. This initializes it.
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
 #include "catch_amalgamated.hpp"
@@ -470,6 +525,60 @@ TEMPLATE_TEST_CASE("Subnormal  check on primitive types", "[validity]", float, d
     }
 }
 
+TEMPLATE_TEST_CASE("Normal or zero check on primitive types", "[validity]", float, double)
+{
+    std::vector<TestType> all = gSetup.getValid<TestType>();
+    all.insert(all.end(), gSetup.getInvalid<TestType>().begin(), gSetup.getInvalid<TestType>().end());
+    for (auto x : all)
+    {
+        for (auto y : all)
+        {
+            bool expected = hubert::isValid(x) && hubert::isValid(y) && !hubert::isSubnormal(x) && !hubert::isSubnormal(y);
+            CHECK(hubert::areNormalOrZero(x, y, TestType(1.0)) == expected);
+            CHECK(hubert::areNormalOrZero(TestType(0.0), x, y) == expected);
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("Arithmetic results have the same flags as constructed entities", "[validity]", float, double)
+{
+    // the differences and products of the extremes overflow, underflow to
+    // subnormals, or stay normal
+    std::vector<TestType> values = gSetup.getValid<TestType>();
+    values.push_back(std::numeric_limits<TestType>::min() * TestType(1.5));
+    for (auto a : values)
+    {
+        for (auto b : values)
+        {
+            hubert::Point3<TestType> p1(a, b, TestType(1.0));
+            hubert::Point3<TestType> p2(b, TestType(-1.0), a);
+            hubert::Vector3<TestType> v1(a, b, TestType(1.0));
+            hubert::Vector3<TestType> v2(b, TestType(-1.0), a);
+
+            hubert::Vector3<TestType> d = p1 - p2;
+            hubert::Vector3<TestType> dRef(a - b, b + TestType(1.0), TestType(1.0) - a);
+            CHECK(d.amValid() == dRef.amValid());
+            CHECK(d.amSubnormal() == dRef.amSubnormal());
+            CHECK(d.magnitude() == dRef.magnitude());
+
+            hubert::Point3<TestType> p = p1 + v2;
+            hubert::Point3<TestType> pRef(a + b, b - TestType(1.0), TestType(1.0) + a);
+            CHECK(p.amValid() == pRef.amValid());
+            CHECK(p.amSubnormal() == pRef.amSubnormal());
+
+            hubert::Vector3<TestType> c = hubert::crossProduct(v1, v2);
+            hubert::Vector3<TestType> cRef(b * a - TestType(1.0) * TestType(-1.0), TestType(1.0) * b - a * a, a * TestType(-1.0) - b * b);
+            CHECK(c.amValid() == cRef.amValid());
+            CHECK(c.amSubnormal() == cRef.amSubnormal());
+
+            hubert::Vector3<TestType> m = hubert::multiply(v1, b);
+            hubert::Vector3<TestType> mRef(a * b, b * b, TestType(1.0) * b);
+            CHECK(m.amValid() == mRef.amValid());
+            CHECK(m.amSubnormal() == mRef.amSubnormal());
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Point3 construction tests 
 ///////////////////////////////////////////////////////////////////////////
@@ -537,6 +646,19 @@ TEMPLATE_TEST_CASE("Construct Point3 with initializer", "[Point3]", float, doubl
     CHECK_FALSE(isDegenerate(p2));
 }
 
+TEMPLATE_TEST_CASE("Construct Point3 with trusted data", "[Point3]", float, double)
+{
+    hubert::Point3<TestType> p2(hubert::trusted, TestType(1.1), TestType(2.1), TestType(3.1));
+
+    CHECK(p2.x() == TestType(1.1));
+    CHECK(p2.y() == TestType(2.1));
+    CHECK(p2.z() == TestType(3.1));
+
+    CHECK(isValid(p2));
+    CHECK_FALSE(isDegenerate(p2));
+    CHECK_FALSE(isSubnormal(p2));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Point3 validity 
 ///////////////////////////////////////////////////////////////////////////
@@ -681,6 +803,21 @@ TEMPLATE_TEST_CASE("Construct Vector3 with initializer", "[Vector3]", float, dou
     CHECK_FALSE(isDegenerate(p2));
 }
 
+TEMPLATE_TEST_CASE("Construct Vector3 with trusted data", "[Vector3]", float, double)
+{
+    hubert::Vector3<TestType> p1(TestType(1.1), TestType(2.1), TestType(3.1));
+    hubert::Vector3<TestType> p2(hubert::trusted, TestType(1.1), TestType(2.1), TestType(3.1));
+
+    CHECK(p2.x() == TestType(1.1));
+    CHECK(p2.y() == TestType(2.1));
+    CHECK(p2.z() == TestType(3.1));
+    CHECK(p2.magnitude() == p1.magnitude());
+
+    CHECK(p2.amValid());
+    CHECK_FALSE(p2.amDegenerate());
+    CHECK_FALSE(p2.amSubnormal());
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Vector3 validity 
 ///////////////////////////////////////////////////////////////////////////
@@ -743,6 +880,18 @@ TEMPLATE_TEST_CASE("Check Vector3 validity routines", "[Vector3]", float, double
 
 // there are currently no non-validity related degeneracy cases for Vector3
 
+///////////////////////////////////////////////////////////////////////////
+// Vector3 size
+///////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Check Vector3 size", "[Vector3]", float, double)
+{
+    // the flags word and the three components, nothing else
+    CHECK(sizeof(hubert::Vector3<TestType>) == ((sizeof(TestType) == 4) ? 16 : 32));
+    CHECK(sizeof(hubert::UnitVector3<TestType>) == sizeof(hubert::Vector3<TestType>));
+    CHECK(sizeof(hubert::Point3<TestType>) == sizeof(hubert::Vector3<TestType>));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Vector3 magnitude function 
 ///////////////////////////////////////////////////////////////////////////
@@ -803,7 +952,6 @@ TEMPLATE_TEST_CASE("Construct UnitVector3 with constant parameters", "[UnitVecto
     CHECK_FALSE(isDegenerate(p1));
 }
 
-
 TEMPLATE_TEST_CASE("Construct UnitVector3 with copy  constructor", "[UnitVector3]", float, double)
 {
     hubert::UnitVector3<TestType> p1(TestType(1.1), TestType(2.1), TestType(3.1));
@@ -851,6 +999,20 @@ TEMPLATE_TEST_CASE("Construct UnitVector3 with initializer", "[UnitVector3]", fl
     CHECK_FALSE(isDegenerate(p1));
 }
 
+TEMPLATE_TEST_CASE("Construct UnitVector3 with trusted data", "[UnitVector3]", float, double)
+{
+    hubert::UnitVector3<TestType> p1(TestType(1.1), TestType(2.1), TestType(3.1));
+    hubert::UnitVector3<TestType> p2(hubert::trusted, p1.x(), p1.y(), p1.z());
+
+    CHECK(p2.x() == p1.x());
+    CHECK(p2.y() == p1.y());
+    CHECK(p2.z() == p1.z());
+
+    CHECK(isValid(p2));
+    CHECK_FALSE(isDegenerate(p2));
+    CHECK(hubert::dotProduct(p1, p2) == hubert::dotProduct(p1, p1));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // UnitVector3 validity 
 ///////////////////////////////////////////////////////////////////////////
@@ -3209,3 +3371,4080 @@ TEMPLATE_TEST_CASE("multiply(Vector3, Matrix3)", "[transform]", float, double)
     CHECK(hubert::difference(ret.y(), TestType(1.00139)) < tolerance);
     CHECK(hubert::difference(ret.z(), TestType(1.39958)) < tolerance);
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// Aabb3
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Construct Aabb3", "[Aabb3]", float, double)
+{
+    hubert::Point3<TestType> p1(TestType(1.0), TestType(-2.0), TestType(3.0));
+    hubert::Point3<TestType> p2(TestType(-1.0), TestType(2.0), TestType(0.5));
+    hubert::Point3<TestType> p3(TestType(0.0), TestType(4.0), TestType(-3.0));
+
+    SECTION("Empty")
+    {
+        hubert::Aabb3<TestType> box;
+        CHECK(box.amEmpty());
+        CHECK(isValid(box));
+        CHECK(isDegenerate(box));
+
+        box.expand(p1);
+        CHECK_FALSE(box.amEmpty());
+        CHECK_FALSE(isDegenerate(box));
+        CHECK(box.lo().x() == p1.x());
+        CHECK(box.hi().z() == p1.z());
+    }
+
+    SECTION("From corners, segment and triangle")
+    {
+        hubert::Aabb3<TestType> box(p1, p2);
+        CHECK(box.lo().x() == TestType(-1.0));
+        CHECK(box.lo().y() == TestType(-2.0));
+        CHECK(box.lo().z() == TestType(0.5));
+        CHECK(box.hi().x() == TestType(1.0));
+        CHECK(box.hi().y() == TestType(2.0));
+        CHECK(box.hi().z() == TestType(3.0));
+        CHECK_FALSE(isDegenerate(box));
+
+        hubert::Aabb3<TestType> segBox(hubert::Segment3<TestType>(p1, p2));
+        CHECK(segBox.lo().y() == box.lo().y());
+        CHECK(segBox.hi().z() == box.hi().z());
+
+        hubert::Aabb3<TestType> triBox(hubert::Triangle3<TestType>(p1, p2, p3));
+        CHECK(triBox.lo().z() == TestType(-3.0));
+        CHECK(triBox.hi().y() == TestType(4.0));
+        CHECK(triBox.lo().x() == TestType(-1.0));
+
+        hubert::Aabb3<TestType> merged = hubert::merge(box, hubert::Aabb3<TestType>(p3));
+        CHECK(merged.lo().z() == triBox.lo().z());
+        CHECK(merged.hi().y() == triBox.hi().y());
+        CHECK(hubert::merge(hubert::Aabb3<TestType>(), box).hi().x() == box.hi().x());
+
+        // a single point is a box without volume, but not degenerate
+        CHECK_FALSE(isDegenerate(hubert::Aabb3<TestType>(p1)));
+    }
+
+    SECTION("Invalid")
+    {
+        hubert::Aabb3<TestType> box(p1, hubert::invalidPoint3<TestType>());
+        CHECK_FALSE(isValid(box));
+        CHECK(isDegenerate(box));
+
+        hubert::Aabb3<TestType> grown(p1);
+        grown.expand(hubert::invalidPoint3<TestType>());
+        CHECK_FALSE(isValid(grown));
+        grown.expand(p2);
+        CHECK_FALSE(isValid(grown));
+
+        CHECK_FALSE(isValid(hubert::invalidAabb3<TestType>()));
+        CHECK_FALSE(isValid(hubert::merge(hubert::Aabb3<TestType>(p1), hubert::invalidAabb3<TestType>())));
+        CHECK(hubert::isSubnormal(hubert::Aabb3<TestType>(p1, hubert::Point3<TestType>(std::numeric_limits<TestType>::min() / TestType(2.0), TestType(0.0), TestType(0.0)))));
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(Aabb3, Ray3)", "[Aabb3]", float, double)
+{
+    hubert::Aabb3<TestType> box(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(1.0), TestType(2.0), TestType(3.0)));
+    TestType tNear, tFar;
+
+    SECTION("Through")
+    {
+        hubert::Ray3<TestType> theRay(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(-2.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, theRay, tNear, tFar) == hubert::ResultCode::eOk);
+        CHECK(tNear == TestType(2.0));
+        CHECK(tFar == TestType(5.0));
+        CHECK(hubert::intersect(theRay, box) == hubert::ResultCode::eOk);
+    }
+
+    SECTION("From inside")
+    {
+        hubert::Ray3<TestType> theRay(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(-1.0), TestType(0.0)));
+        CHECK(hubert::intersect(box, theRay, tNear, tFar) == hubert::ResultCode::eOk);
+        CHECK(tNear == TestType(0.0));
+        CHECK(tFar == TestType(0.5));
+    }
+
+    SECTION("Pointing away and missing")
+    {
+        hubert::Ray3<TestType> away(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(-2.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(-1.0)));
+        CHECK(hubert::intersect(box, away, tNear, tFar) == hubert::ResultCode::eNoIntersection);
+        CHECK(tNear == hubert::infinity<TestType>());
+
+        hubert::Ray3<TestType> miss(hubert::Point3<TestType>(TestType(1.5), TestType(0.5), TestType(-2.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, miss) == hubert::ResultCode::eNoIntersection);
+
+        hubert::Ray3<TestType> diagonal(hubert::Point3<TestType>(TestType(3.0), TestType(0.0), TestType(0.0)), hubert::UnitVector3<TestType>(TestType(-1.0), TestType(-1.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, diagonal) == hubert::ResultCode::eNoIntersection);
+    }
+
+    SECTION("Along a face and through an edge")
+    {
+        // the origin lies exactly on the slab of the zero direction component
+        hubert::Ray3<TestType> onFace(hubert::Point3<TestType>(TestType(1.0), TestType(0.5), TestType(-2.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, onFace) == hubert::ResultCode::eOk);
+        hubert::Ray3<TestType> onLowFace(hubert::Point3<TestType>(TestType(0.0), TestType(0.5), TestType(-2.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, onLowFace) == hubert::ResultCode::eOk);
+
+        hubert::Ray3<TestType> edge(hubert::Point3<TestType>(TestType(0.0), TestType(0.5), TestType(-1.0)), hubert::UnitVector3<TestType>(TestType(1.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, edge, tNear, tFar) == hubert::ResultCode::eOk);
+        CHECK(hubert::isEqual(tNear, tFar));
+    }
+
+    SECTION("Degenerate")
+    {
+        hubert::Ray3<TestType> theRay;
+        CHECK(hubert::intersect(hubert::Aabb3<TestType>(), theRay) == hubert::ResultCode::eDegenerate);
+        CHECK(hubert::intersect(box, hubert::Ray3<TestType>(hubert::Point3<TestType>(), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)))) == hubert::ResultCode::eDegenerate);
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(Aabb3, Aabb3/Plane)", "[Aabb3]", float, double)
+{
+    hubert::Aabb3<TestType> box(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+
+    SECTION("Box")
+    {
+        hubert::Aabb3<TestType> overlap(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(0.5)), hubert::Point3<TestType>(TestType(2.0), TestType(2.0), TestType(2.0)));
+        hubert::Aabb3<TestType> touch(hubert::Point3<TestType>(TestType(1.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0)));
+        hubert::Aabb3<TestType> apart(hubert::Point3<TestType>(TestType(1.1), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, overlap) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(box, touch) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(box, apart) == hubert::ResultCode::eNoIntersection);
+        CHECK(hubert::intersect(box, hubert::Aabb3<TestType>()) == hubert::ResultCode::eDegenerate);
+    }
+
+    SECTION("Plane")
+    {
+        hubert::Plane<TestType> through(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(0.5)), hubert::UnitVector3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+        hubert::Plane<TestType> corner(hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+        hubert::Plane<TestType> apart(hubert::Point3<TestType>(TestType(1.1), TestType(1.1), TestType(1.1)), hubert::UnitVector3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+        hubert::Plane<TestType> face(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, through) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(corner, box) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(box, apart) == hubert::ResultCode::eNoIntersection);
+        CHECK(hubert::intersect(box, face) == hubert::ResultCode::eOk);
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(Aabb3, Triangle3)", "[Aabb3]", float, double)
+{
+    hubert::Aabb3<TestType> box(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+
+    SECTION("Simple cases")
+    {
+        // inside
+        hubert::Triangle3<TestType> inside(hubert::Point3<TestType>(TestType(0.2), TestType(0.2), TestType(0.5)), hubert::Point3<TestType>(TestType(0.8), TestType(0.2), TestType(0.5)), hubert::Point3<TestType>(TestType(0.5), TestType(0.8), TestType(0.5)));
+        CHECK(hubert::intersect(box, inside) == hubert::ResultCode::eOk);
+
+        // large triangle slicing through with all vertices outside
+        hubert::Triangle3<TestType> slice(hubert::Point3<TestType>(TestType(-10.0), TestType(-10.0), TestType(0.5)), hubert::Point3<TestType>(TestType(10.0), TestType(-10.0), TestType(0.5)), hubert::Point3<TestType>(TestType(0.0), TestType(10.0), TestType(0.5)));
+        CHECK(hubert::intersect(slice, box) == hubert::ResultCode::eOk);
+
+        // near a corner, only separated by an edge cross product axis
+        hubert::Triangle3<TestType> corner(hubert::Point3<TestType>(TestType(1.6), TestType(0.5), TestType(-1.0)), hubert::Point3<TestType>(TestType(0.5), TestType(1.6), TestType(-1.0)), hubert::Point3<TestType>(TestType(1.05), TestType(1.05), TestType(3.0)));
+        CHECK(hubert::intersect(box, corner) == hubert::ResultCode::eNoIntersection);
+
+        // coplanar with a face
+        hubert::Triangle3<TestType> onFace(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(1.0)), hubert::Point3<TestType>(TestType(3.0), TestType(0.5), TestType(1.0)), hubert::Point3<TestType>(TestType(0.5), TestType(3.0), TestType(1.0)));
+        CHECK(hubert::intersect(box, onFace) == hubert::ResultCode::eOk);
+
+        hubert::Triangle3<TestType> degenerate(hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(0.5)), hubert::Point3<TestType>(TestType(0.5), TestType(0.5), TestType(0.5)), hubert::Point3<TestType>(TestType(0.6), TestType(0.5), TestType(0.5)));
+        CHECK(hubert::intersect(box, degenerate) == hubert::ResultCode::eDegenerate);
+    }
+
+    SECTION("Random triangles")
+    {
+        // a vertex inside the box means overlap, boxes apart mean no overlap,
+        // and an edge through the box means overlap
+        std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(2000, 11, TestType(2.0), TestType(1.5));
+        hubert::Aabb3<TestType> centered(hubert::Point3<TestType>(TestType(-1.0), TestType(-1.0), TestType(-1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)));
+        for (auto & tri : tris)
+        {
+            if (hubert::isDegenerate(tri))
+            {
+                continue;
+            }
+
+            hubert::ResultCode rc = hubert::intersect(centered, tri);
+            auto inside = [&](const hubert::Point3<TestType> & p) {
+                return std::abs(p.x()) <= TestType(1.0) && std::abs(p.y()) <= TestType(1.0) && std::abs(p.z()) <= TestType(1.0);
+            };
+            if (inside(tri.p1()) || inside(tri.p2()) || inside(tri.p3()))
+            {
+                CHECK(rc == hubert::ResultCode::eOk);
+            }
+            if (hubert::intersect(centered, hubert::Aabb3<TestType>(tri)) == hubert::ResultCode::eNoIntersection)
+            {
+                CHECK(rc == hubert::ResultCode::eNoIntersection);
+            }
+            for (auto & edge : { hubert::Segment3<TestType>(tri.p1(), tri.p2()), hubert::Segment3<TestType>(tri.p2(), tri.p3()) })
+            {
+                hubert::Ray3<TestType> theRay(edge.base(), hubert::makeUnitVector3(edge.target() - edge.base()));
+                TestType tNear, tFar;
+                if (hubert::intersect(centered, theRay, tNear, tFar) == hubert::ResultCode::eOk && tNear < hubert::distance(edge.base(), edge.target()) * TestType(0.999))
+                {
+                    CHECK(rc == hubert::ResultCode::eOk);
+                }
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Packed storage types
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Convert packed storage types", "[Packed]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(50, 7);
+    tris.emplace_back(hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0)));
+
+    std::vector<hubert::PackedTriangle3<TestType>> packed;
+    for (auto & tri : tris)
+    {
+        packed.push_back(hubert::makePackedTriangle3(tri));
+    }
+    CHECK(packed[0].p2.y == tris[0].p2().y());
+
+    // memcpy-able, as if read from a file
+    std::vector<hubert::PackedTriangle3<TestType>> copy(packed.size());
+    std::memcpy(copy.data(), packed.data(), packed.size() * sizeof(hubert::PackedTriangle3<TestType>));
+
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        hubert::Triangle3<TestType> tri = hubert::makeTriangle3(copy[i]);
+        CHECK(tri.p1().x() == tris[i].p1().x());
+        CHECK(tri.p2().y() == tris[i].p2().y());
+        CHECK(tri.p3().z() == tris[i].p3().z());
+        CHECK(isDegenerate(tri) == isDegenerate(tris[i]));
+
+        hubert::AlignedPoint3<TestType> a = hubert::makeAlignedPoint3(tris[i].p1());
+        CHECK(reinterpret_cast<uintptr_t>(&a) % 16 == 0);
+        hubert::Point3<TestType> p = hubert::makePoint3(a);
+        CHECK(p.x() == tris[i].p1().x());
+        CHECK(p.y() == tris[i].p1().y());
+        CHECK(p.z() == tris[i].p1().z());
+    }
+
+    // validity is found on conversion
+    hubert::PackedPoint3<TestType> bad{ TestType(1.0), hubert::infinity<TestType>(), TestType(1.0) };
+    CHECK_FALSE(isValid(hubert::makePoint3(bad)));
+
+    hubert::TriangleSoup<TestType> theSoup(copy.begin(), copy.end());
+    REQUIRE(theSoup.size() == tris.size());
+    CHECK(theSoup.amDegenerate(tris.size() - 1));
+    CHECK_FALSE(theSoup.amDegenerate(0));
+    CHECK(theSoup.x(1)[3] == tris[3].p2().x());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Triangle soup
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Construct TriangleSoup", "[TriangleSoup]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(100, 1);
+    // a collapsed edge makes the last one degenerate
+    tris.emplace_back(
+        hubert::Point3<TestType>(TestType(1.1), TestType(2.1), TestType(3.1)),
+        hubert::Point3<TestType>(TestType(1.1), TestType(2.1), TestType(3.1)),
+        hubert::Point3<TestType>(TestType(-8.3), TestType(-13.2), TestType(17.8)));
+
+    hubert::TriangleSoup<TestType> theSoup(tris.begin(), tris.end());
+
+    REQUIRE(theSoup.size() == tris.size());
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        CHECK(theSoup.x(0)[i] == tris[i].p1().x());
+        CHECK(theSoup.y(1)[i] == tris[i].p2().y());
+        CHECK(theSoup.z(2)[i] == tris[i].p3().z());
+        CHECK(theSoup.amDegenerate(i) == hubert::isDegenerate(tris[i]));
+
+        hubert::Triangle3<TestType> rebuilt = theSoup.triangle(i);
+        CHECK(rebuilt.p2().x() == tris[i].p2().x());
+        CHECK(hubert::isDegenerate(rebuilt) == hubert::isDegenerate(tris[i]));
+    }
+    CHECK(theSoup.amDegenerate(tris.size() - 1));
+
+    theSoup.clear();
+    CHECK(theSoup.empty());
+}
+
+TEMPLATE_TEST_CASE("intersect(TriangleSoup, Ray3)", "[TriangleSoup]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(300, 2);
+    std::vector<hubert::Ray3<TestType>> rays = makeRandomRays<TestType>(200, 3);
+    hubert::TriangleSoup<TestType> theSoup(tris.begin(), tris.end());
+
+    size_t hits = 0;
+    for (auto & theRay : rays)
+    {
+        // brute force with the pairwise routine
+        size_t expectedIndex = hubert::invalidIndex();
+        TestType expectedDistance = hubert::infinity<TestType>();
+        hubert::Point3<TestType> expectedPoint;
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            hubert::Point3<TestType> intPoint;
+            if (hubert::intersect(tris[i], theRay, intPoint) == hubert::ResultCode::eOk)
+            {
+                TestType dist = hubert::distance(theRay.base(), intPoint);
+                if (dist < expectedDistance)
+                {
+                    expectedDistance = dist;
+                    expectedIndex = i;
+                    expectedPoint = intPoint;
+                }
+            }
+        }
+
+        size_t hitIndex;
+        TestType t;
+        hubert::ResultCode ret = hubert::intersect(theSoup, theRay, hitIndex, t);
+
+        CHECK(hitIndex == expectedIndex);
+        if (expectedIndex == hubert::invalidIndex())
+        {
+            CHECK(ret == hubert::ResultCode::eNoIntersection);
+        }
+        else
+        {
+            hits++;
+            CHECK(ret == hubert::ResultCode::eOk);
+            hubert::Point3<TestType> intPoint = theRay.base() + hubert::multiply(theRay.unitDirection(), t);
+            CHECK(intPoint.x() == expectedPoint.x());
+            CHECK(intPoint.y() == expectedPoint.y());
+            CHECK(intPoint.z() == expectedPoint.z());
+        }
+    }
+    CHECK(hits > 0);
+
+    SECTION("Degenerate ray")
+    {
+        hubert::Ray3<TestType> theRay(hubert::Point3<TestType>(), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)));
+        size_t hitIndex;
+        TestType t;
+        CHECK(hubert::intersect(theSoup, theRay, hitIndex, t) == hubert::ResultCode::eDegenerate);
+        CHECK(hitIndex == hubert::invalidIndex());
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SIMD kernels
+/////////////////////////////////////////////////////////////////////////////
+
+// every instruction set this machine can run, so that each kernel gets checked
+// against the pairwise routine
+static std::vector<hubert::SimdLevel> availableSimdLevels()
+{
+    std::vector<hubert::SimdLevel> levels{ hubert::SimdLevel::eScalar };
+    switch (hubert::simdLevel())
+    {
+    case hubert::SimdLevel::eAvx512:
+        levels.push_back(hubert::SimdLevel::eAvx2);
+        levels.push_back(hubert::SimdLevel::eAvx512);
+        break;
+    case hubert::SimdLevel::eAvx2:
+    case hubert::SimdLevel::eNeon:
+        levels.push_back(hubert::simdLevel());
+        break;
+    default:
+        break;
+    }
+    return levels;
+}
+
+template<typename T>
+static void checkPacketLane(const hubert::PacketResult<T> & packet, uint32_t lane, const hubert::Triangle3<T> & theTri, const hubert::Ray3<T> & theRay)
+{
+    hubert::Point3<T> intPoint;
+    hubert::ResultCode ret = hubert::intersect(theTri, theRay, intPoint);
+    uint32_t bit = uint32_t(1) << lane;
+
+    CHECK(bool(packet.ok & bit) == (ret == hubert::ResultCode::eOk));
+    CHECK(bool(packet.coplanar & bit) == (ret == hubert::ResultCode::eCoplanar));
+    CHECK(bool(packet.degenerate & bit) == (ret == hubert::ResultCode::eDegenerate));
+    CHECK(bool(packet.noIntersection & bit) == (ret == hubert::ResultCode::eNoIntersection));
+    if (ret == hubert::ResultCode::eOk)
+    {
+        hubert::Point3<T> p = theRay.base() + hubert::multiply(theRay.unitDirection(), packet.t[lane]);
+        CHECK(p.x() == intPoint.x());
+        CHECK(p.y() == intPoint.y());
+        CHECK(p.z() == intPoint.z());
+    }
+}
+
+template<typename T>
+static std::vector<hubert::Triangle3<T>> makePacketTestTriangles()
+{
+    std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(200, 4);
+
+    // the rays of the tests run along z, so these are coplanar with some of them
+    tris.emplace_back(hubert::Point3<T>(T(0.0), T(0.0), T(-1.0)), hubert::Point3<T>(T(0.0), T(0.0), T(1.0)), hubert::Point3<T>(T(1.0), T(0.0), T(0.0)));
+    tris.emplace_back(hubert::Point3<T>(T(0.0), T(0.0), T(-1.0)), hubert::Point3<T>(T(0.0), T(1.0), T(1.0)), hubert::Point3<T>(T(0.0), T(1.0), T(0.0)));
+    // the rays hit these exactly on an edge or a vertex
+    tris.emplace_back(hubert::Point3<T>(T(0.0), T(0.0), T(3.0)), hubert::Point3<T>(T(1.0), T(0.0), T(3.0)), hubert::Point3<T>(T(0.0), T(1.0), T(3.0)));
+    tris.emplace_back(hubert::Point3<T>(T(0.5), T(0.5), T(4.0)), hubert::Point3<T>(T(1.0), T(0.0), T(4.0)), hubert::Point3<T>(T(1.0), T(1.0), T(4.0)));
+    // degenerate
+    tris.emplace_back(hubert::Point3<T>(T(1.1), T(2.1), T(3.1)), hubert::Point3<T>(T(1.1), T(2.1), T(3.1)), hubert::Point3<T>(T(0.0), T(1.0), T(3.0)));
+    // behind the rays
+    tris.emplace_back(hubert::Point3<T>(T(-1.0), T(-1.0), T(-9.0)), hubert::Point3<T>(T(2.0), T(-1.0), T(-9.0)), hubert::Point3<T>(T(-1.0), T(2.0), T(-9.0)));
+    return tris;
+}
+
+template<typename T>
+static std::vector<hubert::Ray3<T>> makePacketTestRays()
+{
+    std::vector<hubert::Ray3<T>> rays = makeRandomRays<T>(100, 5);
+    hubert::UnitVector3<T> up(T(0.0), T(0.0), T(1.0));
+    rays.emplace_back(hubert::Point3<T>(T(0.0), T(0.0), T(-5.0)), up);
+    rays.emplace_back(hubert::Point3<T>(T(0.5), T(0.5), T(-5.0)), up);
+    rays.emplace_back(hubert::Point3<T>(T(1.0), T(0.0), T(-5.0)), up);
+    rays.emplace_back(hubert::Point3<T>(T(0.25), T(0.0), T(-5.0)), up);
+    rays.emplace_back(hubert::Point3<T>(T(1.1), T(0.5), T(-5.0)), up);
+    rays.emplace_back(hubert::Point3<T>(T(0.0), T(0.0), T(0.0)), hubert::UnitVector3<T>(T(0.0), T(0.0), T(0.0)));
+    return rays;
+}
+
+TEMPLATE_TEST_CASE("intersectPacket(TriangleSoup, Ray3)", "[simd]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+    hubert::TriangleSoup<TestType> theSoup(tris.begin(), tris.end());
+
+    for (auto level : availableSimdLevels())
+    {
+        for (auto & theRay : rays)
+        {
+            // odd packet sizes exercise the partial loads
+            for (size_t count : { size_t(16), size_t(13), size_t(3) })
+            {
+                for (size_t first = 0; first < tris.size(); first += count)
+                {
+                    hubert::PacketResult<TestType> packet;
+                    hubert::intersectPacket(theSoup, first, count, theRay, packet, level);
+
+                    uint32_t expected = 0;
+                    for (uint32_t lane = 0; lane < count && first + lane < tris.size(); lane++)
+                    {
+                        checkPacketLane(packet, lane, tris[first + lane], theRay);
+                        expected |= uint32_t(1) << lane;
+                    }
+                    CHECK((packet.ok | packet.coplanar | packet.noIntersection | packet.degenerate) == expected);
+                }
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("intersectPacket(Triangle3, Ray3 packet)", "[simd]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+
+    for (auto level : availableSimdLevels())
+    {
+        for (auto & theTri : tris)
+        {
+            for (size_t first = 0; first < rays.size(); first += 16)
+            {
+                size_t count = std::min(size_t(16), rays.size() - first);
+                hubert::PacketResult<TestType> packet;
+                hubert::intersectPacket(theTri, rays.data() + first, count, packet, level);
+
+                for (uint32_t lane = 0; lane < count; lane++)
+                {
+                    checkPacketLane(packet, lane, theTri, rays[first + lane]);
+                }
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(TriangleSoup, Ray3) for each instruction set", "[simd]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+    hubert::TriangleSoup<TestType> theSoup(tris.begin(), tris.end());
+
+    for (auto & theRay : rays)
+    {
+        size_t scalarIndex;
+        TestType scalarT;
+        hubert::ResultCode scalarRet = hubert::intersect(theSoup, theRay, scalarIndex, scalarT, hubert::SimdLevel::eScalar);
+
+        for (auto level : availableSimdLevels())
+        {
+            size_t hitIndex;
+            TestType t;
+            CHECK(hubert::intersect(theSoup, theRay, hitIndex, t, level) == scalarRet);
+            CHECK(hitIndex == scalarIndex);
+            if (scalarRet == hubert::ResultCode::eOk)
+            {
+                CHECK(t == scalarT);
+            }
+        }
+    }
+}
+
+TEST_CASE("intersect(mixedPrecision, TriangleSoup, Ray3)", "[simd]")
+{
+    // random triangles, and a bumpy grid whose shared edges and vertices
+    // the rays below are aimed at, where float alone gets it wrong
+    std::vector<hubert::Triangle3<float>> tris = makePacketTestTriangles<float>();
+    const int cells = 12;
+    auto gridPoint = [](int i, int j) { return hubert::Point3<float>(0.1f * float(i), 0.1f * float(j), 20.0f + 0.01f * float((i * 7 + j * 3) % 5)); };
+    for (int i = 0; i < cells; i++)
+    {
+        for (int j = 0; j < cells; j++)
+        {
+            tris.emplace_back(gridPoint(i, j), gridPoint(i + 1, j), gridPoint(i + 1, j + 1));
+            tris.emplace_back(gridPoint(i, j), gridPoint(i + 1, j + 1), gridPoint(i, j + 1));
+        }
+    }
+
+    hubert::TriangleSoup<float> floatSoup(tris.begin(), tris.end());
+    hubert::TriangleSoup<double> doubleSoup;
+    for (auto & tri : tris)
+    {
+        auto promote = [](const hubert::Point3<float> & p) { return hubert::Point3<double>(p.x(), p.y(), p.z()); };
+        doubleSoup.push_back(hubert::Triangle3<double>(promote(tri.p1()), promote(tri.p2()), promote(tri.p3())));
+    }
+
+    std::vector<hubert::Ray3<double>> rays = makePacketTestRays<double>();
+    std::vector<hubert::Ray3<double>> random = makeRandomRays<double>(200, 29);
+    rays.insert(rays.end(), random.begin(), random.end());
+    hubert::UnitVector3<double> down(0.0, 0.0, -1.0);
+    hubert::UnitVector3<double> slanted(0.3, -0.2, -0.9);
+    for (int i = 1; i < cells; i++)
+    {
+        for (int j = 1; j < cells; j++)
+        {
+            // a grid vertex, the middle of a diagonal and the middle of an
+            // axis parallel edge, from straight above and at a slant
+            const hubert::Point3<float> v = gridPoint(i, j);
+            const hubert::Point3<float> d = gridPoint(i + 1, j + 1);
+            const hubert::Point3<float> e = gridPoint(i, j + 1);
+            const double targets[3][3] = {
+                { v.x(), v.y(), v.z() },
+                { (double(v.x()) + d.x()) / 2, (double(v.y()) + d.y()) / 2, (double(v.z()) + d.z()) / 2 },
+                { (double(v.x()) + e.x()) / 2, (double(v.y()) + e.y()) / 2, (double(v.z()) + e.z()) / 2 } };
+            for (auto & p : targets)
+            {
+                rays.emplace_back(hubert::Point3<double>(p[0], p[1], p[2] + 5.0), down);
+                rays.emplace_back(hubert::Point3<double>(p[0] - 0.3 * 5.0, p[1] + 0.2 * 5.0, p[2] + 0.9 * 5.0), slanted);
+            }
+        }
+    }
+
+    size_t hits = 0;
+    for (auto & theRay : rays)
+    {
+        size_t expectedIndex;
+        double expectedT;
+        hubert::ResultCode expected = hubert::intersect(doubleSoup, theRay, expectedIndex, expectedT);
+        hits += (expected == hubert::ResultCode::eOk) ? 1 : 0;
+
+        for (auto level : availableSimdLevels())
+        {
+            size_t hitIndex;
+            double t;
+            CHECK(hubert::intersect(hubert::mixedPrecision, floatSoup, theRay, hitIndex, t, level) == expected);
+            CHECK(hitIndex == expectedIndex);
+            if (expected == hubert::ResultCode::eOk)
+            {
+                CHECK(t == expectedT);
+            }
+        }
+    }
+    CHECK(hits > 3 * (cells - 1) * (cells - 1));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchy
+/////////////////////////////////////////////////////////////////////////////
+
+// closest hit by testing every triangle, for checking the Bvh queries against
+template<typename T, typename Query>
+static size_t bruteForceClosest(const std::vector<hubert::Triangle3<T>> & tris, const Query & theQuery, const hubert::Point3<T> & base, T & bestDistance)
+{
+    size_t best = hubert::invalidIndex();
+    bestDistance = hubert::infinity<T>();
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        hubert::Point3<T> intPoint;
+        if (hubert::intersect(tris[i], theQuery, intPoint) == hubert::ResultCode::eOk)
+        {
+            T dist = hubert::distance(base, intPoint);
+            if (dist < bestDistance)
+            {
+                best = i;
+                bestDistance = dist;
+            }
+        }
+    }
+    return best;
+}
+
+template<typename T, typename Query>
+static void checkBvhQuery(const hubert::Bvh<T> & theBvh, const std::vector<hubert::Triangle3<T>> & tris, const Query & theQuery, const hubert::Point3<T> & base)
+{
+    T bestDistance;
+    size_t expected = bruteForceClosest(tris, theQuery, base, bestDistance);
+
+    size_t triIndex;
+    hubert::Point3<T> intPoint;
+    hubert::ResultCode rc = hubert::intersect(theBvh, theQuery, triIndex, intPoint);
+    if (expected == hubert::invalidIndex())
+    {
+        CHECK(rc == hubert::ResultCode::eNoIntersection);
+        CHECK(triIndex == hubert::invalidIndex());
+        CHECK(!hubert::isValid(intPoint));
+    }
+    else
+    {
+        // ties may resolve to a different triangle, but never to a farther hit
+        REQUIRE(rc == hubert::ResultCode::eOk);
+        CHECK(hubert::distance(base, intPoint) == bestDistance);
+        hubert::Point3<T> check;
+        CHECK(hubert::intersect(tris[triIndex], theQuery, check) == hubert::ResultCode::eOk);
+        CHECK(check.x() == intPoint.x());
+        CHECK(check.y() == intPoint.y());
+        CHECK(check.z() == intPoint.z());
+    }
+
+    rc = hubert::intersectAny(theBvh, theQuery, triIndex, intPoint);
+    CHECK((rc == hubert::ResultCode::eOk) == (expected != hubert::invalidIndex()));
+    if (rc == hubert::ResultCode::eOk)
+    {
+        CHECK(triIndex < tris.size());
+    }
+}
+
+TEMPLATE_TEST_CASE("Construct Bvh", "[Bvh]", float, double)
+{
+    hubert::Bvh<TestType> empty;
+    CHECK(empty.nodes().empty());
+    CHECK(empty.triangles().empty());
+
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    hubert::Bvh<TestType> theBvh(tris.begin(), tris.end());
+
+    // the degenerate triangle is left out, every other one is in exactly one leaf
+    REQUIRE(theBvh.triangles().size() == tris.size() - 1);
+    CHECK(reinterpret_cast<uintptr_t>(theBvh.nodes().data()) % alignof(hubert::BvhNode<TestType>) == 0);
+
+    std::vector<int> seen(tris.size(), 0);
+    for (auto & node : theBvh.nodes())
+    {
+        if (node.count == 0)
+        {
+            CHECK(node.first + 1 < theBvh.nodes().size());
+            continue;
+        }
+        CHECK(node.count <= 16);
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            size_t orig = theBvh.originalIndex(i);
+            seen[orig]++;
+            CHECK(theBvh.triangles()[i].p1().x() == tris[orig].p1().x());
+            CHECK(theBvh.triangles()[i].p3().z() == tris[orig].p3().z());
+            for (auto p : { tris[orig].p1(), tris[orig].p2(), tris[orig].p3() })
+            {
+                CHECK(p.x() >= node.bmin[0]);
+                CHECK(p.y() >= node.bmin[1]);
+                CHECK(p.z() >= node.bmin[2]);
+                CHECK(p.x() <= node.bmax[0]);
+                CHECK(p.y() <= node.bmax[1]);
+                CHECK(p.z() <= node.bmax[2]);
+            }
+        }
+    }
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        CHECK(seen[i] == (hubert::isDegenerate(tris[i]) ? 0 : 1));
+    }
+
+    // nothing but degenerate triangles
+    std::vector<hubert::Triangle3<TestType>> degenerate(3, hubert::Triangle3<TestType>(hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0))));
+    hubert::Bvh<TestType> degenerateBvh(degenerate.begin(), degenerate.end());
+    CHECK(degenerateBvh.nodes().empty());
+}
+
+TEMPLATE_TEST_CASE("intersect(Bvh, Ray3/Segment3/Line3)", "[Bvh]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    std::vector<hubert::Triangle3<TestType>> more = makeRandomTriangles<TestType>(2000, 6);
+    tris.insert(tris.end(), more.begin(), more.end());
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+
+    for (uint32_t maxLeafSize : { 1u, 4u, 8u })
+    {
+        hubert::Bvh<TestType> theBvh(tris.begin(), tris.end(), maxLeafSize);
+
+        for (auto & theRay : rays)
+        {
+            if (hubert::isDegenerate(theRay))
+            {
+                size_t triIndex;
+                hubert::Point3<TestType> intPoint;
+                CHECK(hubert::intersect(theBvh, theRay, triIndex, intPoint) == hubert::ResultCode::eDegenerate);
+                CHECK(hubert::intersectAny(theBvh, theRay, triIndex, intPoint) == hubert::ResultCode::eDegenerate);
+                CHECK(triIndex == hubert::invalidIndex());
+                continue;
+            }
+
+            checkBvhQuery(theBvh, tris, theRay, theRay.base());
+
+            hubert::Line3<TestType> theLine(theRay.base(), theRay.base() + hubert::multiply(theRay.unitDirection(), TestType(1.0)));
+            checkBvhQuery(theBvh, tris, theLine, theLine.base());
+
+            hubert::Segment3<TestType> theSegment(theRay.base(), theRay.base() + hubert::multiply(theRay.unitDirection(), TestType(12.0)));
+            checkBvhQuery(theBvh, tris, theSegment, theSegment.base());
+        }
+    }
+}
+
+// count triangles in the planes x = 4^i, so that the SAH peels off one at a
+// time and builds a tree about count levels deep. Every box holds the x
+// axis, so a ray along it visits the whole spine, but only triangle hit
+// covers the axis.
+static std::vector<hubert::Triangle3<double>> makeSkewedPlanes(int count, int hit)
+{
+    std::vector<hubert::Triangle3<double>> tris;
+    double x = 1.0;
+    for (int i = 0; i < count; i++, x *= 4.0)
+    {
+        if (i == hit)
+        {
+            tris.emplace_back(hubert::Point3<double>(x, -1.0, -1.0), hubert::Point3<double>(x, 3.0, -1.0), hubert::Point3<double>(x, -1.0, 3.0));
+        }
+        else
+        {
+            // the box holds the x axis but the triangle does not
+            tris.emplace_back(hubert::Point3<double>(x, -0.75, 1.25), hubert::Point3<double>(x, 1.25, 1.25), hubert::Point3<double>(x, 1.25, -0.75));
+        }
+    }
+    return tris;
+}
+
+TEST_CASE("intersect(Bvh, Ray3) in a tree deeper than 64 levels", "[Bvh]")
+{
+    hubert::Ray3<double> theRay(hubert::Point3<double>(0.0, 0.0, 0.0), hubert::UnitVector3<double>(1.0, 0.0, 0.0));
+    for (int hit = 0; hit < 200; hit++)
+    {
+        std::vector<hubert::Triangle3<double>> tris = makeSkewedPlanes(200, hit);
+        hubert::Bvh<double> theBvh(tris.begin(), tris.end(), 1);
+
+        size_t triIndex;
+        hubert::Point3<double> intPoint;
+        REQUIRE(hubert::intersect(theBvh, theRay, triIndex, intPoint) == hubert::ResultCode::eOk);
+        CHECK(triIndex == size_t(hit));
+        CHECK(hubert::intersectAny(theBvh, theRay, triIndex, intPoint) == hubert::ResultCode::eOk);
+        CHECK(triIndex == size_t(hit));
+    }
+}
+
+TEST_CASE("Bvh over float coordinates near the ends of the range", "[Bvh]")
+{
+    // the centroids span more than the largest float, so the extent the
+    // split bins are computed from overflows
+    std::vector<hubert::Triangle3<float>> tris;
+    for (int k = 1; k <= 20; k++)
+    {
+        for (float x : { float(k) * 1e37f, float(k) * -1e37f })
+        {
+            tris.emplace_back(hubert::Point3<float>(x, -1.0f, -1.0f), hubert::Point3<float>(x, 3.0f, -1.0f), hubert::Point3<float>(x, -1.0f, 3.0f));
+        }
+    }
+    hubert::Bvh<float> theBvh(tris.begin(), tris.end(), 1);
+
+    size_t triIndex;
+    hubert::Point3<float> intPoint;
+    REQUIRE(hubert::intersect(theBvh, hubert::Ray3<float>(hubert::Point3<float>(0.0f, 0.0f, 0.0f), hubert::UnitVector3<float>(1.0f, 0.0f, 0.0f)), triIndex, intPoint) == hubert::ResultCode::eOk);
+    CHECK(triIndex == 0);
+    REQUIRE(hubert::intersect(theBvh, hubert::Ray3<float>(hubert::Point3<float>(0.0f, 0.0f, 0.0f), hubert::UnitVector3<float>(-1.0f, 0.0f, 0.0f)), triIndex, intPoint) == hubert::ResultCode::eOk);
+    CHECK(triIndex == 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Batch triangle - triangle intersection
+/////////////////////////////////////////////////////////////////////////////
+
+// a z = 0 grid of n x n quads, two triangles each, all sharing vertices
+template<typename T>
+static std::vector<hubert::Triangle3<T>> makeGridMesh(int n)
+{
+    std::vector<hubert::Triangle3<T>> tris;
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            hubert::Point3<T> p00(T(i), T(j), T(0.0));
+            hubert::Point3<T> p10(T(i + 1), T(j), T(0.0));
+            hubert::Point3<T> p01(T(i), T(j + 1), T(0.0));
+            hubert::Point3<T> p11(T(i + 1), T(j + 1), T(0.0));
+            tris.emplace_back(p00, p10, p11);
+            tris.emplace_back(p00, p11, p01);
+        }
+    }
+    return tris;
+}
+
+TEMPLATE_TEST_CASE("intersectSelf(Triangle3 mesh)", "[TriTriBatch]", float, double)
+{
+    SECTION("Random triangles against brute force")
+    {
+        std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(400, 8);
+        tris.push_back(tris[3]);
+        tris.emplace_back(hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0)));
+
+        for (bool skipNeighbours : { false, true })
+        {
+            std::vector<std::pair<size_t, size_t>> expected;
+            for (size_t i = 0; i < tris.size(); i++)
+            {
+                for (size_t j = i + 1; j < tris.size(); j++)
+                {
+                    if (hubert::isDegenerate(tris[i]) || hubert::isDegenerate(tris[j]) || (skipNeighbours && hubert::shareVertex(tris[i], tris[j])))
+                    {
+                        continue;
+                    }
+                    if (hubert::intersect(tris[i], tris[j]) == hubert::ResultCode::eOk)
+                    {
+                        expected.emplace_back(i, j);
+                    }
+                }
+            }
+            REQUIRE_FALSE(expected.empty());
+
+            for (unsigned threads : { 1u, 3u, 0u })
+            {
+                std::vector<std::pair<size_t, size_t>> pairs;
+                CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs, skipNeighbours, threads) == hubert::ResultCode::eOk);
+                CHECK(pairs == expected);
+            }
+        }
+    }
+
+    SECTION("Neighbours in a mesh")
+    {
+        std::vector<hubert::Triangle3<TestType>> tris = makeGridMesh<TestType>(10);
+        std::vector<std::pair<size_t, size_t>> pairs;
+        CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs) == hubert::ResultCode::eNoIntersection);
+        CHECK(pairs.empty());
+
+        // one triangle poking through the grid
+        tris.emplace_back(hubert::Point3<TestType>(TestType(2.2), TestType(2.3), TestType(-1.0)), hubert::Point3<TestType>(TestType(2.7), TestType(2.3), TestType(-1.0)), hubert::Point3<TestType>(TestType(2.5), TestType(2.6), TestType(1.0)));
+        CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs) == hubert::ResultCode::eOk);
+        REQUIRE_FALSE(pairs.empty());
+        for (auto & p : pairs)
+        {
+            CHECK(p.second == tris.size() - 1);
+        }
+    }
+
+    SECTION("Empty")
+    {
+        std::vector<std::pair<size_t, size_t>> pairs{ { 1, 2 } };
+        CHECK(hubert::intersectSelf<TestType>(nullptr, 0, pairs) == hubert::ResultCode::eNoIntersection);
+        CHECK(pairs.empty());
+    }
+}
+
+TEMPLATE_TEST_CASE("intersectMeshes(Triangle3 mesh, Triangle3 mesh)", "[TriTriBatch]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> meshA = makeRandomTriangles<TestType>(300, 9);
+    std::vector<hubert::Triangle3<TestType>> meshB = makeRandomTriangles<TestType>(200, 10);
+
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (size_t i = 0; i < meshA.size(); i++)
+    {
+        for (size_t j = 0; j < meshB.size(); j++)
+        {
+            if (!hubert::isDegenerate(meshA[i]) && !hubert::isDegenerate(meshB[j]) && hubert::intersect(meshA[i], meshB[j]) == hubert::ResultCode::eOk)
+            {
+                expected.emplace_back(i, j);
+            }
+        }
+    }
+    REQUIRE_FALSE(expected.empty());
+
+    for (unsigned threads : { 1u, 4u })
+    {
+        std::vector<std::pair<size_t, size_t>> pairs;
+        CHECK(hubert::intersectMeshes(meshA.data(), meshA.size(), meshB.data(), meshB.size(), pairs, threads) == hubert::ResultCode::eOk);
+        CHECK(pairs == expected);
+    }
+
+    // a mesh far away from the others
+    std::vector<hubert::Triangle3<TestType>> grid = makeGridMesh<TestType>(4);
+    for (auto & tri : grid)
+    {
+        hubert::Vector3<TestType> offset(TestType(100.0), TestType(0.0), TestType(0.0));
+        tri = hubert::Triangle3<TestType>(tri.p1() + offset, tri.p2() + offset, tri.p3() + offset);
+    }
+    std::vector<std::pair<size_t, size_t>> pairs;
+    CHECK(hubert::intersectMeshes(meshA.data(), meshA.size(), grid.data(), grid.size(), pairs) == hubert::ResultCode::eNoIntersection);
+    CHECK(pairs.empty());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PreparedRay3
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Construct PreparedRay3", "[PreparedRay3]", float, double)
+{
+    hubert::Ray3<TestType> theRay(hubert::Point3<TestType>(TestType(1.0), TestType(2.0), TestType(3.0)), hubert::UnitVector3<TestType>(TestType(0.5), TestType(-2.0), TestType(1.0)));
+    hubert::PreparedRay3<TestType> prepared(theRay);
+
+    CHECK(isValid(prepared));
+    CHECK_FALSE(isDegenerate(prepared));
+    CHECK(prepared.origin()[1] == TestType(2.0));
+    CHECK(prepared.direction()[0] == theRay.unitDirection().x());
+    CHECK(prepared.invDirection()[1] == TestType(1.0) / theRay.unitDirection().y());
+    CHECK(prepared.sign(0) == 0);
+    CHECK(prepared.sign(1) == 1);
+    CHECK(prepared.sign(2) == 0);
+
+    // y dominates and is negative, so x and z swap to keep the winding
+    CHECK(prepared.kz() == 1);
+    CHECK(prepared.kx() == 0);
+    CHECK(prepared.ky() == 2);
+    CHECK(prepared.sz() == TestType(1.0) / theRay.unitDirection().y());
+
+    hubert::PreparedRay3<TestType> degenerate(hubert::Ray3<TestType>(hubert::Point3<TestType>(), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0))));
+    CHECK(isDegenerate(degenerate));
+}
+
+TEMPLATE_TEST_CASE("intersect(Triangle3, PreparedRay3)", "[PreparedRay3]", float, double)
+{
+    SECTION("Agrees with the Moller-Trumbore overload")
+    {
+        std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(300, 12);
+        std::vector<hubert::Ray3<TestType>> rays = makeRandomRays<TestType>(200, 13);
+        size_t hits = 0;
+        size_t disagree = 0;
+        for (auto & theRay : rays)
+        {
+            hubert::PreparedRay3<TestType> prepared(theRay);
+            for (auto & tri : tris)
+            {
+                hubert::Point3<TestType> p1, p2;
+                hubert::ResultCode rc1 = hubert::intersect(tri, theRay, p1);
+                hubert::ResultCode rc2 = hubert::intersect(tri, prepared, p2);
+                if (rc1 == hubert::ResultCode::eDegenerate)
+                {
+                    CHECK(rc2 == hubert::ResultCode::eDegenerate);
+                    continue;
+                }
+                if ((rc1 == hubert::ResultCode::eOk) != (rc2 == hubert::ResultCode::eOk))
+                {
+                    disagree++;
+                    continue;
+                }
+                if (rc1 == hubert::ResultCode::eOk)
+                {
+                    hits++;
+                    CHECK(hubert::distance(p1, p2) <= TestType(1000.0) * hubert::epsilon<TestType>() * TestType(20.0));
+                }
+            }
+        }
+        // only hits within rounding of an edge may differ
+        CHECK(hits > 100);
+        CHECK(disagree * 1000 <= hits);
+    }
+
+    SECTION("Watertight on shared edges and vertices")
+    {
+        std::vector<hubert::Triangle3<TestType>> tris = makeGridMesh<TestType>(4);
+        for (auto & dir : { hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(-1.0)), hubert::UnitVector3<TestType>(TestType(0.3), TestType(0.2), TestType(-1.0)), hubert::UnitVector3<TestType>(TestType(-0.7), TestType(0.1), TestType(1.0)) })
+        {
+            for (int i = 0; i <= 8; i++)
+            {
+                for (int j = 0; j <= 8; j++)
+                {
+                    // vertices, edges and diagonals of the inner quads
+                    hubert::Point3<TestType> target(TestType(0.5) + TestType(i) * TestType(0.375), TestType(0.5) + TestType(j) * TestType(0.375), TestType(0.0));
+                    hubert::Point3<TestType> base = target - hubert::multiply(dir, TestType(5.0));
+                    hubert::PreparedRay3<TestType> prepared(hubert::Ray3<TestType>(base, dir));
+
+                    int hitCount = 0;
+                    for (auto & tri : tris)
+                    {
+                        hubert::Point3<TestType> p;
+                        if (hubert::intersect(tri, prepared, p) == hubert::ResultCode::eOk)
+                        {
+                            hitCount++;
+                            CHECK(std::abs(p.z()) <= TestType(16.0) * hubert::epsilon<TestType>());
+                        }
+                    }
+                    CHECK(hitCount >= 1);
+                }
+            }
+        }
+    }
+
+    SECTION("Behind, coplanar and degenerate")
+    {
+        hubert::Triangle3<TestType> tri(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(1.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(0.0), TestType(1.0), TestType(0.0)));
+        hubert::Point3<TestType> p;
+
+        hubert::PreparedRay3<TestType> behind(hubert::Ray3<TestType>(hubert::Point3<TestType>(TestType(0.2), TestType(0.2), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0))));
+        CHECK(hubert::intersect(tri, behind, p) == hubert::ResultCode::eNoIntersection);
+        CHECK_FALSE(isValid(p));
+
+        hubert::PreparedRay3<TestType> below(hubert::Ray3<TestType>(hubert::Point3<TestType>(TestType(0.2), TestType(0.2), TestType(-1.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0))));
+        CHECK(hubert::intersect(below, tri, p) == hubert::ResultCode::eOk);
+        CHECK(p.x() == TestType(0.2));
+        CHECK(p.y() == TestType(0.2));
+        CHECK(p.z() == TestType(0.0));
+
+        hubert::PreparedRay3<TestType> inPlane(hubert::Ray3<TestType>(hubert::Point3<TestType>(TestType(-1.0), TestType(0.2), TestType(0.0)), hubert::UnitVector3<TestType>(TestType(1.0), TestType(0.0), TestType(0.0))));
+        CHECK(hubert::intersect(tri, inPlane, p) == hubert::ResultCode::eCoplanar);
+
+        hubert::Triangle3<TestType> degenerate(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(0.0)), hubert::Point3<TestType>(TestType(0.0), TestType(1.0), TestType(0.0)));
+        CHECK(hubert::intersect(degenerate, below, p) == hubert::ResultCode::eDegenerate);
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(Aabb3/Plane, PreparedRay3)", "[PreparedRay3]", float, double)
+{
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+    hubert::Aabb3<TestType> box(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(-1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(2.0), TestType(3.0)));
+    hubert::Plane<TestType> thePlane(hubert::Point3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(0.2), TestType(0.1), TestType(1.0)));
+
+    for (auto & theRay : rays)
+    {
+        hubert::PreparedRay3<TestType> prepared(theRay);
+
+        TestType tNear1, tFar1, tNear2, tFar2;
+        CHECK(hubert::intersect(box, theRay, tNear1, tFar1) == hubert::intersect(box, prepared, tNear2, tFar2));
+        CHECK(tNear1 == tNear2);
+        CHECK(tFar1 == tFar2);
+
+        hubert::Point3<TestType> p1, p2;
+        CHECK(hubert::intersect(thePlane, theRay, p1) == hubert::intersect(prepared, thePlane, p2));
+        CHECK(((p1.x() == p2.x()) || !isValid(p1)));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PreparedTriangle3
+/////////////////////////////////////////////////////////////////////////////
+
+template<typename T, typename Query>
+static void checkPreparedTriangle(const hubert::Triangle3<T> & tri, const hubert::PreparedTriangle3<T> & prepared, const Query & theQuery)
+{
+    hubert::Point3<T> p1, p2;
+    CHECK(hubert::intersect(tri, theQuery, p1) == hubert::intersect(prepared, theQuery, p2));
+    CHECK(hubert::isValid(p1) == hubert::isValid(p2));
+    if (hubert::isValid(p1))
+    {
+        CHECK(p1.x() == p2.x());
+        CHECK(p1.y() == p2.y());
+        CHECK(p1.z() == p2.z());
+    }
+}
+
+TEMPLATE_TEST_CASE("Construct PreparedTriangle3", "[PreparedTriangle3]", float, double)
+{
+    hubert::Triangle3<TestType> tri(hubert::Point3<TestType>(TestType(1.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(2.0), TestType(1.0), TestType(1.0)), hubert::Point3<TestType>(TestType(1.0), TestType(3.0), TestType(1.0)));
+    hubert::PreparedTriangle3<TestType> prepared(tri);
+
+    CHECK(isValid(prepared));
+    CHECK_FALSE(isDegenerate(prepared));
+    CHECK(prepared.p1().x() == TestType(1.0));
+    CHECK(prepared.edge1()[0] == TestType(1.0));
+    CHECK(prepared.edge2()[1] == TestType(2.0));
+    CHECK(prepared.normal().z() == TestType(1.0));
+    CHECK(prepared.normal().x() == hubert::unitNormal(tri).x());
+
+    hubert::PreparedTriangle3<TestType> degenerate(tri.p1(), tri.p1(), tri.p3());
+    CHECK(isValid(degenerate));
+    CHECK(isDegenerate(degenerate));
+    CHECK_FALSE(isValid(degenerate.normal()));
+
+    hubert::PreparedTriangle3<TestType> invalid(tri.p1(), hubert::invalidPoint3<TestType>(), tri.p3());
+    CHECK_FALSE(isValid(invalid));
+}
+
+TEMPLATE_TEST_CASE("intersect(PreparedTriangle3, Ray3/Line3/Segment3)", "[PreparedTriangle3]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makePacketTestTriangles<TestType>();
+    std::vector<hubert::Ray3<TestType>> rays = makePacketTestRays<TestType>();
+
+    for (auto & tri : tris)
+    {
+        hubert::PreparedTriangle3<TestType> prepared(tri);
+        for (auto & theRay : rays)
+        {
+            checkPreparedTriangle(tri, prepared, theRay);
+
+            hubert::Line3<TestType> theLine(theRay.base(), theRay.base() + hubert::multiply(theRay.unitDirection(), TestType(1.0)));
+            checkPreparedTriangle(tri, prepared, theLine);
+
+            hubert::Segment3<TestType> theSegment(theRay.base(), theRay.base() + hubert::multiply(theRay.unitDirection(), TestType(12.0)));
+            checkPreparedTriangle(tri, prepared, theSegment);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Triangle degeneracy classification
+/////////////////////////////////////////////////////////////////////////////
+
+// the checks Triangle3 used to run one after the other, for comparison
+template<typename T>
+static bool referenceDegenerate(const hubert::Point3<T> & p1, const hubert::Point3<T> & p2, const hubert::Point3<T> & p3)
+{
+    if (!(hubert::isValid(p1) && hubert::isValid(p2) && hubert::isValid(p3)))
+    {
+        return true;
+    }
+
+    for (auto d : { hubert::distance(p1, p2), hubert::distance(p2, p3), hubert::distance(p3, p1) })
+    {
+        if (hubert::isEqual(d, T(0.0)) || !hubert::isValid(d))
+        {
+            return true;
+        }
+    }
+
+    hubert::Vector3<T> c = hubert::crossProduct(p2 - p1, p3 - p1);
+    if (hubert::isValid(c) && hubert::isEqual(std::hypot(c.x(), c.y(), c.z()) * T(0.5), T(0.0)))
+    {
+        return true;
+    }
+
+    for (auto v : { hubert::crossProduct(p2 - p1, p3 - p1), hubert::crossProduct(p2 - p1, p3 - p2), hubert::crossProduct(p3 - p1, p3 - p2) })
+    {
+        if (hubert::isEqual(v.x(), T(0.0)) && hubert::isEqual(v.y(), T(0.0)) && hubert::isEqual(v.z(), T(0.0)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// triangles around the edges of the classifier's bands: edges and areas
+// near epsilon, and coordinates near overflow
+template<typename T>
+static std::vector<hubert::PackedTriangle3<T>> makeClassifierTestTriangles()
+{
+    std::mt19937 gen(14);
+    std::uniform_real_distribution<T> unit(T(-1.0), T(1.0));
+    const T eps = hubert::epsilon<T>();
+    const T big = std::numeric_limits<T>::max();
+    const std::vector<T> scales{ T(0.0), eps * T(0.3), eps * T(0.5), eps * T(0.51), eps * T(0.7), eps, eps * T(1.01), eps * T(1.5), eps * T(2.0), eps * T(2.5), T(1e-3), T(1.0), T(1e3), big * T(0.2), big * T(0.4), big * T(0.6) };
+
+    std::vector<hubert::PackedTriangle3<T>> tris;
+    for (int n = 0; n < 20000; n++)
+    {
+        T s1 = scales[gen() % scales.size()];
+        T s2 = scales[gen() % scales.size()];
+        T base = (gen() % 4 == 0) ? big * T(0.5) : T(1.0);
+        hubert::PackedPoint3<T> p1{ unit(gen) * base, unit(gen) * base, unit(gen) * base };
+        hubert::PackedPoint3<T> e1{ unit(gen) * s1, unit(gen) * s1, unit(gen) * s1 };
+        hubert::PackedPoint3<T> e2{ unit(gen) * s2, unit(gen) * s2, unit(gen) * s2 };
+        if (gen() % 3 == 0)
+        {
+            // nearly collinear
+            T f = unit(gen);
+            e2 = hubert::PackedPoint3<T>{ e1.x * f + e2.x * eps, e1.y * f + e2.y * eps, e1.z * f + e2.z * eps };
+        }
+        tris.push_back(hubert::PackedTriangle3<T>{ p1, { p1.x + e1.x, p1.y + e1.y, p1.z + e1.z }, { p1.x + e2.x, p1.y + e2.y, p1.z + e2.z } });
+    }
+    tris.push_back(hubert::PackedTriangle3<T>{ { T(0.0), T(0.0), T(0.0) }, { hubert::infinity<T>(), T(0.0), T(0.0) }, { T(0.0), T(1.0), T(0.0) } });
+    tris.push_back(hubert::PackedTriangle3<T>{ { -big, T(0.0), T(0.0) }, { big, T(0.0), T(0.0) }, { T(0.0), T(1.0), T(0.0) } });
+    return tris;
+}
+
+TEMPLATE_TEST_CASE("Triangle degeneracy classifier", "[Triangle3]", float, double)
+{
+    std::vector<hubert::PackedTriangle3<TestType>> tris = makeClassifierTestTriangles<TestType>();
+
+    size_t degenerate = 0;
+    size_t ambiguous = 0;
+    std::vector<bool> expected;
+    for (auto & packed : tris)
+    {
+        hubert::Point3<TestType> p1 = hubert::makePoint3(packed.p1);
+        hubert::Point3<TestType> p2 = hubert::makePoint3(packed.p2);
+        hubert::Point3<TestType> p3 = hubert::makePoint3(packed.p3);
+        bool ref = referenceDegenerate(p1, p2, p3);
+        expected.push_back(ref);
+        degenerate += ref ? 1 : 0;
+
+        CHECK(isDegenerate(hubert::Triangle3<TestType>(p1, p2, p3)) == ref);
+
+        const TestType a[3] = { packed.p1.x, packed.p1.y, packed.p1.z };
+        const TestType b[3] = { packed.p2.x, packed.p2.y, packed.p2.z };
+        const TestType c[3] = { packed.p3.x, packed.p3.y, packed.p3.z };
+        bool amb;
+        hubert::classifyTriangle(a, b, c, amb);
+        ambiguous += amb ? 1 : 0;
+        CHECK(hubert::isDegenerateTriangleExact(a, b, c) == ref);
+    }
+
+    // the set must exercise all the paths
+    CHECK(degenerate > 100);
+    CHECK(degenerate + 100 < tris.size());
+    CHECK(ambiguous > 10);
+
+    for (unsigned threads : { 1u, 3u })
+    {
+        std::vector<uint64_t> bits;
+        CHECK(hubert::validateTriangles(tris.data(), tris.size(), bits, threads) == degenerate);
+        REQUIRE(bits.size() == (tris.size() + 63) / 64);
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            CHECK((((bits[i >> 6] >> (i & 63)) & 1) != 0) == expected[i]);
+        }
+    }
+
+    // bulk appending to a soup agrees with adding one at a time
+    hubert::TriangleSoup<TestType> one;
+    one.push_back(hubert::makeTriangle3(tris[0]));
+    hubert::TriangleSoup<TestType> bulk(one);
+    for (auto & packed : tris)
+    {
+        one.push_back(packed);
+    }
+    bulk.append(tris.data(), tris.size(), 2);
+    REQUIRE(bulk.size() == one.size());
+    for (size_t i = 0; i < one.size(); i++)
+    {
+        CHECK(bulk.amDegenerate(i) == one.amDegenerate(i));
+        CHECK(bulk.x(2)[i] == one.x(2)[i]);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Triangle / plane classification and slicing
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("intersect(Triangle3, Plane)", "[Plane]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    hubert::Plane<TestType> thePlane(P(TestType(0.0), TestType(0.0), TestType(1.0)), hubert::UnitVector3<TestType>(TestType(0.0), TestType(0.0), TestType(1.0)));
+
+    // crossing
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 0), P(1, 0, 2), P(0, 1, 2)), thePlane) == hubert::ResultCode::eOk);
+    CHECK(hubert::intersect(thePlane, hubert::Triangle3<TestType>(P(0, 0, 0), P(1, 0, 2), P(0, 1, 2))) == hubert::ResultCode::eOk);
+    // touching at a vertex, and along an edge
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 1), P(1, 0, 2), P(0, 1, 2)), thePlane) == hubert::ResultCode::eOk);
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 1), P(1, 0, 1), P(0, 1, 0)), thePlane) == hubert::ResultCode::eOk);
+    // within epsilon of the plane counts as touching
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, TestType(1.0) + hubert::epsilon<TestType>() / 2), P(1, 0, 2), P(0, 1, 2)), thePlane) == hubert::ResultCode::eOk);
+    // in the plane
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 1), P(1, 0, 1), P(0, 1, 1)), thePlane) == hubert::ResultCode::eCoplanar);
+    // parallel, and tilted but to one side
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 3), P(1, 0, 3), P(0, 1, 3)), thePlane) == hubert::ResultCode::eParallel);
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 3), P(1, 0, 4), P(0, 1, 3)), thePlane) == hubert::ResultCode::eNoIntersection);
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, -3), P(1, 0, -4), P(0, 1, -3)), thePlane) == hubert::ResultCode::eNoIntersection);
+    // degenerate input
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, 0), P(1, 0, 2), P(2, 0, 4)), thePlane) == hubert::ResultCode::eDegenerate);
+    // overflowing distance
+    TestType big = std::numeric_limits<TestType>::max();
+    CHECK(hubert::intersect(hubert::Triangle3<TestType>(P(0, 0, big / 2), P(1, 0, big / 2), P(0, 1, big / 2)), hubert::Plane<TestType>(P(0, 0, -big), hubert::UnitVector3<TestType>(0, 0, 1))) == hubert::ResultCode::eOverflow);
+
+    // the crossing decision agrees with the segment/plane test on the edges
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(2000, 12, 3);
+    for (auto & tri : tris)
+    {
+        hubert::Point3<TestType> p;
+        bool edgeHits = hubert::intersect(hubert::Segment3<TestType>(tri.p1(), tri.p2()), thePlane, p) == hubert::ResultCode::eOk
+            || hubert::intersect(hubert::Segment3<TestType>(tri.p2(), tri.p3()), thePlane, p) == hubert::ResultCode::eOk
+            || hubert::intersect(hubert::Segment3<TestType>(tri.p3(), tri.p1()), thePlane, p) == hubert::ResultCode::eOk;
+        if (!isDegenerate(tri))
+        {
+            CHECK((hubert::intersect(tri, thePlane) == hubert::ResultCode::eOk) == edgeHits);
+        }
+    }
+}
+
+// a closed box with outward facing normals
+template<typename T>
+static std::vector<hubert::PackedTriangle3<T>> makeBoxMesh(T sx, T sy, T sz)
+{
+    const hubert::PackedPoint3<T> v[8] = { { 0, 0, 0 }, { sx, 0, 0 }, { sx, sy, 0 }, { 0, sy, 0 }, { 0, 0, sz }, { sx, 0, sz }, { sx, sy, sz }, { 0, sy, sz } };
+    const int faces[12][3] = { { 0, 2, 1 }, { 0, 3, 2 }, { 4, 5, 6 }, { 4, 6, 7 }, { 0, 1, 5 }, { 0, 5, 4 }, { 1, 2, 6 }, { 1, 6, 5 }, { 2, 3, 7 }, { 2, 7, 6 }, { 3, 0, 4 }, { 3, 4, 7 } };
+    std::vector<hubert::PackedTriangle3<T>> tris;
+    for (auto & f : faces)
+    {
+        tris.push_back(hubert::PackedTriangle3<T>{ v[f[0]], v[f[1]], v[f[2]] });
+    }
+    return tris;
+}
+
+// checks that the segments form closed loops, returning the signed area
+// they enclose seen from +z
+template<typename T>
+static T checkClosedSlice(const std::vector<hubert::SliceSegment<T>> & segs)
+{
+    T area = T(0.0);
+    for (auto & s : segs)
+    {
+        size_t next = 0;
+        size_t prev = 0;
+        for (auto & o : segs)
+        {
+            next += (o.a.x == s.b.x && o.a.y == s.b.y && o.a.z == s.b.z) ? 1 : 0;
+            prev += (o.b.x == s.a.x && o.b.y == s.a.y && o.b.z == s.a.z) ? 1 : 0;
+        }
+        CHECK(next == 1);
+        CHECK(prev == 1);
+        area += (s.a.x * s.b.y - s.b.x * s.a.y) / 2;
+    }
+    return area;
+}
+
+TEMPLATE_TEST_CASE("slice(PackedTriangle3, Plane)", "[Plane]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    hubert::Plane<TestType> ground(P(0, 0, 0), hubert::UnitVector3<TestType>(0, 0, 1));
+    std::vector<std::vector<hubert::SliceSegment<TestType>>> layers;
+
+    // a box 2 x 3 x 1 cut every 0.125: vertices on a layer count as above
+    // it, so the bottom face touches layer 0 and adds nothing, while the
+    // sides reach up to layer 8 and close a loop there
+    std::vector<hubert::PackedTriangle3<TestType>> box = makeBoxMesh<TestType>(2, 3, 1);
+    REQUIRE(hubert::slice(box.data(), box.size(), ground, TestType(0.125), 12, layers) == hubert::ResultCode::eOk);
+    REQUIRE(layers.size() == 12);
+    CHECK(layers[0].empty());
+    CHECK(layers[9].empty());
+    CHECK(layers[11].empty());
+    for (size_t k = 1; k <= 8; k++)
+    {
+        CHECK(layers[k].size() == ((k == 8) ? 4u : 8u));
+        CHECK(std::abs(checkClosedSlice(layers[k]) - TestType(6.0)) < TestType(1e-4));
+        for (auto & s : layers[k])
+        {
+            CHECK(s.a.z == TestType(k) * TestType(0.125));
+            CHECK(s.triangle >= 4);
+        }
+    }
+
+    // an octahedron cut through its four equator vertices, which count as
+    // above the plane
+    const hubert::PackedPoint3<TestType> v[6] = { { 1, 0, 0 }, { 0, 1, 0 }, { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    std::vector<hubert::PackedTriangle3<TestType>> octa;
+    for (int i = 0; i < 4; i++)
+    {
+        octa.push_back(hubert::PackedTriangle3<TestType>{ v[i], v[(i + 1) % 4], v[4] });
+        octa.push_back(hubert::PackedTriangle3<TestType>{ v[(i + 1) % 4], v[i], v[5] });
+    }
+    hubert::Plane<TestType> below(P(0, 0, -1), hubert::UnitVector3<TestType>(0, 0, 1));
+    REQUIRE(hubert::slice(octa.data(), octa.size(), below, TestType(0.5), 4, layers) == hubert::ResultCode::eOk);
+    CHECK(layers[0].empty());
+    CHECK(std::abs(checkClosedSlice(layers[1]) - TestType(0.5)) < TestType(1e-4));
+    CHECK(layers[2].size() == 4);
+    CHECK(std::abs(checkClosedSlice(layers[2]) - TestType(2.0)) < TestType(1e-4));
+    CHECK(std::abs(checkClosedSlice(layers[3]) - TestType(0.5)) < TestType(1e-4));
+
+    // a tilted plane and a random closed surface: every layer still closes
+    std::vector<hubert::PackedTriangle3<TestType>> grid;
+    const int n = 24;
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<TestType> jitter(TestType(0.8), TestType(1.2));
+    std::vector<hubert::PackedPoint3<TestType>> sphere;
+    for (int i = 0; i <= n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            TestType theta = TestType(3.14159265358979) * TestType(i) / TestType(n);
+            TestType phi = TestType(6.28318530717959) * TestType(j) / TestType(n);
+            TestType r = (i == 0 || i == n) ? TestType(1.0) : jitter(gen);
+            sphere.push_back({ r * std::sin(theta) * std::cos(phi), r * std::sin(theta) * std::sin(phi), (i == 0 || i == n) ? ((i == 0) ? TestType(1.0) : TestType(-1.0)) : r * std::cos(theta) });
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            int a = i * n + j;
+            int b = i * n + (j + 1) % n;
+            int c = (i + 1) * n + j;
+            int d = (i + 1) * n + (j + 1) % n;
+            // the poles are a ring of coincident points, so some of these
+            // triangles are degenerate, which slicing must cope with
+            grid.push_back(hubert::PackedTriangle3<TestType>{ sphere[a], sphere[c], sphere[d] });
+            grid.push_back(hubert::PackedTriangle3<TestType>{ sphere[a], sphere[d], sphere[b] });
+        }
+    }
+    REQUIRE(hubert::slice(grid.data(), grid.size(), ground, TestType(0.1), 10, layers) == hubert::ResultCode::eOk);
+    for (auto & layer : layers)
+    {
+        CHECK_FALSE(layer.empty());
+        CHECK(checkClosedSlice(layer) > TestType(0.0));
+    }
+
+    // bad planes and steps
+    CHECK(hubert::slice(box.data(), box.size(), ground, TestType(0.0), 4, layers) == hubert::ResultCode::eDegenerate);
+    CHECK(layers.size() == 4);
+    CHECK(hubert::slice(box.data(), box.size(), ground, hubert::infinity<TestType>(), 4, layers) == hubert::ResultCode::eDegenerate);
+    CHECK(hubert::slice(box.data(), box.size(), ground, TestType(1.0), 0, layers) == hubert::ResultCode::eOk);
+    CHECK(layers.empty());
+}
+
+TEMPLATE_TEST_CASE("MeshSlicer", "[Plane]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    hubert::Plane<TestType> ground(P(0, 0, 0), hubert::UnitVector3<TestType>(0, 0, 1));
+
+    // two boxes, one on top of the other's far corner, and a box with a
+    // box shaped hole in the middle (the hole's faces point inwards)
+    std::vector<hubert::PackedTriangle3<TestType>> mesh = makeBoxMesh<TestType>(4, 4, 2);
+    for (auto tri : makeBoxMesh<TestType>(1, 1, 1))
+    {
+        for (auto * p : { &tri.p1, &tri.p2, &tri.p3 })
+        {
+            p->x += 10;
+            p->z += TestType(0.5);
+        }
+        mesh.push_back(tri);
+    }
+    for (auto tri : makeBoxMesh<TestType>(2, 2, 4))
+    {
+        std::swap(tri.p2, tri.p3);
+        for (auto * p : { &tri.p1, &tri.p2, &tri.p3 })
+        {
+            p->x += 1;
+            p->y += 1;
+            p->z -= 1;
+        }
+        mesh.push_back(tri);
+    }
+
+    hubert::MeshSlicer<TestType> slicer(mesh.data(), mesh.size(), ground, TestType(0.25));
+    REQUIRE(slicer.layers() == 13);
+    CHECK(slicer.candidates(0) < mesh.size());
+
+    std::vector<std::vector<hubert::SliceContour<TestType>>> contours;
+    REQUIRE(slicer.slice(contours, 3) == hubert::ResultCode::eOk);
+    REQUIRE(contours.size() == 13);
+    std::vector<std::vector<hubert::SliceSegment<TestType>>> reference;
+    REQUIRE(hubert::slice(mesh.data(), mesh.size(), ground, TestType(0.25), 13, reference) == hubert::ResultCode::eOk);
+    for (size_t k = 0; k < contours.size(); k++)
+    {
+        // the same crossings as slice(), all used once
+        std::vector<hubert::SliceSegment<TestType>> segs;
+        slicer.segments(k, segs);
+        REQUIRE(segs.size() == reference[k].size());
+        size_t points = 0;
+        for (auto & c : contours[k])
+        {
+            CHECK(c.closed);
+            points += c.points.size();
+
+            TestType area = TestType(0.0);
+            for (size_t i = 0; i < c.points.size(); i++)
+            {
+                const auto & a = c.points[i];
+                const auto & b = c.points[(i + 1) % c.points.size()];
+                area += (a.x * b.y - b.x * a.y) / 2;
+                CHECK(a.z == TestType(k) * TestType(0.25));
+            }
+            // outer walls counter clockwise, the hole clockwise
+            CHECK((std::abs(area - TestType(16.0)) < TestType(1e-4) || std::abs(area - TestType(1.0)) < TestType(1e-4) || std::abs(area + TestType(4.0)) < TestType(1e-4)));
+        }
+        CHECK(points == segs.size());
+    }
+    // the bottom faces only touch their bottom layer while the top ones
+    // close a loop, so the big box spans layers 1 to 8, the small one 3 to
+    // 6, and the hole 0 to 12
+    CHECK(contours[0].size() == 1);
+    CHECK(contours[1].size() == 2);
+    CHECK(contours[2].size() == 2);
+    CHECK(contours[3].size() == 3);
+    CHECK(contours[6].size() == 3);
+    CHECK(contours[7].size() == 2);
+    CHECK(contours[8].size() == 2);
+    CHECK(contours[9].size() == 1);
+    CHECK(contours[12].size() == 1);
+
+    std::vector<hubert::SliceContour<TestType>> one;
+    CHECK(slicer.sliceLayer(4, one) == hubert::ResultCode::eOk);
+    CHECK(one.size() == contours[4].size());
+    CHECK(slicer.sliceLayer(13, one) == hubert::ResultCode::eNoIntersection);
+    CHECK(one.empty());
+
+    // a mesh with a face missing gives an open contour
+    std::vector<hubert::PackedTriangle3<TestType>> open = makeBoxMesh<TestType>(1, 1, 1);
+    open.erase(open.begin() + 4, open.begin() + 6);
+    hubert::MeshSlicer<TestType> openSlicer(open.data(), open.size(), ground, TestType(0.5), 2);
+    CHECK(openSlicer.sliceLayer(1, one) == hubert::ResultCode::eOk);
+    REQUIRE(one.size() == 1);
+    CHECK_FALSE(one[0].closed);
+    CHECK(one[0].points.size() == 7);
+
+    // bad set up
+    hubert::MeshSlicer<TestType> bad(mesh.data(), mesh.size(), ground, TestType(-1.0), 4);
+    CHECK(bad.layers() == 0);
+    CHECK(bad.slice(contours) == hubert::ResultCode::eDegenerate);
+    CHECK(contours.empty());
+    CHECK(bad.sliceLayer(0, one) == hubert::ResultCode::eDegenerate);
+
+    // too many layers to reach the top, or more than size_t can count
+    for (TestType step : { TestType(1e-9), std::numeric_limits<TestType>::denorm_min() })
+    {
+        hubert::MeshSlicer<TestType> tiny(mesh.data(), mesh.size(), ground, step);
+        CHECK(tiny.layers() == 0);
+        CHECK(tiny.slice(contours) == hubert::ResultCode::eDegenerate);
+        CHECK(tiny.sliceLayer(0, one) == hubert::ResultCode::eDegenerate);
+    }
+    std::vector<hubert::PackedTriangle3<TestType>> tall = mesh;
+    TestType high = std::numeric_limits<TestType>::max() / TestType(4.0);
+    tall.push_back(hubert::PackedTriangle3<TestType>{ { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, high } });
+    hubert::MeshSlicer<TestType> huge(tall.data(), tall.size(), ground, TestType(0.25));
+    CHECK(huge.layers() == 0);
+    CHECK(huge.slice(contours) == hubert::ResultCode::eDegenerate);
+    // an explicit layer count still slices the bottom of that mesh
+    hubert::MeshSlicer<TestType> bottom(tall.data(), tall.size(), ground, TestType(0.25), 4);
+    CHECK(bottom.layers() == 4);
+    CHECK(bottom.sliceLayer(1, one) == hubert::ResultCode::eOk);
+    // but not one above the limit, nor one whose offsets would wrap
+    for (size_t layers : { hubert::MeshSlicer<TestType>::cMaxLayers + 1, std::numeric_limits<size_t>::max() })
+    {
+        hubert::MeshSlicer<TestType> many(mesh.data(), mesh.size(), ground, TestType(0.25), layers);
+        CHECK(many.layers() == 0);
+        CHECK(many.slice(contours) == hubert::ResultCode::eDegenerate);
+        CHECK(many.sliceLayer(0, one) == hubert::ResultCode::eDegenerate);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Executors and batch queries
+/////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("ThreadPool runs every chunk once", "[Batch]")
+{
+    hubert::ThreadPool pool(4);
+    CHECK(pool.threads() == 4);
+
+    for (size_t count : { size_t(0), size_t(1), size_t(7), size_t(1000), size_t(100003) })
+    {
+        std::vector<std::atomic<int>> seen(count);
+        for (auto & s : seen)
+        {
+            s = 0;
+        }
+        pool.forChunks(count, 64, [&](size_t begin, size_t end) {
+            CHECK(end - begin <= 64);
+            for (size_t i = begin; i < end; i++)
+            {
+                seen[i]++;
+            }
+        });
+        size_t once = 0;
+        for (auto & s : seen)
+        {
+            once += (s == 1) ? 1 : 0;
+        }
+        CHECK(once == count);
+    }
+
+    // a nested batch runs inline instead of deadlocking
+    std::atomic<size_t> total(0);
+    pool.forChunks(16, 1, [&](size_t, size_t) {
+        pool.forChunks(100, 10, [&](size_t begin, size_t end) { total += end - begin; });
+    });
+    CHECK(total == 1600);
+
+    // batches from several threads are run one after the other
+    std::atomic<size_t> sum(0);
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 3; t++)
+    {
+        callers.emplace_back([&] {
+            for (int n = 0; n < 20; n++)
+            {
+                pool.forChunks(500, 7, [&](size_t begin, size_t end) { sum += end - begin; });
+            }
+        });
+    }
+    for (auto & t : callers)
+    {
+        t.join();
+    }
+    CHECK(sum == 3 * 20 * 500);
+}
+
+TEMPLATE_TEST_CASE("distanceBatch and closestPointBatch", "[Batch]", float, double)
+{
+    std::mt19937 gen(21);
+    std::uniform_real_distribution<TestType> coord(TestType(-100.0), TestType(100.0));
+    std::vector<hubert::Point3<TestType>> points;
+    for (int i = 0; i < 20000; i++)
+    {
+        points.emplace_back(coord(gen), coord(gen), coord(gen));
+    }
+    points.push_back(hubert::invalidPoint3<TestType>());
+
+    hubert::Point3<TestType> p(1, 2, 3);
+    hubert::Plane<TestType> thePlane(p, hubert::UnitVector3<TestType>(1, 1, 1));
+    hubert::Line3<TestType> theLine(p, hubert::Point3<TestType>(2, 1, 3));
+
+    hubert::ThreadPool pool(3);
+    auto check = [&](auto && exec) {
+        std::vector<TestType> dist(points.size());
+        std::vector<hubert::Point3<TestType>> closest(points.size());
+
+        hubert::distanceBatch(points.data(), points.size(), thePlane, dist.data(), exec);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            TestType expected = hubert::distance(points[i], thePlane);
+            CHECK((dist[i] == expected || (std::isnan(dist[i]) && std::isnan(expected))));
+        }
+        hubert::distanceBatch(points.data(), points.size(), p, dist.data(), exec);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            TestType expected = hubert::distance(points[i], p);
+            CHECK((dist[i] == expected || (std::isnan(dist[i]) && std::isnan(expected))));
+        }
+        hubert::closestPointBatch(points.data(), points.size(), thePlane, closest.data(), exec);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            hubert::Point3<TestType> expected = hubert::closestPoint(thePlane, points[i]);
+            CHECK(isValid(closest[i]) == isValid(expected));
+            CHECK((!isValid(expected) || (closest[i].x() == expected.x() && closest[i].y() == expected.y() && closest[i].z() == expected.z())));
+        }
+        hubert::closestPointBatch(points.data(), points.size(), theLine, closest.data(), exec);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            hubert::Point3<TestType> expected = hubert::closestPoint(theLine, points[i]);
+            CHECK(isValid(closest[i]) == isValid(expected));
+            CHECK((!isValid(expected) || (closest[i].x() == expected.x() && closest[i].y() == expected.y() && closest[i].z() == expected.z())));
+        }
+    };
+    check(hubert::SerialExecutor());
+    check(hubert::ThreadExecutor{ 4 });
+    check(pool);
+#if defined(HUBERT_PARALLEL_STL)
+    check(hubert::ParallelStlExecutor());
+#endif
+
+    // nothing to do
+    hubert::distanceBatch(points.data(), 0, thePlane, static_cast<TestType *>(nullptr), pool);
+}
+
+TEMPLATE_TEST_CASE("intersectBatch", "[Batch]", float, double)
+{
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(500, 8);
+    hubert::Bvh<TestType> bvh(tris.begin(), tris.end());
+    std::vector<hubert::Ray3<TestType>> rays = makeRandomRays<TestType>(3000, 9);
+    std::vector<hubert::Segment3<TestType>> segments;
+    for (auto & r : rays)
+    {
+        segments.emplace_back(r.base(), r.base() + hubert::multiply(r.unitDirection(), TestType(12.0)));
+    }
+
+    auto check = [&](auto && exec, const auto & queries) {
+        std::vector<hubert::BatchHit<TestType>> hits(queries.size());
+        size_t n = hubert::intersectBatch(queries.data(), queries.size(), bvh, hits.data(), exec);
+        size_t expectedHits = 0;
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            size_t tri;
+            hubert::Point3<TestType> point;
+            hubert::ResultCode result = hubert::intersect(bvh, queries[i], tri, point);
+            expectedHits += (result == hubert::ResultCode::eOk) ? 1 : 0;
+            CHECK(hits[i].result == result);
+            CHECK(hits[i].triangle == tri);
+            CHECK((!isValid(point) || (hits[i].point.x() == point.x() && hits[i].point.y() == point.y() && hits[i].point.z() == point.z())));
+        }
+        CHECK(n == expectedHits);
+        CHECK(n > 0);
+
+        size_t any = hubert::intersectAnyBatch(queries.data(), queries.size(), bvh, hits.data(), exec);
+        CHECK(any == expectedHits);
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            if (hits[i].result == hubert::ResultCode::eOk)
+            {
+                CHECK(hits[i].triangle < tris.size());
+            }
+        }
+    };
+
+    hubert::ThreadPool pool(4);
+    check(hubert::SerialExecutor(), rays);
+    check(hubert::ThreadExecutor{ 3 }, rays);
+    check(pool, rays);
+    check(pool, segments);
+    check(hubert::sharedThreadPool(), segments);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Closest feature queries
+/////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static T closestTolerance()
+{
+    return std::is_same<T, float>::value ? T(1e-3) : T(1e-9);
+}
+
+// points spread over a triangle, including its vertices and edges
+template<typename T>
+static std::vector<hubert::Point3<T>> sampleTriangle(const hubert::Triangle3<T> & tri, int n)
+{
+    std::vector<hubert::Point3<T>> points;
+    for (int i = 0; i <= n; i++)
+    {
+        for (int j = 0; i + j <= n; j++)
+        {
+            T u = T(i) / T(n);
+            T v = T(j) / T(n);
+            points.push_back(tri.p1() + hubert::multiply(tri.p2() - tri.p1(), u) + hubert::multiply(tri.p3() - tri.p1(), v));
+        }
+    }
+    return points;
+}
+
+template<typename T>
+static std::vector<hubert::Point3<T>> sampleSegment(const hubert::Segment3<T> & seg, int n)
+{
+    std::vector<hubert::Point3<T>> points;
+    for (int i = 0; i <= n; i++)
+    {
+        points.push_back(seg.base() + hubert::multiply(seg.target() - seg.base(), T(i) / T(n)));
+    }
+    return points;
+}
+
+TEMPLATE_TEST_CASE("closestPoint(Triangle3/Segment3/Ray3, Point3)", "[Closest]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    const TestType tol = closestTolerance<TestType>();
+
+    // one point in each of the Voronoi regions of the triangle
+    hubert::Triangle3<TestType> tri(P(0, 0, 0), P(4, 0, 0), P(0, 4, 0));
+    const std::vector<std::pair<P, P>> regions{
+        { P(-1, -1, 2), P(0, 0, 0) }, { P(6, -1, 0), P(4, 0, 0) }, { P(-1, 6, -3), P(0, 4, 0) },
+        { P(2, -3, 1), P(2, 0, 0) }, { P(-2, 1, 0), P(0, 1, 0) }, { P(3, 3, 5), P(2, 2, 0) },
+        { P(1, 1, -7), P(1, 1, 0) } };
+    for (auto & r : regions)
+    {
+        P c = hubert::closestPoint(tri, r.first);
+        CHECK(hubert::distance(c, r.second) < tol);
+        CHECK(hubert::distance(r.first, tri) == hubert::distance(r.first, c));
+        CHECK(hubert::distance(tri, r.first) == hubert::distance(r.first, c));
+        CHECK(std::abs(hubert::distanceSquared(r.first, tri) - hubert::distance(r.first, c) * hubert::distance(r.first, c)) < tol * TestType(10.0));
+    }
+
+    hubert::Segment3<TestType> seg(P(1, 1, 1), P(3, 1, 1));
+    CHECK(hubert::distance(hubert::closestPoint(seg, P(0, 5, 1)), P(1, 1, 1)) < tol);
+    CHECK(hubert::distance(hubert::closestPoint(seg, P(2, 5, 1)), P(2, 1, 1)) < tol);
+    CHECK(hubert::distance(hubert::closestPoint(seg, P(9, 5, 1)), P(3, 1, 1)) < tol);
+    CHECK(std::abs(hubert::distance(P(2, 5, 1), seg) - TestType(4.0)) < tol);
+    CHECK(std::abs(hubert::distanceSquared(seg, P(2, 5, 1)) - TestType(16.0)) < tol);
+
+    hubert::Ray3<TestType> ray(P(1, 1, 1), hubert::UnitVector3<TestType>(1, 0, 0));
+    CHECK(hubert::distance(hubert::closestPoint(ray, P(0, 5, 1)), P(1, 1, 1)) < tol);
+    CHECK(hubert::distance(hubert::closestPoint(ray, P(90, 5, 1)), P(90, 1, 1)) < tol);
+    CHECK(std::abs(hubert::distance(P(90, 1, 4), ray) - TestType(3.0)) < tol);
+
+    // against a brute force search
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(100, 31, 5, 4);
+    std::mt19937 gen(32);
+    std::uniform_real_distribution<TestType> coord(TestType(-8.0), TestType(8.0));
+    for (auto & t : tris)
+    {
+        if (isDegenerate(t))
+        {
+            continue;
+        }
+        std::vector<P> samples = sampleTriangle(t, 40);
+        for (int n = 0; n < 5; n++)
+        {
+            P p(coord(gen), coord(gen), coord(gen));
+            P c = hubert::closestPoint(t, p);
+            TestType best = hubert::infinity<TestType>();
+            for (auto & s : samples)
+            {
+                best = std::min(best, hubert::distance(p, s));
+            }
+            CHECK(hubert::distance(p, c) <= best + tol);
+            // and the point really is on the triangle
+            CHECK(std::abs(hubert::distance(c, hubert::Plane<TestType>(t.p1(), hubert::unitNormal(t)))) < tol * TestType(10.0));
+        }
+    }
+
+    // degenerate and invalid inputs
+    CHECK_FALSE(isValid(hubert::closestPoint(hubert::Triangle3<TestType>(P(0, 0, 0), P(1, 1, 1), P(2, 2, 2)), P(1, 0, 0))));
+    CHECK_FALSE(isValid(hubert::closestPoint(hubert::Segment3<TestType>(P(1, 1, 1), P(1, 1, 1)), P(1, 0, 0))));
+    CHECK_FALSE(isValid(hubert::closestPoint(tri, hubert::invalidPoint3<TestType>())));
+    CHECK(hubert::distance(hubert::invalidPoint3<TestType>(), seg) == hubert::infinity<TestType>());
+    CHECK(hubert::distanceSquared(ray, hubert::invalidPoint3<TestType>()) == hubert::infinity<TestType>());
+}
+
+TEMPLATE_TEST_CASE("closestPoints(Segment3/Ray3/Triangle3, ...)", "[Closest]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    const TestType tol = closestTolerance<TestType>();
+    P p1;
+    P p2;
+
+    // skew, parallel and crossing segments
+    hubert::Segment3<TestType> s1(P(0, 0, 0), P(4, 0, 0));
+    CHECK(hubert::closestPoints(s1, hubert::Segment3<TestType>(P(2, -1, 3), P(2, 1, 3)), p1, p2) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, P(2, 0, 0)) < tol);
+    CHECK(hubert::distance(p2, P(2, 0, 3)) < tol);
+    CHECK(std::abs(hubert::distance(s1, hubert::Segment3<TestType>(P(1, 2, 0), P(9, 2, 0))) - TestType(2.0)) < tol);
+    CHECK(std::abs(hubert::distance(s1, hubert::Segment3<TestType>(P(6, 0, 0), P(9, 0, 0))) - TestType(2.0)) < tol);
+    CHECK(hubert::distance(s1, hubert::Segment3<TestType>(P(1, -1, 0), P(1, 1, 0))) < tol);
+    CHECK(std::abs(hubert::distanceSquared(s1, hubert::Segment3<TestType>(P(2, -1, 3), P(2, 1, 3))) - TestType(9.0)) < tol);
+
+    // rays only go one way
+    hubert::Ray3<TestType> ray(P(-2, 0, 1), hubert::UnitVector3<TestType>(-1, 0, 0));
+    CHECK(hubert::closestPoints(ray, s1, p1, p2) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, P(-2, 0, 1)) < tol);
+    CHECK(hubert::distance(p2, P(0, 0, 0)) < tol);
+    CHECK(hubert::closestPoints(s1, ray, p2, p1) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, P(-2, 0, 1)) < tol);
+    hubert::Ray3<TestType> up(P(2, 1, -5), hubert::UnitVector3<TestType>(0, 0, 1));
+    CHECK(std::abs(hubert::distance(up, s1) - TestType(1.0)) < tol);
+    CHECK(std::abs(hubert::distance(up, ray) - TestType(sqrt(17.0))) < tol);
+
+    // segments and rays through, beside and in the plane of a triangle
+    hubert::Triangle3<TestType> tri(P(0, 0, 0), P(4, 0, 0), P(0, 4, 0));
+    CHECK(hubert::closestPoints(hubert::Segment3<TestType>(P(1, 1, -1), P(1, 1, 1)), tri, p1, p2) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, P(1, 1, 0)) < tol);
+    CHECK(hubert::distance(p2, P(1, 1, 0)) < tol);
+    CHECK(std::abs(hubert::distance(hubert::Segment3<TestType>(P(1, 1, 2), P(1, 1, 5)), tri) - TestType(2.0)) < tol);
+    CHECK(std::abs(hubert::distance(tri, hubert::Segment3<TestType>(P(-1, -1, 0), P(-1, 5, 0))) - TestType(1.0)) < tol);
+    CHECK(hubert::distance(hubert::Segment3<TestType>(P(1, 1, 0), P(2, 1, 0)), tri) < tol);
+    CHECK(hubert::distance(up, tri) < tol);
+    CHECK(hubert::closestPoints(tri, up, p1, p2) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, P(2, 1, 0)) < tol);
+    CHECK(std::abs(hubert::distance(hubert::Ray3<TestType>(P(1, 1, 3), hubert::UnitVector3<TestType>(0, 0, 1)), tri) - TestType(3.0)) < tol);
+
+    // triangles: apart, touching, crossing and coplanar overlapping
+    CHECK(std::abs(hubert::distance(tri, hubert::Triangle3<TestType>(P(0, 0, 2), P(4, 0, 2), P(0, 4, 3))) - TestType(2.0)) < tol);
+    CHECK(std::abs(hubert::distance(tri, hubert::Triangle3<TestType>(P(5, 5, -1), P(5, 5, 1), P(9, 9, 0))) - TestType(sqrt(18.0))) < tol);
+    CHECK(hubert::distance(tri, hubert::Triangle3<TestType>(P(1, 1, -1), P(1, 1, 1), P(9, 9, 0))) < tol);
+    CHECK(hubert::distance(tri, hubert::Triangle3<TestType>(P(1, 1, 0), P(1, 2, 0), P(2, 1, 0))) < tol);
+    CHECK(hubert::closestPoints(hubert::Triangle3<TestType>(P(-1, 1, -1), P(-1, 1, 1), P(9, 1, 0)), tri, p1, p2) == hubert::ResultCode::eOk);
+    CHECK(hubert::distance(p1, p2) < tol);
+    CHECK(std::abs(p1.y() - TestType(1.0)) < tol);
+    CHECK(std::abs(p1.z()) < tol);
+
+    // against a brute force search, and the triangle/triangle test
+    std::vector<hubert::Triangle3<TestType>> tris = makeRandomTriangles<TestType>(120, 41, 4, 4);
+    for (size_t i = 0; i + 1 < tris.size(); i += 2)
+    {
+        const hubert::Triangle3<TestType> & t1 = tris[i];
+        const hubert::Triangle3<TestType> & t2 = tris[i + 1];
+        if (isDegenerate(t1) || isDegenerate(t2))
+        {
+            continue;
+        }
+        REQUIRE(hubert::closestPoints(t1, t2, p1, p2) == hubert::ResultCode::eOk);
+        TestType d = hubert::distance(p1, p2);
+        CHECK(hubert::distance(t1, t2) == d);
+        CHECK(hubert::distance(p1, t1) < tol);
+        CHECK(hubert::distance(p2, t2) < tol);
+        TestType best = hubert::infinity<TestType>();
+        for (auto & s : sampleTriangle(t1, 25))
+        {
+            best = std::min(best, hubert::distance(s, t2));
+        }
+        CHECK(d <= best + tol);
+        if (hubert::intersect(t1, t2) == hubert::ResultCode::eOk)
+        {
+            CHECK(d < tol);
+        }
+        else if (d > tol * TestType(100.0))
+        {
+            CHECK(hubert::intersect(t1, t2) == hubert::ResultCode::eNoIntersection);
+        }
+
+        // the edges of the first one against the second and each other
+        hubert::Segment3<TestType> e1(t1.p1(), t1.p2());
+        hubert::Segment3<TestType> e2(t2.p2(), t2.p3());
+        REQUIRE(hubert::closestPoints(e1, t2, p1, p2) == hubert::ResultCode::eOk);
+        best = hubert::infinity<TestType>();
+        for (auto & s : sampleSegment(e1, 400))
+        {
+            best = std::min(best, hubert::distance(s, t2));
+        }
+        CHECK(hubert::distance(p1, p2) <= best + tol);
+        CHECK(hubert::distance(p1, e1) < tol);
+        CHECK(hubert::distance(p2, t2) < tol);
+
+        REQUIRE(hubert::closestPoints(e1, e2, p1, p2) == hubert::ResultCode::eOk);
+        best = hubert::infinity<TestType>();
+        for (auto & s : sampleSegment(e1, 400))
+        {
+            best = std::min(best, hubert::distance(s, e2));
+        }
+        CHECK(hubert::distance(p1, p2) <= best + tol);
+        CHECK(std::abs(hubert::distanceSquared(e1, e2) - hubert::distance(p1, p2) * hubert::distance(p1, p2)) < tol * TestType(10.0));
+    }
+
+    // degenerate inputs
+    hubert::Triangle3<TestType> flat(P(0, 0, 0), P(1, 1, 1), P(2, 2, 2));
+    hubert::Segment3<TestType> point(P(1, 1, 1), P(1, 1, 1));
+    CHECK(hubert::closestPoints(tri, flat, p1, p2) == hubert::ResultCode::eDegenerate);
+    CHECK_FALSE(isValid(p1));
+    CHECK_FALSE(isValid(p2));
+    CHECK(hubert::closestPoints(point, tri, p1, p2) == hubert::ResultCode::eDegenerate);
+    CHECK(hubert::closestPoints(s1, point, p1, p2) == hubert::ResultCode::eDegenerate);
+    CHECK(hubert::distance(flat, ray) == hubert::infinity<TestType>());
+    CHECK(hubert::distanceSquared(point, s1) == hubert::infinity<TestType>());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Squared lengths and zero length checks
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("isZeroLength agrees with isEqual(hypot, 0)", "[Distance]", float, double)
+{
+    const TestType eps = hubert::epsilon<TestType>();
+    std::mt19937 gen(17);
+    std::uniform_real_distribution<TestType> unit(TestType(-1.0), TestType(1.0));
+    std::uniform_real_distribution<TestType> band(TestType(0.98), TestType(1.02));
+
+    size_t zero = 0;
+    size_t nonZero = 0;
+    for (int n = 0; n < 200000; n++)
+    {
+        // vectors with lengths clustered around epsilon
+        TestType x = unit(gen);
+        TestType y = unit(gen);
+        TestType z = unit(gen);
+        TestType scale = eps * band(gen) / std::hypot(x, y, z);
+        x *= scale;
+        y *= scale;
+        z *= scale;
+        bool expected = hubert::isEqual(std::hypot(x, y, z), TestType(0.0));
+        CHECK(hubert::isZeroLength(x, y, z) == expected);
+        zero += expected ? 1 : 0;
+        nonZero += expected ? 0 : 1;
+    }
+    CHECK(zero > 1000);
+    CHECK(nonZero > 1000);
+
+    const TestType big = std::numeric_limits<TestType>::max();
+    const TestType tiny = std::numeric_limits<TestType>::denorm_min();
+    for (TestType v : { TestType(0.0), tiny, eps / 2, eps, eps * 2, TestType(1.0), big, hubert::infinity<TestType>(), std::numeric_limits<TestType>::quiet_NaN() })
+    {
+        bool expected = hubert::isEqual(std::hypot(v, TestType(0.0), TestType(0.0)), TestType(0.0));
+        CHECK(hubert::isZeroLength(v, TestType(0.0), TestType(0.0)) == expected);
+        CHECK(hubert::isZeroLength(-v, v, v) == hubert::isEqual(std::hypot(-v, v, v), TestType(0.0)));
+        CHECK(hubert::isFiniteLength(v, v, TestType(0.0)) == hubert::isValid(std::hypot(v, v, TestType(0.0))));
+    }
+    CHECK(hubert::isFiniteLength(big / 2, big / 2, TestType(0.0)));
+    CHECK_FALSE(hubert::isFiniteLength(big, big, TestType(0.0)));
+}
+
+TEMPLATE_TEST_CASE("distanceSquared, magnitudeSquared, isCoincident", "[Distance]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    const TestType eps = hubert::epsilon<TestType>();
+
+    CHECK(hubert::distanceSquared(P(1, 2, 3), P(4, 6, 3)) == TestType(25.0));
+    CHECK(hubert::distanceSquared(P(1, 2, 3), P(1, 2, 3)) == TestType(0.0));
+    CHECK(hubert::magnitudeSquared(hubert::Vector3<TestType>(3, 0, 4)) == TestType(25.0));
+    CHECK(hubert::Vector3<TestType>(1, 2, 2).magnitudeSquared() == TestType(9.0));
+    CHECK(hubert::Vector3<TestType>(hubert::infinity<TestType>(), 0, 0).magnitudeSquared() == hubert::infinity<TestType>());
+
+    CHECK(hubert::isCoincident(P(1, 1, 1), P(1, 1, 1)));
+    CHECK(hubert::isCoincident(P(0, 0, 0), P(eps / 2, 0, 0)));
+    CHECK_FALSE(hubert::isCoincident(P(0, 0, 0), P(eps * 2, 0, 0)));
+    CHECK_FALSE(hubert::isCoincident(P(0, 0, 0), hubert::invalidPoint3<TestType>()));
+
+    CHECK(hubert::isZeroLength(hubert::Vector3<TestType>(0, eps / 2, 0)));
+    CHECK_FALSE(hubert::isZeroLength(hubert::Vector3<TestType>(0, eps * 2, 0)));
+    CHECK_FALSE(hubert::isZeroLength(hubert::Vector3<TestType>(hubert::infinity<TestType>(), 0, 0)));
+
+    // the entity validation that now uses them makes the same decisions
+    for (TestType d : { eps / 2, eps * TestType(0.999), eps, eps * TestType(1.001), eps * 2 })
+    {
+        bool zero = hubert::isEqual(hubert::distance(P(1, 0, 0), P(1, d, 0)) , TestType(0.0));
+        CHECK(isDegenerate(hubert::Segment3<TestType>(P(1, 0, 0), P(1, d, 0))) == zero);
+        CHECK(isDegenerate(hubert::Line3<TestType>(P(0, 0, 1), P(0, d, 1))) == hubert::isEqual(d, TestType(0.0)));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Point indexes
+/////////////////////////////////////////////////////////////////////////////
+
+// integer coordinates on a small lattice give plenty of equally distant points
+template <typename T>
+std::vector<hubert::Point3<T>> makeLatticePoints(size_t count, unsigned seed, int extent)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> coord(-extent, extent);
+    std::vector<hubert::Point3<T>> points;
+    for (size_t i = 0; i < count; i++)
+    {
+        points.emplace_back(T(coord(gen)), T(coord(gen)), T(coord(gen)));
+    }
+    return points;
+}
+
+template <typename T>
+std::vector<size_t> bruteNearest(const std::vector<hubert::Point3<T>> & points, const hubert::Point3<T> & q, size_t k)
+{
+    std::vector<std::pair<T, size_t>> ranked;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        if (hubert::isValid(points[i]))
+        {
+            ranked.emplace_back(hubert::distanceSquared(q, points[i]), i);
+        }
+    }
+    std::sort(ranked.begin(), ranked.end());
+    std::vector<size_t> result;
+    for (size_t i = 0; i < std::min(k, ranked.size()); i++)
+    {
+        result.push_back(ranked[i].second);
+    }
+    return result;
+}
+
+template <typename T>
+std::vector<size_t> bruteRadius(const std::vector<hubert::Point3<T>> & points, const hubert::Point3<T> & q, T radius)
+{
+    std::vector<size_t> result;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        if (hubert::isValid(points[i]) && hubert::distanceSquared(q, points[i]) <= radius * radius)
+        {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+template <typename Index, typename T>
+void checkPointIndex(const Index & index, const std::vector<hubert::Point3<T>> & points, const std::vector<hubert::Point3<T>> & queries)
+{
+    std::vector<size_t> result;
+    for (auto & q : queries)
+    {
+        std::vector<size_t> expected = bruteNearest(points, q, 1);
+        CHECK(index.nearest(q) == expected[0]);
+        for (size_t k : { size_t(1), size_t(5), size_t(17) })
+        {
+            index.nearest(q, k, result);
+            CHECK(result == bruteNearest(points, q, k));
+        }
+        for (T radius : { T(0.0), T(1.0), T(2.5) })
+        {
+            index.withinRadius(q, radius, result);
+            std::sort(result.begin(), result.end());
+            CHECK(result == bruteRadius(points, q, radius));
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("PointIndex matches brute force", "[PointIndex]", float, double)
+{
+    auto points = makeLatticePoints<TestType>(3000, 7, 6);
+    points[10] = hubert::invalidPoint3<TestType>();
+    auto queries = makeLatticePoints<TestType>(40, 8, 9);
+    queries.emplace_back(TestType(0.5), TestType(0.5), TestType(0.5));
+    queries.emplace_back(TestType(100), TestType(-50), TestType(3));
+
+    hubert::PointIndex<TestType> serial(points.data(), points.size());
+    CHECK(serial.size() == points.size() - 1);
+    checkPointIndex(serial, points, queries);
+
+    // a parallel build answers the same
+    hubert::PointIndex<TestType> parallel(points.begin(), points.end(), 4);
+    checkPointIndex(parallel, points, queries);
+
+    // more neighbours asked for than there are points
+    std::vector<size_t> result;
+    hubert::PointIndex<TestType> few(points.begin(), points.begin() + 5);
+    few.nearest(queries[0], 10, result);
+    CHECK(result == bruteNearest(std::vector<hubert::Point3<TestType>>(points.begin(), points.begin() + 5), queries[0], 10));
+}
+
+TEMPLATE_TEST_CASE("PointGrid matches brute force", "[PointIndex]", float, double)
+{
+    auto points = makeLatticePoints<TestType>(3000, 9, 6);
+    points[3] = hubert::invalidPoint3<TestType>();
+    auto queries = makeLatticePoints<TestType>(40, 10, 9);
+    queries.emplace_back(TestType(100), TestType(-50), TestType(3));
+
+    hubert::PointGrid<TestType> automatic(points.data(), points.size());
+    CHECK(automatic.size() == points.size() - 1);
+    CHECK(automatic.cellSize() > TestType(0.0));
+    checkPointIndex(automatic, points, queries);
+
+    for (TestType cell : { TestType(0.3), TestType(1.0), TestType(7.0), TestType(50.0) })
+    {
+        hubert::PointGrid<TestType> grid(points.begin(), points.end(), cell, 4);
+        checkPointIndex(grid, points, queries);
+    }
+}
+
+TEMPLATE_TEST_CASE("PointGrid on planar and collinear points", "[PointIndex]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    std::vector<P> planar;
+    std::vector<P> collinear;
+    for (int i = 0; i < 100; i++)
+    {
+        for (int j = 0; j < 100; j++)
+        {
+            planar.emplace_back(TestType(i), TestType(j), TestType(2.0));
+            collinear.emplace_back(TestType(-5.0), TestType(100 * i + j) * TestType(0.5), TestType(1.0));
+        }
+    }
+    std::vector<P> queries;
+    for (int i = 0; i < 12; i++)
+    {
+        queries.emplace_back(TestType(9 * i) + TestType(0.3), TestType(7 * i) + TestType(0.2), TestType(2.5));
+        queries.emplace_back(TestType(-5.25), TestType(400 * i) + TestType(0.1), TestType(-3.0));
+    }
+    queries.emplace_back(TestType(1000), TestType(-700), TestType(40));
+
+    // the cells follow the spacing in the plane or along the line
+    hubert::PointGrid<TestType> flat(planar.data(), planar.size());
+    CHECK(flat.cellSize() > TestType(1.0));
+    CHECK(flat.cellSize() < TestType(2.0));
+    checkPointIndex(flat, planar, queries);
+
+    hubert::PointGrid<TestType> line(collinear.data(), collinear.size());
+    CHECK(line.cellSize() > TestType(0.5));
+    CHECK(line.cellSize() < TestType(2.0));
+    checkPointIndex(line, collinear, queries);
+
+    // all in one place, and two far apart clusters
+    std::vector<P> same(50, P(3, 3, 3));
+    hubert::PointGrid<TestType> one(same.data(), same.size());
+    CHECK(one.cellSize() > TestType(0.0));
+    CHECK(one.nearest(P(0, 0, 0)) == 0);
+    std::vector<P> apart = { P(0, 0, 0), P(1e6, 0, 0), P(TestType(0.5), 0, 0) };
+    hubert::PointGrid<TestType> clusters(apart.data(), apart.size());
+    CHECK(clusters.cellSize() >= TestType(1e6) / TestType(4096));
+    checkPointIndex(clusters, apart, queries);
+}
+
+TEMPLATE_TEST_CASE("Point indexes with no points or bad queries", "[PointIndex]", float, double)
+{
+    std::vector<hubert::Point3<TestType>> none;
+    std::vector<hubert::Point3<TestType>> invalid(3, hubert::invalidPoint3<TestType>());
+    hubert::Point3<TestType> q(1, 2, 3);
+    std::vector<size_t> result{ 1 };
+
+    hubert::PointIndex<TestType> empty(none.begin(), none.end());
+    CHECK(empty.nearest(q) == hubert::invalidIndex());
+    hubert::PointIndex<TestType> allInvalid(invalid.begin(), invalid.end());
+    CHECK(allInvalid.size() == 0);
+    allInvalid.nearest(q, 3, result);
+    CHECK(result.empty());
+
+    hubert::PointGrid<TestType> grid(invalid.begin(), invalid.end());
+    CHECK(grid.nearest(q) == hubert::invalidIndex());
+    hubert::PointGrid<TestType> badCell(&q, 1, TestType(-1.0));
+    CHECK(badCell.size() == 0);
+
+    auto points = makeLatticePoints<TestType>(100, 11, 3);
+    hubert::PointIndex<TestType> index(points.begin(), points.end());
+    CHECK(index.nearest(hubert::invalidPoint3<TestType>()) == hubert::invalidIndex());
+    index.withinRadius(q, TestType(-1.0), result);
+    CHECK(result.empty());
+    index.nearest(q, 0, result);
+    CHECK(result.empty());
+}
+
+TEMPLATE_TEST_CASE("Point index batch queries", "[PointIndex]", float, double)
+{
+    auto points = makeLatticePoints<TestType>(2000, 12, 8);
+    auto queries = makeLatticePoints<TestType>(500, 13, 10);
+    hubert::PointIndex<TestType> index(points.begin(), points.end(), 2);
+    hubert::PointGrid<TestType> grid(points.begin(), points.end(), TestType(2.0), 2);
+    hubert::ThreadPool pool(3);
+
+    std::vector<size_t> nearest(queries.size());
+    std::vector<size_t> threaded(queries.size());
+    hubert::nearestBatch(index, queries.data(), queries.size(), nearest.data());
+    hubert::nearestBatch(grid, queries.data(), queries.size(), threaded.data(), hubert::ThreadExecutor{ 4 });
+    CHECK(nearest == threaded);
+
+    const size_t k = 4;
+    std::vector<size_t> knn(queries.size() * k);
+    hubert::nearestBatch(index, queries.data(), queries.size(), k, knn.data(), pool);
+    std::vector<std::vector<size_t>> within;
+    hubert::withinRadiusBatch(grid, queries.data(), queries.size(), TestType(1.5), within, pool);
+    REQUIRE(within.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        CHECK(nearest[i] == bruteNearest(points, queries[i], 1)[0]);
+        CHECK(std::vector<size_t>(knn.begin() + i * k, knn.begin() + (i + 1) * k) == bruteNearest(points, queries[i], k));
+        std::sort(within[i].begin(), within[i].end());
+        CHECK(within[i] == bruteRadius(points, queries[i], TestType(1.5)));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Batch transforms
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+hubert::MatrixRotation3<T> testRotation()
+{
+    return hubert::MatrixRotation3<T>(
+        hubert::UnitVector3<T>(T(0.8911844994581091), T(-0.2924131506006626), T(-0.34682090087160805)),
+        hubert::UnitVector3<T>(T(0.34682090087160805), T(0.9319903121613182), T(0.1054007625971222)),
+        hubert::UnitVector3<T>(T(0.2924131506006626), T(-0.21421626313901312), T(0.9319903121613182)));
+}
+
+template <typename T>
+bool sameBits(const hubert::Point3<T> & p1, const hubert::Point3<T> & p2)
+{
+    return p1.x() == p2.x() && p1.y() == p2.y() && p1.z() == p2.z() && hubert::isValid(p1) == hubert::isValid(p2);
+}
+
+TEMPLATE_TEST_CASE("transformPoints matches multiply", "[Transform]", float, double)
+{
+    auto rotation = testRotation<TestType>();
+    hubert::Matrix3<TestType> general(2, 0.5, -1, 0.25, 3, 0, -2, 1, 0.75);
+    hubert::Vector3<TestType> t(10, -20, 0.125);
+
+    std::vector<hubert::Point3<TestType>> points;
+    for (auto & tri : makeRandomTriangles<TestType>(350, 21))
+    {
+        points.push_back(tri.p1());
+    }
+    points[5] = hubert::invalidPoint3<TestType>();
+
+    const hubert::Matrix3<TestType> * matrices[] = { &rotation, &general };
+    for (const hubert::Matrix3<TestType> * m : matrices)
+    {
+        std::vector<hubert::Point3<TestType>> out(points.size());
+        std::vector<hubert::Point3<TestType>> moved(points.size());
+        CHECK(hubert::transformPoints(*m, points.data(), points.size(), out.data()) == hubert::ResultCode::eOk);
+        CHECK(hubert::transformPoints(*m, t, points.data(), points.size(), moved.data()) == hubert::ResultCode::eOk);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            if (!hubert::isValid(points[i]))
+            {
+                CHECK_FALSE(hubert::isValid(out[i]));
+                CHECK_FALSE(hubert::isValid(moved[i]));
+                continue;
+            }
+            hubert::Vector3<TestType> v = hubert::multiply(hubert::Vector3<TestType>(points[i].x(), points[i].y(), points[i].z()), *m);
+            CHECK(sameBits(out[i], hubert::Point3<TestType>(v.x(), v.y(), v.z())));
+            CHECK(sameBits(moved[i], hubert::Point3<TestType>(v.x() + t.x(), v.y() + t.y(), v.z() + t.z())));
+        }
+
+        // in place gives the same
+        std::vector<hubert::Point3<TestType>> inPlace(points);
+        CHECK(hubert::transformPoints(*m, t, inPlace.data(), inPlace.size()) == hubert::ResultCode::eOk);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            CHECK(sameBits(inPlace[i], moved[i]));
+        }
+        inPlace = points;
+        CHECK(hubert::transformPoints(*m, inPlace.data(), inPlace.size()) == hubert::ResultCode::eOk);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            CHECK(sameBits(inPlace[i], out[i]));
+        }
+
+        // vectors
+        std::vector<hubert::Vector3<TestType>> vectors;
+        for (auto & p : points)
+        {
+            vectors.emplace_back(p.x(), p.y(), p.z());
+        }
+        std::vector<hubert::Vector3<TestType>> vout(vectors.size());
+        CHECK(hubert::transformVectors(*m, vectors.data(), vectors.size(), vout.data()) == hubert::ResultCode::eOk);
+        CHECK(hubert::transformVectors(*m, vectors.data(), vectors.size()) == hubert::ResultCode::eOk);
+        for (size_t i = 0; i < vectors.size(); i++)
+        {
+            CHECK(vout[i].x() == out[i].x());
+            CHECK(vout[i].y() == out[i].y());
+            CHECK(vout[i].z() == out[i].z());
+            CHECK(vectors[i].x() == vout[i].x());
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("transformPoints on packed and SoA data", "[Transform]", float, double)
+{
+    auto rotation = testRotation<TestType>();
+    hubert::Vector3<TestType> t(-3, 4, 5);
+    std::vector<hubert::Point3<TestType>> points;
+    for (auto & tri : makeRandomTriangles<TestType>(301, 22))
+    {
+        points.push_back(tri.p2());
+    }
+    std::vector<hubert::Point3<TestType>> expected(points.size());
+    REQUIRE(hubert::transformPoints(rotation, t, points.data(), points.size(), expected.data()) == hubert::ResultCode::eOk);
+
+    std::vector<hubert::PackedPoint3<TestType>> packed;
+    std::vector<TestType> x, y, z;
+    for (auto & p : points)
+    {
+        packed.push_back({ p.x(), p.y(), p.z() });
+        x.push_back(p.x());
+        y.push_back(p.y());
+        z.push_back(p.z());
+    }
+    std::vector<hubert::PackedPoint3<TestType>> packedOut(packed.size());
+    CHECK(hubert::transformPoints(rotation, t, packed.data(), packed.size(), packedOut.data()) == hubert::ResultCode::eOk);
+    CHECK(hubert::transformPoints(rotation, t, x.data(), y.data(), z.data(), x.size(), x.data(), y.data(), z.data()) == hubert::ResultCode::eOk);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        CHECK(packedOut[i].x == expected[i].x());
+        CHECK(packedOut[i].y == expected[i].y());
+        CHECK(packedOut[i].z == expected[i].z());
+        CHECK(x[i] == expected[i].x());
+        CHECK(y[i] == expected[i].y());
+        CHECK(z[i] == expected[i].z());
+    }
+
+    // without a translation
+    REQUIRE(hubert::transformPoints(rotation, points.data(), points.size(), expected.data()) == hubert::ResultCode::eOk);
+    std::vector<TestType> rx(x.size()), ry(y.size()), rz(z.size());
+    CHECK(hubert::transformPoints(rotation, packed.data(), packed.size(), packedOut.data()) == hubert::ResultCode::eOk);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        x[i] = points[i].x();
+        y[i] = points[i].y();
+        z[i] = points[i].z();
+    }
+    CHECK(hubert::transformPoints(rotation, x.data(), y.data(), z.data(), x.size(), rx.data(), ry.data(), rz.data()) == hubert::ResultCode::eOk);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        CHECK(packedOut[i].x == expected[i].x());
+        CHECK(packedOut[i].z == expected[i].z());
+        CHECK(rx[i] == expected[i].x());
+        CHECK(rz[i] == expected[i].z());
+    }
+
+    // every kernel agrees with the scalar one, for lengths around the widths
+    for (size_t n : { size_t(1), size_t(7), size_t(16), size_t(33) })
+    {
+        std::vector<TestType> scalar[3];
+        bool scalarNormal = false;
+        for (auto level : availableSimdLevels())
+        {
+            hubert::TransformLanes<TestType> tl;
+            REQUIRE(hubert::makeTransformLanes(rotation, &t, tl));
+            std::vector<TestType> out[3] = { std::vector<TestType>(n), std::vector<TestType>(n), std::vector<TestType>(n) };
+            const TestType * in[3] = { x.data(), y.data(), z.data() };
+            for (int c = 0; c < 3; c++)
+            {
+                tl.in[c] = in[c];
+                tl.out[c] = out[c].data();
+            }
+            bool normal = hubert::transformLanes(tl, n, level);
+            if (level == hubert::SimdLevel::eScalar)
+            {
+                scalarNormal = normal;
+                for (int c = 0; c < 3; c++)
+                {
+                    scalar[c] = out[c];
+                }
+            }
+            CHECK(normal == scalarNormal);
+            for (int c = 0; c < 3; c++)
+            {
+                CHECK(out[c] == scalar[c]);
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("transformPoints with bad matrices and overflow", "[Transform]", float, double)
+{
+    hubert::Matrix3<TestType> invalid(hubert::infinity<TestType>(), 0, 0, 0, 1, 0, 0, 0, 1);
+    hubert::MatrixRotation3<TestType> notRotation(
+        hubert::UnitVector3<TestType>(1, 0, 0), hubert::UnitVector3<TestType>(1, 0, 0), hubert::UnitVector3<TestType>(0, 0, 1));
+    REQUIRE(hubert::isDegenerate(notRotation));
+
+    std::vector<hubert::Point3<TestType>> points{ { 1, 2, 3 }, { 4, 5, 6 } };
+    std::vector<hubert::Point3<TestType>> out(points.size());
+    CHECK(hubert::transformPoints(invalid, points.data(), points.size(), out.data()) == hubert::ResultCode::eDegenerate);
+    CHECK_FALSE(hubert::isValid(out[0]));
+    CHECK(hubert::transformPoints(notRotation, points.data(), points.size(), out.data()) == hubert::ResultCode::eDegenerate);
+    CHECK_FALSE(hubert::isValid(out[1]));
+    hubert::Vector3<TestType> badT(0, hubert::infinity<TestType>(), 0);
+    CHECK(hubert::transformPoints(testRotation<TestType>(), badT, points.data(), points.size(), out.data()) == hubert::ResultCode::eDegenerate);
+
+    // a valid point that lands out of range
+    const TestType big = std::numeric_limits<TestType>::max();
+    hubert::Matrix3<TestType> scale(4, 0, 0, 0, 1, 0, 0, 0, 1);
+    points[1] = hubert::Point3<TestType>(big, 0, 0);
+    CHECK(hubert::transformPoints(scale, points.data(), points.size(), out.data()) == hubert::ResultCode::eOverflow);
+    CHECK(hubert::isValid(out[0]));
+    CHECK_FALSE(hubert::isValid(out[1]));
+
+    // subnormal results are flagged as such
+    const TestType tiny = std::numeric_limits<TestType>::min();
+    hubert::Matrix3<TestType> shrink(TestType(0.25), 0, 0, 0, 1, 0, 0, 0, 1);
+    points[1] = hubert::Point3<TestType>(tiny, 1, 1);
+    CHECK(hubert::transformPoints(shrink, points.data(), points.size(), out.data()) == hubert::ResultCode::eOk);
+    CHECK(hubert::isSubnormal(out[1]));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Transform3
+/////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+hubert::MatrixRotation3<T> rotationAboutZ(T angle)
+{
+    T c = std::cos(angle);
+    T s = std::sin(angle);
+    return hubert::MatrixRotation3<T>(hubert::UnitVector3<T>(c, s, 0), hubert::UnitVector3<T>(-s, c, 0), hubert::UnitVector3<T>(0, 0, 1));
+}
+
+template <typename T>
+bool nearPoint(const hubert::Point3<T> & p1, const hubert::Point3<T> & p2, T tolerance)
+{
+    return hubert::isValid(p1) && hubert::isValid(p2) && hubert::distance(p1, p2) < tolerance;
+}
+
+TEMPLATE_TEST_CASE("Transform3 construction and apply", "[Transform3]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    hubert::Transform3<TestType> identity;
+    CHECK(hubert::isValid(identity));
+    CHECK_FALSE(hubert::isDegenerate(identity));
+    CHECK(sameBits(hubert::transform(identity, P(1, 2, 3)), P(1, 2, 3)));
+
+    hubert::Transform3<TestType> xf(testRotation<TestType>(), hubert::Vector3<TestType>(1, -2, 3));
+    P p(4, 5, -6);
+    hubert::Vector3<TestType> v = hubert::multiply(hubert::Vector3<TestType>(p.x(), p.y(), p.z()), xf.rotation());
+    CHECK(sameBits(hubert::transform(xf, p), P(v.x() + 1, v.y() - 2, v.z() + 3)));
+    CHECK(hubert::transform(xf, hubert::Vector3<TestType>(4, 5, -6)).x() == v.x());
+
+    // every entity type moves with its points
+    const TestType tol = TestType(1e-4);
+    auto moved = [&](const P & q) { return hubert::transform(xf, q); };
+    P a(1, 0, 0), b(0, 2, 0), c(0, 0, 3);
+    hubert::Segment3<TestType> seg = hubert::transform(xf, hubert::Segment3<TestType>(a, b));
+    CHECK(nearPoint(seg.base(), moved(a), tol));
+    CHECK(nearPoint(seg.target(), moved(b), tol));
+    hubert::Line3<TestType> line = hubert::transform(xf, hubert::Line3<TestType>(a, b));
+    CHECK(nearPoint(line.target(), moved(b), tol));
+    hubert::Triangle3<TestType> tri = hubert::transform(xf, hubert::Triangle3<TestType>(a, b, c));
+    CHECK(nearPoint(tri.p3(), moved(c), tol));
+    hubert::Ray3<TestType> ray = hubert::transform(xf, hubert::Ray3<TestType>(a, hubert::UnitVector3<TestType>(0, 1, 0)));
+    CHECK(nearPoint(ray.base(), moved(a), tol));
+    CHECK(std::abs(ray.unitDirection().x() - xf.rotation().get(1, 0)) < tol);
+    hubert::Plane<TestType> plane = hubert::transform(xf, hubert::Plane<TestType>(a, hubert::UnitVector3<TestType>(0, 0, 1)));
+    CHECK(std::abs(hubert::distance(plane, moved(P(5, 5, 2))) - TestType(2)) < tol);
+    CHECK_FALSE(hubert::isDegenerate(plane));
+
+    // degenerate transforms and invalid input give invalid results
+    hubert::MatrixRotation3<TestType> notRotation(
+        hubert::UnitVector3<TestType>(1, 0, 0), hubert::UnitVector3<TestType>(1, 0, 0), hubert::UnitVector3<TestType>(0, 0, 1));
+    hubert::Transform3<TestType> bad(notRotation, hubert::Vector3<TestType>(0, 0, 0));
+    CHECK(hubert::isDegenerate(bad));
+    CHECK_FALSE(hubert::isValid(hubert::transform(bad, p)));
+    CHECK_FALSE(hubert::isValid(hubert::transform(xf, hubert::invalidPoint3<TestType>())));
+    CHECK(hubert::isDegenerate(hubert::transform(bad, tri)));
+    CHECK_FALSE(hubert::isValid(hubert::compose(xf, bad)));
+    CHECK_FALSE(hubert::isValid(hubert::inverse(bad)));
+    CHECK_FALSE(hubert::isValid(hubert::Transform3<TestType>(testRotation<TestType>(), hubert::invalidVector3<TestType>())));
+}
+
+TEMPLATE_TEST_CASE("Transform3 compose and inverse", "[Transform3]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    const TestType tol = TestType(1e-3);
+    hubert::Transform3<TestType> a(testRotation<TestType>(), hubert::Vector3<TestType>(1, -2, 3));
+    hubert::Transform3<TestType> b(rotationAboutZ(TestType(0.7)), hubert::Vector3<TestType>(-5, 0.5, 2));
+
+    hubert::Transform3<TestType> ab = hubert::compose(a, b);
+    CHECK(hubert::isValid(ab));
+    CHECK_FALSE(hubert::isDegenerate(ab));
+    CHECK(ab.composed() == 1);
+    hubert::Transform3<TestType> inv = hubert::inverse(ab);
+    CHECK_FALSE(hubert::isDegenerate(inv));
+    for (auto & tri : makeRandomTriangles<TestType>(50, 23))
+    {
+        P p = tri.p1();
+        CHECK(nearPoint(hubert::transform(ab, p), hubert::transform(b, hubert::transform(a, p)), tol));
+        CHECK(nearPoint(hubert::transform(inv, hubert::transform(ab, p)), p, tol));
+    }
+    CHECK(hubert::compose(ab, inv).rotation().isIdentityTolerance(TestType(1e-5)));
+
+    // a long chain drifts unless it is re-orthonormalized
+    hubert::Transform3<TestType> step(rotationAboutZ(TestType(0.01)), hubert::Vector3<TestType>(0, 0, 0));
+    hubert::Transform3<TestType> kept = step;
+    hubert::Transform3<TestType> drifting = step;
+    for (int i = 0; i < 1000; i++)
+    {
+        kept = hubert::compose(kept, step);
+        drifting = hubert::compose(drifting, step, 0);
+        CHECK(kept.composed() < hubert::cReorthonormalizeInterval);
+    }
+    CHECK(drifting.composed() == 1000);
+    CHECK_FALSE(hubert::isDegenerate(drifting));
+    hubert::MatrixRotation3<TestType> expected = rotationAboutZ(TestType(10.01));
+    for (uint32_t r = 0; r < 3; r++)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            CHECK(std::abs(kept.rotation().get(r, c) - expected.get(r, c)) < TestType(1e-3));
+        }
+    }
+    hubert::MatrixRotation3<TestType> fixed = hubert::orthonormalize(drifting.rotation());
+    CHECK_FALSE(hubert::isDegenerate(fixed));
+    CHECK(std::abs(fixed.determinant() - TestType(1)) < TestType(1e-5));
+
+    // the batch transform agrees with the single one
+    std::vector<P> points;
+    for (auto & tri : makeRandomTriangles<TestType>(300, 24))
+    {
+        points.push_back(tri.p3());
+    }
+    std::vector<P> out(points.size());
+    CHECK(hubert::transformPoints(ab, points.data(), points.size(), out.data()) == hubert::ResultCode::eOk);
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        CHECK(sameBits(out[i], hubert::transform(ab, points[i])));
+    }
+    CHECK(hubert::transformPoints(ab, points.data(), points.size()) == hubert::ResultCode::eOk);
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        CHECK(sameBits(out[i], points[i]));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Indexed mesh
+/////////////////////////////////////////////////////////////////////////////
+
+// shares the exactly equal corners of a triangle list
+template <typename T>
+static hubert::IndexedMesh<T> indexTriangles(const std::vector<hubert::PackedTriangle3<T>> & tris)
+{
+    std::vector<hubert::PackedPoint3<T>> vertices;
+    std::vector<uint32_t> indices;
+    for (auto & tri : tris)
+    {
+        for (const hubert::PackedPoint3<T> * p : { &tri.p1, &tri.p2, &tri.p3 })
+        {
+            size_t v = 0;
+            while (v < vertices.size() && !(vertices[v].x == p->x && vertices[v].y == p->y && vertices[v].z == p->z))
+            {
+                v++;
+            }
+            if (v == vertices.size())
+            {
+                vertices.push_back(*p);
+            }
+            indices.push_back(uint32_t(v));
+        }
+    }
+    return hubert::IndexedMesh<T>(vertices, indices);
+}
+
+template <typename T>
+static void checkFaceData(const hubert::IndexedMesh<T> & mesh, size_t f)
+{
+    hubert::Triangle3<T> tri = mesh.triangle(f);
+    CHECK(mesh.amDegenerate(f) == hubert::isDegenerate(tri));
+    CHECK(mesh.area(f) == hubert::area(tri));
+    CHECK(sameBits(mesh.centroid(f), hubert::centroid(tri)));
+    hubert::UnitVector3<T> n = hubert::unitNormal(tri);
+    CHECK(mesh.unitNormal(f).x() == n.x());
+    CHECK(mesh.unitNormal(f).z() == n.z());
+    CHECK(sameBits(mesh.bounds(f).lo(), hubert::Aabb3<T>(tri).lo()));
+    CHECK(sameBits(mesh.bounds(f).hi(), hubert::Aabb3<T>(tri).hi()));
+}
+
+TEMPLATE_TEST_CASE("IndexedMesh face data", "[IndexedMesh]", float, double)
+{
+    hubert::IndexedMesh<TestType> mesh = indexTriangles(makeBoxMesh<TestType>(2, 3, 1));
+    REQUIRE(mesh.vertexCount() == 8);
+    REQUIRE(mesh.faceCount() == 12);
+    CHECK(mesh.staleFaces() == 12);
+
+    TestType total = 0;
+    for (size_t f = 0; f < mesh.faceCount(); f++)
+    {
+        CHECK_FALSE(mesh.amDegenerate(f));
+        total += mesh.area(f);
+        checkFaceData(mesh, f);
+    }
+    CHECK(std::abs(total - TestType(22)) < TestType(1e-4));
+    CHECK(mesh.staleFaces() == 0);
+
+    // moving a vertex only touches the faces around it
+    size_t around = 0;
+    for (size_t f = 0; f < mesh.faceCount(); f++)
+    {
+        around += (mesh.index(f, 0) == 6 || mesh.index(f, 1) == 6 || mesh.index(f, 2) == 6) ? 1 : 0;
+    }
+    mesh.setVertex(6, hubert::Point3<TestType>(3, 4, 2));
+    CHECK(mesh.staleFaces() == around);
+    mesh.update(2);
+    CHECK(mesh.staleFaces() == 0);
+    for (size_t f = 0; f < mesh.faceCount(); f++)
+    {
+        checkFaceData(mesh, f);
+    }
+
+    // flattening a face makes it degenerate
+    hubert::PackedPoint3<TestType> v0 = mesh.vertices()[mesh.index(0, 0)];
+    hubert::PackedPoint3<TestType> v2 = mesh.vertices()[mesh.index(0, 2)];
+    mesh.setVertex(mesh.index(0, 1), hubert::PackedPoint3<TestType>{ (v0.x + v2.x) / 2, (v0.y + v2.y) / 2, (v0.z + v2.z) / 2 });
+    CHECK(mesh.amDegenerate(0));
+    CHECK(mesh.area(0) == TestType(0));
+
+    // out of range indices and invalid vertices
+    std::vector<hubert::PackedPoint3<TestType>> vertices{ { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { hubert::infinity<TestType>(), 0, 0 } };
+    std::vector<uint32_t> indices{ 0, 1, 2, 0, 1, 7, 0, 1, 3, 2 };
+    hubert::IndexedMesh<TestType> bad(vertices, indices);
+    REQUIRE(bad.faceCount() == 3);
+    CHECK_FALSE(bad.amDegenerate(0));
+    CHECK(bad.amDegenerate(1));
+    CHECK_FALSE(hubert::isValid(bad.triangle(1)));
+    CHECK(bad.amDegenerate(2));
+    CHECK_FALSE(hubert::isValid(bad.vertex(3)));
+    CHECK_FALSE(hubert::isValid(bad.vertex(9)));
+
+    // moving a vertex that is not there changes nothing
+    bad.update();
+    CHECK_FALSE(bad.setVertex(4, hubert::PackedPoint3<TestType>{ 5, 5, 5 }));
+    CHECK_FALSE(bad.setVertex(size_t(-1), hubert::Point3<TestType>(5, 5, 5)));
+    CHECK(bad.vertexCount() == 4);
+    CHECK(bad.staleFaces() == 0);
+    CHECK(bad.setVertex(2, hubert::Point3<TestType>(0, 2, 0)));
+    CHECK(bad.staleFaces() == 1);
+    CHECK(bad.area(0) == TestType(1));
+}
+
+TEMPLATE_TEST_CASE("IndexedMesh in the Bvh, soup and slicer", "[IndexedMesh]", float, double)
+{
+    using P = hubert::Point3<TestType>;
+    std::vector<hubert::PackedTriangle3<TestType>> box = makeBoxMesh<TestType>(4, 4, 2);
+    hubert::IndexedMesh<TestType> mesh = indexTriangles(box);
+
+    std::vector<hubert::Triangle3<TestType>> tris;
+    for (auto & t : box)
+    {
+        tris.push_back(hubert::makeTriangle3(t));
+    }
+    hubert::Bvh<TestType> fromMesh(mesh);
+    hubert::Bvh<TestType> fromTris(tris.begin(), tris.end());
+    for (auto & ray : makeRandomRays<TestType>(100, 25, 6))
+    {
+        size_t i1, i2;
+        P p1, p2;
+        hubert::ResultCode r1 = hubert::intersect(fromMesh, ray, i1, p1);
+        CHECK(r1 == hubert::intersect(fromTris, ray, i2, p2));
+        if (r1 == hubert::ResultCode::eOk)
+        {
+            CHECK(i1 == i2);
+            CHECK(sameBits(p1, p2));
+        }
+    }
+
+    hubert::TriangleSoup<TestType> soup(mesh);
+    REQUIRE(soup.size() == box.size());
+    for (size_t f = 0; f < box.size(); f++)
+    {
+        CHECK(soup.amDegenerate(f) == mesh.amDegenerate(f));
+        CHECK(sameBits(soup.triangle(f).p2(), tris[f].p2()));
+    }
+
+    hubert::Plane<TestType> ground(P(0, 0, 0), hubert::UnitVector3<TestType>(0, 0, 1));
+    hubert::MeshSlicer<TestType> slicerMesh(mesh, ground, TestType(0.25));
+    hubert::MeshSlicer<TestType> slicerTris(box.data(), box.size(), ground, TestType(0.25));
+    REQUIRE(slicerMesh.layers() == slicerTris.layers());
+    std::vector<std::vector<hubert::SliceSegment<TestType>>> segments;
+    REQUIRE(hubert::slice(mesh, ground, TestType(0.25), slicerMesh.layers(), segments) == hubert::ResultCode::eOk);
+    for (size_t k = 0; k < slicerMesh.layers(); k++)
+    {
+        std::vector<hubert::SliceSegment<TestType>> s1, s2;
+        slicerMesh.segments(k, s1);
+        slicerTris.segments(k, s2);
+        REQUIRE(s1.size() == s2.size());
+        CHECK(segments[k].size() == s1.size());
+        for (size_t i = 0; i < s1.size(); i++)
+        {
+            CHECK(s1[i].triangle == s2[i].triangle);
+            CHECK(s1[i].a.x == s2[i].a.x);
+            CHECK(s1[i].b.y == s2[i].b.y);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Exact orientation predicates
+/////////////////////////////////////////////////////////////////////////////
+
+// Exact integer references for the predicates and the triangle test, on
+// small integer coordinates.
+using IntPoint = std::array<int64_t, 3>;
+
+int64_t intOrient3d(const IntPoint & a, const IntPoint & b, const IntPoint & c, const IntPoint & d)
+{
+    int64_t adx = a[0] - d[0], ady = a[1] - d[1], adz = a[2] - d[2];
+    int64_t bdx = b[0] - d[0], bdy = b[1] - d[1], bdz = b[2] - d[2];
+    int64_t cdx = c[0] - d[0], cdy = c[1] - d[1], cdz = c[2] - d[2];
+    return adz * (bdx * cdy - cdx * bdy) + bdz * (cdx * ady - adx * cdy) + cdz * (adx * bdy - bdx * ady);
+}
+
+int64_t intOrient2d(const IntPoint & a, const IntPoint & b, const IntPoint & c, int i, int j)
+{
+    return (a[i] - c[i]) * (b[j] - c[j]) - (a[j] - c[j]) * (b[i] - c[i]);
+}
+
+int sign(int64_t v)
+{
+    return (v > 0) - (v < 0);
+}
+
+template <typename T>
+int sign(T v)
+{
+    return (v > T(0)) - (v < T(0));
+}
+
+// closed segments ab and cd in the plane of axes i and j
+bool intSegmentsMeet2d(const IntPoint & a, const IntPoint & b, const IntPoint & c, const IntPoint & d, int i, int j)
+{
+    int o1 = sign(intOrient2d(a, b, c, i, j)), o2 = sign(intOrient2d(a, b, d, i, j));
+    int o3 = sign(intOrient2d(c, d, a, i, j)), o4 = sign(intOrient2d(c, d, b, i, j));
+    if (o1 * o2 < 0 && o3 * o4 < 0)
+    {
+        return true;
+    }
+    auto onSegment = [&](const IntPoint & p, const IntPoint & q, const IntPoint & r) {
+        return sign(intOrient2d(p, q, r, i, j)) == 0 &&
+            std::min(p[i], q[i]) <= r[i] && r[i] <= std::max(p[i], q[i]) &&
+            std::min(p[j], q[j]) <= r[j] && r[j] <= std::max(p[j], q[j]);
+    };
+    return onSegment(a, b, c) || onSegment(a, b, d) || onSegment(c, d, a) || onSegment(c, d, b);
+}
+
+bool intInTriangle2d(const IntPoint & p, const IntPoint * tri, int i, int j)
+{
+    int s1 = sign(intOrient2d(tri[0], tri[1], p, i, j));
+    int s2 = sign(intOrient2d(tri[1], tri[2], p, i, j));
+    int s3 = sign(intOrient2d(tri[2], tri[0], p, i, j));
+    return (s1 >= 0 && s2 >= 0 && s3 >= 0) || (s1 <= 0 && s2 <= 0 && s3 <= 0);
+}
+
+// closed segment ab and closed, non-degenerate triangle tri
+bool intSegmentMeetsTriangle(const IntPoint & a, const IntPoint & b, const IntPoint * tri)
+{
+    int s1 = sign(intOrient3d(tri[0], tri[1], tri[2], a));
+    int s2 = sign(intOrient3d(tri[0], tri[1], tri[2], b));
+    if (s1 * s2 > 0)
+    {
+        return false;
+    }
+    if (s1 == 0 && s2 == 0)
+    {
+        // in the plane of the triangle, projected along the normal's largest component
+        int64_t n[3];
+        for (int k = 0; k < 3; k++)
+        {
+            int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+            n[k] = (tri[1][k1] - tri[0][k1]) * (tri[2][k2] - tri[0][k2]) - (tri[1][k2] - tri[0][k2]) * (tri[2][k1] - tri[0][k1]);
+        }
+        int k = 0;
+        for (int m = 1; m < 3; m++)
+        {
+            if (std::abs(n[m]) > std::abs(n[k])) k = m;
+        }
+        int i = (k + 1) % 3, j = (k + 2) % 3;
+        return intInTriangle2d(a, tri, i, j) || intInTriangle2d(b, tri, i, j) ||
+            intSegmentsMeet2d(a, b, tri[0], tri[1], i, j) || intSegmentsMeet2d(a, b, tri[1], tri[2], i, j) || intSegmentsMeet2d(a, b, tri[2], tri[0], i, j);
+    }
+    int v1 = sign(intOrient3d(a, b, tri[0], tri[1]));
+    int v2 = sign(intOrient3d(a, b, tri[1], tri[2]));
+    int v3 = sign(intOrient3d(a, b, tri[2], tri[0]));
+    return (v1 >= 0 && v2 >= 0 && v3 >= 0) || (v1 <= 0 && v2 <= 0 && v3 <= 0);
+}
+
+bool intTrianglesMeet(const IntPoint * t1, const IntPoint * t2)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        if (intSegmentMeetsTriangle(t1[k], t1[(k + 1) % 3], t2) || intSegmentMeetsTriangle(t2[k], t2[(k + 1) % 3], t1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEMPLATE_TEST_CASE("orient2d and orient3d signs are exact", "[Predicates]", float, double)
+{
+    using T = TestType;
+    SECTION("orient2d near a line")
+    {
+        // a on a grid of ulps around (0.5, 0.5), close to the line through b and c
+        const T u = std::numeric_limits<T>::epsilon() / 2;
+        const T b[2] = { T(12), T(12) };
+        const T c[2] = { T(24), T(24) };
+        int naiveWrong = 0;
+        for (int i = 0; i < 64; i++)
+        {
+            for (int j = 0; j < 64; j++)
+            {
+                const T a[2] = { T(0.5) + T(i) * u, T(0.5) + T(j) * u };
+                // the determinant is -12 (ax - ay)
+                int expected = (j > i) - (j < i);
+                CHECK(sign(hubert::orient2d(a, b, c)) == expected);
+                CHECK(sign(hubert::orient2d(b, c, a)) == expected);
+                CHECK(sign(hubert::orient2d(b, a, c)) == -expected);
+
+                T naive = (a[0] - c[0]) * (b[1] - c[1]) - (a[1] - c[1]) * (b[0] - c[0]);
+                naiveWrong += (sign(naive) != expected);
+            }
+        }
+        // the grid is fine enough to defeat plain floating point
+        CHECK(naiveWrong > 0);
+    }
+
+    SECTION("orient3d near a plane")
+    {
+        // a, b, c on the plane z = x + y, d on it or a few ulps off it
+        std::mt19937 gen(22);
+        std::uniform_int_distribution<int> grid(-64, 64);
+        const T offset = T(1000);
+        for (int n = 0; n < 500; n++)
+        {
+            T pts[4][3];
+            for (auto & p : pts)
+            {
+                p[0] = offset + T(grid(gen)) / T(8);
+                p[1] = offset + T(grid(gen)) / T(8);
+                p[2] = p[0] + p[1];
+            }
+            T far[3] = { pts[3][0], pts[3][1], pts[3][2] + T(1000) };
+            int above = sign(hubert::orient3d(pts[0], pts[1], pts[2], far));
+            if (above == 0)
+            {
+                continue;
+            }
+
+            CHECK(hubert::orient3d(pts[0], pts[1], pts[2], pts[3]) == T(0));
+            T z = pts[3][2], up = z, down = z;
+            for (int k = 1; k <= 3; k++)
+            {
+                up = std::nextafter(up, T(2) * z);
+                down = std::nextafter(down, T(0));
+                pts[3][2] = up;
+                CHECK(sign(hubert::orient3d(pts[0], pts[1], pts[2], pts[3])) == above);
+                CHECK(sign(hubert::orient3d(pts[1], pts[0], pts[2], pts[3])) == -above);
+                CHECK(sign(hubert::orient3d(pts[1], pts[2], pts[0], pts[3])) == above);
+                pts[3][2] = down;
+                CHECK(sign(hubert::orient3d(pts[0], pts[1], pts[2], pts[3])) == -above);
+            }
+        }
+    }
+
+    SECTION("Integer coordinates")
+    {
+        std::mt19937 gen(23);
+        std::uniform_int_distribution<int> coord(-1000, 1000);
+        for (int n = 0; n < 2000; n++)
+        {
+            IntPoint ip[4];
+            T fp[4][3];
+            for (int k = 0; k < 4; k++)
+            {
+                for (int m = 0; m < 3; m++)
+                {
+                    ip[k][m] = coord(gen);
+                    fp[k][m] = T(ip[k][m]);
+                }
+            }
+            CHECK(sign(hubert::orient3d(fp[0], fp[1], fp[2], fp[3])) == sign(intOrient3d(ip[0], ip[1], ip[2], ip[3])));
+            CHECK(sign(hubert::orient2d(fp[0], fp[1], fp[2])) == sign(intOrient2d(ip[0], ip[1], ip[2], 0, 1)));
+        }
+    }
+
+    SECTION("Point3 overloads")
+    {
+        hubert::Point3<T> a(0, 0, 0), b(1, 0, 0), c(0, 1, 0), d(0, 0, 1);
+        CHECK(hubert::orient3d(a, b, c, d) < T(0));
+        CHECK(hubert::orient3d(a, c, b, d) > T(0));
+        CHECK(hubert::orient3d(a, b, c, hubert::Point3<T>(T(0.25), T(0.5), 0)) == T(0));
+    }
+}
+
+TEMPLATE_TEST_CASE("intersect(exact, Triangle3, Triangle3)", "[Predicates]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+
+    SECTION("Against an integer reference")
+    {
+        // small coordinates, so that touching and coplanar pairs are common
+        std::mt19937 gen(24);
+        std::uniform_int_distribution<int> coord(-2, 2);
+        int hits = 0, coplanar = 0;
+        for (int n = 0; n < 20000; n++)
+        {
+            IntPoint it[2][3];
+            P pt[2][3];
+            for (int t = 0; t < 2; t++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    for (int m = 0; m < 3; m++)
+                    {
+                        it[t][k][m] = coord(gen);
+                    }
+                    pt[t][k] = P(T(it[t][k][0]), T(it[t][k][1]), T(it[t][k][2]));
+                }
+            }
+            // flatten some pairs into a common axis plane
+            if (n % 4 == 0)
+            {
+                int axis = (n / 4) % 3;
+                for (int t = 0; t < 2; t++)
+                {
+                    for (int k = 0; k < 3; k++)
+                    {
+                        it[t][k][axis] = 1;
+                        pt[t][k] = P(T(it[t][k][0]), T(it[t][k][1]), T(it[t][k][2]));
+                    }
+                }
+            }
+
+            hubert::Triangle3<T> tri1(pt[0][0], pt[0][1], pt[0][2]);
+            hubert::Triangle3<T> tri2(pt[1][0], pt[1][1], pt[1][2]);
+            if (hubert::isDegenerate(tri1) || hubert::isDegenerate(tri2))
+            {
+                CHECK(hubert::intersect(hubert::exact, tri1, tri2) == hubert::ResultCode::eDegenerate);
+                continue;
+            }
+            bool expected = intTrianglesMeet(it[0], it[1]);
+            hits += expected;
+            coplanar += (intOrient3d(it[0][0], it[0][1], it[0][2], it[1][0]) == 0 && intOrient3d(it[0][0], it[0][1], it[0][2], it[1][1]) == 0 && intOrient3d(it[0][0], it[0][1], it[0][2], it[1][2]) == 0);
+            hubert::ResultCode result = expected ? hubert::ResultCode::eOk : hubert::ResultCode::eNoIntersection;
+            CHECK(hubert::intersect(hubert::exact, tri1, tri2) == result);
+            CHECK(hubert::intersect(hubert::exact, tri2, tri1) == result);
+            hubert::Triangle3<T> rotated(pt[0][1], pt[0][2], pt[0][0]);
+            hubert::Triangle3<T> flipped(pt[1][0], pt[1][2], pt[1][1]);
+            CHECK(hubert::intersect(hubert::exact, rotated, flipped) == result);
+        }
+        CHECK(hits > 1000);
+        CHECK(coplanar > 1000);
+    }
+
+    SECTION("Agrees with intersect away from degeneracies")
+    {
+        std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(400, 25, T(3.0), T(2.0));
+        int hits = 0;
+        for (size_t i = 0; i + 1 < tris.size(); i += 2)
+        {
+            hubert::ResultCode r = hubert::intersect(tris[i], tris[i + 1]);
+            CHECK(hubert::intersect(hubert::exact, tris[i], tris[i + 1]) == r);
+            hits += (r == hubert::ResultCode::eOk);
+        }
+        CHECK(hits > 0);
+    }
+
+    SECTION("Touching at large coordinates")
+    {
+        // vertex of tri2 on the face of tri1, or one ulp above it
+        const T s = T(1 << 20);
+        hubert::Triangle3<T> tri1(P(s, 0, 0), P(0, s, 0), P(0, 0, s));
+        P touch(s / 4, s / 4, s / 2);
+        hubert::Triangle3<T> tri2(touch, P(s, s, s), P(s, T(0.5) * s, s));
+        CHECK(hubert::intersect(hubert::exact, tri1, tri2) == hubert::ResultCode::eOk);
+
+        P lifted(s / 4, s / 4, std::nextafter(s / 2, 2 * s));
+        hubert::Triangle3<T> tri3(lifted, P(s, s, s), P(s, T(0.5) * s, s));
+        CHECK(hubert::intersect(hubert::exact, tri1, tri3) == hubert::ResultCode::eNoIntersection);
+
+        // edges crossing at a single point
+        hubert::Triangle3<T> tri4(P(0, 0, 0), P(s, 0, 0), P(0, s, 0));
+        hubert::Triangle3<T> tri5(P(s / 2, s / 2, 0), P(s, s, s), P(s, s, -s));
+        CHECK(hubert::intersect(hubert::exact, tri4, tri5) == hubert::ResultCode::eOk);
+        hubert::Triangle3<T> tri6(P(std::nextafter(s / 2, 2 * s), s / 2, 0), P(s, s, s), P(s, s, -s));
+        CHECK(hubert::intersect(hubert::exact, tri4, tri6) == hubert::ResultCode::eNoIntersection);
+    }
+
+    SECTION("Degenerate")
+    {
+        hubert::Triangle3<T> good(P(0, 0, 0), P(1, 0, 0), P(0, 1, 0));
+        hubert::Triangle3<T> line(P(0, 0, 0), P(1, 1, 1), P(2, 2, 2));
+        CHECK(hubert::intersect(hubert::exact, good, line) == hubert::ResultCode::eDegenerate);
+        CHECK(hubert::intersect(hubert::exact, line, good) == hubert::ResultCode::eDegenerate);
+        hubert::Triangle3<T> bad(P(0, 0, 0), P(1, 0, 0), P(0, std::numeric_limits<T>::infinity(), 0));
+        CHECK(hubert::intersect(hubert::exact, good, bad) == hubert::ResultCode::eDegenerate);
+    }
+
+    SECTION("Batch routines")
+    {
+        std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(400, 26, T(4.0), T(1.5));
+        std::vector<std::pair<size_t, size_t>> expected;
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            for (size_t j = i + 1; j < tris.size(); j++)
+            {
+                if (hubert::intersect(hubert::exact, tris[i], tris[j]) == hubert::ResultCode::eOk && !hubert::shareVertex(tris[i], tris[j]))
+                {
+                    expected.emplace_back(i, j);
+                }
+            }
+        }
+        REQUIRE_FALSE(expected.empty());
+        std::vector<std::pair<size_t, size_t>> pairs;
+        CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs, true, 3, hubert::Predicates::eExact) == hubert::ResultCode::eOk);
+        CHECK(pairs == expected);
+
+        std::vector<hubert::Triangle3<T>> meshB(tris.begin() + 200, tris.end());
+        std::vector<std::pair<size_t, size_t>> cross;
+        for (size_t i = 0; i < 200; i++)
+        {
+            for (size_t j = 0; j < meshB.size(); j++)
+            {
+                if (hubert::intersect(hubert::exact, tris[i], meshB[j]) == hubert::ResultCode::eOk)
+                {
+                    cross.emplace_back(i, j);
+                }
+            }
+        }
+        REQUIRE_FALSE(cross.empty());
+        CHECK(hubert::intersectMeshes(tris.data(), size_t(200), meshB.data(), meshB.size(), pairs, 2, hubert::Predicates::eExact) == hubert::ResultCode::eOk);
+        CHECK(pairs == cross);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Triangle intersection segment
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("intersect(Triangle3, Triangle3, Segment3)", "[TriTriSegment]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+
+    SECTION("Known segment")
+    {
+        hubert::Triangle3<T> ground(P(-4, -4, 0), P(4, -4, 0), P(0, 4, 0));
+        hubert::Triangle3<T> wall(P(-1, 0, -1), P(1, 0, -1), P(0, 0, 1));
+        hubert::Segment3<T> segment;
+        REQUIRE(hubert::intersect(ground, wall, segment) == hubert::ResultCode::eOk);
+        P lo = segment.base().x() < segment.target().x() ? segment.base() : segment.target();
+        P hi = segment.base().x() < segment.target().x() ? segment.target() : segment.base();
+        CHECK(nearPoint(lo, P(T(-0.5), 0, 0), T(1e-4)));
+        CHECK(nearPoint(hi, P(T(0.5), 0, 0), T(1e-4)));
+
+        // the wall clipped by the edge of the ground triangle
+        hubert::Triangle3<T> wideWall(P(-10, 0, -1), P(10, 0, -1), P(0, 0, 1));
+        REQUIRE(hubert::intersect(ground, wideWall, segment) == hubert::ResultCode::eOk);
+        CHECK(std::abs(std::abs(segment.base().x()) - T(2)) < T(1e-4));
+        CHECK(std::abs(std::abs(segment.target().x()) - T(2)) < T(1e-4));
+        CHECK(std::abs(segment.base().x() + segment.target().x()) < T(1e-4));
+    }
+
+    SECTION("Touching at a point")
+    {
+        hubert::Triangle3<T> ground(P(-4, -4, 0), P(4, -4, 0), P(0, 4, 0));
+        hubert::Triangle3<T> spike(P(0, 0, 0), P(1, 0, 1), P(0, 1, 1));
+        hubert::Segment3<T> segment;
+        REQUIRE(hubert::intersect(ground, spike, segment) == hubert::ResultCode::eOk);
+        CHECK(hubert::isDegenerate(segment));
+        CHECK(nearPoint(segment.base(), P(0, 0, 0), T(1e-4)));
+    }
+
+    SECTION("Agrees with intersect and lies on both triangles")
+    {
+        std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(1000, 27, T(1.0), T(2.0));
+        int hits = 0;
+        for (size_t i = 0; i + 1 < tris.size(); i += 2)
+        {
+            const hubert::Triangle3<T> & tri1 = tris[i];
+            const hubert::Triangle3<T> & tri2 = tris[i + 1];
+            hubert::Segment3<T> segment;
+            hubert::ResultCode r = hubert::intersect(tri1, tri2, segment);
+            if (hubert::isDegenerate(tri1) || hubert::isDegenerate(tri2))
+            {
+                CHECK(r == hubert::ResultCode::eDegenerate);
+                continue;
+            }
+            CHECK(r == hubert::intersect(tri1, tri2));
+            if (r != hubert::ResultCode::eOk)
+            {
+                CHECK_FALSE(hubert::isValid(segment));
+                continue;
+            }
+            hits++;
+            for (const P & p : { segment.base(), segment.target() })
+            {
+                CHECK(hubert::distance(p, hubert::closestPoint(tri1, p)) < T(1e-3));
+                CHECK(hubert::distance(p, hubert::closestPoint(tri2, p)) < T(1e-3));
+            }
+
+            // one against many, with the plane of the first triangle prepared
+            hubert::PreparedTriangle3<T> prepared(tri1);
+            hubert::Segment3<T> preparedSegment;
+            CHECK(hubert::intersect(prepared, tri2) == r);
+            CHECK(hubert::intersect(prepared, tri2, preparedSegment) == r);
+            CHECK(sameBits(preparedSegment.base(), segment.base()));
+            CHECK(sameBits(preparedSegment.target(), segment.target()));
+        }
+        CHECK(hits > 50);
+    }
+
+    SECTION("Prepared test gives the results of the plain one")
+    {
+        std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(300, 28, T(2.0), T(1.5));
+        for (size_t i = 0; i < 20; i++)
+        {
+            hubert::PreparedTriangle3<T> prepared(tris[i]);
+            for (size_t j = 0; j < tris.size(); j++)
+            {
+                CHECK(hubert::intersect(prepared, tris[j]) == hubert::intersect(tris[i], tris[j]));
+            }
+        }
+    }
+
+    SECTION("Coplanar and degenerate")
+    {
+        hubert::Triangle3<T> tri1(P(0, 0, 0), P(2, 0, 0), P(0, 2, 0));
+        hubert::Triangle3<T> tri2(P(1, 1, 0), P(3, 1, 0), P(1, 3, 0));
+        hubert::Triangle3<T> far(P(5, 5, 0), P(6, 5, 0), P(5, 6, 0));
+        hubert::Segment3<T> segment;
+        CHECK(hubert::intersect(tri1, tri2) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(tri1, tri2, segment) == hubert::ResultCode::eCoplanar);
+        CHECK_FALSE(hubert::isValid(segment));
+        CHECK(hubert::intersect(tri1, far, segment) == hubert::ResultCode::eNoIntersection);
+
+        hubert::Triangle3<T> line(P(0, 0, -1), P(1, 1, 0), P(2, 2, 1));
+        CHECK(hubert::intersect(tri1, line, segment) == hubert::ResultCode::eDegenerate);
+        CHECK(hubert::intersect(hubert::PreparedTriangle3<T>(line), tri1, segment) == hubert::ResultCode::eDegenerate);
+        CHECK_FALSE(hubert::isValid(segment));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Epsilon policies
+/////////////////////////////////////////////////////////////////////////////
+
+static_assert(hubert::AbsoluteTolerance<1, 4>::tolerance<double>() == 0.25, "tolerance is a compile time constant");
+static_assert(hubert::AbsoluteEpsilon<2>::tolerance<float>() == 2 * std::numeric_limits<float>::epsilon(), "tolerance is a compile time constant");
+
+TEMPLATE_TEST_CASE("Epsilon policies", "[Epsilon]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+    const T eps = std::numeric_limits<T>::epsilon();
+
+    SECTION("Comparisons")
+    {
+        const T values[] = { T(0), eps / 2, eps, 3 * eps, T(1), T(1) + eps, T(1) + 4 * eps, T(1e20), T(1e20) * (T(1) + eps / 2), -T(1) };
+        for (T a : values)
+        {
+            for (T b : values)
+            {
+                CHECK(hubert::isEqual(hubert::DefaultEpsilon(), a, b) == hubert::isEqual(a, b));
+                CHECK(hubert::isEqual(hubert::ScaledEpsilon<1>(), a, b) == hubert::isEqual(a, b));
+                CHECK(hubert::isEqual(hubert::ScaledEpsilon<8>(), a, b) == hubert::isEqualScaled(a, b, T(8)));
+                CHECK(hubert::isGreaterOrEqual(hubert::DefaultEpsilon(), a, b) == hubert::isGreaterOrEqual(a, b));
+                CHECK(hubert::isLessOrEqual(hubert::DefaultEpsilon(), a, b) == hubert::isLessOrEqual(a, b));
+                CHECK(hubert::isEqual(hubert::AbsoluteEpsilon<>(), a, b) == (std::abs(a - b) <= eps));
+            }
+        }
+
+        // absolute tolerances ignore the magnitudes
+        CHECK(hubert::isEqual(hubert::AbsoluteTolerance<1, 1000>(), T(1), T(1.0005)));
+        CHECK_FALSE(hubert::isEqual(hubert::AbsoluteTolerance<1, 1000>(), T(1), T(1.002)));
+        CHECK(hubert::isEqual(hubert::AbsoluteTolerance<1, 1000>(), T(0), T(-0.0005)));
+        CHECK(hubert::isEqual(T(1e20), T(1e20) * (T(1) + eps / 2)));
+        CHECK_FALSE(hubert::isEqual(hubert::AbsoluteEpsilon<>(), T(1e20), T(1e20) * (T(1) + eps)));
+        CHECK(hubert::isGreaterOrEqual(hubert::AbsoluteTolerance<1, 100>(), T(-0.005), T(0)));
+        CHECK(hubert::isLessOrEqual(hubert::AbsoluteTolerance<1, 100>(), T(1.005), T(1)));
+        CHECK(hubert::isEqualScaled(hubert::AbsoluteTolerance<1, 100>(), T(1), T(1.015), T(2)));
+    }
+
+    SECTION("The default policy gives the plain results")
+    {
+        std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(400, 29, T(2.0), T(2.0));
+        std::vector<hubert::Ray3<T>> rays = makeRandomRays<T>(400, 30, T(3.0));
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            P p1, p2;
+            CHECK(hubert::intersect(hubert::DefaultEpsilon(), tris[i], rays[i], p1) == hubert::intersect(tris[i], rays[i], p2));
+            CHECK(sameBits(p1, p2));
+            hubert::PreparedTriangle3<T> prepared(tris[i]);
+            CHECK(hubert::intersect(hubert::DefaultEpsilon(), prepared, rays[i], p1) == hubert::intersect(prepared, rays[i], p2));
+            CHECK(sameBits(p1, p2));
+            size_t j = (i + 1) % tris.size();
+            CHECK(hubert::intersect(hubert::DefaultEpsilon(), tris[i], tris[j]) == hubert::intersect(tris[i], tris[j]));
+            CHECK(hubert::intersect(hubert::AbsoluteEpsilon<>(), tris[i], tris[j]) == hubert::intersect(tris[i], tris[j]));
+        }
+    }
+
+    SECTION("Tolerances in the intersection routines")
+    {
+        hubert::Triangle3<T> tri(P(0, 0, 0), P(1, 0, 0), P(0, 1, 0));
+        using Loose = hubert::AbsoluteTolerance<1, 1000>;
+
+        // a ray just outside an edge
+        hubert::Ray3<T> ray(P(T(-0.0005), T(0.5), T(1)), hubert::UnitVector3<T>(0, 0, -1));
+        P p;
+        CHECK(hubert::intersect(tri, ray, p) == hubert::ResultCode::eNoIntersection);
+        CHECK(hubert::intersect(Loose(), tri, ray, p) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(Loose(), hubert::PreparedTriangle3<T>(tri), ray, p) == hubert::ResultCode::eOk);
+        hubert::Segment3<T> segment(P(T(-0.0005), T(0.5), T(1)), P(T(-0.0005), T(0.5), T(-1)));
+        CHECK(hubert::intersect(tri, segment, p) == hubert::ResultCode::eNoIntersection);
+        CHECK(hubert::intersect(Loose(), tri, segment, p) == hubert::ResultCode::eOk);
+
+        // a line almost parallel to a plane
+        hubert::Plane<T> plane(P(0, 0, 0), hubert::UnitVector3<T>(0, 0, 1));
+        hubert::Line3<T> line(P(0, 0, T(0.0001)), P(1, 0, T(0.0002)));
+        CHECK(hubert::intersect(plane, line, p) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(Loose(), plane, line, p) == hubert::ResultCode::eCoplanar);
+
+        // a triangle a small gap above another
+        hubert::Triangle3<T> above(P(T(0.2), T(0.2), T(0.0001)), P(T(0.4), T(0.2), T(1)), P(T(0.2), T(0.4), T(1)));
+        hubert::Segment3<T> crossing;
+        CHECK(hubert::intersect(tri, above) == hubert::ResultCode::eNoIntersection);
+        CHECK(hubert::intersect(Loose(), tri, above) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(Loose(), tri, above, crossing) == hubert::ResultCode::eOk);
+        CHECK(hubert::intersect(Loose(), hubert::PreparedTriangle3<T>(tri), above, crossing) == hubert::ResultCode::eOk);
+    }
+}
+
+TEMPLATE_TEST_CASE("Instrumentation counters", "[Instrumentation]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+    using E = hubert::InstrumentedEntity;
+    using Q = hubert::InstrumentedQuery;
+    using R = hubert::ResultCode;
+
+    SECTION("Validations")
+    {
+        hubert::instrumentationReset();
+        P good(1, 2, 3);
+        P bad(hubert::infinity<T>(), 0, 0);
+        P trusted(hubert::trusted, 4, 5, 6);
+        hubert::Segment3<T> segment(good, trusted);
+        hubert::Segment3<T> flat(good, good);
+        hubert::InstrumentationCounts counts = hubert::instrumentationSnapshot();
+        if constexpr (hubert::cInstrumented)
+        {
+            CHECK(counts.validated[size_t(E::ePoint3)] >= 2);
+            CHECK(counts.invalid[size_t(E::ePoint3)] >= 1);
+            CHECK(counts.trusted[size_t(E::ePoint3)] >= 1);
+            CHECK(counts.validated[size_t(E::eSegment3)] == 2);
+            CHECK(counts.degenerate[size_t(E::eSegment3)] == 1);
+            CHECK(counts.invalid[size_t(E::eSegment3)] == 0);
+            CHECK(counts.constructed(E::eSegment3) == 2);
+        }
+        else
+        {
+            CHECK(counts.constructed(E::ePoint3) == 0);
+            CHECK(counts.constructed(E::eSegment3) == 0);
+        }
+    }
+
+    SECTION("Results")
+    {
+        hubert::Triangle3<T> tri(P(0, 0, 0), P(1, 0, 0), P(0, 1, 0));
+        hubert::Ray3<T> hit(P(T(0.2), T(0.2), 1), hubert::UnitVector3<T>(0, 0, -1));
+        hubert::Ray3<T> miss(P(2, 2, 1), hubert::UnitVector3<T>(0, 0, -1));
+        hubert::instrumentationReset();
+        P p;
+        CHECK(hubert::intersect(tri, hit, p) == R::eOk);
+        CHECK(hubert::intersect(tri, miss, p) == R::eNoIntersection);
+        CHECK(hubert::intersect(hubert::PreparedTriangle3<T>(tri), miss, p) == R::eNoIntersection);
+        CHECK(hubert::intersect(tri, tri) == R::eOk);
+        hubert::InstrumentationCounts counts = hubert::instrumentationSnapshot();
+        if constexpr (hubert::cInstrumented)
+        {
+            CHECK(counts.result(Q::eTriangleRay, R::eOk) == 1);
+            CHECK(counts.result(Q::eTriangleRay, R::eNoIntersection) == 2);
+            CHECK(counts.calls(Q::eTriangleRay) == 3);
+            CHECK(counts.result(Q::eTriangleTriangle, R::eOk) == 1);
+            CHECK(counts.calls(Q::ePlaneRay) == 0);
+        }
+        else
+        {
+            CHECK(counts.calls(Q::eTriangleRay) == 0);
+        }
+
+        // counts made on other threads, including exited ones, are summed
+        std::thread worker([&]() {
+            P q;
+            hubert::intersect(tri, hit, q);
+            (void)hubert::distance(P(0, 0, 0), P(3, 4, 0));
+        });
+        worker.join();
+        counts = hubert::instrumentationSnapshot();
+        CHECK(counts.result(Q::eTriangleRay, R::eOk) == (hubert::cInstrumented ? 2 : 0));
+        CHECK((counts.hypot > 0) == hubert::cInstrumented);
+
+        hubert::instrumentationReset();
+        counts = hubert::instrumentationSnapshot();
+        CHECK(counts.calls(Q::eTriangleRay) == 0);
+        CHECK(counts.hypot == 0);
+    }
+}
+
+// A file in the temporary directory holding bytes, removed again when it
+// goes out of scope. name is prefixed with random digits, so that test
+// runs going on at the same time do not share files.
+class TempFile
+{
+    public:
+        TempFile(const std::string & name, const std::vector<uint8_t> & bytes)
+        {
+            std::random_device rd;
+            uint64_t unique = (uint64_t(rd()) << 32) ^ uint64_t(rd()) ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+            std::ostringstream fileName;
+            fileName << std::hex << unique << '_' << name;
+            _path = (std::filesystem::temp_directory_path() / fileName.str()).string();
+            std::ofstream out(_path, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+        }
+        TempFile(const TempFile &) = delete;
+        TempFile & operator=(const TempFile &) = delete;
+        ~TempFile()
+        {
+            std::error_code error;
+            std::filesystem::remove(_path, error);
+        }
+
+        const char * path() const { return _path.c_str(); }
+
+    private:
+        std::string     _path;
+};
+
+template <typename V>
+static void appendBytes(std::vector<uint8_t> & bytes, V v)
+{
+    uint8_t b[sizeof(V)];
+    std::memcpy(b, &v, sizeof(V));
+    bytes.insert(bytes.end(), b, b + sizeof(V));
+}
+
+static void appendText(std::vector<uint8_t> & bytes, const std::string & text)
+{
+    bytes.insert(bytes.end(), text.begin(), text.end());
+}
+
+static std::vector<uint8_t> makeStl(const std::vector<hubert::PackedTriangle3<float>> & tris)
+{
+    std::vector<uint8_t> bytes(80, uint8_t(' '));
+    appendBytes(bytes, uint32_t(tris.size()));
+    for (size_t i = 0; i < tris.size(); i++)
+    {
+        const hubert::PackedPoint3<float> * pts[3] = { &tris[i].p1, &tris[i].p2, &tris[i].p3 };
+        for (int k = 0; k < 3; k++)
+        {
+            appendBytes(bytes, 0.0f);
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            appendBytes(bytes, pts[c]->x);
+            appendBytes(bytes, pts[c]->y);
+            appendBytes(bytes, pts[c]->z);
+        }
+        appendBytes(bytes, uint16_t(i));
+    }
+    return bytes;
+}
+
+TEST_CASE("StlFile", "[MeshFiles]")
+{
+    using PP = hubert::PackedPoint3<float>;
+    using PT = hubert::PackedTriangle3<float>;
+
+    SECTION("Triangles, validation and soups")
+    {
+        std::vector<hubert::Triangle3<float>> source = makeRandomTriangles<float>(1000, 41, 2.0f, 1.0f);
+        std::vector<PT> tris;
+        for (const auto & t : source)
+        {
+            tris.push_back(PT{ PP{ t.p1().x(), t.p1().y(), t.p1().z() }, PP{ t.p2().x(), t.p2().y(), t.p2().z() }, PP{ t.p3().x(), t.p3().y(), t.p3().z() } });
+        }
+        // a collinear one and an invalid one
+        tris[10] = PT{ PP{ 0, 0, 0 }, PP{ 1, 1, 1 }, PP{ 2, 2, 2 } };
+        tris[20].p2.y = hubert::infinity<float>();
+
+        TempFile fileTestsStl("hubertTests.stl", makeStl(tris));
+        hubert::StlFile stl;
+        CHECK(stl.open(fileTestsStl.path()) == hubert::LoadResult::eOk);
+        REQUIRE(stl.size() == tris.size());
+        CHECK(stl.attribute(7) == 7);
+        CHECK(!stl.validated());
+
+        size_t flagged = stl.validate(4);
+        CHECK(stl.validated());
+        size_t expected = 0;
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            PT t = stl.triangle(i);
+            CHECK(std::memcmp(&t, &tris[i], sizeof(PT)) == 0);
+            bool degenerate = hubert::makeTriangle3(tris[i]).amDegenerate();
+            CHECK(stl.amDegenerate(i) == degenerate);
+            expected += degenerate ? 1 : 0;
+        }
+        CHECK(flagged == expected);
+        CHECK(stl.amDegenerate(10));
+        CHECK(stl.amDegenerate(20));
+
+        hubert::TriangleSoup<float> soup;
+        stl.appendTo(soup);
+        hubert::TriangleSoup<float> reference;
+        reference.append(tris.data(), tris.size());
+        REQUIRE(soup.size() == reference.size());
+        for (size_t i = 0; i < soup.size(); i++)
+        {
+            CHECK(soup.amDegenerate(i) == reference.amDegenerate(i));
+            CHECK(sameBits(soup.triangle(i).p3(), reference.triangle(i).p3()));
+        }
+
+        // appended behind triangles that are already there
+        hubert::TriangleSoup<float> behind;
+        for (size_t i = 0; i < 5; i++)
+        {
+            behind.push_back(tris[10 + i]);
+        }
+        stl.appendTo(behind);
+        REQUIRE(behind.size() == tris.size() + 5);
+        CHECK(behind.amDegenerate(0));
+        for (size_t i = 0; i < tris.size(); i++)
+        {
+            CHECK(behind.amDegenerate(i + 5) == stl.amDegenerate(i));
+        }
+    }
+
+    SECTION("Welding")
+    {
+        // two triangles sharing an edge, one corner written as -0
+        std::vector<PT> tris = {
+            PT{ PP{ 0, 0, 0 }, PP{ 1, 0, 0 }, PP{ 0, 1, 0 } },
+            PT{ PP{ 1, 0, 0 }, PP{ 1, 1, 0 }, PP{ -0.0f, 1, 0 } } };
+        TempFile fileWeldStl("hubertWeld.stl", makeStl(tris));
+        hubert::StlFile stl(fileWeldStl.path());
+        REQUIRE(stl.isOpen());
+        hubert::IndexedMesh<float> mesh = stl.weld();
+        CHECK(mesh.vertexCount() == 4);
+        REQUIRE(mesh.faceCount() == 2);
+        CHECK(mesh.index(1, 0) == mesh.index(0, 1));
+        CHECK(mesh.index(1, 2) == mesh.index(0, 2));
+        CHECK(sameBits(mesh.triangle(1).p2(), hubert::Point3<float>(1, 1, 0)));
+
+        hubert::IndexedMesh<float> direct = hubert::weldTriangles(tris.data(), tris.size());
+        CHECK(direct.indices() == mesh.indices());
+    }
+
+    SECTION("Bad files")
+    {
+        std::vector<uint8_t> bytes = makeStl({ PT{ PP{ 0, 0, 0 }, PP{ 1, 0, 0 }, PP{ 0, 1, 0 } } });
+        bytes.pop_back();
+        TempFile fileShortStl("hubertShort.stl", bytes);
+        hubert::StlFile stl;
+        CHECK(stl.open(fileShortStl.path()) == hubert::LoadResult::eBadFormat);
+        CHECK(!stl.isOpen());
+        CHECK(stl.size() == 0);
+
+        std::vector<uint8_t> ascii;
+        appendText(ascii, "solid cube\nfacet normal 0 0 1\nouter loop\nvertex 0 0 0\nvertex 1 0 0\nvertex 0 1 0\nendloop\nendfacet\nendsolid cube\n");
+        TempFile fileAsciiStl("hubertAscii.stl", ascii);
+        CHECK(stl.open(fileAsciiStl.path()) == hubert::LoadResult::eUnsupported);
+        CHECK(stl.open((std::filesystem::temp_directory_path() / "hubertMissing.stl").string().c_str()) == hubert::LoadResult::eOpenFailed);
+
+        // an empty mesh is fine
+        TempFile fileEmptyStl("hubertEmpty.stl", makeStl({}));
+        CHECK(stl.open(fileEmptyStl.path()) == hubert::LoadResult::eOk);
+        CHECK(stl.size() == 0);
+        CHECK(stl.validate() == 0);
+        stl.close();
+    }
+}
+
+TEMPLATE_TEST_CASE("PlyFile", "[MeshFiles]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+    const char * type = std::is_same<T, float>::value ? "float" : "double";
+    const T corners[5][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 2, 2, 2 } };
+
+    // a quad, a triangle using an out of range vertex, a triangle with
+    // repeated vertices and a face too short to be one
+    auto faces = [](std::vector<uint8_t> & bytes) {
+        bytes.push_back(4);
+        for (int32_t v : { 0, 1, 2, 3 })
+        {
+            appendBytes(bytes, v);
+        }
+        bytes.push_back(3);
+        for (int32_t v : { 0, 1, 7 })
+        {
+            appendBytes(bytes, v);
+        }
+        bytes.push_back(3);
+        for (int32_t v : { 4, 4, 1 })
+        {
+            appendBytes(bytes, v);
+        }
+        bytes.push_back(2);
+        for (int32_t v : { 0, 1 })
+        {
+            appendBytes(bytes, v);
+        }
+    };
+
+    SECTION("Packed vertices are used in place")
+    {
+        // the comment pads the header to a multiple of 8 bytes
+        std::string header = std::string("ply\nformat binary_little_endian 1.0\nelement vertex 5\nproperty ") + type + " x\nproperty " + type + " y\nproperty " + type + " z\n"
+            + "element face 4\nproperty list uchar int vertex_indices\nend_header\n";
+        header.insert(4, "comment " + std::string((8 - (header.size() + 9) % 8) % 8, 'x') + "\n");
+        REQUIRE(header.size() % 8 == 0);
+        std::vector<uint8_t> bytes;
+        appendText(bytes, header);
+        for (const auto & c : corners)
+        {
+            appendBytes(bytes, c[0]);
+            appendBytes(bytes, c[1]);
+            appendBytes(bytes, c[2]);
+        }
+        faces(bytes);
+
+        TempFile filePackedPly("hubertPacked.ply", bytes);
+        hubert::PlyFile ply;
+        REQUIRE(ply.open(filePackedPly.path()) == hubert::LoadResult::eOk);
+        CHECK(ply.vertexCount() == 5);
+        REQUIRE(ply.faceCount() == 4);
+        const hubert::PackedPoint3<T> * packed = ply.template packedVertices<T>();
+        REQUIRE(packed != nullptr);
+        CHECK(packed[2].x == T(1));
+        CHECK(packed[2].y == T(1));
+
+        CHECK(ply.template validate<T>(2) == 2);
+        CHECK(!ply.amDegenerate(0));
+        CHECK(!ply.amDegenerate(1));
+        CHECK(ply.amDegenerate(2));
+        CHECK(ply.amDegenerate(3));
+
+        hubert::IndexedMesh<T> mesh = ply.template mesh<T>();
+        CHECK(mesh.vertexCount() == 5);
+        REQUIRE(mesh.faceCount() == 4);
+        CHECK(sameBits(mesh.triangle(1).p3(), P(0, 1, 0)));
+        CHECK(sameBits(mesh.triangle(1).p2(), mesh.triangle(0).p3()));
+        CHECK(!mesh.triangle(2).amValid());
+
+        hubert::TriangleSoup<T> soup;
+        ply.appendTo(soup);
+        REQUIRE(soup.size() == 4);
+        CHECK(soup.amDegenerate(2));
+        CHECK(!soup.amDegenerate(1));
+    }
+
+    SECTION("Other vertex layouts are converted")
+    {
+        std::vector<uint8_t> bytes;
+        appendText(bytes, "ply\r\nformat binary_little_endian 1.0\r\nelement vertex 5\r\nproperty uchar red\r\nproperty double x\r\nproperty float y\r\nproperty short z\r\n"
+            "element face 4\r\nproperty uchar flags\r\nproperty list uint8 uint32 vertex_index\r\nelement edge 1\r\nproperty int vertex1\r\nproperty int vertex2\r\nend_header\r\n");
+        for (const auto & c : corners)
+        {
+            bytes.push_back(255);
+            appendBytes(bytes, double(c[0]));
+            appendBytes(bytes, float(c[1]));
+            appendBytes(bytes, int16_t(c[2]));
+        }
+        std::vector<uint8_t> faceBytes;
+        faces(faceBytes);
+        // a flags byte before each list
+        size_t at = 0;
+        for (size_t length : { 4, 3, 3, 2 })
+        {
+            faceBytes.insert(faceBytes.begin() + std::ptrdiff_t(at), uint8_t(0));
+            at += 2 + 4 * length;
+        }
+        bytes.insert(bytes.end(), faceBytes.begin(), faceBytes.end());
+        appendBytes(bytes, int32_t(0));
+        appendBytes(bytes, int32_t(1));
+
+        TempFile fileConvertedPly("hubertConverted.ply", bytes);
+        hubert::PlyFile ply;
+        REQUIRE(ply.open(fileConvertedPly.path()) == hubert::LoadResult::eOk);
+        CHECK(ply.template packedVertices<T>() == nullptr);
+        REQUIRE(ply.faceCount() == 4);
+        hubert::PackedTriangle3<T> tri = ply.template triangle<T>(1);
+        CHECK(tri.p2.x == T(1));
+        CHECK(tri.p2.y == T(1));
+        CHECK(tri.p3.y == T(1));
+        CHECK(ply.template vertex<T>(4).z == T(2));
+        CHECK(ply.template validate<T>() == 2);
+
+        hubert::IndexedMesh<T> mesh = ply.template mesh<T>();
+        CHECK(sameBits(mesh.triangle(0).p2(), P(1, 0, 0)));
+    }
+
+    SECTION("Bad files")
+    {
+        hubert::PlyFile ply;
+        std::vector<uint8_t> ascii;
+        appendText(ascii, "ply\nformat ascii 1.0\nelement vertex 1\nproperty float x\nproperty float y\nproperty float z\nend_header\n0 0 0\n");
+        TempFile fileAsciiPly("hubertAscii.ply", ascii);
+        CHECK(ply.open(fileAsciiPly.path()) == hubert::LoadResult::eUnsupported);
+
+        std::vector<uint8_t> truncated;
+        appendText(truncated, "ply\nformat binary_little_endian 1.0\nelement vertex 2\nproperty float x\nproperty float y\nproperty float z\nend_header\n");
+        appendBytes(truncated, 1.0f);
+        TempFile fileShortPly("hubertShort.ply", truncated);
+        CHECK(ply.open(fileShortPly.path()) == hubert::LoadResult::eBadFormat);
+        CHECK(ply.vertexCount() == 0);
+
+        std::vector<uint8_t> noZ;
+        appendText(noZ, "ply\nformat binary_little_endian 1.0\nelement vertex 0\nproperty float x\nproperty float y\nend_header\n");
+        TempFile fileNoZPly("hubertNoZ.ply", noZ);
+        CHECK(ply.open(fileNoZPly.path()) == hubert::LoadResult::eBadFormat);
+
+        std::vector<uint8_t> longList;
+        appendText(longList, "ply\nformat binary_little_endian 1.0\nelement vertex 0\nproperty float x\nproperty float y\nproperty float z\nelement face 1\nproperty list uchar int vertex_indices\nend_header\n");
+        longList.push_back(3);
+        appendBytes(longList, int32_t(0));
+        TempFile fileLongListPly("hubertLongList.ply", longList);
+        CHECK(ply.open(fileLongListPly.path()) == hubert::LoadResult::eBadFormat);
+
+        std::vector<uint8_t> notPly;
+        appendText(notPly, "solid\n");
+        TempFile fileNotPlyPly("hubertNotPly.ply", notPly);
+        CHECK(ply.open(fileNotPlyPly.path()) == hubert::LoadResult::eBadFormat);
+
+        // indices in a double list must be whole numbers; whole numbers out
+        // of range make invalid triangles rather than wrapping around
+        auto doubleList = [](double last) {
+            std::vector<uint8_t> bytes;
+            appendText(bytes, "ply\nformat binary_little_endian 1.0\nelement vertex 3\nproperty float x\nproperty float y\nproperty float z\nelement face 1\nproperty list uchar double vertex_indices\nend_header\n");
+            for (float c : { 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f })
+            {
+                appendBytes(bytes, c);
+            }
+            bytes.push_back(3);
+            for (double v : { 0.0, 1.0, last })
+            {
+                appendBytes(bytes, v);
+            }
+            return bytes;
+        };
+        for (double bad : { 0.5, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity() })
+        {
+            TempFile fileFractionPly("hubertFraction.ply", doubleList(bad));
+            CHECK(ply.open(fileFractionPly.path()) == hubert::LoadResult::eBadFormat);
+        }
+        TempFile fileWholePly("hubertWhole.ply", doubleList(2.0));
+        REQUIRE(ply.open(fileWholePly.path()) == hubert::LoadResult::eOk);
+        CHECK(!ply.template mesh<T>().triangle(0).amDegenerate());
+        for (double outside : { -4294967295.0, 4294967298.0, 1e300 })
+        {
+            TempFile fileOutsidePly("hubertOutside.ply", doubleList(outside));
+            REQUIRE(ply.open(fileOutsidePly.path()) == hubert::LoadResult::eOk);
+            REQUIRE(ply.faceCount() == 1);
+            CHECK(!ply.template mesh<T>().triangle(0).amValid());
+            ply.close();
+        }
+        ply.close();
+    }
+}
+
+TEMPLATE_TEST_CASE("Streaming queries", "[Stream]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+    using PP = hubert::PackedPoint3<T>;
+    using PT = hubert::PackedTriangle3<T>;
+
+    std::vector<hubert::Triangle3<T>> source = makeRandomTriangles<T>(3000, 51, T(2.0), T(0.5));
+    std::vector<PT> tris;
+    for (const auto & t : source)
+    {
+        tris.push_back(PT{ PP{ t.p1().x(), t.p1().y(), t.p1().z() }, PP{ t.p2().x(), t.p2().y(), t.p2().z() }, PP{ t.p3().x(), t.p3().y(), t.p3().z() } });
+    }
+    for (size_t i = 0; i < tris.size(); i += 97)
+    {
+        tris[i].p2 = tris[i].p1;
+    }
+    // the same triangle twice, away from the others, so that a tie
+    // straddles the chunks
+    tris[299] = PT{ PP{ 10, 10, 50 }, PP{ 11, 10, 50 }, PP{ 10, 11, 50 } };
+    tris[300] = tris[299];
+    std::vector<hubert::Ray3<T>> rays = makeRandomRays<T>(400, 52, T(3.0));
+    rays[5] = hubert::Ray3<T>(P(0, 0, 0), hubert::UnitVector3<T>(0, 0, 0));
+    rays[6] = hubert::Ray3<T>(P(T(10.2), T(10.2), 60), hubert::UnitVector3<T>(0, 0, -1));
+    hubert::PackedTriangleSource<T> stream(tris.data(), tris.size());
+
+    SECTION("Ray hits match the in-core query")
+    {
+        hubert::TriangleSoup<T> soup;
+        soup.append(tris.data(), tris.size());
+        for (size_t chunkSize : { size_t(300), size_t(1000), size_t(5000) })
+        {
+            std::vector<hubert::BatchHit<T>> hits(rays.size());
+            size_t hitCount = hubert::intersectStream(rays.data(), rays.size(), stream, hits.data(), hubert::ThreadExecutor{ 3 }, chunkSize);
+            size_t expected = 0;
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                size_t index;
+                T t;
+                hubert::ResultCode r = hubert::intersect(soup, rays[i], index, t);
+                CHECK(hits[i].result == r);
+                if (r == hubert::ResultCode::eOk)
+                {
+                    expected++;
+                    CHECK(hits[i].triangle == index);
+                    CHECK(sameBits(hits[i].point, rays[i].base() + hubert::multiply(rays[i].unitDirection(), t)));
+                }
+                else
+                {
+                    CHECK(hits[i].triangle == hubert::invalidIndex());
+                }
+            }
+            CHECK(hitCount == expected);
+            CHECK(hits[5].result == hubert::ResultCode::eDegenerate);
+            CHECK(hits[6].triangle == 299);
+        }
+    }
+
+    SECTION("Point distances match the brute force ones")
+    {
+        std::vector<P> points;
+        for (const auto & ray : rays)
+        {
+            points.push_back(ray.base());
+        }
+        points.push_back(hubert::invalidPoint3<T>());
+        std::vector<T> distances(points.size());
+        std::vector<size_t> nearest(points.size());
+        hubert::distanceStream(points.data(), points.size(), stream, distances.data(), nearest.data(), hubert::SerialExecutor(), 700);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            T best = hubert::infinity<T>();
+            size_t bestIndex = hubert::invalidIndex();
+            for (size_t j = 0; j < tris.size(); j++)
+            {
+                T d = hubert::distance(points[i], hubert::makeTriangle3(tris[j]));
+                if (d < best)
+                {
+                    best = d;
+                    bestIndex = j;
+                }
+            }
+            CHECK(distances[i] == best);
+            CHECK(nearest[i] == bestIndex);
+        }
+        CHECK(nearest.back() == hubert::invalidIndex());
+    }
+
+    SECTION("Empty sources and files")
+    {
+        hubert::PackedTriangleSource<T> empty(tris.data(), 0);
+        std::vector<hubert::BatchHit<T>> hits(rays.size());
+        CHECK(hubert::intersectStream(rays.data(), rays.size(), empty, hits.data()) == 0);
+        CHECK(hits[0].result == hubert::ResultCode::eNoIntersection);
+
+        if constexpr (std::is_same<T, float>::value)
+        {
+            TempFile fileStreamStl("hubertStream.stl", makeStl(tris));
+            hubert::StlFile stl(fileStreamStl.path());
+            REQUIRE(stl.size() == tris.size());
+            std::vector<hubert::BatchHit<T>> fromFile(rays.size());
+            std::vector<hubert::BatchHit<T>> inMemory(rays.size());
+            CHECK(hubert::intersectStream(rays.data(), rays.size(), stl, fromFile.data(), hubert::SerialExecutor(), 512) > 0);
+            hubert::intersectStream(rays.data(), rays.size(), stream, inMemory.data());
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                CHECK(fromFile[i].result == inMemory[i].result);
+                CHECK(fromFile[i].triangle == inMemory[i].triangle);
+            }
+        }
+    }
+}
+
+// a source whose reads fail from triangle failAt on
+class FailingSource
+{
+    public:
+        FailingSource(const hubert::PackedTriangle3<float> * tris, size_t count, size_t failAt) : _tris(tris), _count(count), _failAt(failAt) {}
+
+        inline size_t size() const { return _count; }
+
+        void read(size_t first, size_t count, hubert::TriangleSoup<float> & chunk) const
+        {
+            if (first + count > _failAt)
+            {
+                throw std::runtime_error("read failed");
+            }
+            chunk.clear();
+            chunk.append(_tris + first, count);
+        }
+
+    private:
+        const hubert::PackedTriangle3<float> *  _tris;
+        size_t                                  _count;
+        size_t                                  _failAt;
+};
+
+TEST_CASE("Streaming passes on exceptions", "[Stream]")
+{
+    using PP = hubert::PackedPoint3<float>;
+    std::vector<hubert::PackedTriangle3<float>> tris(1000, hubert::PackedTriangle3<float>{ PP{ 0, 0, 0 }, PP{ 1, 0, 0 }, PP{ 0, 1, 0 } });
+    std::vector<hubert::Ray3<float>> rays(4, hubert::Ray3<float>(hubert::Point3<float>(0.25f, 0.25f, 1.0f), hubert::UnitVector3<float>(0, 0, -1)));
+    std::vector<hubert::BatchHit<float>> hits(rays.size());
+
+    // in the first read, on the calling thread, and in a later one, on the
+    // reading thread
+    for (size_t failAt : { size_t(10), size_t(450), size_t(999) })
+    {
+        FailingSource source(tris.data(), tris.size(), failAt);
+        CHECK_THROWS_AS(hubert::intersectStream(rays.data(), rays.size(), source, hits.data(), hubert::SerialExecutor(), 100), std::runtime_error);
+    }
+
+    // in the processing, while the next chunk is being read
+    hubert::PackedTriangleSource<float> source(tris.data(), tris.size());
+    size_t processed = 0;
+    auto prepare = [](hubert::StreamChunk<float> &) {};
+    auto process = [&](const hubert::StreamChunk<float> &, size_t first) {
+        processed++;
+        if (first == 300)
+        {
+            throw std::logic_error("process failed");
+        }
+    };
+    CHECK_THROWS_AS(hubert::streamChunks<hubert::StreamChunk<float>>(source, 100, prepare, process), std::logic_error);
+    CHECK(processed == 4);
+}
+
+TEST_CASE("MonotonicArena", "[Arena]")
+{
+    SECTION("Alignment and large requests")
+    {
+        hubert::MonotonicArena arena(1024);
+        for (size_t alignment : { size_t(1), size_t(8), size_t(64), size_t(256) })
+        {
+            void * p = arena.allocate(3, alignment);
+            CHECK(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+        }
+        size_t before = arena.capacity();
+        uint8_t * big = static_cast<uint8_t *>(arena.allocate(10000, 32));
+        CHECK(reinterpret_cast<uintptr_t>(big) % 32 == 0);
+        CHECK(arena.capacity() >= before + 10000);
+        big[0] = 1;
+        big[9999] = 2;
+        CHECK(arena.used() == 4 * 3 + 10000);
+    }
+
+    SECTION("reset() reuses the blocks")
+    {
+        hubert::MonotonicArena arena(4096);
+        void * first = arena.allocate(100);
+        for (int i = 0; i < 100; i++)
+        {
+            arena.allocate(1000);
+        }
+        size_t capacity = arena.capacity();
+        arena.reset();
+        CHECK(arena.used() == 0);
+        CHECK(arena.allocate(100) == first);
+        for (int i = 0; i < 100; i++)
+        {
+            arena.allocate(1000);
+        }
+        CHECK(arena.capacity() == capacity);
+
+        arena.release();
+        CHECK(arena.capacity() == 0);
+        CHECK(arena.allocate(8) != nullptr);
+    }
+
+    SECTION("ArenaVector")
+    {
+        hubert::MonotonicArena arena;
+        hubert::ArenaVector<double> values{ hubert::ArenaAllocator<double>(arena) };
+        for (int i = 0; i < 20000; i++)
+        {
+            values.push_back(i * 0.5);
+        }
+        CHECK(values.size() == 20000);
+        CHECK(values[19999] == 19999 * 0.5);
+        CHECK(arena.used() >= 20000 * sizeof(double));
+        CHECK(values.get_allocator() == hubert::ArenaAllocator<int>(arena));
+    }
+}
+
+TEMPLATE_TEST_CASE("Batch results in arenas", "[Arena]", float, double)
+{
+    using T = TestType;
+    std::vector<hubert::Triangle3<T>> tris = makeRandomTriangles<T>(300, 31);
+    std::vector<std::pair<size_t, size_t>> expected;
+    REQUIRE(hubert::intersectSelf(tris.data(), tris.size(), expected, false) == hubert::ResultCode::eOk);
+
+    SECTION("forEachSelfIntersection")
+    {
+        std::vector<std::vector<std::pair<size_t, size_t>>> perThread(hubert::threadCount(3));
+        hubert::forEachSelfIntersection(tris.data(), tris.size(), [&](unsigned thread, size_t i, size_t j) {
+            perThread[thread].emplace_back(i, j);
+        }, false, 3);
+        std::vector<std::pair<size_t, size_t>> pairs;
+        for (auto & p : perThread)
+        {
+            pairs.insert(pairs.end(), p.begin(), p.end());
+        }
+        std::sort(pairs.begin(), pairs.end());
+        CHECK(pairs == expected);
+
+        std::vector<std::pair<size_t, size_t>> between;
+        REQUIRE(hubert::intersectMeshes(tris.data(), 150, tris.data() + 150, 150, between) == hubert::ResultCode::eOk);
+        size_t calls = 0;
+        hubert::forEachMeshIntersection(tris.data(), 150, tris.data() + 150, 150, [&](unsigned, size_t i, size_t j) {
+            CHECK(std::binary_search(between.begin(), between.end(), std::make_pair(i, j)));
+            calls++;
+        }, 1);
+        CHECK(calls == between.size());
+    }
+
+    SECTION("Pairs in an arena")
+    {
+        hubert::MonotonicArena arena;
+        hubert::ArenaVector<std::pair<size_t, size_t>> pairs{ hubert::ArenaAllocator<std::pair<size_t, size_t>>(arena) };
+        CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs, false) == hubert::ResultCode::eOk);
+        CHECK(std::equal(pairs.begin(), pairs.end(), expected.begin(), expected.end()));
+    }
+
+#if defined(HUBERT_HAS_PMR)
+    SECTION("std::pmr outputs")
+    {
+        hubert::MonotonicArena arena;
+        hubert::ArenaResource resource(arena);
+        std::pmr::vector<std::pair<size_t, size_t>> pairs(&resource);
+        CHECK(hubert::intersectSelf(tris.data(), tris.size(), pairs, false) == hubert::ResultCode::eOk);
+        CHECK(std::equal(pairs.begin(), pairs.end(), expected.begin(), expected.end()));
+        CHECK(arena.used() >= pairs.size() * sizeof(pairs[0]));
+
+        using P = hubert::Point3<T>;
+        hubert::Plane<T> ground(P(0, 0, 0), hubert::UnitVector3<T>(0, 0, 1));
+        std::vector<hubert::PackedTriangle3<T>> box = makeBoxMesh<T>(2, 3, 1);
+        std::vector<std::vector<hubert::SliceSegment<T>>> layers;
+        REQUIRE(hubert::slice(box.data(), box.size(), ground, T(0.125), 12, layers) == hubert::ResultCode::eOk);
+
+        std::pmr::monotonic_buffer_resource buffer;
+        std::pmr::vector<std::pmr::vector<hubert::SliceSegment<T>>> pmrLayers(&buffer);
+        REQUIRE(hubert::slice(box.data(), box.size(), ground, T(0.125), 12, pmrLayers) == hubert::ResultCode::eOk);
+        REQUIRE(pmrLayers.size() == layers.size());
+        for (size_t k = 0; k < layers.size(); k++)
+        {
+            REQUIRE(pmrLayers[k].size() == layers[k].size());
+            CHECK(pmrLayers[k].get_allocator().resource() == &buffer);
+            for (size_t n = 0; n < layers[k].size(); n++)
+            {
+                CHECK(pmrLayers[k][n].triangle == layers[k][n].triangle);
+                CHECK(std::memcmp(&pmrLayers[k][n].a, &layers[k][n].a, sizeof(layers[k][n].a)) == 0);
+                CHECK(std::memcmp(&pmrLayers[k][n].b, &layers[k][n].b, sizeof(layers[k][n].b)) == 0);
+            }
+        }
+    }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Device views
+/////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Device view queries match the host queries", "[DeviceView]", float, double)
+{
+    using T = TestType;
+    using P = hubert::Point3<T>;
+
+    std::vector<hubert::Triangle3<T>> tris = makePacketTestTriangles<T>();
+    std::vector<hubert::Triangle3<T>> more = makeRandomTriangles<T>(2000, 61);
+    tris.insert(tris.end(), more.begin(), more.end());
+    std::vector<hubert::Ray3<T>> rays = makePacketTestRays<T>();
+    std::vector<hubert::Ray3<T>> random = makeRandomRays<T>(300, 62);
+    rays.insert(rays.end(), random.begin(), random.end());
+
+    hubert::TriangleSoup<T> soup(tris.begin(), tris.end());
+    hubert::SoupView<T> soupView = hubert::makeSoupView(soup);
+    REQUIRE(soupView.size == tris.size());
+
+    SECTION("Soup and Bvh views give the soup's closest hit")
+    {
+        size_t hits = 0;
+        for (uint32_t maxLeafSize : { 1u, 4u })
+        {
+            hubert::FlatBvh<T> flat(hubert::Bvh<T>(tris.begin(), tris.end(), maxLeafSize));
+            hubert::BvhView<T> bvhView = flat.view();
+
+            for (const auto & theRay : rays)
+            {
+                if (hubert::isDegenerate(theRay))
+                {
+                    continue;
+                }
+                size_t index;
+                T t;
+                hubert::ResultCode r = hubert::intersect(soup, theRay, index, t);
+                hubert::PackedRay3<T> packed = hubert::makePackedRay3(theRay);
+
+                hubert::RayHit<T> soupHit = hubert::intersect(soupView, packed);
+                hubert::RayHit<T> bvhHit = hubert::intersect(bvhView, packed);
+                CHECK(soupHit.triangle == index);
+                CHECK(bvhHit.triangle == index);
+                if (r == hubert::ResultCode::eOk)
+                {
+                    hits++;
+                    CHECK(soupHit.t == t);
+                    CHECK(bvhHit.t == t);
+                }
+                else
+                {
+                    CHECK(soupHit.t == hubert::invalidValue<T>());
+                    CHECK(bvhHit.t == hubert::invalidValue<T>());
+                }
+            }
+        }
+        CHECK(hits > 0);
+    }
+
+    SECTION("The Bvh view walks trees of any depth")
+    {
+        hubert::PackedRay3<double> alongX{ { 0.0, 0.0, 0.0 }, { 1.0, 0.0, 0.0 } };
+        for (int hit = 0; hit < 200; hit++)
+        {
+            std::vector<hubert::Triangle3<double>> skewed = makeSkewedPlanes(200, hit);
+            hubert::FlatBvh<double> flat(hubert::Bvh<double>(skewed.begin(), skewed.end(), 1));
+            CHECK(hubert::intersect(flat.view(), alongX).triangle == size_t(hit));
+        }
+    }
+
+    SECTION("An empty Bvh view hits nothing")
+    {
+        hubert::FlatBvh<T> flat;
+        hubert::RayHit<T> hit = hubert::intersect(flat.view(), hubert::makePackedRay3(rays[0]));
+        CHECK(hit.triangle == hubert::invalidIndex());
+    }
+
+    SECTION("signedDistance matches distance(Point3, Plane)")
+    {
+        hubert::Plane<T> thePlane(P(1, 2, 3), hubert::UnitVector3<T>(1, -2, 2));
+        hubert::PackedPoint3<T> base = hubert::makePackedPoint3(thePlane.base());
+        hubert::PackedPoint3<T> up{ thePlane.up().x(), thePlane.up().y(), thePlane.up().z() };
+        for (const auto & tri : more)
+        {
+            for (const P & p : { tri.p1(), tri.p2(), tri.p3() })
+            {
+                CHECK(hubert::signedDistance(hubert::makePackedPoint3(p), base, up) == Catch::Approx(hubert::distance(p, thePlane)));
+            }
+        }
+        T big = std::numeric_limits<T>::max();
+        CHECK(hubert::signedDistance(hubert::PackedPoint3<T>{ big, 0, 0 }, hubert::PackedPoint3<T>{ -big, 0, 0 }, up) == hubert::infinity<T>());
+        CHECK(hubert::distance(P(big, 0, 0), hubert::Plane<T>(P(-big, 0, 0), thePlane.up())) == hubert::infinity<T>());
+    }
+}